@@ -0,0 +1,1405 @@
+/**
+ * @file ca821x_bench.c
+ * @brief Microbenchmarks for the ca821x api encoders and dispatch.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Usage: ca821x-bench [options]
+ *   --filter SUBSTR    only run benchmarks whose name contains SUBSTR
+ *   --min-time MS      minimum measured time per repetition (default 50)
+ *   --repeat N         repetitions, the fastest is reported (default 3)
+ *   --quick            one short repetition of each benchmark (smoke test)
+ *   --json FILE        write results as JSON to FILE ("-" for stdout)
+ *   --baseline FILE    compare against a JSON file written by --json
+ *   --threshold PCT    slowdown over the baseline that fails (default 10)
+ *
+ * Results are ns/op and the bytes passed through the exchange per op.
+ * With --baseline the exit status is 1 if any benchmark regressed.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ca821x_aes.h"
+#include "ca821x_api.h"
+#include "ca821x_beacon.h"
+#include "ca821x_dedup.h"
+#include "ca821x_fcs.h"
+#include "ca821x_frame.h"
+#include "ca821x_haes.h"
+#include "ca821x_link.h"
+#include "ca821x_neighbour.h"
+#include "ca821x_pcps.h"
+#include "ca821x_rxfilter.h"
+#include "ca821x_scan.h"
+#include "ca821x_sec.h"
+#include "ca821x_sec_mirror.h"
+#include "ca821x_sim.h"
+#include "ca821x_subscribe.h"
+#include "ca821x_sync_stats.h"
+#include "ca821x_trace.h"
+
+/** Number of PAN descriptors that fit in a scan confirm */
+#define BENCH_SCAN_PDESCS   ((sizeof(((struct MAC_Message *)0)->PData) - \
+                              MLME_SCAN_CONFIRM_BASE_SIZE) / PAN_DESCRIPTOR_BASE_SIZE)
+/** PAN descriptors in the large filter benchmarks, more than a frame holds */
+#define BENCH_FILTER_PDESCS (200)
+/** LQI either side of the api's scan confirm filter limit */
+#define BENCH_LQI_GOOD      (200)
+#define BENCH_LQI_BAD       (20)
+/** Length of the dispatch mix */
+#define BENCH_MIX_LEN       (100)
+
+/** A benchmark: runs the operation iters times */
+struct bench {
+	const char *name;
+	void (*fn)(uint64_t iters);
+};
+
+/** Result of one benchmark */
+struct bench_result {
+	const char *name;
+	uint64_t    iters;
+	double      ns_per_op;
+	double      bytes_per_op;
+};
+
+static struct ca821x_dev bench_dev;
+static uint64_t bench_bytes;
+static volatile uint32_t bench_sink;
+
+static uint8_t scan_template[3][sizeof(struct MAC_Message)];
+static uint8_t scan_work[sizeof(struct MAC_Message)];
+static uint8_t filter_template[3][MLME_SCAN_CONFIRM_BASE_SIZE +
+                                  BENCH_FILTER_PDESCS * PAN_DESCRIPTOR_BASE_SIZE];
+static uint8_t filter_work[sizeof(filter_template[0])];
+static uint8_t beacon_ind[64];
+static size_t beacon_ind_len;
+/* Secured data frame with long addresses, as received in a PCPS-DATA.indication */
+static uint8_t mac_frame[aMaxPHYPacketSize];
+static size_t mac_frame_len;
+static struct ca821x_frame_hdr mac_frame_hdr;
+static struct MAC_Message mix_msgs[8];
+static uint8_t mix_order[BENCH_MIX_LEN];
+
+/******************************************************************************/
+/****** Null exchange                                                    ******/
+/******************************************************************************/
+
+/**
+ * Downstream that only counts bytes. Synchronous commands get a successful
+ * confirm of the paired type with all parameters zeroed.
+ */
+static int null_downstream(
+	const uint8_t     *buf,
+	size_t             len,
+	uint8_t           *response,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	(void)pDeviceRef;
+	bench_bytes += len;
+	if (response && (buf[0] & SPI_SYN)) {
+		response[0] = sync_pairings[buf[0] & SPI_MID_MASK];
+		response[1] = 8;
+		memset(response + 2, 0, 8);
+	}
+	return 0;
+}
+
+static int count_data_indication(
+	struct MCPS_DATA_indication_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	(void)pDeviceRef;
+	bench_sink += params->MsduLength;
+	return 1;
+}
+
+static int count_data_confirm(
+	struct MCPS_DATA_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	(void)pDeviceRef;
+	bench_sink += params->MsduHandle;
+	return 1;
+}
+
+static int count_scan_confirm(
+	struct MLME_SCAN_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	(void)pDeviceRef;
+	bench_sink += params->ResultListSize;
+	return 1;
+}
+
+static int count_generic(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	(void)len;
+	(void)pDeviceRef;
+	bench_sink += buf[0];
+	return 1;
+}
+
+/******************************************************************************/
+/****** Encoders                                                         ******/
+/******************************************************************************/
+
+static struct FullAddr bench_addr(uint8_t mode)
+{
+	struct FullAddr addr;
+	int i;
+
+	addr.AddressMode = mode;
+	addr.PANId[0] = 0x5C;
+	addr.PANId[1] = 0xCA;
+	for (i = 0; i < 8; i++)
+		addr.Address[i] = 0x11 * (i + 1);
+	return addr;
+}
+
+static struct SecSpec bench_sec(void)
+{
+	struct SecSpec sec = {5, 1, {0}, 7};
+	return sec;
+}
+
+static void bench_mcps_data(uint64_t iters)
+{
+	struct FullAddr dst = bench_addr(MAC_MODE_SHORT_ADDR);
+	uint8_t msdu[100];
+	uint64_t i;
+
+	memset(msdu, 0xA5, sizeof(msdu));
+	for (i = 0; i < iters; i++)
+		MCPS_DATA_request(MAC_MODE_SHORT_ADDR, dst, sizeof(msdu), msdu,
+		                  (uint8_t)i, TXOPT_ACKREQ, NULL, &bench_dev);
+}
+
+static void bench_mcps_data_sec(uint64_t iters)
+{
+	struct FullAddr dst = bench_addr(MAC_MODE_LONG_ADDR);
+	struct SecSpec sec = bench_sec();
+	uint8_t msdu[20];
+	uint64_t i;
+
+	memset(msdu, 0xA5, sizeof(msdu));
+	for (i = 0; i < iters; i++)
+		MCPS_DATA_request(MAC_MODE_LONG_ADDR, dst, sizeof(msdu), msdu,
+		                  (uint8_t)i, TXOPT_ACKREQ, &sec, &bench_dev);
+}
+
+static void bench_mcps_purge(uint64_t iters)
+{
+	uint8_t handle = 1;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MCPS_PURGE_request_sync(&handle, &bench_dev);
+}
+
+#if CASCODA_CA_VER >= 8211
+static void bench_pcps_data(uint64_t iters)
+{
+	uint8_t psdu[aMaxPHYPacketSize];
+	uint64_t i;
+
+	memset(psdu, 0x5A, sizeof(psdu));
+	for (i = 0; i < iters; i++)
+		PCPS_DATA_request((uint8_t)i, 0, sizeof(psdu), psdu, &bench_dev);
+}
+
+/**
+ * Stream maximum length PSDUs through a transmitter to a simulated device,
+ * running the simulation whenever the window is full. Measures the host cost
+ * of each PSDU from submission to matched confirm.
+ */
+static void bench_pcps_sim(uint8_t window, uint64_t iters)
+{
+	struct ca821x_dev dev;
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct ca821x_pcps_tx tx;
+	uint8_t psdu[aMaxPHYPacketSize];
+	uint64_t i;
+
+	memset(psdu, 0, sizeof(psdu));
+	psdu[0] = MAC_FC_FT_DATA;
+	ca821x_api_init(&dev);
+	if (ca821x_sim_engine_init(&engine))
+		return;
+	ca821x_sim_init(&sim, &engine, 1, &dev);
+	ca821x_pcps_tx_init(&tx, window, NULL);
+	dev.pcps_tx = &tx;
+
+	for (i = 0; i < iters; i++) {
+		while (ca821x_pcps_tx_submit(psdu, sizeof(psdu), 0, NULL, &dev) < 0)
+			ca821x_sim_run_until(&engine, engine.heap[0].time_ns);
+		bench_bytes += sizeof(psdu);
+	}
+	while (engine.count)
+		ca821x_sim_run_until(&engine, engine.heap[0].time_ns);
+	bench_sink += tx.confirmed;
+	ca821x_sim_engine_deinit(&engine);
+}
+
+static void bench_pcps_sim_window1(uint64_t iters)
+{
+	bench_pcps_sim(1, iters);
+}
+
+static void bench_pcps_sim_window4(uint64_t iters)
+{
+	bench_pcps_sim(SIM_DIRECT_QUEUE_SIZE, iters);
+}
+#endif
+
+static void bench_mlme_associate(uint64_t iters)
+{
+	struct FullAddr coord = bench_addr(MAC_MODE_SHORT_ADDR);
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_ASSOCIATE_request(11, coord, 0x8E, NULL, &bench_dev);
+}
+
+static void bench_mlme_associate_rsp(uint64_t iters)
+{
+	struct FullAddr dev = bench_addr(MAC_MODE_LONG_ADDR);
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_ASSOCIATE_response(dev.Address, 0x1234, MAC_SUCCESS, NULL, &bench_dev);
+}
+
+static void bench_mlme_disassociate(uint64_t iters)
+{
+	struct FullAddr dev = bench_addr(MAC_MODE_LONG_ADDR);
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_DISASSOCIATE_request(dev, 2, 1, NULL, &bench_dev);
+}
+
+static void bench_mlme_get(uint64_t iters)
+{
+	uint8_t len, value[MAX_ATTRIBUTE_SIZE];
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_GET_request_sync(macPANId, 0, &len, value, &bench_dev);
+}
+
+/** MLME_GET_request_sync with latency statistics attached */
+static void bench_mlme_get_stats(uint64_t iters)
+{
+	static struct ca821x_sync_stats stats;
+
+	ca821x_sync_stats_init(&stats);
+	bench_dev.sync_stats = &stats;
+	bench_mlme_get(iters);
+	bench_dev.sync_stats = NULL;
+}
+
+static struct ca821x_trace bench_trace;
+static struct ca821x_trace_slot bench_trace_slots[256];
+
+/** Run a benchmark with a frame trace attached */
+static void bench_traced(void (*fn)(uint64_t iters), uint64_t iters)
+{
+	ca821x_trace_init(&bench_trace, bench_trace_slots, 256);
+	bench_dev.trace = &bench_trace;
+	fn(iters);
+	bench_dev.trace = NULL;
+}
+
+static void bench_mcps_data_traced(uint64_t iters)
+{
+	bench_traced(bench_mcps_data, iters);
+}
+
+static void bench_mlme_get_traced(uint64_t iters)
+{
+	bench_traced(bench_mlme_get, iters);
+}
+
+static void bench_mlme_orphan_rsp(uint64_t iters)
+{
+	struct FullAddr dev = bench_addr(MAC_MODE_LONG_ADDR);
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_ORPHAN_response(dev.Address, 0x1234, 1, NULL, &bench_dev);
+}
+
+static void bench_mlme_reset(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_RESET_request_sync(0, &bench_dev);
+}
+
+static void bench_mlme_rx_enable(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_RX_ENABLE_request_sync(0, 0, 1000, &bench_dev);
+}
+
+static void bench_mlme_scan(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_SCAN_request(ACTIVE_SCAN, 0x07FFF800, 4, NULL, &bench_dev);
+}
+
+static void bench_mlme_set(uint64_t iters)
+{
+	uint16_t panid = 0xCA5C;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_SET_request_sync(macPANId, 0, 2, &panid, &bench_dev);
+}
+
+static void bench_mlme_start(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_START_request_sync(0xCA5C, 11, 15, 15, 1, 0, 0, NULL, NULL,
+		                        &bench_dev);
+}
+
+static void bench_mlme_poll(uint64_t iters)
+{
+	struct FullAddr coord = bench_addr(MAC_MODE_SHORT_ADDR);
+#if CASCODA_CA_VER == 8210
+	uint8_t interval[2] = {0, 0};
+#endif
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		MLME_POLL_request_sync(coord,
+#if CASCODA_CA_VER == 8210
+		                       interval,
+#endif
+		                       NULL, &bench_dev);
+}
+
+static void bench_hwme_set(uint64_t iters)
+{
+	uint8_t value = 100;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		HWME_SET_request_sync(HWME_EDTHRESHOLD, 1, &value, &bench_dev);
+}
+
+static void bench_hwme_get(uint64_t iters)
+{
+	uint8_t len, value[MAX_HWME_ATTRIBUTE_SIZE];
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		HWME_GET_request_sync(HWME_EDTHRESHOLD, &len, value, &bench_dev);
+}
+
+static void bench_hwme_haes(uint64_t iters)
+{
+	uint8_t data[16] = {0};
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		HWME_HAES_request_sync(HAES_MODE_ENCRYPT, data, &bench_dev);
+}
+
+static void bench_haes_ctr(uint64_t iters)
+{
+	uint8_t ctr[CA821X_HAES_BLOCK] = {0}, data[100] = {0};
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		ca821x_haes_ctr(ctr, data, sizeof(data), &bench_dev);
+}
+
+static void bench_haes_cbc_mac(uint64_t iters)
+{
+	uint8_t mac[CA821X_HAES_BLOCK] = {0}, data[100] = {0};
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		ca821x_haes_cbc_mac(mac, data, sizeof(data), &bench_dev);
+}
+
+static void bench_tdme_setsfr(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_SETSFR_request_sync(1, 0xBF, 0xAE, &bench_dev);
+}
+
+static void bench_tdme_getsfr(uint64_t iters)
+{
+	uint8_t value;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_GETSFR_request_sync(1, 0xBF, &value, &bench_dev);
+}
+
+static void bench_tdme_testmode(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_TESTMODE_request_sync(TDME_TEST_IDLE, &bench_dev);
+}
+
+static void bench_tdme_set(uint64_t iters)
+{
+	uint8_t channel = 13;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_SET_request_sync(TDME_CHANNEL, 1, &channel, &bench_dev);
+}
+
+static void bench_tdme_txpkt(uint64_t iters)
+{
+	uint8_t seq = 0, len = 20, data[aMaxPHYPacketSize] = {0};
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_TXPKT_request_sync(TDME_TXD_APPENDED, &seq, &len, data, &bench_dev);
+}
+
+static void bench_tdme_lotlk(uint64_t iters)
+{
+	uint8_t ch = 11, rx_txb = 1, fdac, amp, txcal;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_LOTLK_request_sync(&ch, &rx_txb, &fdac, &amp, &txcal, &bench_dev);
+}
+
+static void bench_tdme_chipinit(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_ChipInit(&bench_dev);
+}
+
+static void bench_tdme_channelinit(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_ChannelInit((uint8_t)(11 + (i & 15)), &bench_dev);
+}
+
+static void bench_tdme_settxpower(uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_SetTxPower(0x3F, &bench_dev);
+}
+
+static void bench_tdme_gettxpower(uint64_t iters)
+{
+	uint8_t txp;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++)
+		TDME_GetTxPower(&txp, &bench_dev);
+}
+
+/******************************************************************************/
+/****** Dispatch                                                         ******/
+/******************************************************************************/
+
+/** Fill a scan confirm parameter set with n PAN descriptors of the given LQIs */
+static size_t build_scan_list(struct MLME_SCAN_confirm_pset *cnf, unsigned n, int pattern)
+{
+	struct PanDescriptor *pdesc;
+	uint8_t *list = (uint8_t *)cnf + MLME_SCAN_CONFIRM_BASE_SIZE;
+	unsigned i;
+
+	memset(cnf, 0, MLME_SCAN_CONFIRM_BASE_SIZE + n * PAN_DESCRIPTOR_BASE_SIZE);
+	cnf->Status = MAC_SUCCESS;
+	cnf->ScanType = ACTIVE_SCAN;
+	cnf->ResultListSize = n;
+	for (i = 0; i < n; i++) {
+		pdesc = (struct PanDescriptor *)(list + i * PAN_DESCRIPTOR_BASE_SIZE);
+		pdesc->Coord = bench_addr(MAC_MODE_SHORT_ADDR);
+		pdesc->LogicalChannel = 11 + i % 16;
+		pdesc->SuperframeSpec[0] = 0xFF;
+		pdesc->SuperframeSpec[1] = 0xCF;
+		if (pattern == 0)
+			pdesc->LinkQuality = BENCH_LQI_GOOD;
+		else if (pattern == 1)
+			pdesc->LinkQuality = BENCH_LQI_BAD;
+		else
+			pdesc->LinkQuality = (i & 1) ? BENCH_LQI_BAD : BENCH_LQI_GOOD;
+	}
+	return MLME_SCAN_CONFIRM_BASE_SIZE + n * PAN_DESCRIPTOR_BASE_SIZE;
+}
+
+/** Build a scan confirm with a full result list of the given LQIs */
+static void build_scan_cnf(uint8_t *buf, int pattern)
+{
+	struct MAC_Message *msg = (struct MAC_Message *)buf;
+
+	memset(buf, 0, sizeof(struct MAC_Message));
+	msg->CommandId = SPI_MLME_SCAN_CONFIRM;
+	msg->Length = build_scan_list(&msg->PData.ScanCnf, BENCH_SCAN_PDESCS, pattern);
+}
+
+static void bench_scan_cnf(int pattern, uint64_t iters)
+{
+	const uint8_t *tmpl = scan_template[pattern];
+	size_t len = tmpl[1] + 2;
+	uint64_t i;
+
+	/* The filter works in place, so restore the list every time */
+	for (i = 0; i < iters; i++) {
+		memcpy(scan_work, tmpl, len);
+		ca821x_downstream_dispatch(scan_work, len, &bench_dev);
+		bench_bytes += len;
+	}
+}
+
+static void bench_scan_cnf_keep(uint64_t iters)
+{
+	bench_scan_cnf(0, iters);
+}
+
+static void bench_scan_cnf_drop(uint64_t iters)
+{
+	bench_scan_cnf(1, iters);
+}
+
+static void bench_scan_cnf_mixed(uint64_t iters)
+{
+	bench_scan_cnf(2, iters);
+}
+
+static void bench_scan_filter(int pattern, uint64_t iters)
+{
+	struct MLME_SCAN_confirm_pset *cnf = (struct MLME_SCAN_confirm_pset *)filter_work;
+	size_t len = sizeof(filter_work);
+	uint64_t i;
+
+	/* Keeping everything leaves the list unchanged, so only restore it when
+	 * the filter removes descriptors */
+	memcpy(filter_work, filter_template[pattern], len);
+	for (i = 0; i < iters; i++) {
+		if (pattern)
+			memcpy(filter_work, filter_template[pattern], len);
+		bench_sink += ca821x_scan_filter_lqi(cnf, len, API_LQI_LIMIT);
+		bench_bytes += len;
+	}
+}
+
+static void bench_scan_filter_keep(uint64_t iters)
+{
+	bench_scan_filter(0, iters);
+}
+
+static void bench_scan_filter_drop(uint64_t iters)
+{
+	bench_scan_filter(1, iters);
+}
+
+static void bench_scan_filter_mixed(uint64_t iters)
+{
+	bench_scan_filter(2, iters);
+}
+
+/**
+ * Build a beacon notify listing six short and one extended pending address,
+ * none of them the address looked up, so every lookup scans the whole list
+ */
+static void build_beacon(void)
+{
+	uint8_t *p = beacon_ind;
+	unsigned i;
+
+	memset(beacon_ind, 0, sizeof(beacon_ind));
+	p += 1 + PAN_DESCRIPTOR_BASE_SIZE;
+	*p++ = 6 | (1 << 4);
+	for (i = 0; i < 6; i++, p += 2)
+		PUTLE16(0x0100 + i, p);
+	memset(p, 0xEE, 8);
+	p += 8;
+	*p++ = 8;
+	p += 8;
+	beacon_ind_len = (size_t)(p - beacon_ind);
+}
+
+static void bench_beacon_pending(uint64_t iters)
+{
+	const struct MLME_BEACON_NOTIFY_indication_pset *ind =
+		(const struct MLME_BEACON_NOTIFY_indication_pset *)beacon_ind;
+	static const uint8_t extaddr[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	struct ca821x_beacon_view view;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		if (!ca821x_beacon_parse(&view, ind, beacon_ind_len))
+			bench_sink += ca821x_beacon_addr_pending(&view, 0x0042, extaddr);
+		bench_bytes += beacon_ind_len;
+	}
+}
+
+/** Build a secured 2006 data frame between long addresses, with an FCS */
+static void build_mac_frame(void)
+{
+	static const uint8_t payload[32] = {0};
+	struct ca821x_frame_hdr *hdr = &mac_frame_hdr;
+	int len;
+
+	hdr->fc = MAC_FC_FT_DATA | MAC_FC_ACK_REQ;
+	hdr->dsn = 0x42;
+	hdr->dst.AddressMode = MAC_MODE_LONG_ADDR;
+	hdr->src.AddressMode = MAC_MODE_LONG_ADDR;
+	memset(hdr->dst.Address, 0xAA, 8);
+	memset(hdr->src.Address, 0xBB, 8);
+	hdr->security.SecurityLevel = 5;
+	hdr->security.KeyIdMode = 1;
+	hdr->security.KeyIndex = 1;
+	len = ca821x_frame_build(mac_frame, sizeof(mac_frame), hdr, payload, sizeof(payload));
+	mac_frame_len = len + MAC_FCS_LEN;
+}
+
+static void bench_frame_decode(uint64_t iters)
+{
+	struct ca821x_frame frame;
+	struct FullAddr src, dst;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		if (!ca821x_frame_decode(&frame, mac_frame, mac_frame_len, 1)) {
+			ca821x_frame_get_addrs(&frame, &src, &dst);
+			bench_sink += frame.payload_len + src.Address[0];
+		}
+		bench_bytes += mac_frame_len;
+	}
+}
+
+static void bench_frame_build(uint64_t iters)
+{
+	static const uint8_t payload[32] = {0};
+	uint8_t buf[aMaxPHYPacketSize];
+	uint64_t i;
+	int len;
+
+	for (i = 0; i < iters; i++) {
+		mac_frame_hdr.frame_counter = (uint32_t)i;
+		len = ca821x_frame_build(buf, sizeof(buf), &mac_frame_hdr, payload, sizeof(payload));
+		bench_sink += buf[len - 1];
+		bench_bytes += len;
+	}
+}
+
+/** Capture data for the FCS benchmarks: a PSDU, or a 4 KiB archive block */
+static uint8_t fcs_data[4096];
+
+static void bench_fcs(uint16_t (*fn)(uint16_t, const uint8_t *, size_t), size_t len,
+                      uint64_t iters)
+{
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		fcs_data[0] = (uint8_t)i;
+		bench_sink += fn(CA821X_FCS_INIT, fcs_data, len);
+		bench_bytes += len;
+	}
+}
+
+static void bench_fcs_psdu(uint64_t iters)
+{
+	bench_fcs(ca821x_fcs_update, aMaxPHYPacketSize, iters);
+}
+
+static void bench_fcs_psdu_portable(uint64_t iters)
+{
+	bench_fcs(ca821x_fcs_update_portable, aMaxPHYPacketSize, iters);
+}
+
+static void bench_fcs_4k(uint64_t iters)
+{
+	bench_fcs(ca821x_fcs_update, sizeof(fcs_data), iters);
+}
+
+static void bench_fcs_4k_portable(uint64_t iters)
+{
+	bench_fcs(ca821x_fcs_update_portable, sizeof(fcs_data), iters);
+}
+
+static struct ca821x_aes_key aes_key;
+static struct ca821x_sec_keytab sec_keytab;
+static const uint8_t sec_ext_addr[8] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF};
+
+/** Key table with one key, found by default key source and index 1 */
+static void build_sec_keytab(void)
+{
+	struct M_KeyDescriptor desc;
+
+	memset(&desc, 0, sizeof(desc));
+	memset(desc.Fixed.Key, 0x5C, sizeof(desc.Fixed.Key));
+	desc.Fixed.KeyIdLookupListEntries = 1;
+	desc.KeyIdLookupList[0].LookupData[8] = 1;
+	desc.KeyIdLookupList[0].LookupDataSizeCode = 1;
+	ca821x_sec_keytab_init(&sec_keytab);
+	ca821x_sec_keytab_set(&sec_keytab, 0, &desc);
+	aes_key = sec_keytab.sched[0];
+}
+
+static void bench_aes_block(void (*fn)(const struct ca821x_aes_key *, const uint8_t *,
+                                       uint8_t *), uint64_t iters)
+{
+	uint8_t block[CA821X_AES_BLOCK] = {0};
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		fn(&aes_key, block, block);
+		bench_bytes += sizeof(block);
+	}
+	bench_sink += block[0];
+}
+
+static void bench_aes_encrypt(uint64_t iters)
+{
+	bench_aes_block(ca821x_aes_encrypt, iters);
+}
+
+static void bench_aes_encrypt_portable(uint64_t iters)
+{
+	bench_aes_block(ca821x_aes_encrypt_portable, iters);
+}
+
+/** The secured frame of decode/mac_frame, secured and unsecured on the host */
+static void bench_sec_build(uint64_t iters)
+{
+	static const uint8_t payload[32] = {0};
+	uint8_t buf[aMaxPHYPacketSize];
+	uint64_t i;
+	int len;
+
+	for (i = 0; i < iters; i++) {
+		mac_frame_hdr.frame_counter = (uint32_t)i;
+		len = ca821x_sec_frame_build(&sec_keytab, buf, sizeof(buf), &mac_frame_hdr,
+		                             payload, sizeof(payload), sec_ext_addr);
+		bench_sink += buf[len - 1];
+		bench_bytes += len;
+	}
+}
+
+static void bench_sec_open(uint64_t iters)
+{
+	static const uint8_t payload[32] = {0};
+	uint8_t frame[aMaxPHYPacketSize], buf[aMaxPHYPacketSize];
+	struct ca821x_frame decoded;
+	uint64_t i;
+	int len;
+
+	len = ca821x_sec_frame_build(&sec_keytab, frame, sizeof(frame), &mac_frame_hdr,
+	                             payload, sizeof(payload), sec_ext_addr);
+	for (i = 0; i < iters; i++) {
+		memcpy(buf, frame, len);
+		if (!ca821x_sec_frame_open(&sec_keytab, &decoded, buf, len, 0, NULL))
+			bench_sink += decoded.payload_len;
+		bench_bytes += len;
+	}
+}
+
+/** Look up each neighbour of a full table in turn, by the address mode given */
+static void bench_neighbour_find(uint8_t mode, uint64_t iters)
+{
+	static struct ca821x_neighbours nb;
+	static struct FullAddr addrs[CA821X_NEIGHBOUR_MAX];
+	struct ca821x_neighbour *n;
+	uint64_t i;
+	int j;
+
+	ca821x_neighbour_init(&nb);
+	for (j = 0; j < CA821X_NEIGHBOUR_MAX; j++) {
+		addrs[j].AddressMode = mode;
+		PUTLE16(0xCA5C, addrs[j].PANId);
+		if (mode == MAC_MODE_LONG_ADDR) {
+			memset(addrs[j].Address, 0x77, 8);
+			addrs[j].Address[7] = (uint8_t)j;
+		} else {
+			PUTLE16(0x1000 + j, addrs[j].Address);
+		}
+		ca821x_neighbour_learn(&nb, mode == MAC_MODE_LONG_ADDR ? addrs[j].Address : NULL,
+		                       addrs[j].PANId, addrs[j].Address);
+	}
+	for (i = 0; i < iters; i++) {
+		n = ca821x_neighbour_find(&nb, &addrs[i % CA821X_NEIGHBOUR_MAX]);
+		bench_sink += n->device_index;
+	}
+}
+
+static void bench_neighbour_find_ext(uint64_t iters)
+{
+	bench_neighbour_find(MAC_MODE_LONG_ADDR, iters);
+}
+
+static void bench_neighbour_find_short(uint64_t iters)
+{
+	bench_neighbour_find(MAC_MODE_SHORT_ADDR, iters);
+}
+
+/** New DSNs from each of a full filter's sources in turn */
+static void bench_dedup_check(uint64_t iters)
+{
+	static struct ca821x_dedup dedup;
+	struct FullAddr addrs[CA821X_DEDUP_SOURCES];
+	uint64_t i;
+	int j;
+
+	ca821x_dedup_init(&dedup, 0);
+	for (j = 0; j < CA821X_DEDUP_SOURCES; j++) {
+		addrs[j] = bench_addr(MAC_MODE_SHORT_ADDR);
+		PUTLE16(0x1000 + j, addrs[j].Address);
+	}
+	for (i = 0; i < iters; i++)
+		bench_sink += ca821x_dedup_check(&dedup, &addrs[i % CA821X_DEDUP_SOURCES],
+		                                 (uint8_t)(i / CA821X_DEDUP_SOURCES), 0);
+}
+
+/** Data indications from 128 sources, half of them in a 64 address set */
+static void bench_rxfilter_check(uint64_t iters)
+{
+	static struct ca821x_rxfilter filter;
+	static struct MAC_Message msgs[2 * CA821X_RXF_SET_MAX];
+	struct ca821x_rxfilter_rule rule;
+	struct MAC_Message *m;
+	uint64_t i;
+	int j;
+
+	ca821x_rxfilter_init(&filter, CA821X_RXF_DROP);
+	memset(&rule, 0, sizeof(rule));
+	rule.match = CA821X_RXF_SRC_IN | CA821X_RXF_LQI;
+	rule.action = CA821X_RXF_ACCEPT;
+	rule.lqi_min = BENCH_LQI_GOOD;
+	ca821x_rxfilter_add_rule(&filter, &rule);
+	for (j = 0; j < 2 * CA821X_RXF_SET_MAX; j++) {
+		m = &msgs[j];
+		m->CommandId = SPI_MCPS_DATA_INDICATION;
+		m->Length = sizeof(struct MCPS_DATA_indication_pset) - MAX_DATA_SIZE;
+		m->PData.DataInd.Src = bench_addr(MAC_MODE_SHORT_ADDR);
+		PUTLE16(0x1000 + j * 13, m->PData.DataInd.Src.Address);
+		m->PData.DataInd.Dst = bench_addr(MAC_MODE_SHORT_ADDR);
+		m->PData.DataInd.MpduLinkQuality = BENCH_LQI_GOOD;
+		if (j & 1)
+			ca821x_rxfilter_add_addr(&filter, 0, &m->PData.DataInd.Src);
+	}
+	for (i = 0; i < iters; i++) {
+		m = &msgs[i % (2 * CA821X_RXF_SET_MAX)];
+		bench_sink += ca821x_rxfilter_check(&filter, &m->CommandId, m->Length + 2);
+	}
+}
+
+/** Plan the SETs for a join against a mirror of full tables less one device */
+static void bench_sec_mirror_plan(uint64_t iters)
+{
+	static struct ca821x_sec_mirror mirror;
+	static struct ca821x_sec_tables tables;
+	struct ca821x_sec_set sets[CA821X_SEC_MAX_SETS];
+	uint64_t i;
+	int d;
+
+	ca821x_sec_mirror_init(&mirror);
+	ca821x_sec_tables_init(&tables);
+	tables.keys.entries = 1;
+	tables.keys.desc[0].Fixed.KeyDeviceListEntries = DEVICE_TABLE_SIZE - 1;
+	tables.device_entries = DEVICE_TABLE_SIZE - 1;
+	for (d = 0; d < DEVICE_TABLE_SIZE; d++)
+		memset(tables.devices[d].ExtAddress, d, 8);
+	mirror.dev = tables;
+	mirror.device_known = 0xFFFFFFFF;
+	mirror.level_known = mirror.key_known = 0xFF;
+	mirror.key_source_known = 1;
+	tables.device_entries = DEVICE_TABLE_SIZE;
+	tables.keys.desc[0].Fixed.KeyDeviceListEntries = DEVICE_TABLE_SIZE;
+
+	for (i = 0; i < iters; i++)
+		bench_sink += ca821x_sec_mirror_plan(&mirror, &tables, sets, CA821X_SEC_MAX_SETS);
+}
+
+/** Build the upstream messages and the order they are dispatched in */
+static void build_mix(void)
+{
+	/* Percentages of a busy coordinator's upstream traffic */
+	static const uint8_t weights[] = {50, 30, 8, 5, 3, 2, 1, 1};
+	struct MAC_Message *m;
+	unsigned i, j, k = 0;
+	uint32_t x = 0x2545F491;
+
+	memset(mix_msgs, 0, sizeof(mix_msgs));
+
+	m = &mix_msgs[0];
+	m->CommandId = SPI_MCPS_DATA_INDICATION;
+	m->PData.DataInd.Src = bench_addr(MAC_MODE_SHORT_ADDR);
+	m->PData.DataInd.Dst = bench_addr(MAC_MODE_SHORT_ADDR);
+	m->PData.DataInd.Dst.Address[0] = 0xFF;
+	m->PData.DataInd.Dst.Address[1] = 0xFF;
+	m->PData.DataInd.MsduLength = 40;
+	m->Length = sizeof(struct MCPS_DATA_indication_pset) - MAX_DATA_SIZE + 40 + 1;
+
+	m = &mix_msgs[1];
+	m->CommandId = SPI_MCPS_DATA_CONFIRM;
+	m->Length = sizeof(struct MCPS_DATA_confirm_pset);
+
+	m = &mix_msgs[2];
+	m->CommandId = SPI_MLME_COMM_STATUS_INDICATION;
+	m->Length = sizeof(struct MLME_COMM_STATUS_indication_pset) - sizeof(struct SecSpec) + 1;
+
+	m = &mix_msgs[3];
+	m->CommandId = SPI_MLME_BEACON_NOTIFY_INDICATION;
+	m->PData.BeaconInd.PanDescriptor.Coord = bench_addr(MAC_MODE_SHORT_ADDR);
+	m->PData.BeaconInd.PanDescriptor.LinkQuality = BENCH_LQI_GOOD;
+	m->Length = 1 + 22 + 1 + 10;
+
+	m = &mix_msgs[4];
+	m->CommandId = SPI_MLME_ASSOCIATE_INDICATION;
+	m->Length = sizeof(struct MLME_ASSOCIATE_indication_pset) - sizeof(struct SecSpec) + 1;
+
+	m = &mix_msgs[5];
+	m->CommandId = SPI_MLME_SCAN_CONFIRM;
+	m->PData.ScanCnf.ScanType = ENERGY_DETECT;
+	m->PData.ScanCnf.ResultListSize = 16;
+	m->Length = 7 + 16;
+
+	m = &mix_msgs[6];
+	m->CommandId = SPI_MLME_ASSOCIATE_CONFIRM;
+	m->PData.AssocCnf.AssocShortAddress[0] = 0x34;
+	m->PData.AssocCnf.AssocShortAddress[1] = 0x12;
+	m->Length = sizeof(struct MLME_ASSOCIATE_confirm_pset) - sizeof(struct SecSpec) + 1;
+
+	m = &mix_msgs[7];
+	m->CommandId = SPI_HWME_WAKEUP_INDICATION;
+	m->Length = sizeof(struct HWME_WAKEUP_indication_pset);
+
+	for (i = 0; i < sizeof(weights); i++)
+		for (j = 0; j < weights[i]; j++)
+			mix_order[k++] = i;
+	/* Shuffle so branch predictors see a realistic sequence */
+	for (i = BENCH_MIX_LEN - 1; i > 0; i--) {
+		uint8_t t;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		j = x % (i + 1);
+		t = mix_order[i];
+		mix_order[i] = mix_order[j];
+		mix_order[j] = t;
+	}
+}
+
+static void bench_dispatch_mix(uint64_t iters)
+{
+	struct MAC_Message *m;
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		m = &mix_msgs[mix_order[i % BENCH_MIX_LEN]];
+		ca821x_downstream_dispatch(&m->CommandId, m->Length + 2, &bench_dev);
+		bench_bytes += m->Length + 2;
+	}
+}
+
+static void bench_dispatch_data_ind(uint64_t iters)
+{
+	struct MAC_Message *m = &mix_msgs[0];
+	uint64_t i;
+
+	for (i = 0; i < iters; i++) {
+		ca821x_downstream_dispatch(&m->CommandId, m->Length + 2, &bench_dev);
+		bench_bytes += m->Length + 2;
+	}
+}
+
+/** The same, from a neighbour of a full table whose link statistics are kept */
+static void bench_dispatch_data_ind_links(uint64_t iters)
+{
+	static struct ca821x_neighbours nb;
+	static struct ca821x_links links;
+	struct MAC_Message *m = &mix_msgs[0];
+	const struct FullAddr *src = &m->PData.DataInd.Src;
+	uint8_t addr[2];
+	int j;
+
+	ca821x_neighbour_init(&nb);
+	ca821x_link_init(&links);
+	for (j = 0; j < CA821X_NEIGHBOUR_MAX - 1; j++) {
+		PUTLE16(GETLE16(src->Address) + 1 + j, addr);
+		ca821x_neighbour_learn(&nb, NULL, src->PANId, addr);
+	}
+	ca821x_neighbour_learn(&nb, NULL, src->PANId, src->Address);
+	bench_dev.neighbours = &nb;
+	bench_dev.links = &links;
+	bench_dispatch_data_ind(iters);
+	bench_dev.neighbours = NULL;
+	bench_dev.links = NULL;
+}
+
+static void bench_sub_handler(const uint8_t *buf, size_t len, void *context,
+                              struct ca821x_dev *pDeviceRef)
+{
+	(void)context;
+	(void)pDeviceRef;
+	bench_sink += buf[len - 1];
+}
+
+/** The same, with a full row of subscriptions of which three match */
+static void bench_dispatch_data_ind_subs(uint64_t iters)
+{
+	static struct ca821x_subs subs;
+	struct MAC_Message *m = &mix_msgs[0];
+	struct ca821x_sub_filter filter;
+
+	ca821x_subs_init(&subs);
+	memset(&filter, 0, sizeof(filter));
+	ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, NULL, bench_sub_handler, NULL);
+	filter.match = CA821X_SUB_SRC;
+	filter.src = m->PData.DataInd.Src;
+	ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, &filter, bench_sub_handler, NULL);
+	filter.match = CA821X_SUB_DST;
+	filter.dst = bench_addr(MAC_MODE_LONG_ADDR);
+	filter.dst.Address[0] ^= 0xFF;
+	ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, &filter, bench_sub_handler, NULL);
+	filter.match = CA821X_SUB_PAN;
+	memcpy(filter.pan_id, m->PData.DataInd.Dst.PANId, 2);
+	ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, &filter, bench_sub_handler, NULL);
+	bench_dev.subs = &subs;
+	bench_dispatch_data_ind(iters);
+	bench_dev.subs = NULL;
+}
+
+/** The same, dropped by a receive filter in promiscuous mode */
+static void bench_dispatch_data_ind_rxfilter(uint64_t iters)
+{
+	static struct ca821x_rxfilter filter;
+
+	ca821x_rxfilter_init(&filter, CA821X_RXF_DROP);
+	bench_dev.rxfilter = &filter;
+	bench_dispatch_data_ind(iters);
+	bench_dev.rxfilter = NULL;
+}
+
+static void bench_dispatch_mix_traced(uint64_t iters)
+{
+	bench_traced(bench_dispatch_mix, iters);
+}
+
+static const struct bench benches[] = {
+	{"encode/MCPS_DATA_request",           bench_mcps_data},
+	{"encode/MCPS_DATA_request_secured",   bench_mcps_data_sec},
+	{"encode/MCPS_DATA_request_traced",    bench_mcps_data_traced},
+	{"encode/MCPS_PURGE_request_sync",     bench_mcps_purge},
+#if CASCODA_CA_VER >= 8211
+	{"encode/PCPS_DATA_request",           bench_pcps_data},
+#endif
+	{"encode/mac_frame",                   bench_frame_build},
+	{"encode/MLME_ASSOCIATE_request",      bench_mlme_associate},
+	{"encode/MLME_ASSOCIATE_response",     bench_mlme_associate_rsp},
+	{"encode/MLME_DISASSOCIATE_request",   bench_mlme_disassociate},
+	{"encode/MLME_GET_request_sync",       bench_mlme_get},
+	{"encode/MLME_GET_request_sync_stats", bench_mlme_get_stats},
+	{"encode/MLME_GET_request_sync_traced", bench_mlme_get_traced},
+	{"encode/MLME_ORPHAN_response",        bench_mlme_orphan_rsp},
+	{"encode/MLME_RESET_request_sync",     bench_mlme_reset},
+	{"encode/MLME_RX_ENABLE_request_sync", bench_mlme_rx_enable},
+	{"encode/MLME_SCAN_request",           bench_mlme_scan},
+	{"encode/MLME_SET_request_sync",       bench_mlme_set},
+	{"encode/MLME_START_request_sync",     bench_mlme_start},
+	{"encode/MLME_POLL_request_sync",      bench_mlme_poll},
+	{"encode/HWME_SET_request_sync",       bench_hwme_set},
+	{"encode/HWME_GET_request_sync",       bench_hwme_get},
+	{"encode/HWME_HAES_request_sync",      bench_hwme_haes},
+	{"encode/HWME_HAES_ctr_100",           bench_haes_ctr},
+	{"encode/HWME_HAES_cbc_mac_100",       bench_haes_cbc_mac},
+	{"encode/TDME_SETSFR_request_sync",    bench_tdme_setsfr},
+	{"encode/TDME_GETSFR_request_sync",    bench_tdme_getsfr},
+	{"encode/TDME_TESTMODE_request_sync",  bench_tdme_testmode},
+	{"encode/TDME_SET_request_sync",       bench_tdme_set},
+	{"encode/TDME_TXPKT_request_sync",     bench_tdme_txpkt},
+	{"encode/TDME_LOTLK_request_sync",     bench_tdme_lotlk},
+	{"encode/TDME_ChipInit",               bench_tdme_chipinit},
+	{"encode/TDME_ChannelInit",            bench_tdme_channelinit},
+	{"encode/TDME_SetTxPower",             bench_tdme_settxpower},
+	{"encode/TDME_GetTxPower",             bench_tdme_gettxpower},
+	{"decode/beacon_notify_pending",       bench_beacon_pending},
+	{"decode/mac_frame",                   bench_frame_decode},
+	{"fcs/psdu_127",                       bench_fcs_psdu},
+	{"fcs/psdu_127_portable",              bench_fcs_psdu_portable},
+	{"fcs/4k",                             bench_fcs_4k},
+	{"fcs/4k_portable",                    bench_fcs_4k_portable},
+	{"aes/encrypt",                        bench_aes_encrypt},
+	{"aes/encrypt_portable",               bench_aes_encrypt_portable},
+	{"sec/build_enc_mic_32",               bench_sec_build},
+	{"sec/open_enc_mic_32",                bench_sec_open},
+	{"sec/mirror_plan_join",               bench_sec_mirror_plan},
+	{"neighbour/find_ext_64",              bench_neighbour_find_ext},
+	{"dedup/check_64_sources",             bench_dedup_check},
+	{"rxfilter/check_64_addrs",            bench_rxfilter_check},
+	{"neighbour/find_short_64",            bench_neighbour_find_short},
+	{"dispatch/mix",                       bench_dispatch_mix},
+	{"dispatch/mix_traced",                bench_dispatch_mix_traced},
+	{"dispatch/MCPS_DATA_indication",      bench_dispatch_data_ind},
+	{"dispatch/MCPS_DATA_indication_links", bench_dispatch_data_ind_links},
+	{"dispatch/MCPS_DATA_indication_subs", bench_dispatch_data_ind_subs},
+	{"dispatch/MCPS_DATA_indication_drop", bench_dispatch_data_ind_rxfilter},
+	{"dispatch/scan_confirm_keep_all",     bench_scan_cnf_keep},
+	{"dispatch/scan_confirm_drop_all",     bench_scan_cnf_drop},
+	{"dispatch/scan_confirm_drop_half",    bench_scan_cnf_mixed},
+	{"scan/filter_lqi_200_keep_all",       bench_scan_filter_keep},
+	{"scan/filter_lqi_200_drop_all",       bench_scan_filter_drop},
+	{"scan/filter_lqi_200_drop_half",      bench_scan_filter_mixed},
+#if CASCODA_CA_VER >= 8211
+	{"pcps/sim_stream_window_1",           bench_pcps_sim_window1},
+	{"pcps/sim_stream_window_4",           bench_pcps_sim_window4},
+#endif
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/******************************************************************************/
+/****** Harness                                                          ******/
+/******************************************************************************/
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Time one benchmark, returning the fastest of repeat runs */
+static void run_bench(const struct bench *b, uint64_t min_ns, int repeat,
+                      struct bench_result *res)
+{
+	uint64_t iters = 1, start, elapsed = 0, bytes;
+	double ns;
+	int r;
+
+	/* Find an iteration count that takes at least min_ns */
+	for (;;) {
+		bench_bytes = 0;
+		start = now_ns();
+		b->fn(iters);
+		elapsed = now_ns() - start;
+		if (elapsed >= min_ns || iters >= (1ULL << 40))
+			break;
+		if (elapsed < min_ns / 100)
+			iters *= 10;
+		else
+			iters = iters * min_ns / elapsed + 1;
+	}
+	bytes = bench_bytes;
+
+	res->name = b->name;
+	res->iters = iters;
+	res->ns_per_op = (double)elapsed / iters;
+	res->bytes_per_op = (double)bytes / iters;
+	for (r = 1; r < repeat; r++) {
+		bench_bytes = 0;
+		start = now_ns();
+		b->fn(iters);
+		ns = (double)(now_ns() - start) / iters;
+		if (ns < res->ns_per_op)
+			res->ns_per_op = ns;
+	}
+}
+
+static void write_json(FILE *f, const struct bench_result *res, unsigned count)
+{
+	unsigned i;
+
+	fprintf(f, "{\n  \"ca_ver\": %d,\n  \"benchmarks\": [\n", CASCODA_CA_VER);
+	for (i = 0; i < count; i++) {
+		fprintf(f, "    {\"name\": \"%s\", \"iterations\": %llu, "
+		        "\"ns_per_op\": %.3f, \"bytes_per_op\": %.2f}%s\n",
+		        res[i].name, (unsigned long long)res[i].iters,
+		        res[i].ns_per_op, res[i].bytes_per_op,
+		        i + 1 < count ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+/** Look up a benchmark's ns/op in JSON written by write_json, or -1 */
+static double baseline_lookup(const char *json, const char *name)
+{
+	char key[128];
+	const char *p;
+
+	snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+	p = strstr(json, key);
+	if (!p)
+		return -1;
+	p = strstr(p, "\"ns_per_op\": ");
+	if (!p)
+		return -1;
+	return strtod(p + strlen("\"ns_per_op\": "), NULL);
+}
+
+static char *read_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf;
+	long len;
+
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(len + 1);
+	if (buf && fread(buf, 1, len, f) != (size_t)len) {
+		free(buf);
+		buf = NULL;
+	}
+	if (buf)
+		buf[len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [--filter SUBSTR] [--min-time MS] [--repeat N] "
+	        "[--quick] [--json FILE] [--baseline FILE] [--threshold PCT]\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_result results[NUM_BENCHES];
+	const char *filter = NULL, *json_path = NULL, *baseline_path = NULL;
+	char *baseline = NULL;
+	uint64_t min_ns = 50000000;
+	double threshold = 10.0, base, change;
+	int repeat = 3, regressions = 0, i;
+	unsigned count = 0, b;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--quick")) {
+			min_ns = 1000000;
+			repeat = 1;
+		} else if (i + 1 < argc && !strcmp(argv[i], "--filter")) {
+			filter = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--min-time")) {
+			min_ns = strtoull(argv[++i], NULL, 10) * 1000000;
+		} else if (i + 1 < argc && !strcmp(argv[i], "--repeat")) {
+			repeat = atoi(argv[++i]);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--json")) {
+			json_path = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--baseline")) {
+			baseline_path = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--threshold")) {
+			threshold = strtod(argv[++i], NULL);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (repeat < 1)
+		repeat = 1;
+	if (!min_ns)
+		min_ns = 1;
+	if (baseline_path) {
+		baseline = read_file(baseline_path);
+		if (!baseline) {
+			fprintf(stderr, "cannot read baseline %s\n", baseline_path);
+			return 2;
+		}
+	}
+
+	ca821x_api_init(&bench_dev);
+	bench_dev.ca821x_api_downstream = null_downstream;
+	bench_dev.callbacks.MCPS_DATA_indication = count_data_indication;
+	bench_dev.callbacks.MCPS_DATA_confirm = count_data_confirm;
+	bench_dev.callbacks.MLME_SCAN_confirm = count_scan_confirm;
+	bench_dev.callbacks.generic_dispatch = count_generic;
+	build_scan_cnf(scan_template[0], 0);
+	build_scan_cnf(scan_template[1], 1);
+	build_scan_cnf(scan_template[2], 2);
+	for (i = 0; i < 3; i++)
+		build_scan_list((struct MLME_SCAN_confirm_pset *)filter_template[i],
+		                BENCH_FILTER_PDESCS, i);
+	build_mix();
+	build_beacon();
+	build_mac_frame();
+	build_sec_keytab();
+
+	printf("%-40s %12s %10s %10s\n", "benchmark", "ns/op", "bytes/op",
+	       baseline ? "change" : "");
+	for (b = 0; b < NUM_BENCHES; b++) {
+		struct bench_result *res = &results[count];
+		if (filter && !strstr(benches[b].name, filter))
+			continue;
+		run_bench(&benches[b], min_ns, repeat, res);
+		count++;
+
+		printf("%-40s %12.2f %10.2f", res->name, res->ns_per_op, res->bytes_per_op);
+		base = baseline ? baseline_lookup(baseline, res->name) : -1;
+		if (base > 0) {
+			change = (res->ns_per_op - base) * 100.0 / base;
+			printf(" %+9.1f%%%s", change, change > threshold ? " REGRESSED" : "");
+			if (change > threshold)
+				regressions++;
+		}
+		printf("\n");
+	}
+
+	if (json_path) {
+		FILE *f = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+		if (!f) {
+			fprintf(stderr, "cannot write %s\n", json_path);
+			return 2;
+		}
+		write_json(f, results, count);
+		if (f != stdout)
+			fclose(f);
+	}
+	free(baseline);
+
+	if (regressions) {
+		printf("%d benchmark(s) regressed by more than %.1f%%\n", regressions,
+		       threshold);
+		return 1;
+	}
+	return 0;
+}
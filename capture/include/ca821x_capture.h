@@ -0,0 +1,94 @@
+/**
+ * @file ca821x_capture.h
+ * @brief Streaming pcapng capture of the frames received by ca821x devices.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_CAPTURE_H
+#define CA821X_CAPTURE_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+
+/***************************************************************************//**
+ * \defgroup CaptureDefaults Capture defaults
+ ************************************************************************** @{*/
+/** Frames that can wait for the writer before further frames are dropped */
+#define CA821X_CAPTURE_DEF_QUEUE_LEN    (1024)
+/** Size of the file write buffer */
+#define CA821X_CAPTURE_BUFFER_SIZE      (64 * 1024)
+/** Longest the writer sleeps while idle, bounding flush and rotation delay */
+#define CA821X_CAPTURE_IDLE_MS          (5)
+/** Devices that can be attached to one capture */
+#define CA821X_CAPTURE_MAX_IFACES       (16)
+/** pcapng link type of IEEE 802.15.4 frames with a TAP header */
+#define CA821X_CAPTURE_LINKTYPE         (283)
+/**@}*/
+
+/** Capture configuration, see ca821x_capture_open */
+struct ca821x_capture_config {
+	/** File to write. With rotation, files are named with a _NNNNN sequence
+	 *  number inserted before the extension (e.g. rx_00000.pcapng) */
+	const char *path;
+	uint64_t    rotate_bytes;   /**< Start a new file at this size, 0: never */
+	uint32_t    rotate_seconds; /**< Start a new file after this long, 0: never */
+	unsigned    max_files;      /**< Delete older rotated files, 0: keep all */
+	unsigned    queue_len;      /**< Power of two, 0: CA821X_CAPTURE_DEF_QUEUE_LEN */
+	uint8_t     channel;        /**< Channel recorded with each frame, 0: unknown */
+};
+
+/** Capture counters, see ca821x_capture_get_stats */
+struct ca821x_capture_stats {
+	uint64_t frames;  /**< Frames written */
+	uint64_t dropped; /**< Frames lost to a full queue or a write error */
+	uint64_t bytes;   /**< Octets written, across all files */
+	unsigned files;   /**< Files opened */
+	int      error;   /**< errno of the first write error, 0 if none */
+};
+
+struct ca821x_capture;
+
+/***************************************************************************//**
+ * A capture records MCPS-DATA.indication, PCPS-DATA.indication and
+ * TDME-RXPKT.indication frames of the attached devices as pcapng, with one
+ * interface per device and a LINKTYPE_IEEE802_15_4_TAP header carrying the
+ * link quality, energy (as RSS) and channel of each frame.
+ *
+ * MAC data indications are re-encoded as unsecured 802.15.4-2006 data frames
+ * without FCS, since the device has already removed any security. PHY frames
+ * are recorded as received, including the FCS.
+ *
+ * Frames are copied into a lock-free queue from the exchange context and
+ * written by a dedicated thread, so capturing never blocks dispatch. If the
+ * writer falls behind, frames are dropped and counted.
+ ******************************************************************************/
+struct ca821x_capture *ca821x_capture_open(
+	const struct ca821x_capture_config *config
+);
+
+int ca821x_capture_attach(struct ca821x_capture *cap, struct ca821x_dev *pDeviceRef);
+
+void ca821x_capture_detach(struct ca821x_capture *cap, struct ca821x_dev *pDeviceRef);
+
+int ca821x_capture_flush(struct ca821x_capture *cap);
+
+void ca821x_capture_get_stats(struct ca821x_capture *cap,
+                              struct ca821x_capture_stats *stats);
+
+int ca821x_capture_close(struct ca821x_capture *cap);
+
+#endif // CA821X_CAPTURE_H
@@ -0,0 +1,110 @@
+/**
+ * @file ca821x_replay.h
+ * @brief Replay of recorded ca821x traffic into an application.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_REPLAY_H
+#define CA821X_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_store.h"
+#include "ca821x_sync_stats.h"
+#include "ca821x_trace.h"
+
+/** Replay options, see ca821x_replay_run */
+struct ca821x_replay_config {
+	/** Playback rate relative to the recording (2.0 is twice as fast), or 0
+	 *  to replay as fast as possible */
+	double                    speed;
+	/** Nonzero to time each ca821x_downstream_dispatch, see
+	 *  ca821x_replay_latency */
+	int                       record_latency;
+};
+
+/** Outcome of a replay */
+struct ca821x_replay_stats {
+	uint64_t upstream;        /**< Frames passed to ca821x_downstream_dispatch */
+	uint64_t downstream;      /**< Commands re-issued to the exchange */
+	uint64_t errors;          /**< Failed dispatches and commands */
+	uint64_t elapsed_ns;      /**< Wall-clock duration of the replay */
+	uint64_t max_lateness_ns; /**< Furthest a frame fell behind its schedule */
+	double   upstream_per_sec;/**< Achieved dispatch throughput */
+};
+
+/** Callback latencies of the frames of one command id */
+struct ca821x_replay_latency {
+	/** Histogram of the time spent in ca821x_downstream_dispatch (ns), laid
+	 *  out as in ca821x_sync_stats.h (see ca821x_sync_hist_percentile) */
+	uint32_t buckets[SYNC_STATS_BUCKETS];
+	uint32_t count;   /**< Frames dispatched */
+	uint32_t max_ns;  /**< Largest latency (saturates at 2^32-1) */
+	uint32_t errors;  /**< Dispatches that returned an error */
+};
+
+struct ca821x_replay;
+
+/***************************************************************************//**
+ * A replay holds recorded frames in timestamp order. Frames recorded
+ * upstream (from a store, or the upstream records of a trace) are passed to
+ * ca821x_downstream_dispatch of the target device, so its callbacks run as
+ * they did in production. Downstream commands (from a trace) are re-issued
+ * through the device's ca821x_api_downstream, typically a simulator exchange
+ * (see ca821x_sim_init), to reproduce the state the recording assumed; their
+ * responses are discarded.
+ *
+ * Frames are replayed on the calling thread, paced against the monotonic
+ * clock.
+ ******************************************************************************/
+struct ca821x_replay *ca821x_replay_create(void);
+
+void ca821x_replay_destroy(struct ca821x_replay *replay);
+
+int ca821x_replay_add(
+	struct ca821x_replay  *replay,
+	uint64_t               timestamp_ns,
+	enum ca821x_trace_dir  dir,
+	const uint8_t         *buf,
+	size_t                 len
+);
+
+int ca821x_replay_load_store(
+	struct ca821x_replay            *replay,
+	const char                      *dir,
+	const struct ca821x_store_query *query
+);
+
+int ca821x_replay_load_trace(struct ca821x_replay *replay, struct ca821x_trace *trace);
+
+size_t ca821x_replay_len(struct ca821x_replay *replay);
+
+int ca821x_replay_run(
+	struct ca821x_replay              *replay,
+	const struct ca821x_replay_config *config,
+	struct ca821x_replay_stats        *stats,
+	struct ca821x_dev                 *pDeviceRef
+);
+
+int ca821x_replay_latency(
+	struct ca821x_replay         *replay,
+	uint8_t                       cmdid,
+	struct ca821x_replay_latency *latency
+);
+
+#endif // CA821X_REPLAY_H
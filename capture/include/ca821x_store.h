@@ -0,0 +1,136 @@
+/**
+ * @file ca821x_store.h
+ * @brief Append-only, indexed store of the frames received by ca821x devices.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_STORE_H
+#define CA821X_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "mac_messages.h"
+
+/***************************************************************************//**
+ * \defgroup StoreDefaults Store layout
+ ************************************************************************** @{*/
+/** Default size of a segment file */
+#define CA821X_STORE_DEF_SEGMENT_SIZE   (16 * 1024 * 1024)
+/** Smallest segment size accepted */
+#define CA821X_STORE_MIN_SEGMENT_SIZE   (64 * 1024)
+/** Records covered by one entry of a segment's sparse index */
+#define CA821X_STORE_BLOCK_RECORDS      (64)
+/** Devices that can be attached to one store */
+#define CA821X_STORE_MAX_IFACES         (16)
+/**@}*/
+
+/** Which addresses of a frame a query matches against */
+enum ca821x_store_match {
+	CA821X_STORE_MATCH_SRC    = 1, //!< Source address
+	CA821X_STORE_MATCH_DST    = 2, //!< Destination address
+	CA821X_STORE_MATCH_EITHER = 3  //!< Source or destination address
+};
+
+/** Store configuration, see ca821x_store_open */
+struct ca821x_store_config {
+	const char *dir;          /**< Directory of segment files, created if needed */
+	uint32_t    segment_size; /**< Multiple of 4096, 0: CA821X_STORE_DEF_SEGMENT_SIZE */
+	unsigned    max_segments; /**< Delete the oldest segments, 0: keep all */
+};
+
+/** Selection of frames, see ca821x_store_query */
+struct ca821x_store_query {
+	uint64_t        start_ns; /**< Earliest timestamp included */
+	uint64_t        end_ns;   /**< Timestamps from this are excluded, 0: none */
+	/** Address to match, AddressMode MAC_MODE_NO_ADDR for any frame. The PAN
+	 *  id is only compared for short addresses */
+	struct FullAddr addr;
+	uint8_t         match;    /**< enum ca821x_store_match, 0: either */
+};
+
+/** Work done by a query, showing how much the index skipped */
+struct ca821x_store_query_stats {
+	unsigned segments;         /**< Segment files in the store */
+	unsigned segments_scanned; /**< Segments whose index was searched */
+	unsigned blocks_scanned;   /**< Index blocks whose records were read */
+	uint64_t records_scanned;  /**< Records compared against the query */
+};
+
+/** A stored frame, passed to a ca821x_store_query_fn */
+struct ca821x_store_frame {
+	uint64_t       timestamp_ns;
+	uint8_t        iface; /**< Interface id from ca821x_store_attach */
+	const uint8_t *buf;   /**< Frame as dispatched, from the command id */
+	size_t         len;
+};
+
+/** Called with each frame matching a query, returning nonzero to stop */
+typedef int (*ca821x_store_query_fn)(const struct ca821x_store_frame *frame,
+                                     void *context);
+
+struct ca821x_store;
+
+/***************************************************************************//**
+ * A store keeps the frames dispatched to the attached devices in a directory
+ * of fixed-size segment files, written through mmap. Each segment holds a
+ * sparse index with one entry per CA821X_STORE_BLOCK_RECORDS records: the
+ * block's time range and a bloom filter of the source and destination
+ * addresses of its MCPS-DATA.indications and of the MAC frames of its
+ * PCPS-DATA.indications. Each segment header holds its time
+ * range and a larger bloom filter. Queries by time and address therefore
+ * only read the records of the blocks that may match.
+ *
+ * Segments are written in native byte order. Appending a record and updating
+ * the index is a memory copy. Each segment_size bytes, one append in the
+ * caller's context also creates the file of the next segment, outside the
+ * store's lock (see ca821x_store_append). Records become visible to queries, even
+ * from another process, as soon as they are appended.
+ ******************************************************************************/
+struct ca821x_store *ca821x_store_open(const struct ca821x_store_config *config);
+
+int ca821x_store_attach(struct ca821x_store *store, struct ca821x_dev *pDeviceRef);
+
+void ca821x_store_detach(struct ca821x_store *store, struct ca821x_dev *pDeviceRef);
+
+int ca821x_store_append(
+	struct ca821x_store *store,
+	uint8_t              iface,
+	const uint8_t       *buf,
+	size_t               len,
+	uint64_t             timestamp_ns
+);
+
+int ca821x_store_sync(struct ca821x_store *store);
+
+int ca821x_store_close(struct ca821x_store *store);
+
+int ca821x_store_query(
+	const char                      *dir,
+	const struct ca821x_store_query *query,
+	ca821x_store_query_fn            callback,
+	void                            *context,
+	struct ca821x_store_query_stats *stats
+);
+
+int ca821x_store_frame_addrs(
+	const struct ca821x_store_frame *frame,
+	struct FullAddr                 *src,
+	struct FullAddr                 *dst
+);
+
+#endif // CA821X_STORE_H
@@ -0,0 +1,782 @@
+/**
+ * @file ca821x_capture.c
+ * @brief Streaming pcapng capture of the frames received by ca821x devices.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+#include "ca821x_capture.h"
+#include "ca821x_frame.h"
+#include "hwme_tdme.h"
+#include "ieee_802_15_4.h"
+#include "mac_messages.h"
+
+#ifndef CA821X_HAVE_ATOMICS
+#error "ca821x-capture requires C11 atomics"
+#endif
+
+/** Longest dispatched frame: command id, length and parameters */
+#define CAPTURE_FRAME_MAX       (2 + 255)
+/** Longest encoded packet: TAP header with four TLVs, MAC header and MSDU */
+#define CAPTURE_PACKET_MAX      (4 + 4 * 8 + 23 + MAX_DATA_SIZE)
+
+/** pcapng block types */
+#define PCAPNG_SHB              (0x0A0D0D0A)
+#define PCAPNG_IDB              (0x00000001)
+#define PCAPNG_EPB              (0x00000006)
+/** pcapng option codes */
+#define PCAPNG_OPT_END          (0)
+#define PCAPNG_SHB_USERAPPL     (4)
+#define PCAPNG_IF_NAME          (2)
+#define PCAPNG_IF_TSRESOL       (9)
+
+/** IEEE 802.15.4 TAP TLV types */
+#define TAP_FCS_TYPE            (0)
+#define TAP_RSS                 (1)
+#define TAP_CHANNEL             (3)
+#define TAP_LQI                 (10)
+/** TAP FCS types */
+#define TAP_FCS_NONE            (0)
+#define TAP_FCS_16BIT           (1)
+
+#define PAD4(x)                 (((x) + 3) & ~(size_t)3)
+
+/** Frame waiting in the queue for the writer */
+struct capture_slot {
+	ca821x_atomic32_t seq;       /**< Position + 1 once filled */
+	uint8_t           iface;
+	uint8_t           lqi_is_ed; /**< Device reports ED as LQI */
+	uint16_t          len;
+	uint64_t          timestamp_ns;
+	uint8_t           frame[CAPTURE_FRAME_MAX];
+};
+
+/** An attached device */
+struct capture_iface {
+	struct ca821x_tap      tap;
+	struct ca821x_capture *cap;
+	struct ca821x_dev     *dev;
+	uint8_t                id;
+};
+
+struct ca821x_capture {
+	struct ca821x_capture_config config;
+	char                        *path;
+	char                        *name;    /**< Scratch for file names */
+
+	/* Bounded multi-producer queue, one sequence number per slot */
+	struct capture_slot         *slots;
+	uint32_t                     mask;
+	ca821x_atomic32_t            tail;    /**< Next position for a producer */
+	uint32_t                     head;    /**< Next position for the writer */
+	atomic_uint_least64_t        dropped;
+
+	struct capture_iface         ifaces[CA821X_CAPTURE_MAX_IFACES];
+	unsigned                     num_ifaces;
+
+	pthread_t                    thread;
+	pthread_mutex_t              lock;
+	pthread_cond_t               wake;    /**< Signalled to wake the writer */
+	pthread_cond_t               flushed; /**< Signalled when flush_done moves */
+	int                          stop;
+	unsigned                     flush_req, flush_done;
+
+	/* Owned by the writer once started */
+	FILE                        *file;
+	char                        *buffer;
+	uint64_t                     file_bytes;
+	uint64_t                     file_packets;
+	struct timespec              file_start;
+	uint32_t                     idb_written; /**< Interfaces described in file */
+	unsigned                     file_index;
+
+	/* Guarded by lock */
+	uint64_t                     frames;
+	uint64_t                     bytes;
+	uint64_t                     write_dropped;
+	unsigned                     files;
+	int                          error;
+};
+
+/** Timestamp of a frame: the device clock if it has one, otherwise UTC */
+static uint64_t capture_time(struct ca821x_dev *pDeviceRef)
+{
+	struct timespec ts;
+
+	if (pDeviceRef->clock)
+		return ca821x_get_time_ns(pDeviceRef);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/** Tap callback: queue interesting frames, dropping them if the queue is full */
+static void capture_tap(const uint8_t *buf, size_t len, void *context,
+                        struct ca821x_dev *pDeviceRef)
+{
+	struct capture_iface *iface = context;
+	struct ca821x_capture *cap = iface->cap;
+	struct capture_slot *slot;
+	uint32_t pos, seq;
+
+	switch (buf[0]) {
+	case SPI_MCPS_DATA_INDICATION:
+#if CASCODA_CA_VER >= 8211
+	case SPI_PCPS_DATA_INDICATION:
+#endif
+	case SPI_TDME_RXPKT_INDICATION:
+		break;
+	default:
+		return;
+	}
+	if (len > CAPTURE_FRAME_MAX)
+		len = CAPTURE_FRAME_MAX;
+
+	pos = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+	for (;;) {
+		slot = &cap->slots[pos & cap->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&cap->tail, &pos, pos + 1,
+			                                          memory_order_relaxed,
+			                                          memory_order_relaxed))
+				break;
+		} else if ((int32_t)(seq - pos) < 0) {
+			atomic_fetch_add_explicit(&cap->dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+		}
+	}
+
+	slot->iface = iface->id;
+	slot->lqi_is_ed = pDeviceRef->lqi_mode == HWME_LQIMODE_ED;
+	slot->len = (uint16_t)len;
+	slot->timestamp_ns = capture_time(pDeviceRef);
+	memcpy(slot->frame, buf, len);
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+/******************************************************************************/
+/****** Encoding                                                         ******/
+/******************************************************************************/
+
+/** Append an option or TLV with 16-bit type and length, padded to 4 octets */
+static uint8_t *put_tlv(uint8_t *p, uint16_t type, const void *value, uint16_t len)
+{
+	PUTLE16(type, p);
+	PUTLE16(len, p + 2);
+	if (len)
+		memcpy(p + 4, value, len);
+	memset(p + 4 + len, 0, PAD4(len) - len);
+	return p + 4 + PAD4(len);
+}
+
+static uint8_t *put_tlv_u8(uint8_t *p, uint16_t type, uint8_t value)
+{
+	return put_tlv(p, type, &value, 1);
+}
+
+/** RSS TLV from a CA-821X energy detect value */
+static uint8_t *put_rss(uint8_t *p, uint8_t ed)
+{
+	float dbm = ed / 2.0f - 128.0f;
+	uint32_t bits;
+	uint8_t le[4];
+
+	memcpy(&bits, &dbm, sizeof(bits));
+	PUTLE32(bits, le);
+	return put_tlv(p, TAP_RSS, le, 4);
+}
+
+/** Re-encode a data indication as an unsecured data frame without FCS */
+static uint8_t *put_data_frame(uint8_t *p, const struct MCPS_DATA_indication_pset *ind)
+{
+	struct ca821x_frame_hdr hdr;
+	int len;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.fc = MAC_FC_FT_DATA | MAC_FC_VER2006;
+#if CASCODA_CA_VER == 8211
+	if (ind->FramePending)
+		hdr.fc |= MAC_FC_FP;
+#endif
+	hdr.dsn = ind->DSN;
+	hdr.dst = ind->Dst;
+	hdr.src = ind->Src;
+	len = ca821x_frame_build(p, aMaxPHYPacketSize, &hdr, ind->Msdu, ind->MsduLength);
+	return len < 0 ? NULL : p + len;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Encode a queued frame as a TAP packet
+ *******************************************************************************
+ * \param cap - Capture
+ * \param slot - Queued frame
+ * \param out - Buffer of at least CAPTURE_PACKET_MAX octets
+ *******************************************************************************
+ * \return Length of the packet, or 0 if the frame is malformed
+ *******************************************************************************
+ ******************************************************************************/
+static size_t capture_encode(struct ca821x_capture *cap,
+                             const struct capture_slot *slot, uint8_t *out)
+{
+	const uint8_t *pset = slot->frame + 2;
+	size_t plen;
+	const uint8_t *psdu = NULL;
+	uint8_t psdu_len = 0, ed = 0, lqi = 0, chan[3];
+	int have_ed = 0;
+	uint8_t *p = out + 4;
+
+	if (slot->len < 2)
+		return 0;
+	plen = slot->len - 2;
+	if (slot->frame[1] < plen)
+		plen = slot->frame[1];
+
+	switch (slot->frame[0]) {
+	case SPI_MCPS_DATA_INDICATION: {
+		const struct MCPS_DATA_indication_pset *ind = (const void *)pset;
+		if (plen < offsetof(struct MCPS_DATA_indication_pset, Msdu) ||
+		    plen < offsetof(struct MCPS_DATA_indication_pset, Msdu) + ind->MsduLength ||
+		    ind->MsduLength > MAX_DATA_SIZE)
+			return 0;
+		lqi = ind->MpduLinkQuality;
+		have_ed = slot->lqi_is_ed;
+		ed = lqi;
+		p = put_tlv_u8(p, TAP_FCS_TYPE, TAP_FCS_NONE);
+		break;
+	}
+#if CASCODA_CA_VER >= 8211
+	case SPI_PCPS_DATA_INDICATION: {
+		const struct PCPS_DATA_indication_pset *ind = (const void *)pset;
+		if (plen < 3 || plen < 3u + ind->PsduLength ||
+		    ind->PsduLength > aMaxPHYPacketSize)
+			return 0;
+		lqi = ind->CS;
+		ed = ind->ED;
+		have_ed = 1;
+		psdu = ind->Psdu;
+		psdu_len = ind->PsduLength;
+		p = put_tlv_u8(p, TAP_FCS_TYPE, TAP_FCS_16BIT);
+		break;
+	}
+#endif
+	case SPI_TDME_RXPKT_INDICATION: {
+		const struct TDME_RXPKT_indication_pset *ind = (const void *)pset;
+		if (plen < 5 || plen < 5u + ind->TestPacketLength ||
+		    ind->TestPacketLength > aMaxPHYPacketSize)
+			return 0;
+		lqi = ind->TestPacketCSValue;
+		ed = ind->TestPacketEDValue;
+		have_ed = 1;
+		psdu = ind->TestPacketData;
+		psdu_len = ind->TestPacketLength;
+		p = put_tlv_u8(p, TAP_FCS_TYPE, TAP_FCS_16BIT);
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	if (have_ed)
+		p = put_rss(p, ed);
+	if (cap->config.channel) {
+		chan[0] = cap->config.channel;
+		chan[1] = 0;
+		chan[2] = 0; /* Channel page */
+		p = put_tlv(p, TAP_CHANNEL, chan, 3);
+	}
+	if (!have_ed || psdu)
+		p = put_tlv_u8(p, TAP_LQI, lqi);
+
+	/* TAP header: version, reserved, length including TLVs */
+	out[0] = 0;
+	out[1] = 0;
+	PUTLE16((uint16_t)(p - out), out + 2);
+
+	if (psdu) {
+		memcpy(p, psdu, psdu_len);
+		p += psdu_len;
+	} else {
+		p = put_data_frame(p, (const struct MCPS_DATA_indication_pset *)pset);
+		if (!p)
+			return 0;
+	}
+	return (size_t)(p - out);
+}
+
+/******************************************************************************/
+/****** File output                                                      ******/
+/******************************************************************************/
+
+static void capture_set_error(struct ca821x_capture *cap, int error)
+{
+	pthread_mutex_lock(&cap->lock);
+	if (!cap->error)
+		cap->error = error;
+	pthread_mutex_unlock(&cap->lock);
+	if (cap->file) {
+		fclose(cap->file);
+		cap->file = NULL;
+	}
+}
+
+/** Write a pcapng block with the given body, padding it to 4 octets */
+static int capture_write_block(struct ca821x_capture *cap, uint32_t type,
+                               const uint8_t *body, size_t len)
+{
+	static const uint8_t pad[3];
+	uint32_t total = (uint32_t)(12 + PAD4(len));
+	uint8_t head[8], tail[4];
+
+	if (!cap->file)
+		return -1;
+	PUTLE32(type, head);
+	PUTLE32(total, head + 4);
+	PUTLE32(total, tail);
+	if (fwrite(head, 1, 8, cap->file) != 8 ||
+	    fwrite(body, 1, len, cap->file) != len ||
+	    fwrite(pad, 1, PAD4(len) - len, cap->file) != PAD4(len) - len ||
+	    fwrite(tail, 1, 4, cap->file) != 4) {
+		capture_set_error(cap, errno ? errno : EIO);
+		return -1;
+	}
+	cap->file_bytes += total;
+	pthread_mutex_lock(&cap->lock);
+	cap->bytes += total;
+	pthread_mutex_unlock(&cap->lock);
+	return 0;
+}
+
+static int capture_write_shb(struct ca821x_capture *cap)
+{
+	static const char appl[] = "ca821x-api";
+	uint8_t body[16 + 4 + PAD4(sizeof(appl) - 1) + 4], *p = body;
+
+	PUTLE32(0x1A2B3C4D, p);           /* Byte order magic */
+	PUTLE16(1, p + 4);                /* Major version */
+	PUTLE16(0, p + 6);                /* Minor version */
+	memset(p + 8, 0xFF, 8);           /* Section length unspecified */
+	p = put_tlv(p + 16, PCAPNG_SHB_USERAPPL, appl, sizeof(appl) - 1);
+	p = put_tlv(p, PCAPNG_OPT_END, NULL, 0);
+	return capture_write_block(cap, PCAPNG_SHB, body, (size_t)(p - body));
+}
+
+static int capture_write_idb(struct ca821x_capture *cap, uint8_t iface)
+{
+	char name[16];
+	uint8_t body[8 + 4 + 16 + 8 + 4], *p = body;
+	int len = snprintf(name, sizeof(name), "ca821x%u", iface);
+
+	PUTLE16(CA821X_CAPTURE_LINKTYPE, p);
+	PUTLE16(0, p + 2);
+	PUTLE32(0, p + 4);                /* No snapshot length limit */
+	p = put_tlv(p + 8, PCAPNG_IF_NAME, name, (uint16_t)len);
+	p = put_tlv_u8(p, PCAPNG_IF_TSRESOL, 9); /* Nanoseconds */
+	p = put_tlv(p, PCAPNG_OPT_END, NULL, 0);
+	if (capture_write_block(cap, PCAPNG_IDB, body, (size_t)(p - body)))
+		return -1;
+	cap->idb_written |= 1u << iface;
+	return 0;
+}
+
+/** Name of the file with the given rotation index */
+static void capture_file_name(struct ca821x_capture *cap, unsigned index, char *name)
+{
+	const char *slash = strrchr(cap->path, '/');
+	const char *dot = strrchr(cap->path, '.');
+
+	if (!cap->config.rotate_bytes && !cap->config.rotate_seconds) {
+		strcpy(name, cap->path);
+		return;
+	}
+	if (!dot || (slash && dot < slash))
+		dot = cap->path + strlen(cap->path);
+	sprintf(name, "%.*s_%05u%s", (int)(dot - cap->path), cap->path, index, dot);
+}
+
+/** Close the current file, if any, and start the next one */
+static int capture_next_file(struct ca821x_capture *cap)
+{
+	char *name = cap->name;
+
+	if (cap->file && fclose(cap->file)) {
+		cap->file = NULL;
+		capture_set_error(cap, errno);
+		return -1;
+	}
+	capture_file_name(cap, cap->file_index, name);
+	cap->file = fopen(name, "wb");
+	if (!cap->file) {
+		capture_set_error(cap, errno);
+		return -1;
+	}
+	setvbuf(cap->file, cap->buffer, _IOFBF, CA821X_CAPTURE_BUFFER_SIZE);
+	cap->file_bytes = 0;
+	cap->file_packets = 0;
+	cap->idb_written = 0;
+	clock_gettime(CLOCK_MONOTONIC, &cap->file_start);
+	pthread_mutex_lock(&cap->lock);
+	cap->files++;
+	pthread_mutex_unlock(&cap->lock);
+
+	if (cap->config.max_files && cap->file_index >= cap->config.max_files) {
+		capture_file_name(cap, cap->file_index - cap->config.max_files, name);
+		remove(name);
+	}
+	cap->file_index++;
+	return capture_write_shb(cap);
+}
+
+/** Whether the next packet of the given block size belongs in a new file */
+static int capture_should_rotate(struct ca821x_capture *cap, size_t block)
+{
+	struct timespec now;
+
+	if (!cap->file_packets)
+		return 0;
+	if (cap->config.rotate_bytes &&
+	    cap->file_bytes + block > cap->config.rotate_bytes)
+		return 1;
+	if (cap->config.rotate_seconds) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - cap->file_start.tv_sec >= (time_t)cap->config.rotate_seconds)
+			return 1;
+	}
+	return 0;
+}
+
+static int capture_write_packet(struct ca821x_capture *cap,
+                                const struct capture_slot *slot)
+{
+	uint8_t body[20 + CAPTURE_PACKET_MAX];
+	size_t len = capture_encode(cap, slot, body + 20);
+
+	if (!len)
+		return -1;
+	if (capture_should_rotate(cap, 12 + 20 + PAD4(len)) && capture_next_file(cap))
+		return -1;
+	if (!(cap->idb_written & (1u << slot->iface)) &&
+	    capture_write_idb(cap, slot->iface))
+		return -1;
+
+	PUTLE32(slot->iface, body);
+	PUTLE32((uint32_t)(slot->timestamp_ns >> 32), body + 4);
+	PUTLE32((uint32_t)slot->timestamp_ns, body + 8);
+	PUTLE32((uint32_t)len, body + 12);
+	PUTLE32((uint32_t)len, body + 16);
+	if (capture_write_block(cap, PCAPNG_EPB, body, 20 + len))
+		return -1;
+	cap->file_packets++;
+	return 0;
+}
+
+/** Write every frame in the queue, returning the number consumed */
+static unsigned capture_drain(struct ca821x_capture *cap)
+{
+	unsigned consumed = 0, written = 0;
+
+	for (;;) {
+		struct capture_slot *slot = &cap->slots[cap->head & cap->mask];
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+		if (seq != cap->head + 1)
+			break;
+		if (!capture_write_packet(cap, slot))
+			written++;
+		atomic_store_explicit(&slot->seq, cap->head + cap->mask + 1,
+		                      memory_order_release);
+		cap->head++;
+		consumed++;
+	}
+	if (consumed) {
+		pthread_mutex_lock(&cap->lock);
+		cap->frames += written;
+		cap->write_dropped += consumed - written;
+		pthread_mutex_unlock(&cap->lock);
+	}
+	return consumed;
+}
+
+static void *capture_writer(void *arg)
+{
+	struct ca821x_capture *cap = arg;
+	struct timespec until;
+	unsigned req;
+
+	pthread_mutex_lock(&cap->lock);
+	for (;;) {
+		req = cap->flush_req;
+		pthread_mutex_unlock(&cap->lock);
+		while (capture_drain(cap))
+			;
+		if (req != cap->flush_done && cap->file && fflush(cap->file))
+			capture_set_error(cap, errno);
+
+		pthread_mutex_lock(&cap->lock);
+		if (req != cap->flush_done) {
+			cap->flush_done = req;
+			pthread_cond_broadcast(&cap->flushed);
+		}
+		if (cap->stop)
+			break;
+		if (req == cap->flush_req) {
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += CA821X_CAPTURE_IDLE_MS * 1000000L;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&cap->wake, &cap->lock, &until);
+		}
+	}
+	pthread_mutex_unlock(&cap->lock);
+
+	while (capture_drain(cap))
+		;
+	return NULL;
+}
+
+/******************************************************************************/
+/****** Public API                                                       ******/
+/******************************************************************************/
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Open a capture file and start its writer
+ *******************************************************************************
+ * \param config - Capture configuration, copied
+ *******************************************************************************
+ * \return The capture, or NULL with errno set if the configuration is invalid
+ *         or the file could not be created
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_capture *ca821x_capture_open(
+	const struct ca821x_capture_config *config
+)
+{
+	struct ca821x_capture *cap;
+	unsigned queue_len = config->queue_len ? config->queue_len :
+	                                         CA821X_CAPTURE_DEF_QUEUE_LEN;
+	unsigned i;
+	int error;
+
+	if (!config->path || (queue_len & (queue_len - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+	cap->config = *config;
+	cap->config.queue_len = queue_len;
+	cap->path = strdup(config->path);
+	cap->name = malloc(strlen(config->path) + 16);
+	cap->slots = calloc(queue_len, sizeof(*cap->slots));
+	cap->buffer = malloc(CA821X_CAPTURE_BUFFER_SIZE);
+	if (!cap->path || !cap->name || !cap->slots || !cap->buffer)
+		goto fail;
+	cap->config.path = cap->path;
+	cap->mask = queue_len - 1;
+	for (i = 0; i < queue_len; i++)
+		atomic_init(&cap->slots[i].seq, i);
+	atomic_init(&cap->tail, 0);
+	atomic_init(&cap->dropped, 0);
+	pthread_mutex_init(&cap->lock, NULL);
+	pthread_cond_init(&cap->wake, NULL);
+	pthread_cond_init(&cap->flushed, NULL);
+
+	if (capture_next_file(cap)) {
+		errno = cap->error;
+		goto fail_sync;
+	}
+	error = pthread_create(&cap->thread, NULL, capture_writer, cap);
+	if (error) {
+		fclose(cap->file);
+		errno = error;
+		goto fail_sync;
+	}
+	return cap;
+
+fail_sync:
+	error = errno;
+	pthread_cond_destroy(&cap->flushed);
+	pthread_cond_destroy(&cap->wake);
+	pthread_mutex_destroy(&cap->lock);
+	errno = error;
+fail:
+	error = errno;
+	free(cap->buffer);
+	free(cap->slots);
+	free(cap->name);
+	free(cap->path);
+	free(cap);
+	errno = error;
+	return NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Start capturing the frames received by a device
+ *******************************************************************************
+ * Registers a tap (see ca821x_register_tap), so must not be called while the
+ * exchange may be dispatching frames to the device.
+ *******************************************************************************
+ * \param cap - Capture
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return pcapng interface id of the device, or -ENOSPC if
+ *         CA821X_CAPTURE_MAX_IFACES devices have already been attached
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_capture_attach(struct ca821x_capture *cap, struct ca821x_dev *pDeviceRef)
+{
+	struct capture_iface *iface;
+
+	if (cap->num_ifaces >= CA821X_CAPTURE_MAX_IFACES)
+		return -ENOSPC;
+	iface = &cap->ifaces[cap->num_ifaces];
+	iface->cap = cap;
+	iface->dev = pDeviceRef;
+	iface->id = (uint8_t)cap->num_ifaces;
+	iface->tap.callback = capture_tap;
+	iface->tap.context = iface;
+	ca821x_register_tap(&iface->tap, pDeviceRef);
+	return (int)cap->num_ifaces++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Stop capturing the frames received by a device
+ *******************************************************************************
+ * Frames already queued are still written. Its interface id is not reused.
+ *******************************************************************************
+ * \param cap - Capture
+ * \param pDeviceRef - Device previously passed to ca821x_capture_attach
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_capture_detach(struct ca821x_capture *cap, struct ca821x_dev *pDeviceRef)
+{
+	unsigned i;
+
+	for (i = 0; i < cap->num_ifaces; i++) {
+		if (cap->ifaces[i].dev == pDeviceRef) {
+			ca821x_unregister_tap(&cap->ifaces[i].tap, pDeviceRef);
+			cap->ifaces[i].dev = NULL;
+		}
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Wait until every frame queued so far is written to the file
+ *******************************************************************************
+ * Blocks the caller, so must not be called from a callback or tap.
+ *******************************************************************************
+ * \param cap - Capture
+ *******************************************************************************
+ * \return 0, or the negated errno of the first write error
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_capture_flush(struct ca821x_capture *cap)
+{
+	unsigned req;
+	int error;
+
+	pthread_mutex_lock(&cap->lock);
+	req = ++cap->flush_req;
+	pthread_cond_signal(&cap->wake);
+	while ((int)(cap->flush_done - req) < 0)
+		pthread_cond_wait(&cap->flushed, &cap->lock);
+	error = cap->error;
+	pthread_mutex_unlock(&cap->lock);
+	return -error;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Read the counters of a capture
+ *******************************************************************************
+ * \param cap - Capture
+ * \param stats - Receives the counters
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_capture_get_stats(struct ca821x_capture *cap,
+                              struct ca821x_capture_stats *stats)
+{
+	pthread_mutex_lock(&cap->lock);
+	stats->frames = cap->frames;
+	stats->dropped = cap->write_dropped;
+	stats->bytes = cap->bytes;
+	stats->files = cap->files;
+	stats->error = cap->error;
+	pthread_mutex_unlock(&cap->lock);
+	stats->dropped += atomic_load_explicit(&cap->dropped, memory_order_relaxed);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Detach all devices, write the remaining frames and close a capture
+ *******************************************************************************
+ * Must not be called while the exchange may be dispatching frames to an
+ * attached device.
+ *******************************************************************************
+ * \param cap - Capture to close, freed on return
+ *******************************************************************************
+ * \return 0, or the negated errno of the first write error
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_capture_close(struct ca821x_capture *cap)
+{
+	unsigned i;
+	int error;
+
+	for (i = 0; i < cap->num_ifaces; i++) {
+		if (cap->ifaces[i].dev)
+			ca821x_capture_detach(cap, cap->ifaces[i].dev);
+	}
+
+	pthread_mutex_lock(&cap->lock);
+	cap->stop = 1;
+	pthread_cond_signal(&cap->wake);
+	pthread_mutex_unlock(&cap->lock);
+	pthread_join(cap->thread, NULL);
+
+	if (cap->file && fclose(cap->file) && !cap->error)
+		cap->error = errno;
+	error = cap->error;
+
+	pthread_cond_destroy(&cap->flushed);
+	pthread_cond_destroy(&cap->wake);
+	pthread_mutex_destroy(&cap->lock);
+	free(cap->buffer);
+	free(cap->slots);
+	free(cap->name);
+	free(cap->path);
+	free(cap);
+	return -error;
+}
@@ -0,0 +1,420 @@
+/**
+ * @file ca821x_replay.c
+ * @brief Replay of recorded ca821x traffic into an application.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ca821x_api.h"
+#include "ca821x_replay.h"
+#include "ca821x_store.h"
+#include "ca821x_sync_stats.h"
+#include "ca821x_trace.h"
+#include "mac_messages.h"
+
+/** Longest frame: command id, length and parameters */
+#define REPLAY_FRAME_MAX        (2 + 255)
+
+struct replay_entry {
+	uint64_t timestamp_ns;
+	size_t   offset; /**< Of the frame in the arena */
+	uint32_t order;  /**< Insertion order, keeps equal timestamps stable */
+	uint16_t len;
+	uint8_t  dir;
+};
+
+struct ca821x_replay {
+	struct replay_entry *entries;
+	size_t               num, cap;
+	uint8_t             *arena;
+	size_t               arena_len, arena_cap;
+	int                  sorted;
+	/** Callback latencies by command id, allocated on the first frame */
+	struct ca821x_replay_latency *latency[256];
+};
+
+static void record_latency(
+	struct ca821x_replay *replay,
+	uint8_t               cmdid,
+	uint64_t              latency_ns,
+	int                   failed
+)
+{
+	struct ca821x_replay_latency *l = replay->latency[cmdid];
+
+	if (!l) {
+		/* Out of memory loses the sample rather than the replay */
+		l = replay->latency[cmdid] = calloc(1, sizeof(*l));
+		if (!l)
+			return;
+	}
+	if (latency_ns > UINT32_MAX)
+		latency_ns = UINT32_MAX;
+	l->buckets[ca821x_sync_stats_bucket(latency_ns)]++;
+	l->count++;
+	if (latency_ns > l->max_ns)
+		l->max_ns = latency_ns;
+	if (failed)
+		l->errors++;
+}
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(ns / 1000000000ULL);
+	ts.tv_nsec = (long)(ns % 1000000000ULL);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct replay_entry *x = a, *y = b;
+
+	if (x->timestamp_ns != y->timestamp_ns)
+		return x->timestamp_ns < y->timestamp_ns ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Create an empty replay
+ *******************************************************************************
+ * \return The replay, or NULL if out of memory
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_replay *ca821x_replay_create(void)
+{
+	struct ca821x_replay *replay = calloc(1, sizeof(*replay));
+
+	if (replay)
+		replay->sorted = 1;
+	return replay;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Free a replay and its frames
+ *******************************************************************************
+ * \param replay - Replay to free
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_replay_destroy(struct ca821x_replay *replay)
+{
+	unsigned id;
+
+	for (id = 0; id < 256; id++)
+		free(replay->latency[id]);
+	free(replay->entries);
+	free(replay->arena);
+	free(replay);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Add a recorded frame to a replay
+ *******************************************************************************
+ * Frames may be added in any order. Synchronous responses are ignored, as
+ * the exchange produces them again.
+ *******************************************************************************
+ * \param replay - Replay
+ * \param timestamp_ns - Time the frame was recorded
+ * \param dir - Direction of the frame
+ * \param buf - Frame, from the command id
+ * \param len - Length of the frame
+ *******************************************************************************
+ * \return 0, -EINVAL for an oversized frame, or -ENOMEM
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_replay_add(
+	struct ca821x_replay  *replay,
+	uint64_t               timestamp_ns,
+	enum ca821x_trace_dir  dir,
+	const uint8_t         *buf,
+	size_t                 len
+)
+{
+	struct replay_entry *e;
+
+	if (len < 2 || len > REPLAY_FRAME_MAX)
+		return -EINVAL;
+	if (dir == CA821X_TRACE_RESPONSE)
+		return 0;
+	if (replay->num == replay->cap) {
+		size_t cap = replay->cap ? replay->cap * 2 : 256;
+		e = realloc(replay->entries, cap * sizeof(*e));
+		if (!e)
+			return -ENOMEM;
+		replay->entries = e;
+		replay->cap = cap;
+	}
+	if (replay->arena_len + len > replay->arena_cap) {
+		size_t cap = replay->arena_cap ? replay->arena_cap * 2 : 16384;
+		uint8_t *arena = realloc(replay->arena, cap);
+		if (!arena)
+			return -ENOMEM;
+		replay->arena = arena;
+		replay->arena_cap = cap;
+	}
+
+	e = &replay->entries[replay->num];
+	e->timestamp_ns = timestamp_ns;
+	e->offset = replay->arena_len;
+	e->order = (uint32_t)replay->num;
+	e->len = (uint16_t)len;
+	e->dir = (uint8_t)dir;
+	memcpy(replay->arena + replay->arena_len, buf, len);
+	replay->arena_len += len;
+	if (replay->num && timestamp_ns < e[-1].timestamp_ns)
+		replay->sorted = 0;
+	replay->num++;
+	return 0;
+}
+
+struct load_context {
+	struct ca821x_replay *replay;
+	int                   added;
+	int                   error;
+};
+
+static int load_store_frame(const struct ca821x_store_frame *frame, void *context)
+{
+	struct load_context *ctx = context;
+
+	ctx->error = ca821x_replay_add(ctx->replay, frame->timestamp_ns,
+	                               CA821X_TRACE_UPSTREAM, frame->buf, frame->len);
+	if (!ctx->error)
+		ctx->added++;
+	return ctx->error == -ENOMEM;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Add the frames of a capture store to a replay
+ *******************************************************************************
+ * \param replay - Replay
+ * \param dir - Directory of the store
+ * \param query - Frames to add, or NULL for all
+ *******************************************************************************
+ * \return Number of frames added, or negative errno
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_replay_load_store(
+	struct ca821x_replay            *replay,
+	const char                      *dir,
+	const struct ca821x_store_query *query
+)
+{
+	struct load_context ctx = {replay, 0, 0};
+	struct ca821x_store_query all;
+	int ret;
+
+	if (!query) {
+		memset(&all, 0, sizeof(all));
+		query = &all;
+	}
+	ret = ca821x_store_query(dir, query, load_store_frame, &ctx, NULL);
+	if (ret < 0)
+		return ret;
+	return ctx.error == -ENOMEM ? -ENOMEM : ctx.added;
+}
+
+static void load_trace_record(const struct ca821x_trace_record *record, void *context)
+{
+	struct load_context *ctx = context;
+
+	int ret;
+
+	if (ctx->error || record->caplen < record->len)
+		return;
+	ret = ca821x_replay_add(ctx->replay, record->timestamp_ns,
+	                        (enum ca821x_trace_dir)record->dir,
+	                        record->data, record->caplen);
+	if (ret == -ENOMEM)
+		ctx->error = ret;
+	else if (!ret && record->dir != CA821X_TRACE_RESPONSE)
+		ctx->added++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Add the frames held in a trace ring to a replay
+ *******************************************************************************
+ * Frames truncated to CA821X_TRACE_SNAPLEN are skipped, since they cannot be
+ * reproduced.
+ *******************************************************************************
+ * \param replay - Replay
+ * \param trace - Trace to copy from
+ *******************************************************************************
+ * \return Number of frames added, or negative errno
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_replay_load_trace(struct ca821x_replay *replay, struct ca821x_trace *trace)
+{
+	struct load_context ctx = {replay, 0, 0};
+
+	ca821x_trace_dump(trace, load_trace_record, &ctx);
+	return ctx.error ? ctx.error : ctx.added;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Number of frames in a replay
+ *******************************************************************************
+ * \param replay - Replay
+ *******************************************************************************
+ * \return Number of upstream and downstream frames held
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_replay_len(struct ca821x_replay *replay)
+{
+	return replay->num;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Replay every frame into a device
+ *******************************************************************************
+ * The first frame is replayed immediately, and each later frame when its
+ * offset from the first, divided by the speed, has elapsed. Frames that fall
+ * behind schedule are replayed without waiting. A replay can be run any
+ * number of times; with config->record_latency set, each run starts its
+ * latency histograms afresh.
+ *******************************************************************************
+ * \param replay - Replay
+ * \param config - Replay options
+ * \param stats - Receives the outcome, or NULL
+ * \param pDeviceRef - Device to replay into, with callbacks registered
+ *******************************************************************************
+ * \return 0, or -EINVAL for a negative speed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_replay_run(
+	struct ca821x_replay              *replay,
+	const struct ca821x_replay_config *config,
+	struct ca821x_replay_stats        *stats,
+	struct ca821x_dev                 *pDeviceRef
+)
+{
+	struct ca821x_replay_stats local;
+	struct MAC_Message response;
+	uint8_t frame[REPLAY_FRAME_MAX];
+	uint64_t start, base, due, now, done;
+	size_t i;
+	int ret;
+
+	if (config->speed < 0)
+		return -EINVAL;
+	if (!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+	if (config->record_latency) {
+		for (i = 0; i < 256; i++) {
+			if (replay->latency[i])
+				memset(replay->latency[i], 0, sizeof(*replay->latency[i]));
+		}
+	}
+	if (!replay->sorted) {
+		qsort(replay->entries, replay->num, sizeof(*replay->entries),
+		      compare_entries);
+		replay->sorted = 1;
+	}
+
+	start = mono_ns();
+	base = replay->num ? replay->entries[0].timestamp_ns : 0;
+	for (i = 0; i < replay->num; i++) {
+		const struct replay_entry *e = &replay->entries[i];
+
+		if (config->speed > 0) {
+			due = start + (uint64_t)((e->timestamp_ns - base) / config->speed);
+			now = mono_ns();
+			if (now < due) {
+				sleep_until(due);
+				now = mono_ns();
+			}
+			if (now - due > stats->max_lateness_ns)
+				stats->max_lateness_ns = now - due;
+		}
+
+		/* Dispatch may rewrite the frame, so work on a copy */
+		memcpy(frame, replay->arena + e->offset, e->len);
+		if (e->dir == CA821X_TRACE_DOWNSTREAM) {
+			stats->downstream++;
+			if (!pDeviceRef->ca821x_api_downstream ||
+			    pDeviceRef->ca821x_api_downstream(
+			        frame, e->len, (frame[0] & SPI_SYN) ? &response.CommandId : NULL,
+			        pDeviceRef))
+				stats->errors++;
+			continue;
+		}
+
+		now = mono_ns();
+		ret = ca821x_downstream_dispatch(frame, e->len, pDeviceRef);
+		done = mono_ns();
+		stats->upstream++;
+		if (ret < 0)
+			stats->errors++;
+		if (config->record_latency)
+			record_latency(replay, replay->arena[e->offset], done - now, ret < 0);
+	}
+
+	stats->elapsed_ns = mono_ns() - start;
+	if (stats->elapsed_ns)
+		stats->upstream_per_sec = stats->upstream * 1e9 / stats->elapsed_ns;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Callback latencies of one command id in the last recorded run
+ *******************************************************************************
+ * \param replay - Replay run with config->record_latency set
+ * \param cmdid - Command id of the upstream frames
+ * \param latency - Receives the latencies, or NULL
+ *******************************************************************************
+ * \return Number of frames of cmdid timed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_replay_latency(
+	struct ca821x_replay         *replay,
+	uint8_t                       cmdid,
+	struct ca821x_replay_latency *latency
+)
+{
+	const struct ca821x_replay_latency *l = replay->latency[cmdid];
+
+	if (latency) {
+		if (l)
+			*latency = *l;
+		else
+			memset(latency, 0, sizeof(*latency));
+	}
+	return l ? (int)l->count : 0;
+}
@@ -0,0 +1,848 @@
+/**
+ * @file ca821x_store.c
+ * @brief Append-only, indexed store of the frames received by ca821x devices.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+#include "ca821x_frame.h"
+#include "ca821x_store.h"
+#include "mac_messages.h"
+
+#ifndef CA821X_HAVE_ATOMICS
+#error "ca821x-capture requires C11 atomics"
+#endif
+
+#define STORE_MAGIC             "CA821XS1"
+/** Space reserved for the segment header */
+#define STORE_HEADER_SIZE       (4096)
+/** 64-bit words in the address bloom filter of a segment (4096 bits) */
+#define STORE_SEG_BLOOM_WORDS   (64)
+/** 64-bit words in the address bloom filter of a block (512 bits) */
+#define STORE_BLOCK_BLOOM_WORDS (8)
+#define STORE_ALIGN(x)          (((x) + 7) & ~(size_t)7)
+/** File of the spare segment, not a segment name so queries skip it */
+#define STORE_SPARE_NAME        "spare.tmp"
+
+/** Header at the start of each segment file */
+struct store_seg_header {
+	char     magic[8];
+	uint32_t header_size;
+	uint32_t segment_size;
+	uint64_t seq;
+	uint64_t min_ts;
+	uint64_t max_ts;
+	uint32_t data_end;  /**< End of the committed records */
+	uint32_t records;
+	uint32_t blocks;    /**< Index entries in use */
+	uint32_t sealed;    /**< Nonzero once the writer moved on */
+	uint64_t bloom[STORE_SEG_BLOOM_WORDS];
+};
+
+/** Sparse index entry, stored backwards from the end of the segment */
+struct store_block {
+	uint64_t min_ts;
+	uint64_t max_ts;
+	uint32_t offset;    /**< First record of the block */
+	uint32_t count;
+	uint64_t bloom[STORE_BLOCK_BLOOM_WORDS];
+};
+
+/** Header of each record, followed by the frame and padding to 8 octets */
+struct store_record {
+	uint64_t timestamp_ns;
+	uint16_t len;
+	uint8_t  iface;
+	uint8_t  reserved[5];
+};
+
+/** An attached device */
+struct store_iface {
+	struct ca821x_tap    tap;
+	struct ca821x_store *store;
+	struct ca821x_dev   *dev;
+	uint8_t              id;
+};
+
+struct ca821x_store {
+	char                    *dir;
+	char                    *name;  /**< Scratch for file names */
+	uint32_t                 segment_size;
+	unsigned                 max_segments;
+	pthread_mutex_t          lock;
+
+	int                      fd;
+	uint8_t                 *map;
+	struct store_seg_header *hdr;
+	uint64_t                 next_seq;
+	uint64_t                 oldest_seq;
+
+	/* Next segment, created ahead of time outside the lock */
+	char                    *spare_name;
+	enum {
+		SPARE_NONE,      /**< Prepare one once the segment is half full */
+		SPARE_PREPARING, /**< An append is preparing one */
+		SPARE_READY,     /**< spare_fd and spare_map hold one */
+		SPARE_FAILED     /**< Preparing failed, retry after the next segment */
+	}                        spare;
+	int                      spare_fd;
+	uint8_t                 *spare_map;
+
+	struct store_iface       ifaces[CA821X_STORE_MAX_IFACES];
+	unsigned                 num_ifaces;
+};
+
+/******************************************************************************/
+/****** Addresses and bloom filters                                      ******/
+/******************************************************************************/
+
+/** Key of an address for the bloom filters, 0 for none */
+static uint64_t addr_key(const struct FullAddr *addr)
+{
+	uint64_t key = 0;
+	int i;
+
+	if (addr->AddressMode == MAC_MODE_SHORT_ADDR)
+		return (1ULL << 63) | ((uint64_t)GETLE16(addr->PANId) << 16) |
+		       GETLE16(addr->Address);
+	if (addr->AddressMode != MAC_MODE_LONG_ADDR)
+		return 0;
+	for (i = 7; i >= 0; i--)
+		key = (key << 8) | addr->Address[i];
+	return key | 1; /* Never 0 */
+}
+
+static uint64_t key_hash(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xBF58476D1CE4E5B9ULL;
+	key ^= key >> 27;
+	key *= 0x94D049BB133111EBULL;
+	return key ^ (key >> 31);
+}
+
+/** Set k bits of a bloom filter of words 64-bit words, taken from a hash */
+static void bloom_add(uint64_t *bloom, unsigned words, unsigned k, uint64_t h)
+{
+	unsigned i, bit;
+
+	for (i = 0; i < k; i++) {
+		bit = (unsigned)(h >> (16 * i)) & (words * 64 - 1);
+		bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+static int bloom_has(const uint64_t *bloom, unsigned words, unsigned k, uint64_t h)
+{
+	unsigned i, bit;
+
+	for (i = 0; i < k; i++) {
+		bit = (unsigned)(h >> (16 * i)) & (words * 64 - 1);
+		if (!(bloom[bit / 64] & (1ULL << (bit % 64))))
+			return 0;
+	}
+	return 1;
+}
+
+static int addr_equal(const struct FullAddr *a, const struct FullAddr *b)
+{
+	if (a->AddressMode != b->AddressMode)
+		return 0;
+	if (a->AddressMode == MAC_MODE_SHORT_ADDR)
+		return !memcmp(a->PANId, b->PANId, 2) && !memcmp(a->Address, b->Address, 2);
+	if (a->AddressMode == MAC_MODE_LONG_ADDR)
+		return !memcmp(a->Address, b->Address, 8);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Source and destination addresses of a stored frame
+ *******************************************************************************
+ * \param frame - Stored frame
+ * \param src - Receives the source address
+ * \param dst - Receives the destination address
+ *******************************************************************************
+ * \return 0: frame is an MCPS-DATA.indication, or a PCPS-DATA.indication of a
+ *         well-formed MAC frame, and the addresses were read<br>
+ *         -EINVAL: frame carries no addresses
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_store_frame_addrs(
+	const struct ca821x_store_frame *frame,
+	struct FullAddr                 *src,
+	struct FullAddr                 *dst
+)
+{
+	const struct MCPS_DATA_indication_pset *ind;
+
+#if CASCODA_CA_VER >= 8211
+	if (frame->len >= 2 + 3 && frame->buf[0] == SPI_PCPS_DATA_INDICATION) {
+		const struct PCPS_DATA_indication_pset *pind;
+		struct ca821x_frame mac;
+
+		pind = (const struct PCPS_DATA_indication_pset *)(frame->buf + 2);
+		if (frame->len < 2 + 3u + pind->PsduLength ||
+		    ca821x_frame_decode(&mac, pind->Psdu, pind->PsduLength, 1))
+			return -EINVAL;
+		ca821x_frame_get_addrs(&mac, src, dst);
+		return 0;
+	}
+#endif
+	if (frame->len < 2 + offsetof(struct MCPS_DATA_indication_pset, MsduLength) ||
+	    frame->buf[0] != SPI_MCPS_DATA_INDICATION)
+		return -EINVAL;
+	ind = (const struct MCPS_DATA_indication_pset *)(frame->buf + 2);
+	*src = ind->Src;
+	*dst = ind->Dst;
+	return 0;
+}
+
+/******************************************************************************/
+/****** Writing                                                          ******/
+/******************************************************************************/
+
+static void store_segment_name(struct ca821x_store *store, uint64_t seq)
+{
+	sprintf(store->name, "%s/%010llu.seg", store->dir, (unsigned long long)seq);
+}
+
+/** Parse a segment file name, returning 0 and its sequence number if valid */
+static int parse_segment_name(const char *name, uint64_t *seq)
+{
+	char *end;
+
+	if (name[0] < '0' || name[0] > '9')
+		return -1;
+	*seq = strtoull(name, &end, 10);
+	return strcmp(end, ".seg") ? -1 : 0;
+}
+
+static void store_unmap(struct ca821x_store *store)
+{
+	if (!store->map)
+		return;
+	store->hdr->sealed = 1;
+	munmap(store->map, store->segment_size);
+	close(store->fd);
+	store->map = NULL;
+	store->hdr = NULL;
+}
+
+/** Create and allocate a spare segment, called without the lock */
+static void store_prepare(struct ca821x_store *store)
+{
+	void *map = MAP_FAILED;
+	int fd;
+
+	fd = open(store->spare_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd >= 0 && !posix_fallocate(fd, 0, store->segment_size))
+		map = mmap(NULL, store->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		           fd, 0);
+	if (fd >= 0 && map == MAP_FAILED) {
+		close(fd);
+		unlink(store->spare_name);
+	}
+
+	pthread_mutex_lock(&store->lock);
+	if (map == MAP_FAILED) {
+		store->spare = SPARE_FAILED;
+	} else {
+		store->spare_fd = fd;
+		store->spare_map = map;
+		store->spare = SPARE_READY;
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+/** Remove the spare segment, if one is ready */
+static void store_drop_spare(struct ca821x_store *store)
+{
+	if (store->spare != SPARE_READY)
+		return;
+	munmap(store->spare_map, store->segment_size);
+	close(store->spare_fd);
+	unlink(store->spare_name);
+	store->spare = SPARE_NONE;
+}
+
+/** Seal the current segment and start the next, from the spare if one is
+ *  ready, else by creating it here */
+static int store_next_segment(struct ca821x_store *store)
+{
+	int fd, error;
+	void *map;
+
+	store_unmap(store);
+	store_segment_name(store, store->next_seq);
+	if (store->spare == SPARE_READY) {
+		if (!rename(store->spare_name, store->name)) {
+			fd = store->spare_fd;
+			map = store->spare_map;
+			store->spare = SPARE_NONE;
+			goto start;
+		}
+		store_drop_spare(store);
+	}
+	if (store->spare == SPARE_FAILED)
+		store->spare = SPARE_NONE;
+
+	fd = open(store->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+	/* Allocate up front, so running out of space fails here, not as SIGBUS */
+	error = posix_fallocate(fd, 0, store->segment_size);
+	if (!error) {
+		map = mmap(NULL, store->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		           fd, 0);
+		if (map == MAP_FAILED)
+			error = errno;
+	}
+	if (error) {
+		close(fd);
+		unlink(store->name);
+		return -error;
+	}
+
+start:
+	store->fd = fd;
+	store->map = map;
+	store->hdr = map;
+	memcpy(store->hdr->magic, STORE_MAGIC, 8);
+	store->hdr->header_size = STORE_HEADER_SIZE;
+	store->hdr->segment_size = store->segment_size;
+	store->hdr->seq = store->next_seq;
+	store->hdr->min_ts = UINT64_MAX;
+	store->hdr->data_end = STORE_HEADER_SIZE;
+	store->next_seq++;
+
+	while (store->max_segments && store->next_seq - store->oldest_seq > store->max_segments) {
+		store_segment_name(store, store->oldest_seq++);
+		unlink(store->name);
+	}
+	return 0;
+}
+
+/** Tap callback: append every dispatched frame */
+static void store_tap(const uint8_t *buf, size_t len, void *context,
+                      struct ca821x_dev *pDeviceRef)
+{
+	struct store_iface *iface = context;
+	struct timespec ts;
+	uint64_t now;
+
+	if (pDeviceRef->clock) {
+		now = ca821x_get_time_ns(pDeviceRef);
+	} else {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+	}
+	ca821x_store_append(iface->store, iface->id, buf, len, now);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Open a store for appending
+ *******************************************************************************
+ * Frames are appended to a new segment, after any already in the directory.
+ *******************************************************************************
+ * \param config - Store configuration, copied
+ *******************************************************************************
+ * \return The store, or NULL with errno set
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_store *ca821x_store_open(const struct ca821x_store_config *config)
+{
+	struct ca821x_store *store;
+	struct dirent *entry;
+	uint64_t seq;
+	DIR *dir;
+	int error;
+
+	if (!config->dir || (config->segment_size &&
+	    (config->segment_size % 4096 ||
+	     config->segment_size < CA821X_STORE_MIN_SEGMENT_SIZE))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (mkdir(config->dir, 0755) && errno != EEXIST)
+		return NULL;
+	dir = opendir(config->dir);
+	if (!dir)
+		return NULL;
+
+	store = calloc(1, sizeof(*store));
+	if (!store) {
+		closedir(dir);
+		return NULL;
+	}
+	store->oldest_seq = UINT64_MAX;
+	while ((entry = readdir(dir))) {
+		if (parse_segment_name(entry->d_name, &seq))
+			continue;
+		if (seq >= store->next_seq)
+			store->next_seq = seq + 1;
+		if (seq < store->oldest_seq)
+			store->oldest_seq = seq;
+	}
+	closedir(dir);
+	if (store->oldest_seq == UINT64_MAX)
+		store->oldest_seq = store->next_seq;
+
+	store->segment_size = config->segment_size ? config->segment_size :
+	                                             CA821X_STORE_DEF_SEGMENT_SIZE;
+	store->max_segments = config->max_segments;
+	store->dir = strdup(config->dir);
+	store->name = malloc(strlen(config->dir) + 32);
+	store->spare_name = malloc(strlen(config->dir) + sizeof(STORE_SPARE_NAME) + 1);
+	if (!store->dir || !store->name || !store->spare_name) {
+		error = ENOMEM;
+		goto fail;
+	}
+	/* Left by a store that was not closed */
+	sprintf(store->spare_name, "%s/" STORE_SPARE_NAME, config->dir);
+	unlink(store->spare_name);
+	error = -store_next_segment(store);
+	if (error)
+		goto fail;
+	pthread_mutex_init(&store->lock, NULL);
+	return store;
+
+fail:
+	free(store->spare_name);
+	free(store->name);
+	free(store->dir);
+	free(store);
+	errno = error;
+	return NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Append a frame to a store
+ *******************************************************************************
+ * Safe to call concurrently. Called by the tap of each attached device.
+ *
+ * The append that fills half of a segment also creates and allocates the
+ * file of the next one. It does so without holding the store's lock, so
+ * appends from other threads carry on meanwhile, but the call itself takes
+ * as long as the file system needs to allocate segment_size bytes. Starting
+ * the next segment is then only a rename. If the spare is not ready in
+ * time, the append that fills the segment creates the next one itself,
+ * holding the lock.
+ *******************************************************************************
+ * \param store - Store
+ * \param iface - Interface id recorded with the frame
+ * \param buf - Frame, from the command id
+ * \param len - Length of the frame
+ * \param timestamp_ns - Time of the frame
+ *******************************************************************************
+ * \return 0, or negative errno if a new segment could not be created
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_store_append(
+	struct ca821x_store *store,
+	uint8_t              iface,
+	const uint8_t       *buf,
+	size_t               len,
+	uint64_t             timestamp_ns
+)
+{
+	size_t size = STORE_ALIGN(sizeof(struct store_record) + len);
+	struct ca821x_store_frame frame = {timestamp_ns, iface, buf, len};
+	struct FullAddr src, dst;
+	struct store_seg_header *hdr;
+	struct store_record *rec;
+	struct store_block *block;
+	uint64_t keys[2];
+	unsigned num_keys = 0, i;
+	size_t index_size;
+	int new_block, prepare, error;
+
+	if (len > UINT16_MAX ||
+	    STORE_HEADER_SIZE + size + sizeof(*block) > store->segment_size)
+		return -EMSGSIZE;
+	if (!ca821x_store_frame_addrs(&frame, &src, &dst)) {
+		if ((keys[num_keys] = addr_key(&src)))
+			num_keys++;
+		if ((keys[num_keys] = addr_key(&dst)))
+			num_keys++;
+	}
+
+	pthread_mutex_lock(&store->lock);
+	for (;;) {
+		hdr = store->hdr;
+		if (hdr) {
+			new_block = hdr->records % CA821X_STORE_BLOCK_RECORDS == 0;
+			index_size = (hdr->blocks + new_block) * sizeof(*block);
+			if (hdr->data_end + size + index_size <= store->segment_size)
+				break;
+		}
+		error = store_next_segment(store);
+		if (error) {
+			pthread_mutex_unlock(&store->lock);
+			return error;
+		}
+	}
+
+	rec = (struct store_record *)(store->map + hdr->data_end);
+	rec->timestamp_ns = timestamp_ns;
+	rec->len = (uint16_t)len;
+	rec->iface = iface;
+	memset(rec->reserved, 0, sizeof(rec->reserved));
+	memcpy(rec + 1, buf, len);
+
+	/* Block i is the (i + 1)th entry from the end of the segment */
+	block = (struct store_block *)(store->map + store->segment_size) - hdr->blocks -
+	        new_block;
+	if (new_block) {
+		memset(block, 0, sizeof(*block));
+		block->min_ts = UINT64_MAX;
+		block->offset = hdr->data_end;
+	}
+	block->count++;
+	if (timestamp_ns < block->min_ts)
+		block->min_ts = timestamp_ns;
+	if (timestamp_ns > block->max_ts)
+		block->max_ts = timestamp_ns;
+	if (timestamp_ns < hdr->min_ts)
+		hdr->min_ts = timestamp_ns;
+	if (timestamp_ns > hdr->max_ts)
+		hdr->max_ts = timestamp_ns;
+	for (i = 0; i < num_keys; i++) {
+		uint64_t h = key_hash(keys[i]);
+		bloom_add(block->bloom, STORE_BLOCK_BLOOM_WORDS, 2, h);
+		bloom_add(hdr->bloom, STORE_SEG_BLOOM_WORDS, 3, h >> 8);
+	}
+
+	/* Publish the record to concurrent readers */
+	atomic_thread_fence(memory_order_release);
+	hdr->blocks += new_block;
+	hdr->records++;
+	hdr->data_end += (uint32_t)size;
+	prepare = store->spare == SPARE_NONE && hdr->data_end > store->segment_size / 2;
+	if (prepare)
+		store->spare = SPARE_PREPARING;
+	pthread_mutex_unlock(&store->lock);
+
+	if (prepare)
+		store_prepare(store);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Start storing the frames dispatched to a device
+ *******************************************************************************
+ * Registers a tap (see ca821x_register_tap), so must not be called while the
+ * exchange may be dispatching frames to the device. Frames are timestamped
+ * with the device clock if it has one, otherwise with UTC.
+ *******************************************************************************
+ * \param store - Store
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Interface id of the device, or -ENOSPC if CA821X_STORE_MAX_IFACES
+ *         devices have already been attached
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_store_attach(struct ca821x_store *store, struct ca821x_dev *pDeviceRef)
+{
+	struct store_iface *iface;
+
+	if (store->num_ifaces >= CA821X_STORE_MAX_IFACES)
+		return -ENOSPC;
+	iface = &store->ifaces[store->num_ifaces];
+	iface->store = store;
+	iface->dev = pDeviceRef;
+	iface->id = (uint8_t)store->num_ifaces;
+	iface->tap.callback = store_tap;
+	iface->tap.context = iface;
+	ca821x_register_tap(&iface->tap, pDeviceRef);
+	return (int)store->num_ifaces++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Stop storing the frames dispatched to a device
+ *******************************************************************************
+ * \param store - Store
+ * \param pDeviceRef - Device previously passed to ca821x_store_attach
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_store_detach(struct ca821x_store *store, struct ca821x_dev *pDeviceRef)
+{
+	unsigned i;
+
+	for (i = 0; i < store->num_ifaces; i++) {
+		if (store->ifaces[i].dev == pDeviceRef) {
+			ca821x_unregister_tap(&store->ifaces[i].tap, pDeviceRef);
+			store->ifaces[i].dev = NULL;
+		}
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Write the current segment to disk
+ *******************************************************************************
+ * \param store - Store
+ *******************************************************************************
+ * \return 0, or negative errno
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_store_sync(struct ca821x_store *store)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&store->lock);
+	if (store->map && msync(store->map, store->segment_size, MS_SYNC))
+		ret = -errno;
+	pthread_mutex_unlock(&store->lock);
+	return ret;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Detach all devices and close a store
+ *******************************************************************************
+ * Must not be called while the exchange may be dispatching frames to an
+ * attached device.
+ *******************************************************************************
+ * \param store - Store to close, freed on return
+ *******************************************************************************
+ * \return 0, or negative errno if the last segment could not be synced
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_store_close(struct ca821x_store *store)
+{
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < store->num_ifaces; i++) {
+		if (store->ifaces[i].dev)
+			ca821x_store_detach(store, store->ifaces[i].dev);
+	}
+	ret = ca821x_store_sync(store);
+	store_unmap(store);
+	store_drop_spare(store);
+	pthread_mutex_destroy(&store->lock);
+	free(store->spare_name);
+	free(store->name);
+	free(store->dir);
+	free(store);
+	return ret;
+}
+
+/******************************************************************************/
+/****** Querying                                                         ******/
+/******************************************************************************/
+
+static int frame_matches(const struct ca821x_store_query *query,
+                         const struct ca821x_store_frame *frame)
+{
+	struct FullAddr src, dst;
+	uint8_t match = query->match ? query->match : CA821X_STORE_MATCH_EITHER;
+
+	if (frame->timestamp_ns < query->start_ns ||
+	    (query->end_ns && frame->timestamp_ns >= query->end_ns))
+		return 0;
+	if (query->addr.AddressMode == MAC_MODE_NO_ADDR)
+		return 1;
+	if (ca821x_store_frame_addrs(frame, &src, &dst))
+		return 0;
+	return ((match & CA821X_STORE_MATCH_SRC) && addr_equal(&src, &query->addr)) ||
+	       ((match & CA821X_STORE_MATCH_DST) && addr_equal(&dst, &query->addr));
+}
+
+static int range_overlaps(const struct ca821x_store_query *query,
+                          uint64_t min_ts, uint64_t max_ts)
+{
+	return min_ts <= max_ts && max_ts >= query->start_ns &&
+	       (!query->end_ns || min_ts < query->end_ns);
+}
+
+/** Search one mapped segment, returning nonzero if the callback stopped */
+static int query_segment(
+	const uint8_t                   *map,
+	size_t                           size,
+	const struct ca821x_store_query *query,
+	uint64_t                         hash,
+	ca821x_store_query_fn            callback,
+	void                            *context,
+	struct ca821x_store_query_stats *stats,
+	int                             *found
+)
+{
+	const struct store_seg_header *hdr = (const void *)map;
+	const struct store_block *blocks = (const struct store_block *)(map + size);
+	uint32_t num_blocks, data_end, b, i, off;
+
+	num_blocks = hdr->blocks;
+	data_end = hdr->data_end;
+	atomic_thread_fence(memory_order_acquire);
+	if (data_end > size || num_blocks * sizeof(*blocks) > size - data_end ||
+	    !range_overlaps(query, hdr->min_ts, hdr->max_ts) ||
+	    (hash && !bloom_has(hdr->bloom, STORE_SEG_BLOOM_WORDS, 3, hash >> 8)))
+		return 0;
+	stats->segments_scanned++;
+
+	for (b = 0; b < num_blocks; b++) {
+		const struct store_block *block = blocks - 1 - b;
+		if (!range_overlaps(query, block->min_ts, block->max_ts) ||
+		    (hash && !bloom_has(block->bloom, STORE_BLOCK_BLOOM_WORDS, 2, hash)))
+			continue;
+		stats->blocks_scanned++;
+		off = block->offset;
+		for (i = 0; i < block->count && off + sizeof(struct store_record) <= data_end; i++) {
+			const struct store_record *rec = (const void *)(map + off);
+			struct ca821x_store_frame frame;
+
+			if (off + sizeof(*rec) + rec->len > data_end)
+				break;
+			frame.timestamp_ns = rec->timestamp_ns;
+			frame.iface = rec->iface;
+			frame.buf = (const uint8_t *)(rec + 1);
+			frame.len = rec->len;
+			stats->records_scanned++;
+			if (frame_matches(query, &frame)) {
+				(*found)++;
+				if (callback(&frame, context))
+					return 1;
+			}
+			off += (uint32_t)STORE_ALIGN(sizeof(*rec) + rec->len);
+		}
+	}
+	return 0;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Find the stored frames matching a query
+ *******************************************************************************
+ * Segments are searched oldest first, and blocks in the order they were
+ * written. May be used while the store is being appended to.
+ *******************************************************************************
+ * \param dir - Directory of the store
+ * \param query - Frames to select
+ * \param callback - Called with each matching frame
+ * \param context - Passed to the callback
+ * \param stats - Receives the work done, or NULL
+ *******************************************************************************
+ * \return Number of frames passed to the callback, or negative errno
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_store_query(
+	const char                      *dir,
+	const struct ca821x_store_query *query,
+	ca821x_store_query_fn            callback,
+	void                            *context,
+	struct ca821x_store_query_stats *stats
+)
+{
+	struct ca821x_store_query_stats local;
+	uint64_t *seqs = NULL, hash = 0, key;
+	size_t num = 0, cap = 0, i;
+	char *name = malloc(strlen(dir) + 32);
+	struct dirent *entry;
+	int found = 0, stop = 0;
+	DIR *d;
+
+	if (!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+	if (!name)
+		return -ENOMEM;
+	d = opendir(dir);
+	if (!d) {
+		free(name);
+		return -errno;
+	}
+	while ((entry = readdir(d))) {
+		uint64_t seq;
+		if (parse_segment_name(entry->d_name, &seq))
+			continue;
+		if (num == cap) {
+			uint64_t *grown = realloc(seqs, (cap ? cap * 2 : 64) * sizeof(*seqs));
+			if (!grown) {
+				closedir(d);
+				free(seqs);
+				free(name);
+				return -ENOMEM;
+			}
+			seqs = grown;
+			cap = cap ? cap * 2 : 64;
+		}
+		seqs[num++] = seq;
+	}
+	closedir(d);
+	qsort(seqs, num, sizeof(*seqs), compare_seq);
+	stats->segments = (unsigned)num;
+
+	key = addr_key(&query->addr);
+	if (key)
+		hash = key_hash(key);
+
+	for (i = 0; i < num && !stop; i++) {
+		const struct store_seg_header *hdr;
+		struct stat st;
+		void *map;
+		int fd;
+
+		sprintf(name, "%s/%010llu.seg", dir, (unsigned long long)seqs[i]);
+		fd = open(name, O_RDONLY);
+		if (fd < 0)
+			continue; /* Deleted by the writer */
+		if (fstat(fd, &st) || (size_t)st.st_size < STORE_HEADER_SIZE) {
+			close(fd);
+			continue;
+		}
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			continue;
+		hdr = map;
+		if (!memcmp(hdr->magic, STORE_MAGIC, 8) &&
+		    hdr->header_size == STORE_HEADER_SIZE &&
+		    hdr->segment_size == (uint64_t)st.st_size)
+			stop = query_segment(map, st.st_size, query, hash, callback,
+			                     context, stats, &found);
+		munmap(map, st.st_size);
+	}
+	free(seqs);
+	free(name);
+	return found;
+}
@@ -0,0 +1,195 @@
+/**
+ * @file ca821x_store_query.c
+ * @brief Command line query of a ca821x capture store.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_fcs.h"
+#include "ca821x_store.h"
+
+/**
+ * Parse an address: PPPP:SSSS (hex PAN id and short address) or 16 hex digits
+ * of an extended address, most significant first.
+ */
+static int parse_addr(const char *text, struct FullAddr *addr)
+{
+	unsigned pan, saddr;
+	uint64_t ext;
+	char *end;
+	int i;
+
+	memset(addr, 0, sizeof(*addr));
+	if (sscanf(text, "%4x:%4x", &pan, &saddr) == 2 && strlen(text) == 9) {
+		addr->AddressMode = MAC_MODE_SHORT_ADDR;
+		PUTLE16(pan, addr->PANId);
+		PUTLE16(saddr, addr->Address);
+		return 0;
+	}
+	ext = strtoull(text, &end, 16);
+	if (strlen(text) != 16 || *end)
+		return -1;
+	addr->AddressMode = MAC_MODE_LONG_ADDR;
+	for (i = 0; i < 8; i++)
+		addr->Address[i] = (uint8_t)(ext >> (8 * i));
+	return 0;
+}
+
+static void print_addr(const struct FullAddr *addr)
+{
+	int i;
+
+	if (addr->AddressMode == MAC_MODE_SHORT_ADDR) {
+		printf("%04x:%04x", GETLE16(addr->PANId), GETLE16(addr->Address));
+	} else if (addr->AddressMode == MAC_MODE_LONG_ADDR) {
+		for (i = 7; i >= 0; i--)
+			printf("%02x", addr->Address[i]);
+	} else {
+		printf("-");
+	}
+}
+
+/** Locate the PSDU, with its FCS, of a raw frame indication */
+static int frame_psdu(const struct ca821x_store_frame *frame, const uint8_t **psdu,
+                      size_t *len)
+{
+	const uint8_t *pset = frame->buf + 2;
+
+	if (frame->len < 2)
+		return -1;
+	switch (frame->buf[0]) {
+#if CASCODA_CA_VER >= 8211
+	case SPI_PCPS_DATA_INDICATION:
+		*psdu = pset + offsetof(struct PCPS_DATA_indication_pset, Psdu);
+		*len = pset[offsetof(struct PCPS_DATA_indication_pset, PsduLength)];
+		break;
+#endif
+	case SPI_TDME_RXPKT_INDICATION:
+		*psdu = pset + offsetof(struct TDME_RXPKT_indication_pset, TestPacketData);
+		*len = pset[offsetof(struct TDME_RXPKT_indication_pset, TestPacketLength)];
+		break;
+	default:
+		return -1;
+	}
+	return *psdu + *len <= frame->buf + frame->len ? 0 : -1;
+}
+
+/** Frames shown and whether only raw frames with a bad FCS are */
+struct query_output {
+	int count_only;
+	int bad_fcs;
+	int shown;
+};
+
+static int print_frame(const struct ca821x_store_frame *frame, void *context)
+{
+	struct query_output *out = context;
+	struct FullAddr src, dst;
+	const uint8_t *psdu;
+	size_t i, psdu_len;
+
+	if (out->bad_fcs && (frame_psdu(frame, &psdu, &psdu_len) ||
+	                     ca821x_fcs_check(psdu, psdu_len)))
+		return 0;
+	out->shown++;
+	if (out->count_only)
+		return 0;
+	printf("%llu if%u cmd %02x ", (unsigned long long)frame->timestamp_ns,
+	       frame->iface, frame->len ? frame->buf[0] : 0);
+	if (!ca821x_store_frame_addrs(frame, &src, &dst)) {
+		print_addr(&src);
+		printf(" > ");
+		print_addr(&dst);
+		printf(" ");
+	}
+	printf("len %u:", (unsigned)frame->len);
+	for (i = 0; i < frame->len; i++)
+		printf(" %02x", frame->buf[i]);
+	printf("\n");
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [--from NS] [--to NS] [--src ADDR | --dst ADDR | "
+	        "--addr ADDR] [--bad-fcs] [--count] [--stats] DIR\n"
+	        "ADDR is PPPP:SSSS (hex PAN id and short address) or 16 hex digits\n"
+	        "--bad-fcs shows only raw frame indications whose FCS is wrong\n",
+	        argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ca821x_store_query query;
+	struct ca821x_store_query_stats stats;
+	struct query_output out;
+	const char *dir = NULL;
+	int show_stats = 0, found, i;
+
+	memset(&query, 0, sizeof(query));
+	memset(&out, 0, sizeof(out));
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--count")) {
+			out.count_only = 1;
+		} else if (!strcmp(argv[i], "--bad-fcs")) {
+			out.bad_fcs = 1;
+		} else if (!strcmp(argv[i], "--stats")) {
+			show_stats = 1;
+		} else if (i + 1 < argc && !strcmp(argv[i], "--from")) {
+			query.start_ns = strtoull(argv[++i], NULL, 0);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--to")) {
+			query.end_ns = strtoull(argv[++i], NULL, 0);
+		} else if (i + 1 < argc && (!strcmp(argv[i], "--src") ||
+		                            !strcmp(argv[i], "--dst") ||
+		                            !strcmp(argv[i], "--addr"))) {
+			query.match = argv[i][2] == 's' ? CA821X_STORE_MATCH_SRC :
+			              argv[i][2] == 'd' ? CA821X_STORE_MATCH_DST :
+			                                  CA821X_STORE_MATCH_EITHER;
+			if (parse_addr(argv[++i], &query.addr)) {
+				usage(argv[0]);
+				return 2;
+			}
+		} else if (argv[i][0] != '-' && !dir) {
+			dir = argv[i];
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!dir) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	found = ca821x_store_query(dir, &query, print_frame, &out, &stats);
+	if (found < 0) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(-found));
+		return 1;
+	}
+	if (out.count_only)
+		printf("%d\n", out.shown);
+	if (show_stats)
+		fprintf(stderr, "%d frames, %u/%u segments, %u blocks, %llu records read\n",
+		        found, stats.segments_scanned, stats.segments, stats.blocks_scanned,
+		        (unsigned long long)stats.records_scanned);
+	return 0;
+}
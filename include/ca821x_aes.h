@@ -0,0 +1,69 @@
+/**
+ * @file ca821x_aes.h
+ * @brief Host AES-128 encryption, with AES-NI where available.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_AES_H
+#define CA821X_AES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************//**
+ * Only the forward cipher is provided, which is all CCM* needs. A key is
+ * expanded once with ca821x_aes_set_key; the same schedule serves the
+ * portable and AES-NI implementations.
+ ******************************************************************************/
+
+/** Octets in an AES block, and in an AES-128 key */
+#define CA821X_AES_BLOCK    (16)
+
+/** Implementations of ca821x_aes_encrypt, see ca821x_aes_impl */
+enum ca821x_aes_impl {
+	CA821X_AES_TABLE, //!< Portable, one table lookup per octet and round
+	CA821X_AES_NI     //!< x86 AES instructions
+};
+
+/** Expanded AES-128 key */
+struct ca821x_aes_key {
+	uint8_t rk[11][CA821X_AES_BLOCK]; /**< Round keys */
+};
+
+void ca821x_aes_set_key(struct ca821x_aes_key *key, const uint8_t *k);
+
+void ca821x_aes_encrypt(
+	const struct ca821x_aes_key *key,
+	const uint8_t               *in,
+	uint8_t                     *out
+);
+
+void ca821x_aes_encrypt_portable(
+	const struct ca821x_aes_key *key,
+	const uint8_t               *in,
+	uint8_t                     *out
+);
+
+void ca821x_aes_ctr(
+	const struct ca821x_aes_key *key,
+	uint8_t                     *ctr,
+	uint8_t                     *data,
+	size_t                       len
+);
+
+enum ca821x_aes_impl ca821x_aes_impl(void);
+
+#endif // CA821X_AES_H
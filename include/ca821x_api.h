@@ -70,6 +70,18 @@
 #endif
 
 struct ca821x_dev;
+struct ca821x_sync_stats;
+struct ca821x_trace;
+struct ca821x_pcps_tx;
+struct ca821x_neighbours;
+struct ca821x_links;
+struct ca821x_dedup;
+struct ca821x_subs;
+struct ca821x_rxfilter;
+
+/** Default lqi_limit of a device, below which received frames should be
+ *  rejected */
+#define API_LQI_LIMIT    (75)
 
 /** Real time translations for MLME-SCAN ScanDuration (per channel) */
 enum ca821x_scan_durations {
@@ -119,6 +131,37 @@ typedef int (*ca821x_api_downstream_t)(
 	struct ca821x_dev *pDeviceRef
 );
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Function pointer type for a device clock
+ *******************************************************************************
+ * A clock returns monotonic time in nanoseconds for a device. It is used by
+ * code that needs to measure intervals (such as the PHY tests), so that a
+ * device backed by a simulator can supply virtual time in place of wall-clock
+ * time. The epoch is arbitrary.
+ *******************************************************************************
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Current time in nanoseconds
+ ******************************************************************************/
+typedef uint64_t (*ca821x_clock_t)(struct ca821x_dev *pDeviceRef);
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Observer of the frames dispatched to a device
+ *******************************************************************************
+ * A tap registered with ca821x_register_tap sees every frame passed to
+ * ca821x_downstream_dispatch before it is handled, without taking the place of
+ * any callback. It is called in the context of the exchange, so must not block.
+ ******************************************************************************/
+struct ca821x_tap {
+	/** Called with the entire frame, including command and length bytes */
+	void (*callback)(const uint8_t *buf, size_t len, void *context,
+	                 struct ca821x_dev *pDeviceRef);
+	void *context;           //!< Passed to callback
+	struct ca821x_tap *next; //!< Internal, next tap of the device
+};
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Function pointer for waiting for messages
@@ -254,6 +297,35 @@ struct ca821x_dev {
 
 	//For the API:
 	ca821x_api_downstream_t ca821x_api_downstream;
+	ca821x_clock_t clock; //Monotonic clock, NULL if none is provided
+	void *clock_context; //For the clock
+	/** Synchronous command latency statistics, NULL if disabled
+	 *  (see ca821x_sync_stats.h) */
+	struct ca821x_sync_stats *sync_stats;
+	/** Trace of the frames exchanged, NULL if disabled (see ca821x_trace.h) */
+	struct ca821x_trace *trace;
+	/** Filter dropping irrelevant data indications before dispatch, NULL if
+	 *  disabled (see ca821x_rxfilter.h) */
+	struct ca821x_rxfilter *rxfilter;
+	/** Observers of dispatched frames (see ca821x_register_tap) */
+	struct ca821x_tap *taps;
+	/** Neighbour index kept coherent with macDeviceTable, NULL if not used
+	 *  (see ca821x_neighbour.h) */
+	struct ca821x_neighbours *neighbours;
+	/** Per-neighbour link statistics, NULL if disabled. Requires neighbours
+	 *  (see ca821x_link.h) */
+	struct ca821x_links *links;
+	/** Filter dropping repeated data indications, NULL if disabled
+	 *  (see ca821x_dedup.h) */
+	struct ca821x_dedup *dedup;
+	/** Filtered handlers of dispatched frames, NULL if not used
+	 *  (see ca821x_subscribe.h) */
+	struct ca821x_subs *subs;
+#if CASCODA_CA_VER >= 8211
+	/** Raw PSDU transmitter matching PCPS-DATA confirms, NULL if not used
+	 *  (see ca821x_pcps.h) */
+	struct ca821x_pcps_tx *pcps_tx;
+#endif
 
 	/** Variable for storing callback routines registered by the user */
 	struct ca821x_api_callbacks callbacks;
@@ -262,6 +334,10 @@ struct ca821x_dev {
 	uint16_t shortaddr; /**< Mirrors macShortAddress in the PIB */
 
 	uint8_t lqi_mode;
+	/** PAN descriptors of scan confirms with a beacon LQI at or below this are
+	 *  removed before the callback, API_LQI_LIMIT by default. 0 removes
+	 *  none, even those with an LQI of 0 */
+	uint8_t lqi_limit;
 
 	//MAC Workarounds for V1.1 and MPW silicon (V0.x)
 	uint8_t MAC_Workarounds; /**< Flag to enable workarounds for ca8210 v1.1 */
@@ -288,6 +364,16 @@ uint8_t MCPS_PURGE_request_sync(
 	struct ca821x_dev *pDeviceRef
 );
 
+#if CASCODA_CA_VER >= 8211
+uint8_t PCPS_DATA_request(
+	uint8_t          PsduHandle,
+	uint8_t          TxOpts,
+	uint8_t          PsduLength,
+	uint8_t         *pPsdu,
+	struct ca821x_dev *pDeviceRef
+);
+#endif // CASCODA_CA_VER >= 8211
+
 uint8_t MLME_ASSOCIATE_request(
 	uint8_t          LogicalChannel,
 	struct FullAddr  DstAddr,
@@ -481,6 +567,17 @@ uint8_t TDME_GetTxPower(uint8_t *txp, struct ca821x_dev *pDeviceRef);
  ******************************************************************************/
 int ca821x_api_init(struct ca821x_dev *pDeviceRef);
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Read the monotonic clock of a device
+ *******************************************************************************
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Time in nanoseconds from pDeviceRef->clock, or 0 if no clock has
+ *         been provided
+ ******************************************************************************/
+uint64_t ca821x_get_time_ns(struct ca821x_dev *pDeviceRef);
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Function for registering a callback struct for this device.
@@ -493,6 +590,27 @@ int ca821x_api_init(struct ca821x_dev *pDeviceRef);
 void ca821x_register_callbacks(struct ca821x_api_callbacks *in_callbacks,
                                struct ca821x_dev *pDeviceRef);
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Add a tap to the frames dispatched to this device
+ *******************************************************************************
+ * Taps must not be registered or unregistered while the exchange may be
+ * dispatching frames to the device.
+ *******************************************************************************
+ * \param tap - Tap to add, which must remain valid until unregistered
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ ******************************************************************************/
+void ca821x_register_tap(struct ca821x_tap *tap, struct ca821x_dev *pDeviceRef);
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Remove a tap added by ca821x_register_tap
+ *******************************************************************************
+ * \param tap - Tap to remove
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ ******************************************************************************/
+void ca821x_unregister_tap(struct ca821x_tap *tap, struct ca821x_dev *pDeviceRef);
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Function to get a reference to the callback for a certain command ID
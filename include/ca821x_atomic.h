@@ -0,0 +1,40 @@
+/**
+ * @file ca821x_atomic.h
+ * @brief Atomic counter type used by the api's instrumentation.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_ATOMIC_H
+#define CA821X_ATOMIC_H
+
+#include <stdint.h>
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define CA821X_HAVE_ATOMICS (1)
+/** 32-bit counter: lock-free where C11 atomics are available */
+typedef atomic_uint_least32_t ca821x_atomic32_t;
+/** 64-bit value: atomic where C11 atomics are available */
+typedef atomic_uint_least64_t ca821x_atomic64_t;
+#else
+/** 32-bit counter: plain on toolchains without C11 atomics (single context) */
+typedef volatile uint32_t ca821x_atomic32_t;
+/** 64-bit value: plain on toolchains without C11 atomics (single context) */
+typedef volatile uint64_t ca821x_atomic64_t;
+#endif
+
+#endif // CA821X_ATOMIC_H
@@ -0,0 +1,77 @@
+/**
+ * @file ca821x_beacon.h
+ * @brief Parsing of the variable fields of an MLME-BEACON-NOTIFY indication.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_BEACON_H
+#define CA821X_BEACON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "mac_messages.h"
+
+/***************************************************************************//**
+ * \brief Fields of a beacon notify indication, in place
+ *
+ * After the PAN descriptor, whose size depends on whether the beacon was
+ * secured, a beacon notify carries the pending address specification, the
+ * pending short addresses, the pending extended addresses and the beacon
+ * payload with its length. ca821x_beacon_parse checks all of these against
+ * the message length and points into the indication, which must outlive the
+ * view.
+ ******************************************************************************/
+struct ca821x_beacon_view {
+	uint8_t                     bsn;         /**< Beacon sequence number */
+	const struct PanDescriptor *pan;         /**< PAN descriptor of the beacon */
+	const uint8_t              *short_addrs; /**< Pending short addresses, 2 octets each, little-endian */
+	uint8_t                     num_short;
+	const uint8_t              *ext_addrs;   /**< Pending extended addresses, 8 octets each */
+	uint8_t                     num_ext;
+	const uint8_t              *payload;     /**< Beacon payload */
+	uint8_t                     payload_len;
+};
+
+/***************************************************************************//**
+ * \brief Parameter length of a beacon notify passed to a callback
+ *******************************************************************************
+ * ca821x_downstream_dispatch passes the parameter set of an indication in
+ * place in the upstream frame, so its length is the byte before it. Only
+ * valid for a parameter set received by an MLME_BEACON_NOTIFY_indication
+ * callback.
+ ******************************************************************************/
+#define CA821X_BEACON_IND_LEN(ind)  (((const uint8_t *)(ind))[-1])
+
+int ca821x_beacon_parse(
+	struct ca821x_beacon_view                       *view,
+	const struct MLME_BEACON_NOTIFY_indication_pset *ind,
+	size_t                                           len
+);
+
+int ca821x_beacon_addr_pending(
+	const struct ca821x_beacon_view *view,
+	uint16_t                         shortaddr,
+	const uint8_t                   *extaddr
+);
+
+int ca821x_beacon_dev_pending(
+	const struct ca821x_beacon_view *view,
+	struct ca821x_dev               *pDeviceRef
+);
+
+#endif // CA821X_BEACON_H
@@ -0,0 +1,112 @@
+/**
+ * @file ca821x_chansel.h
+ * @brief Automatic channel selection and coordinator channel migration.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_CHANSEL_H
+#define CA821X_CHANSEL_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+
+/** Number of 2.4GHz channels tracked by the channel selection engine */
+#define CHANSEL_NUM_CHANNELS    (M_MaximumChannel - M_MinimumChannel + 1)
+
+/** Score of an energy detect result (0-255), the result in 8.8 fixed point */
+#define CHANSEL_SCORE_ED(ed)        ((uint16_t)((uint16_t)(ed) << 8))
+/** Score of a failure ratio out of 256, on the ED scale: a channel on which
+ *  every transmission fails scores as a saturated ED result (0xFF00) */
+#define CHANSEL_SCORE_RATIO(ratio)  CHANSEL_SCORE_ED((ratio) > 0xFF ? 0xFF : (ratio))
+
+/***************************************************************************//**
+ * \defgroup ChanSelDefaults Channel selection defaults
+ ************************************************************************** @{*/
+/** Failure score at which the current channel counts as degraded, a quarter
+ *  of transmissions failing */
+#define CHANSEL_DEF_DEGRADE_THRESHOLD   CHANSEL_SCORE_RATIO(64)
+/** Score margin a candidate must win by */
+#define CHANSEL_DEF_HYSTERESIS          CHANSEL_SCORE_ED(24)
+/** Minimum number of data confirms before the current channel is judged */
+#define CHANSEL_DEF_MIN_SAMPLES         (32)
+/** Evaluations to skip after a migration before another is considered */
+#define CHANSEL_DEF_HOLDOFF             (8)
+/**@}*/
+
+/***************************************************************************//**
+ * \brief Channel selection engine state
+ *
+ * Each channel carries a smoothed interference score in 8.8 fixed point ED
+ * units (0 is a quiet channel, 0xFF00 is saturated). Scores are built from
+ * MLME-SCAN ED results, and the score of the current channel is additionally
+ * raised to the score of its MCPS-DATA confirm failure ratio, so that
+ * interference which does not show up in a scan still causes a move. Scores,
+ * degrade_threshold and hysteresis are all on this one scale, see
+ * CHANSEL_SCORE_ED and CHANSEL_SCORE_RATIO.
+ ******************************************************************************/
+struct ca821x_chansel {
+	uint32_t channel_mask;   /**< Channels eligible for selection (ScanChannels format) */
+	uint8_t  current_channel; /**< Channel the coordinator currently operates on */
+	uint16_t score[CHANSEL_NUM_CHANNELS]; /**< Smoothed score per channel */
+	uint32_t scored_mask;    /**< Channels which have at least one ED sample */
+
+	uint16_t tx_attempts;    /**< Data confirms seen in the current window */
+	uint16_t tx_failures;    /**< Of which failed due to CCA failure or no ack */
+
+	/** CHANSEL_SCORE_RATIO of the failure ratio marking degradation. A ratio
+	 *  of r/256 scores as an ED result of r, so the threshold compares
+	 *  directly with scan scores */
+	uint16_t degrade_threshold;
+	uint16_t hysteresis;     /**< Score margin required for a move */
+	uint16_t min_samples;    /**< Window size for the failure ratio */
+	uint8_t  holdoff;        /**< Evaluations to skip after a move */
+	uint8_t  holdoff_count;  /**< Evaluations remaining until moves are allowed */
+};
+
+void ca821x_chansel_init(
+	struct ca821x_chansel *cs,
+	uint8_t                current_channel,
+	uint32_t               channel_mask
+);
+
+int ca821x_chansel_process_scan(
+	struct ca821x_chansel               *cs,
+	uint32_t                             ScanChannels,
+	const struct MLME_SCAN_confirm_pset *scan_cnf
+);
+
+void ca821x_chansel_process_datacnf(
+	struct ca821x_chansel               *cs,
+	const struct MCPS_DATA_confirm_pset *data_cnf
+);
+
+uint16_t ca821x_chansel_get_score(struct ca821x_chansel *cs, uint8_t channel);
+
+uint8_t ca821x_chansel_evaluate(struct ca821x_chansel *cs);
+
+uint8_t ca821x_chansel_migrate(
+	struct ca821x_chansel *cs,
+	uint8_t                LogicalChannel,
+	uint16_t               PANId,
+	uint8_t                BeaconOrder,
+	uint8_t                SuperframeOrder,
+	struct SecSpec        *pCoordRealignSecurity,
+	struct SecSpec        *pBeaconSecurity,
+	struct ca821x_dev     *pDeviceRef
+);
+
+#endif // CA821X_CHANSEL_H
@@ -0,0 +1,96 @@
+/**
+ * @file ca821x_dedup.h
+ * @brief Per-source suppression of duplicate data indications.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_DEDUP_H
+#define CA821X_DEDUP_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+#include "mac_messages.h"
+
+/** Sources whose recent DSNs are remembered */
+#define CA821X_DEDUP_SOURCES    (64)
+/** Slots of the hash index, a power of two at least twice
+ *  CA821X_DEDUP_SOURCES */
+#define CA821X_DEDUP_SLOTS      (128)
+/** DSNs before the newest of a source that are remembered */
+#define CA821X_DEDUP_WINDOW     (32)
+/** Marks an empty link of the recency list */
+#define CA821X_DEDUP_NONE       (0xFF)
+
+/** DSNs recently received from one source */
+struct ca821x_dedup_source {
+	uint64_t key;     /**< Extended address, or PAN id and short address */
+	uint64_t seen_ns; /**< Device clock when last received from */
+	/** Bit n set if the DSN n + 1 before dsn was received */
+	uint32_t window;
+	uint8_t  mode;    /**< Address mode, 0 if the entry is free */
+	uint8_t  dsn;     /**< Newest DSN received */
+	uint8_t  newer;   /**< Recency list, towards the most recently used */
+	uint8_t  older;   /**< Recency list, towards the least recently used */
+};
+
+/***************************************************************************//**
+ * \brief Duplicate data indication filter of a device
+ *
+ * A frame whose acknowledgement is lost is retransmitted with the same DSN,
+ * and indicated again. Attach a filter to a device by pointing
+ * pDeviceRef->dedup at an instance initialised with ca821x_dedup_init, and
+ * ca821x_downstream_dispatch drops each MCPS-DATA.indication whose DSN was
+ * already received from its source, before any callback. Taps and traces
+ * still see every frame.
+ *
+ * For each source, the newest DSN and the CA821X_DEDUP_WINDOW before it are
+ * remembered, so frames delivered out of order are not mistaken for
+ * duplicates. Sources are found through an open-addressed hash index, and
+ * when all CA821X_DEDUP_SOURCES are in use the least recently heard is
+ * forgotten. A source not heard for max_age_ns starts afresh, so a restarted
+ * sender reusing a DSN is not dropped.
+ *
+ * Frames without a source address are never dropped. The filter is used from
+ * the thread dispatching the device's frames; its counters may be read from
+ * any thread.
+ ******************************************************************************/
+struct ca821x_dedup {
+	uint64_t                   max_age_ns; /**< 0: sources never expire */
+	uint8_t                    newest;     /**< Most recently used source */
+	uint8_t                    oldest;     /**< Least recently used source */
+	uint8_t                    count;      /**< Sources in use */
+	/** Hash index, each slot holding a position in sources plus 1, or 0 */
+	uint8_t                    slots[CA821X_DEDUP_SLOTS];
+	struct ca821x_dedup_source sources[CA821X_DEDUP_SOURCES];
+
+	/* Statistics */
+	ca821x_atomic32_t          frames;     /**< Indications checked */
+	ca821x_atomic32_t          duplicates; /**< Indications dropped */
+	ca821x_atomic32_t          evictions;  /**< Sources forgotten for space */
+};
+
+void ca821x_dedup_init(struct ca821x_dedup *dedup, uint64_t max_age_ns);
+
+int ca821x_dedup_check(
+	struct ca821x_dedup   *dedup,
+	const struct FullAddr *src,
+	uint8_t                dsn,
+	uint64_t               now_ns
+);
+
+#endif // CA821X_DEDUP_H
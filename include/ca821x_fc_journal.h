@@ -0,0 +1,83 @@
+/**
+ * @file ca821x_fc_journal.h
+ * @brief Crash-safe journal of security frame counter high-water marks.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_FC_JOURNAL_H
+#define CA821X_FC_JOURNAL_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_sec_mirror.h"
+
+/** Stride used when ca821x_fc_journal_open is passed 0 */
+#define CA821X_FC_JOURNAL_DEF_STRIDE    (1024)
+
+struct ca821x_fc_journal;
+
+/***************************************************************************//**
+ * A journal keeps high-water marks of the outgoing macFrameCounter and of the
+ * FrameCounter of each device descriptor in a small file, so they survive a
+ * restart without being read back from the device one MLME-GET at a time.
+ *
+ * A mark is only written when a counter has advanced by stride or more since
+ * the last one, so most calls to ca821x_fc_journal_note_tx and
+ * ca821x_fc_journal_note_device are a comparison under a lock. The file holds
+ * two copies of the marks, each in its own page, which are written in turn
+ * and synced with msync. A write cut short by a crash leaves a copy whose
+ * check fails, and the other copy is used.
+ *
+ * On restore the outgoing counter resumes at its mark plus stride, which has
+ * not been used provided each counter was noted before the frame using it was
+ * sent. Incoming counters resume at their mark, which is at most stride below
+ * the counter they had: stride bounds both the replay window after a restart
+ * and the number of writes. For frames secured by the device itself, note the
+ * restored counter plus the number of secured frames requested since.
+ *
+ * The file is written in native byte order. Calls may be made from any
+ * thread.
+ ******************************************************************************/
+
+struct ca821x_fc_journal *ca821x_fc_journal_open(const char *path, uint32_t stride);
+
+int ca821x_fc_journal_close(struct ca821x_fc_journal *journal);
+
+int ca821x_fc_journal_note_tx(struct ca821x_fc_journal *journal, uint32_t counter);
+
+int ca821x_fc_journal_note_device(
+	struct ca821x_fc_journal *journal,
+	uint8_t                   index,
+	const uint8_t            *ext_addr,
+	uint32_t                  counter
+);
+
+uint32_t ca821x_fc_journal_restore(
+	struct ca821x_fc_journal *journal,
+	struct ca821x_sec_tables *tables
+);
+
+uint8_t ca821x_fc_journal_restore_sync(
+	struct ca821x_fc_journal *journal,
+	struct ca821x_sec_tables *tables,
+	struct ca821x_sec_mirror *mirror,
+	struct ca821x_dev        *pDeviceRef
+);
+
+uint64_t ca821x_fc_journal_writes(struct ca821x_fc_journal *journal);
+
+#endif // CA821X_FC_JOURNAL_H
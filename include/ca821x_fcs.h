@@ -0,0 +1,55 @@
+/**
+ * @file ca821x_fcs.h
+ * @brief 802.15.4 frame check sequence (CRC-16/ITU-T) computation.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_FCS_H
+#define CA821X_FCS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************//**
+ * The FCS is the CRC with generator x^16 + x^12 + x^5 + 1, computed over the
+ * MAC header and payload with each octet taken least significant bit first,
+ * a zero initial value and no final inversion. It is transmitted least
+ * significant octet first, so the CRC of a frame followed by its FCS is 0.
+ *
+ * A frame held in several buffers is covered by passing each buffer in turn
+ * to ca821x_fcs_update, starting from CA821X_FCS_INIT.
+ ******************************************************************************/
+
+/** Initial value of a running FCS */
+#define CA821X_FCS_INIT     (0x0000)
+
+/** Implementations of ca821x_fcs_update, see ca821x_fcs_impl */
+enum ca821x_fcs_impl {
+	CA821X_FCS_SLICE8, //!< Portable, 8 octets per step from lookup tables
+	CA821X_FCS_CLMUL   //!< x86 carry-less multiply, 64 octets per step
+};
+
+uint16_t ca821x_fcs_update(uint16_t crc, const uint8_t *buf, size_t len);
+
+uint16_t ca821x_fcs_update_portable(uint16_t crc, const uint8_t *buf, size_t len);
+
+enum ca821x_fcs_impl ca821x_fcs_impl(void);
+
+void ca821x_fcs_append(uint8_t *psdu, size_t len);
+
+int ca821x_fcs_check(const uint8_t *psdu, size_t len);
+
+#endif // CA821X_FCS_H
@@ -0,0 +1,111 @@
+/**
+ * @file ca821x_frame.h
+ * @brief Decoding and building of raw 802.15.4 MAC frames (PSDUs).
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_FRAME_H
+#define CA821X_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ieee_802_15_4.h"
+#include "mac_messages.h"
+
+/** Length of the frame check sequence that ends a received PSDU */
+#define MAC_FCS_LEN                 (2)
+/** Frame control frame version mask */
+#define MAC_FC_VER_MASK             (0x3000)
+/** Security control field: security level */
+#define MAC_SC_LEVEL(sc)            ((sc) & 0x07)
+/** Security control field: key identifier mode */
+#define MAC_SC_KEYIDMODE(sc)        (((sc) >> 3) & 0x03)
+
+/***************************************************************************//**
+ * \brief A decoded MAC frame
+ *
+ * Every field points into the decoded PSDU, which must outlive the frame.
+ * Addresses and PAN ids are little-endian, as transmitted. For a secured
+ * frame the payload is still encrypted and ends with the MIC.
+ ******************************************************************************/
+struct ca821x_frame {
+	uint16_t       fc;          /**< Frame control field */
+	uint8_t        type;        /**< Frame type, MAC_FC_FT_* */
+	uint8_t        dsn;         /**< Data sequence number */
+	uint8_t        dst_mode;    /**< Destination address mode, enum mac_addr_mode */
+	uint8_t        src_mode;    /**< Source address mode, enum mac_addr_mode */
+	const uint8_t *dst_pan;     /**< Destination PAN id, NULL if absent */
+	const uint8_t *dst_addr;    /**< Destination address, NULL if absent */
+	/** Source PAN id, which is the destination PAN id for a PAN id
+	 *  compressed frame. NULL if there is no source address */
+	const uint8_t *src_pan;
+	const uint8_t *src_addr;    /**< Source address, NULL if absent */
+
+	uint8_t        sec_level;   /**< Security level, 0 if not secured */
+	uint8_t        key_id_mode; /**< Key identifier mode */
+	uint32_t       frame_counter;
+	/** Key source (0, 4 or 8 octets by key_id_mode), NULL if absent */
+	const uint8_t *key_source;
+	uint8_t        key_index;   /**< Key index, if key_id_mode is nonzero */
+	uint8_t        mic_len;     /**< Length of the MIC ending the payload */
+
+	uint8_t        hdr_len;     /**< Length of the MAC header */
+	const uint8_t *payload;     /**< MAC payload, including any MIC */
+	uint8_t        payload_len;
+};
+
+/***************************************************************************//**
+ * \brief Header fields of a frame to build
+ *
+ * The addressing modes and PAN id compression follow from dst and src: an
+ * AddressMode of MAC_MODE_NO_ADDR omits the address. If both are present
+ * and their PAN ids are equal, the source PAN id is compressed.
+ ******************************************************************************/
+struct ca821x_frame_hdr {
+	/** Frame type (MAC_FC_FT_*), any of MAC_FC_FP and MAC_FC_ACK_REQ, and
+	 *  optionally MAC_FC_VER2006. MAC_FC_SEC_ENA is set from security */
+	uint16_t        fc;
+	uint8_t         dsn;
+	struct FullAddr dst;
+	struct FullAddr src;
+	/** Auxiliary security header, not written if SecurityLevel is 0 */
+	struct SecSpec  security;
+	uint32_t        frame_counter;
+};
+
+int ca821x_frame_decode(
+	struct ca821x_frame *frame,
+	const uint8_t       *psdu,
+	size_t               len,
+	int                  has_fcs
+);
+
+int ca821x_frame_build(
+	uint8_t                       *buf,
+	size_t                         size,
+	const struct ca821x_frame_hdr *hdr,
+	const uint8_t                 *payload,
+	size_t                         payload_len
+);
+
+void ca821x_frame_get_addrs(
+	const struct ca821x_frame *frame,
+	struct FullAddr           *src,
+	struct FullAddr           *dst
+);
+
+#endif // CA821X_FRAME_H
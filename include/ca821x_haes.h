@@ -0,0 +1,69 @@
+/**
+ * @file ca821x_haes.h
+ * @brief Multi-block use of the hardware AES engine through HWME-HAES.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_HAES_H
+#define CA821X_HAES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+
+/** Octets in an AES block */
+#define CA821X_HAES_BLOCK       (16)
+/** Keystream blocks ca821x_haes_ctr buffers before XORing them into the
+ *  data, enough for a whole PSDU */
+#define CA821X_HAES_CTR_BLOCKS  ((aMaxPHYPacketSize + CA821X_HAES_BLOCK - 1) / CA821X_HAES_BLOCK)
+
+/***************************************************************************//**
+ * The device encrypts with the key last written to HWME_HSKEY, which cannot
+ * be read back. Each block is one synchronous HWME-HAES exchange, and only
+ * one synchronous exchange can be outstanding, so these functions cannot
+ * shorten the round trips; they keep the host work between them to a copy.
+ *
+ * ca821x_haes_ctr and ca821x_haes_cbc_mac are the two halves of CCM* as used
+ * by 802.15.4, where the counter occupies the last two octets of the counter
+ * block. A message held in several pieces can be passed to ca821x_haes_ctr
+ * one piece at a time if every piece but the last is a whole number of
+ * blocks. ca821x_haes_cbc_mac pads the data of each call separately, so the
+ * CCM* authentication data and message are passed in separate calls.
+ ******************************************************************************/
+
+uint8_t ca821x_haes_blocks(
+	uint8_t            mode,
+	uint8_t           *data,
+	size_t             nblocks,
+	struct ca821x_dev *pDeviceRef
+);
+
+uint8_t ca821x_haes_ctr(
+	uint8_t           *ctr,
+	uint8_t           *data,
+	size_t             len,
+	struct ca821x_dev *pDeviceRef
+);
+
+uint8_t ca821x_haes_cbc_mac(
+	uint8_t           *mac,
+	const uint8_t     *data,
+	size_t             len,
+	struct ca821x_dev *pDeviceRef
+);
+
+#endif // CA821X_HAES_H
@@ -0,0 +1,119 @@
+/**
+ * @file ca821x_link.h
+ * @brief Per-neighbour link quality tracking from dispatched indications.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_LINK_H
+#define CA821X_LINK_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+#include "ca821x_neighbour.h"
+#include "mac_messages.h"
+
+/** Weight of each new LQI sample in the average, as a shift (1/8) */
+#define CA821X_LINK_LQI_SHIFT   (3)
+/** Fractional bits of the averaged LQI */
+#define CA821X_LINK_LQI_FRAC    (8)
+
+/***************************************************************************//**
+ * \brief Per-neighbour link statistics of a device
+ *
+ * Attach to a device by pointing pDeviceRef->links at an instance initialised
+ * with ca821x_link_init, alongside a neighbour table in pDeviceRef->neighbours.
+ * ca821x_downstream_dispatch then updates the statistics of the neighbour
+ * each frame is from:
+ * - the LQI of MCPS-DATA.indications, MLME-POLL.indications and the PAN
+ *   descriptors of MLME-BEACON-NOTIFY.indications feeds an exponentially
+ *   weighted average;
+ * - MCPS-DATA.confirms are matched by MsduHandle to the destination of their
+ *   MCPS_DATA_request, and counted as acknowledged, unacknowledged or failing
+ *   CCA;
+ * - a received frame or an acknowledgement sets the last seen time, from the
+ *   device clock.
+ * Frames from addresses not in the neighbour table are not tracked.
+ *
+ * Each statistic is an array indexed by neighbour position, so that a pass
+ * over all neighbours (as for a routing decision) reads contiguous memory.
+ * Statistics are updated from the thread dispatching the device's frames,
+ * and may be read concurrently with ca821x_link_snapshot.
+ ******************************************************************************/
+struct ca821x_links {
+	/** Averaged LQI with CA821X_LINK_LQI_FRAC fractional bits */
+	ca821x_atomic32_t lqi[CA821X_NEIGHBOUR_MAX];
+	ca821x_atomic32_t rx[CA821X_NEIGHBOUR_MAX];       /**< Frames received */
+	ca821x_atomic32_t tx[CA821X_NEIGHBOUR_MAX];       /**< MCPS-DATA.confirms */
+	ca821x_atomic32_t tx_acked[CA821X_NEIGHBOUR_MAX]; /**< Of which MAC_SUCCESS */
+	ca821x_atomic32_t tx_cca[CA821X_NEIGHBOUR_MAX];   /**< MAC_CHANNEL_ACCESS_FAILURE */
+	ca821x_atomic64_t last_seen_ns[CA821X_NEIGHBOUR_MAX];
+	/** Neighbour epoch the statistics are for, see ca821x_neighbours.epochs */
+	ca821x_atomic32_t epoch[CA821X_NEIGHBOUR_MAX];
+	/** Neighbour of each MsduHandle in flight: epoch << 8 | position + 1 */
+	ca821x_atomic64_t handles[256];
+};
+
+/** Statistics of one neighbour, see ca821x_link_snapshot */
+struct ca821x_link_snapshot {
+	uint8_t  lqi;          /**< Averaged LQI, 0 if nothing was received */
+	uint32_t rx;
+	uint32_t tx;
+	uint32_t tx_acked;
+	uint32_t tx_cca;
+	/** Acknowledged transmissions out of those that passed CCA, 0 to 1000 */
+	uint16_t ack_permille;
+	/** Transmissions failing CCA, 0 to 1000 */
+	uint16_t cca_permille;
+	uint64_t last_seen_ns; /**< Device clock when last heard, 0 if never */
+};
+
+void ca821x_link_init(struct ca821x_links *links);
+
+void ca821x_link_rx(
+	struct ca821x_links      *links,
+	struct ca821x_neighbours *nb,
+	const struct FullAddr    *src,
+	uint8_t                   lqi,
+	uint64_t                  now_ns
+);
+
+void ca821x_link_tx(
+	struct ca821x_links      *links,
+	struct ca821x_neighbours *nb,
+	const struct FullAddr    *dst,
+	uint8_t                   handle
+);
+
+void ca821x_link_tx_cancel(struct ca821x_links *links, uint8_t handle);
+
+void ca821x_link_confirm(
+	struct ca821x_links      *links,
+	struct ca821x_neighbours *nb,
+	uint8_t                   handle,
+	uint8_t                   status,
+	uint64_t                  now_ns
+);
+
+int ca821x_link_snapshot(
+	struct ca821x_links            *links,
+	const struct ca821x_neighbours *nb,
+	const struct ca821x_neighbour  *n,
+	struct ca821x_link_snapshot    *snapshot
+);
+
+#endif // CA821X_LINK_H
@@ -0,0 +1,110 @@
+/**
+ * @file ca821x_neighbour.h
+ * @brief Hashed index of neighbours by extended and short address.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_NEIGHBOUR_H
+#define CA821X_NEIGHBOUR_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "mac_messages.h"
+
+/** Most neighbours a table can hold, at least DEVICE_TABLE_SIZE */
+#define CA821X_NEIGHBOUR_MAX        (64)
+/** Slots of each hash index, a power of two at least twice
+ *  CA821X_NEIGHBOUR_MAX so that probes stay short */
+#define CA821X_NEIGHBOUR_SLOTS      (128)
+/** ca821x_neighbour.device_index of a neighbour not in macDeviceTable */
+#define CA821X_NEIGHBOUR_NO_DEVICE  (0xFF)
+
+/** A known neighbour */
+struct ca821x_neighbour {
+	uint8_t ext_addr[8];   /**< Extended address, if has_ext */
+	uint8_t pan_id[2];     /**< PAN id of short_addr */
+	uint8_t short_addr[2]; /**< Short address, if has_short */
+	uint8_t has_ext;
+	uint8_t has_short;
+	/** Index of the neighbour's macDeviceTable entry, or
+	 *  CA821X_NEIGHBOUR_NO_DEVICE */
+	uint8_t device_index;
+	/** Learned other than from macDeviceTable, so kept when its entry is
+	 *  removed */
+	uint8_t learned;
+	uint8_t used;
+};
+
+/***************************************************************************//**
+ * \brief Index from received addresses to neighbours and device table entries
+ *
+ * Neighbours are hashed by extended address, and by PAN id and short address,
+ * into two open-addressed indexes, so ca821x_neighbour_find costs a hash and
+ * a short probe whatever the number of neighbours. A neighbour keeps its place
+ * in entries while it is known, so its position (the returned pointer less
+ * entries) can index per-neighbour state kept by the application.
+ *
+ * Attach to a device by pointing pDeviceRef->neighbours at an initialised
+ * table. The API then keeps it coherent with the device: each successful
+ * MLME-SET of a macDeviceTable entry or of macDeviceTableEntries updates the
+ * neighbours' device indexes, a reset to the default PIB clears them, and an
+ * MLME-ASSOCIATE.response or MLME-ORPHAN.response granting a short address
+ * teaches it to the neighbour, under the PAN id last set with MLME-START or
+ * macPANId. A neighbour known only from macDeviceTable is forgotten when its
+ * entry is removed or replaced.
+ *
+ * The table is not locked: attach it to one device, and look up from the
+ * thread that dispatches its indications or with the exchange otherwise idle.
+ ******************************************************************************/
+struct ca821x_neighbours {
+	uint8_t                 count;      /**< Neighbours known */
+	uint8_t                 pan_id[2];  /**< Mirrors macPANId, for learning */
+	struct ca821x_neighbour entries[CA821X_NEIGHBOUR_MAX];
+	/* Indexes, each slot holding a position in entries plus 1, or 0 */
+	uint8_t                 by_ext[CA821X_NEIGHBOUR_SLOTS];
+	uint8_t                 by_short[CA821X_NEIGHBOUR_SLOTS];
+	uint8_t                 by_device[DEVICE_TABLE_SIZE];
+	/** Incremented each time an entry is given to a new neighbour, so that
+	 *  state kept by position can tell it belongs to an old one */
+	uint32_t                epochs[CA821X_NEIGHBOUR_MAX];
+};
+
+void ca821x_neighbour_init(struct ca821x_neighbours *nb);
+
+struct ca821x_neighbour *ca821x_neighbour_find(
+	struct ca821x_neighbours *nb,
+	const struct FullAddr    *addr
+);
+
+struct ca821x_neighbour *ca821x_neighbour_learn(
+	struct ca821x_neighbours *nb,
+	const uint8_t            *ext_addr,
+	const uint8_t            *pan_id,
+	const uint8_t            *short_addr
+);
+
+void ca821x_neighbour_forget(struct ca821x_neighbours *nb, struct ca821x_neighbour *n);
+
+int ca821x_neighbour_set_device(
+	struct ca821x_neighbours        *nb,
+	uint8_t                          index,
+	const struct M_DeviceDescriptor *desc
+);
+
+void ca821x_neighbour_set_device_entries(struct ca821x_neighbours *nb, uint8_t entries);
+
+#endif // CA821X_NEIGHBOUR_H
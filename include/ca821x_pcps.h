@@ -0,0 +1,135 @@
+/**
+ * @file ca821x_pcps.h
+ * @brief Windowed transmission of raw PSDUs through PCPS-DATA.request.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_PCPS_H
+#define CA821X_PCPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+#include "ca821x_sync_stats.h"
+#include "mac_messages.h"
+
+#if CASCODA_CA_VER >= 8211
+
+/** Largest number of PSDUs a transmitter can keep in flight */
+#define CA821X_PCPS_MAX_WINDOW  (16)
+
+struct ca821x_pcps_tx;
+
+/** Called with each PCPS-DATA.confirm matched to a submitted PSDU */
+typedef void (*ca821x_pcps_confirm_fn)(
+	struct ca821x_pcps_tx               *tx,
+	const struct PCPS_DATA_confirm_pset *params,
+	void                                *context,
+	struct ca821x_dev                   *pDeviceRef);
+
+/** A PSDU to submit with ca821x_pcps_tx_submit_batch, which submits each in
+ *  a PCPS_DATA_request of its own */
+struct ca821x_pcps_psdu {
+	const uint8_t *psdu;
+	uint8_t        len;
+	uint8_t        txopts;  /**< TxOpts of the PCPS-DATA.request */
+	void          *context; /**< Passed to on_confirm */
+};
+
+/** A PSDU in flight */
+struct ca821x_pcps_slot {
+	/** 0 if free, else CA821X_PCPS_BUSY | PsduHandle */
+	ca821x_atomic32_t state;
+	void             *context;   /**< Submitter's context for the PSDU */
+	uint64_t          submit_ns; /**< Device clock when it was submitted */
+};
+
+/** Set in ca821x_pcps_slot.state while the slot is in flight */
+#define CA821X_PCPS_BUSY        (0x100)
+
+/***************************************************************************//**
+ * \brief Per-device transmitter for the raw PHY data path
+ *
+ * Attach to a device by pointing pDeviceRef->pcps_tx at an instance
+ * initialised with ca821x_pcps_tx_init. Each PSDU submitted is given a
+ * PsduHandle not held by any other PSDU in flight, and at most window PSDUs
+ * are in flight at once. ca821x_downstream_dispatch matches each
+ * PCPS-DATA.confirm to its PSDU by handle, frees its place in the window and
+ * calls on_confirm, before the PCPS_DATA_confirm callback runs as usual.
+ *
+ * The window should not exceed the number of frames the device can queue for
+ * transmission, or the surplus is rejected with MAC_TRANSACTION_OVERFLOW.
+ *
+ * One thread may submit while another dispatches confirms; submission itself
+ * is not reentrant.
+ *
+ * Every PCPS-DATA.confirm is matched by handle alone, so a PSDU sent with
+ * PCPS_DATA_request directly while the transmitter is attached must not use
+ * a handle of a PSDU in flight: its confirm would complete that PSDU instead.
+ ******************************************************************************/
+struct ca821x_pcps_tx {
+	uint8_t                 window;      /**< PSDUs allowed in flight */
+	uint8_t                 next_handle; /**< Next PsduHandle to try */
+	/** Called with each matched confirm if not NULL */
+	ca821x_pcps_confirm_fn  on_confirm;
+	/** Submit to confirm latency, recorded under SPI_PCPS_DATA_REQUEST if
+	 *  not NULL (see ca821x_sync_stats.h). The statistics are kept per full
+	 *  command id, so they may be the device's sync_stats: PCPS latencies do
+	 *  not mix with those of SPI_MLME_RESET_REQUEST, whose message id code
+	 *  is the same */
+	struct ca821x_sync_stats *latency;
+	struct ca821x_pcps_slot slots[CA821X_PCPS_MAX_WINDOW];
+
+	/* Statistics */
+	ca821x_atomic32_t       submitted;   /**< PSDUs passed to the device */
+	ca821x_atomic32_t       confirmed;   /**< Confirms with MAC_SUCCESS */
+	ca821x_atomic32_t       failed;      /**< Confirms with another status */
+	ca821x_atomic32_t       unmatched;   /**< Confirms for no PSDU in flight */
+};
+
+int ca821x_pcps_tx_init(
+	struct ca821x_pcps_tx  *tx,
+	uint8_t                 window,
+	ca821x_pcps_confirm_fn  on_confirm
+);
+
+int ca821x_pcps_tx_submit(
+	const uint8_t     *psdu,
+	uint8_t            len,
+	uint8_t            txopts,
+	void              *context,
+	struct ca821x_dev *pDeviceRef
+);
+
+size_t ca821x_pcps_tx_submit_batch(
+	const struct ca821x_pcps_psdu *psdus,
+	size_t                         count,
+	struct ca821x_dev             *pDeviceRef
+);
+
+int ca821x_pcps_tx_confirm(
+	struct ca821x_pcps_tx               *tx,
+	const struct PCPS_DATA_confirm_pset *params,
+	struct ca821x_dev                   *pDeviceRef
+);
+
+unsigned ca821x_pcps_tx_in_flight(struct ca821x_pcps_tx *tx);
+
+#endif // CASCODA_CA_VER >= 8211
+
+#endif // CA821X_PCPS_H
@@ -0,0 +1,143 @@
+/**
+ * @file ca821x_rxfilter.h
+ * @brief Host-side receive filter compiled to bytecode, for promiscuous mode.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_RXFILTER_H
+#define CA821X_RXFILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+#include "mac_messages.h"
+
+/** Address sets of a filter */
+#define CA821X_RXF_SETS         (4)
+/** Short and, separately, extended addresses each set can hold */
+#define CA821X_RXF_SET_MAX      (64)
+/** 64 bit words of the Bloom filter of each set */
+#define CA821X_RXF_BLOOM_WORDS  (8)
+/** Instructions a filter's program can hold */
+#define CA821X_RXF_MAX_INSNS    (64)
+
+/** What a rule does with the frames it matches */
+enum ca821x_rxf_action {
+	CA821X_RXF_DROP   = 0,
+	CA821X_RXF_ACCEPT = 1
+};
+
+/** Conditions of a ca821x_rxfilter_rule */
+enum ca821x_rxf_match {
+	CA821X_RXF_SRC_IN = 0x01, //!< Source address is in src_set
+	CA821X_RXF_DST_IN = 0x02, //!< Destination address is in dst_set
+	CA821X_RXF_PAN    = 0x04, //!< Destination PAN id is pan_id
+	CA821X_RXF_TYPE   = 0x08, //!< Frame type is in types
+	CA821X_RXF_LEN    = 0x10, //!< MSDU or PSDU length in len_min to len_max
+	CA821X_RXF_LQI    = 0x20  //!< Link quality at least lqi_min
+};
+
+/***************************************************************************//**
+ * \brief A rule of a receive filter, matching frames meeting all of its
+ *        conditions
+ *
+ * For an MCPS-DATA.indication, the frame type is data, the length is the
+ * MsduLength and the link quality is the MpduLinkQuality. For a
+ * PCPS-DATA.indication, these come from the decoded PSDU, its PsduLength and
+ * its ED value, as the indication carries no LQI; a malformed PSDU has no
+ * frame type or addresses, so matches only length and link quality.
+ ******************************************************************************/
+struct ca821x_rxfilter_rule {
+	uint8_t match;     /**< enum ca821x_rxf_match flags, 0: every frame */
+	uint8_t action;    /**< enum ca821x_rxf_action */
+	uint8_t src_set;   /**< Address set of CA821X_RXF_SRC_IN */
+	uint8_t dst_set;   /**< Address set of CA821X_RXF_DST_IN */
+	uint8_t pan_id[2];
+	uint8_t types;     /**< Bit (1 << MAC_FC_FT_*) for each type matched */
+	uint8_t len_min;
+	uint8_t len_max;
+	uint8_t lqi_min;
+};
+
+/** A set of addresses, short ones qualified by their PAN id */
+struct ca821x_rxf_set {
+	uint64_t bloom[CA821X_RXF_BLOOM_WORDS];
+	uint8_t  num_short;
+	uint8_t  num_ext;
+	uint32_t shorts[CA821X_RXF_SET_MAX]; /**< PAN id << 16 | address, sorted */
+	uint64_t exts[CA821X_RXF_SET_MAX];   /**< Sorted */
+};
+
+/** One step of a filter program */
+struct ca821x_rxf_insn {
+	uint8_t op;       /**< Condition tested, or return */
+	uint8_t arg;      /**< Set, or action returned */
+	uint8_t fail;     /**< Instruction to continue at if the test fails */
+	uint8_t lo;
+	uint8_t hi;
+};
+
+/***************************************************************************//**
+ * \brief Receive filter applied to data indications before dispatch
+ *
+ * With macPromiscuousMode set, the device passes every frame it hears to the
+ * host. Attach a filter initialised with ca821x_rxfilter_init by pointing
+ * pDeviceRef->rxfilter at it to drop the irrelevant ones in
+ * ca821x_downstream_dispatch, before taps (such as captures), subscriptions
+ * or callbacks see them. MCPS-DATA and PCPS-DATA indications are filtered;
+ * other commands are always dispatched.
+ *
+ * Rules are tried in the order they were added, and the first that matches
+ * a frame decides its fate. Frames no rule matches get the default action.
+ * Each rule is compiled when added into a few instructions, cheapest
+ * conditions first. Address sets are tested through a Bloom filter, so an
+ * address outside a set is usually rejected without searching it.
+ *
+ * Rules and addresses must not be added while the exchange may be
+ * dispatching frames to the device.
+ ******************************************************************************/
+struct ca821x_rxfilter {
+	uint8_t                num_insns;
+	struct ca821x_rxf_insn program[CA821X_RXF_MAX_INSNS];
+	struct ca821x_rxf_set  sets[CA821X_RXF_SETS];
+
+	/* Statistics */
+	ca821x_atomic32_t      accepted;
+	ca821x_atomic32_t      dropped;
+};
+
+void ca821x_rxfilter_init(struct ca821x_rxfilter *filter, uint8_t default_action);
+
+int ca821x_rxfilter_add_addr(
+	struct ca821x_rxfilter *filter,
+	uint8_t                 set,
+	const struct FullAddr  *addr
+);
+
+int ca821x_rxfilter_add_rule(
+	struct ca821x_rxfilter            *filter,
+	const struct ca821x_rxfilter_rule *rule
+);
+
+int ca821x_rxfilter_check(
+	struct ca821x_rxfilter *filter,
+	const uint8_t          *buf,
+	size_t                  len
+);
+
+#endif // CA821X_RXFILTER_H
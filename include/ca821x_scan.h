@@ -0,0 +1,73 @@
+/**
+ * @file ca821x_scan.h
+ * @brief Iteration over the result list of an MLME-SCAN confirm.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SCAN_H
+#define CA821X_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "mac_messages.h"
+
+/***************************************************************************//**
+ * \brief Position in the result list of an MLME-SCAN confirm
+ *
+ * The result list of a scan confirm continues past the declared ResultList
+ * array to the end of the upstream frame: one byte per channel for an energy
+ * detect scan, or one PAN descriptor of PAN_DESCRIPTOR_BASE_SIZE or
+ * sizeof(struct PanDescriptor) bytes per coordinator for an active or passive
+ * scan. The iterator reads the results in place, bounded by the message
+ * length, so no result is truncated and none is read past the frame.
+ ******************************************************************************/
+struct ca821x_scan_iter {
+	const uint8_t *next;      /**< Next unread result */
+	const uint8_t *end;       /**< End of the result list */
+	uint8_t        remaining; /**< Results not yet read */
+	uint8_t        scan_type; /**< ScanType of the confirm */
+};
+
+/***************************************************************************//**
+ * \brief Parameter length of a scan confirm passed to a callback
+ *******************************************************************************
+ * ca821x_downstream_dispatch passes the parameter set of a confirm in place
+ * in the upstream frame, so its length is the byte before it. Only valid for
+ * a parameter set received by an MLME_SCAN_confirm callback.
+ ******************************************************************************/
+#define CA821X_SCAN_CNF_LEN(scan_cnf)   (((const uint8_t *)(scan_cnf))[-1])
+
+int ca821x_scan_iter_init(
+	struct ca821x_scan_iter             *it,
+	const struct MLME_SCAN_confirm_pset *scan_cnf,
+	size_t                               len
+);
+
+const struct PanDescriptor *ca821x_scan_next_pan(struct ca821x_scan_iter *it);
+
+int ca821x_scan_next_ed(struct ca821x_scan_iter *it);
+
+size_t ca821x_pan_descriptor_len(const struct PanDescriptor *pdesc);
+
+size_t ca821x_scan_filter_lqi(
+	struct MLME_SCAN_confirm_pset *scan_cnf,
+	size_t                         len,
+	uint8_t                        lqi_limit
+);
+
+#endif // CA821X_SCAN_H
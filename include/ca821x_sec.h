@@ -0,0 +1,108 @@
+/**
+ * @file ca821x_sec.h
+ * @brief Host-side 802.15.4 frame security (CCM*) for raw PSDUs.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SEC_H
+#define CA821X_SEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_aes.h"
+#include "ca821x_frame.h"
+#include "mac_messages.h"
+
+/** Length of a CCM* nonce: source address, frame counter, security level */
+#define CA821X_SEC_NONCE_LEN    (13)
+
+/***************************************************************************//**
+ * \brief Host copy of the MAC key table
+ *
+ * Mirrors macKeyTable and macDefaultKeySource so that a host-side MAC using
+ * the raw PHY (PCPS) can secure and unsecure frames itself. Keys are added
+ * with ca821x_sec_keytab_set, which also expands them for AES.
+ *
+ * Keys are looked up by their KeyIdLookupList only; the KeyDeviceList and
+ * KeyUsageList are kept but not enforced, and incoming frame counters are
+ * not checked against any device table.
+ ******************************************************************************/
+struct ca821x_sec_keytab {
+	uint8_t                entries;               /**< macKeyTableEntries */
+	uint8_t                default_key_source[8]; /**< macDefaultKeySource */
+	struct M_KeyDescriptor desc[KEY_TABLE_SIZE];  /**< macKeyTable */
+	struct ca821x_aes_key  sched[KEY_TABLE_SIZE]; /**< Expanded Key of each */
+};
+
+void ca821x_sec_keytab_init(struct ca821x_sec_keytab *tab);
+
+int ca821x_sec_keytab_set(
+	struct ca821x_sec_keytab     *tab,
+	uint8_t                       index,
+	const struct M_KeyDescriptor *desc
+);
+
+int ca821x_sec_key_lookup(
+	const struct ca821x_sec_keytab *tab,
+	uint8_t                         key_id_mode,
+	const uint8_t                  *key_source,
+	uint8_t                         key_index,
+	const struct FullAddr          *addr
+);
+
+void ca821x_ccm_star_seal(
+	const struct ca821x_aes_key *key,
+	const uint8_t               *nonce,
+	const uint8_t               *a,
+	size_t                       a_len,
+	uint8_t                     *m,
+	size_t                       m_len,
+	uint8_t                     *mic,
+	uint8_t                      mic_len
+);
+
+int ca821x_ccm_star_open(
+	const struct ca821x_aes_key *key,
+	const uint8_t               *nonce,
+	const uint8_t               *a,
+	size_t                       a_len,
+	uint8_t                     *m,
+	size_t                       m_len,
+	const uint8_t               *mic,
+	uint8_t                      mic_len
+);
+
+int ca821x_sec_frame_build(
+	const struct ca821x_sec_keytab *tab,
+	uint8_t                        *buf,
+	size_t                          size,
+	const struct ca821x_frame_hdr  *hdr,
+	const uint8_t                  *payload,
+	size_t                          payload_len,
+	const uint8_t                  *ext_addr
+);
+
+int ca821x_sec_frame_open(
+	const struct ca821x_sec_keytab *tab,
+	struct ca821x_frame            *frame,
+	uint8_t                        *psdu,
+	size_t                          len,
+	int                             has_fcs,
+	const uint8_t                  *src_ext_addr
+);
+
+#endif // CA821X_SEC_H
@@ -0,0 +1,97 @@
+/**
+ * @file ca821x_sec_mirror.h
+ * @brief Host mirror of the MAC security tables, synchronised by difference.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SEC_MIRROR_H
+#define CA821X_SEC_MIRROR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_sec.h"
+#include "mac_messages.h"
+
+/** Most MLME-SET.requests one synchronisation can take: every entry, the
+ *  three entry counts and macDefaultKeySource */
+#define CA821X_SEC_MAX_SETS     (DEVICE_TABLE_SIZE + SECURITY_LEVEL_TABLE_SIZE + \
+                                 KEY_TABLE_SIZE + 4)
+
+/***************************************************************************//**
+ * \brief Contents of the MAC security tables
+ *
+ * The keys, with macDefaultKeySource, are a ca821x_sec_keytab, so the same
+ * tables also serve ca821x_sec_frame_build and ca821x_sec_frame_open.
+ ******************************************************************************/
+struct ca821x_sec_tables {
+	struct ca821x_sec_keytab         keys;
+	uint8_t                          device_entries; /**< macDeviceTableEntries */
+	struct M_DeviceDescriptor        devices[DEVICE_TABLE_SIZE];
+	uint8_t                          level_entries;  /**< macSecurityLevelTableEntries */
+	struct M_SecurityLevelDescriptor levels[SECURITY_LEVEL_TABLE_SIZE];
+};
+
+/***************************************************************************//**
+ * \brief What a device's security tables are known to hold
+ *
+ * The application edits its own ca821x_sec_tables freely, for instance
+ * rewriting them whole after a change of membership, and passes them to
+ * ca821x_sec_mirror_sync. Only the entries that differ from the mirror, and
+ * the entry counts that changed, are then written to the device.
+ *
+ * Entries are compared whole, except that the device advances the
+ * FrameCounter of its device descriptors as frames arrive: a device
+ * descriptor is only rewritten for its FrameCounter if the tables hold a
+ * larger one, and a rewrite never lowers the counter the device holds (see
+ * ca821x_sec_mirror_sync). dev.keys is kept expanded, so it can secure
+ * frames as the device would.
+ ******************************************************************************/
+struct ca821x_sec_mirror {
+	struct ca821x_sec_tables dev;     /**< Tables as written to the device */
+	uint32_t device_known;            /**< Entries of dev.devices that are valid */
+	uint8_t  level_known;             /**< Entries of dev.levels that are valid */
+	uint8_t  key_known;               /**< Entries of dev.keys that are valid */
+	uint8_t  key_source_known;        /**< dev.keys.default_key_source is valid */
+};
+
+/** An MLME-SET.request planned by ca821x_sec_mirror_plan */
+struct ca821x_sec_set {
+	uint8_t attribute; /**< PIB attribute */
+	uint8_t index;     /**< Table index, 0 for entry counts */
+};
+
+void ca821x_sec_tables_init(struct ca821x_sec_tables *tables);
+
+void ca821x_sec_mirror_init(struct ca821x_sec_mirror *mirror);
+
+size_t ca821x_sec_key_encode(const struct M_KeyDescriptor *desc, uint8_t *buf);
+
+size_t ca821x_sec_mirror_plan(
+	const struct ca821x_sec_mirror *mirror,
+	const struct ca821x_sec_tables *want,
+	struct ca821x_sec_set          *sets,
+	size_t                          max
+);
+
+uint8_t ca821x_sec_mirror_sync(
+	struct ca821x_sec_mirror       *mirror,
+	const struct ca821x_sec_tables *want,
+	struct ca821x_dev              *pDeviceRef
+);
+
+#endif // CA821X_SEC_MIRROR_H
@@ -0,0 +1,130 @@
+/**
+ * @file ca821x_subscribe.h
+ * @brief Registry of filtered handlers for dispatched frames.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SUBSCRIBE_H
+#define CA821X_SUBSCRIBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "mac_messages.h"
+
+/** Handlers of each row of the registry, a row holding the command ids that
+ *  are equal under SPI_MID_MASK */
+#define CA821X_SUB_PER_ROW      (4)
+/** Rows of the registry */
+#define CA821X_SUB_ROWS         (SPI_MID_MASK + 1)
+/** Most comparisons a compiled filter can need */
+#define CA821X_SUB_CHECKS       (5)
+
+/** Fields a ca821x_sub_filter matches on */
+enum ca821x_sub_match {
+	CA821X_SUB_SRC    = 1, //!< Source address
+	CA821X_SUB_DST    = 2, //!< Destination address
+	CA821X_SUB_PAN    = 4, //!< PAN id of the frame
+	CA821X_SUB_HANDLE = 8  //!< MsduHandle or PsduHandle range
+};
+
+/***************************************************************************//**
+ * \brief Frames a handler is called with
+ *
+ * An address matches on its AddressMode and Address, and for a short address
+ * on its PAN id. The PAN id of the frame is its destination PAN id, or for a
+ * beacon the coordinator's. Filters apply to these command ids:
+ * - SPI_MCPS_DATA_INDICATION and SPI_MLME_POLL_INDICATION: source,
+ *   destination and PAN id
+ * - SPI_MLME_COMM_STATUS_INDICATION: source, destination and PAN id
+ * - SPI_MLME_BEACON_NOTIFY_INDICATION: source (the coordinator) and PAN id
+ * - SPI_MCPS_DATA_CONFIRM and SPI_PCPS_DATA_CONFIRM: handle
+ ******************************************************************************/
+struct ca821x_sub_filter {
+	uint8_t         match;      /**< enum ca821x_sub_match flags, 0: every frame */
+	struct FullAddr src;
+	struct FullAddr dst;
+	uint8_t         pan_id[2];
+	uint8_t         handle_min; /**< First handle matched */
+	uint8_t         handle_max; /**< Last handle matched */
+};
+
+/** Called with the entire frame, including command and length bytes */
+typedef void (*ca821x_sub_fn)(const uint8_t *buf, size_t len, void *context,
+                              struct ca821x_dev *pDeviceRef);
+
+/** Octets a compiled filter compares at an offset of the parameter set */
+struct ca821x_sub_check {
+	uint8_t offset;
+	uint8_t len;
+	uint8_t value[8];
+};
+
+/** A registered handler, with its filter compiled for its command id */
+struct ca821x_sub {
+	ca821x_sub_fn           fn;         /**< NULL if the entry is free */
+	void                   *context;
+	uint8_t                 cmdid;
+	uint8_t                 min_len;    /**< Shortest frame the checks fit */
+	uint8_t                 num_checks;
+	uint8_t                 handle_off; /**< 0xFF: no handle range */
+	uint8_t                 handle_min;
+	uint8_t                 handle_max;
+	struct ca821x_sub_check checks[CA821X_SUB_CHECKS];
+};
+
+/***************************************************************************//**
+ * \brief Handlers subscribed to the frames dispatched to a device
+ *
+ * Unlike ca821x_register_callbacks, which keeps one callback per command, a
+ * registry calls every handler subscribed to a frame's command id whose
+ * filter matches, so several independent consumers can share a device.
+ * Attach a registry initialised with ca821x_subs_init by pointing
+ * pDeviceRef->subs at it. ca821x_downstream_dispatch then passes each frame
+ * to the matching handlers, after the device's own checks (so frames the
+ * device drops, such as duplicates, are not seen) and before its callback.
+ *
+ * Each filter is compiled when subscribing into a few comparisons of octets
+ * at fixed offsets of the parameter set, so dispatch costs one pass over the
+ * handlers of the command, without allocation. Handlers are called in the
+ * context of the exchange, so must not block, and must not subscribe or
+ * unsubscribe while the exchange may be dispatching frames to the device.
+ ******************************************************************************/
+struct ca821x_subs {
+	struct ca821x_sub rows[CA821X_SUB_ROWS][CA821X_SUB_PER_ROW];
+};
+
+void ca821x_subs_init(struct ca821x_subs *subs);
+
+int ca821x_subscribe(
+	struct ca821x_subs             *subs,
+	uint8_t                         cmdid,
+	const struct ca821x_sub_filter *filter,
+	ca821x_sub_fn                   fn,
+	void                           *context
+);
+
+void ca821x_unsubscribe(struct ca821x_subs *subs, int id);
+
+unsigned ca821x_subs_dispatch(
+	struct ca821x_subs *subs,
+	const uint8_t      *buf,
+	size_t              len,
+	struct ca821x_dev  *pDeviceRef
+);
+
+#endif // CA821X_SUBSCRIBE_H
@@ -0,0 +1,147 @@
+/**
+ * @file ca821x_sync_stats.h
+ * @brief Latency histograms for synchronous ca821x commands.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SYNC_STATS_H
+#define CA821X_SYNC_STATS_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+
+/** Counter type of the histograms */
+typedef ca821x_atomic32_t ca821x_stat_t;
+
+/***************************************************************************//**
+ * \defgroup SyncStatsConfig Histogram layout
+ ************************************************************************** @{*/
+/** log2 of the number of linear sub-buckets per power of two (12.5% error) */
+#define SYNC_STATS_SUB_BITS     (3)
+/** Latencies of 2^SYNC_STATS_MAX_BITS ns (~68s) and above share the top bucket */
+#define SYNC_STATS_MAX_BITS     (36)
+/** Number of histogram buckets */
+#define SYNC_STATS_BUCKETS      ((SYNC_STATS_MAX_BITS - SYNC_STATS_SUB_BITS + 1) << \
+                                 SYNC_STATS_SUB_BITS)
+/**@}*/
+
+/** Command ids with a slot: the synchronous requests, and the PCPS-DATA
+ *  request whose latency a ca821x_pcps_tx may record */
+#if CASCODA_CA_VER >= 8211
+#define SYNC_STATS_PCPS_IDS(X)  X(SPI_PCPS_DATA_REQUEST)
+#else
+#define SYNC_STATS_PCPS_IDS(X)
+#endif
+#define SYNC_STATS_IDS(X) \
+	X(SPI_MCPS_PURGE_REQUEST) \
+	X(SPI_MLME_GET_REQUEST) \
+	X(SPI_MLME_RESET_REQUEST) \
+	X(SPI_MLME_RX_ENABLE_REQUEST) \
+	X(SPI_MLME_SET_REQUEST) \
+	X(SPI_MLME_START_REQUEST) \
+	X(SPI_MLME_POLL_REQUEST) \
+	X(SPI_HWME_SET_REQUEST) \
+	X(SPI_HWME_GET_REQUEST) \
+	X(SPI_HWME_HAES_REQUEST) \
+	X(SPI_TDME_SETSFR_REQUEST) \
+	X(SPI_TDME_GETSFR_REQUEST) \
+	X(SPI_TDME_TESTMODE_REQUEST) \
+	X(SPI_TDME_SET_REQUEST) \
+	X(SPI_TDME_TXPKT_REQUEST) \
+	X(SPI_TDME_LOTLK_REQUEST) \
+	SYNC_STATS_PCPS_IDS(X)
+
+#define SYNC_STATS_SLOT(id)     SYNC_SLOT_##id,
+/** Slot of each command id in SYNC_STATS_IDS */
+enum ca821x_sync_slot {
+	SYNC_STATS_IDS(SYNC_STATS_SLOT)
+	SYNC_STATS_COMMANDS  //!< Number of command slots
+};
+#undef SYNC_STATS_SLOT
+
+/** Outcome of a synchronous exchange */
+enum ca821x_sync_result {
+	SYNC_RESULT_OK,        //!< Paired confirm received
+	SYNC_RESULT_TRANSPORT, //!< ca821x_api_downstream failed
+	SYNC_RESULT_MISMATCH   //!< Response was not the paired confirm
+};
+
+/** Live counters for one synchronous command */
+struct ca821x_sync_hist {
+	ca821x_stat_t buckets[SYNC_STATS_BUCKETS]; /**< Latency histogram (ns) */
+	ca821x_stat_t max_ns;           /**< Largest latency (saturates at 2^32-1) */
+	ca821x_stat_t transport_errors; /**< MAC_SYSTEM_ERROR from the transport */
+	ca821x_stat_t mismatch_errors;  /**< MAC_SYSTEM_ERROR from a wrong response */
+};
+
+/***************************************************************************//**
+ * \brief Per-device synchronous command instrumentation
+ *
+ * Attach to a device by pointing pDeviceRef->sync_stats at an instance
+ * initialised with ca821x_sync_stats_init. Every *_request_sync call then
+ * records the time spent in ca821x_api_downstream, measured with the device
+ * clock (see ca821x_clock_t), under the id of the command sent. Without a
+ * clock, only exchange counts and errors are meaningful.
+ *
+ * Recording only increments counters, so it may run concurrently from
+ * several threads using the same device.
+ ******************************************************************************/
+struct ca821x_sync_stats {
+	struct ca821x_sync_hist cmd[SYNC_STATS_COMMANDS];
+};
+
+/** Copy of the counters for one command, see ca821x_sync_stats_snapshot */
+struct ca821x_sync_snapshot {
+	uint32_t buckets[SYNC_STATS_BUCKETS];
+	uint32_t count;            /**< Exchanges recorded, including errors */
+	uint32_t max_ns;
+	uint32_t transport_errors;
+	uint32_t mismatch_errors;
+};
+
+void ca821x_sync_stats_init(struct ca821x_sync_stats *stats);
+
+void ca821x_sync_stats_record(
+	struct ca821x_sync_stats *stats,
+	uint8_t                   cmdid,
+	uint64_t                  latency_ns,
+	enum ca821x_sync_result   result
+);
+
+int ca821x_sync_stats_snapshot(
+	struct ca821x_sync_stats    *stats,
+	uint8_t                      cmdid,
+	int                          reset,
+	struct ca821x_sync_snapshot *snapshot
+);
+
+unsigned ca821x_sync_stats_bucket(uint64_t latency_ns);
+
+uint64_t ca821x_sync_hist_percentile(
+	const uint32_t *buckets,
+	uint32_t        count,
+	uint32_t        max_ns,
+	unsigned        permille
+);
+
+uint64_t ca821x_sync_snapshot_percentile(
+	const struct ca821x_sync_snapshot *snapshot,
+	unsigned                           permille
+);
+
+#endif // CA821X_SYNC_STATS_H
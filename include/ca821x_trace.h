@@ -0,0 +1,114 @@
+/**
+ * @file ca821x_trace.h
+ * @brief Ring buffer trace of the frames exchanged with a ca821x.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_TRACE_H
+#define CA821X_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_atomic.h"
+
+/** Octets of each frame kept in a record, the rest is truncated */
+#define CA821X_TRACE_SNAPLEN    (48)
+
+/** Direction of a traced frame */
+enum ca821x_trace_dir {
+	CA821X_TRACE_DOWNSTREAM, //!< Command passed to ca821x_api_downstream
+	CA821X_TRACE_RESPONSE,   //!< Synchronous response to a downstream command
+	CA821X_TRACE_UPSTREAM    //!< Frame passed to ca821x_downstream_dispatch
+};
+
+/** One traced frame (64 octets), as passed to a ca821x_trace_dump_fn */
+struct ca821x_trace_record {
+	uint64_t timestamp_ns; /**< ca821x_get_time_ns when traced */
+	uint32_t seq;          /**< Frames traced before this one, plus one */
+	uint16_t len;          /**< Original length of the frame */
+	uint8_t  dir;          /**< enum ca821x_trace_dir */
+	uint8_t  caplen;       /**< Octets of the frame held in data */
+	uint8_t  data[CA821X_TRACE_SNAPLEN];
+};
+
+/** 64-bit words in a record */
+#define CA821X_TRACE_WORDS      (sizeof(struct ca821x_trace_record) / 8)
+
+/** Storage for one record in a trace ring. Its words are only accessed
+ *  atomically, so a record may be copied while it is being overwritten */
+struct ca821x_trace_slot {
+	ca821x_atomic64_t words[CA821X_TRACE_WORDS];
+};
+
+struct ca821x_trace;
+
+/** Called with each record by ca821x_trace_dump, oldest first */
+typedef void (*ca821x_trace_dump_fn)(
+	const struct ca821x_trace_record *record, void *context);
+
+/** Called when an exchange traced by the api fails */
+typedef void (*ca821x_trace_error_fn)(
+	struct ca821x_trace *trace, struct ca821x_dev *pDeviceRef);
+
+/***************************************************************************//**
+ * \brief Per-device trace of SPI frames
+ *
+ * Attach to a device by pointing pDeviceRef->trace at an instance initialised
+ * with ca821x_trace_init. The api then records every command passed to
+ * ca821x_api_downstream, its synchronous response, and every frame passed to
+ * ca821x_downstream_dispatch, timestamped with the device clock (see
+ * ca821x_clock_t). Once the ring is full the oldest records are overwritten.
+ *
+ * Recording claims a slot with a single atomic increment and never blocks, so
+ * frames may be traced concurrently from several threads, and dumped while
+ * they are. Records overwritten while being dumped are skipped.
+ *
+ * The ring lives in storage the application provides, so a trace is only
+ * kept once one is attached; it costs little enough to stay attached in
+ * production (see the *_traced benchmarks).
+ ******************************************************************************/
+struct ca821x_trace {
+	ca821x_atomic32_t         head;    /**< Frames traced since init */
+	struct ca821x_trace_slot *slots;
+	uint32_t                  mask;    /**< Number of slots - 1 */
+	/** Called on a failed exchange if not NULL, typically to dump the ring */
+	ca821x_trace_error_fn     on_error;
+	void                     *error_context; /**< For on_error */
+};
+
+int ca821x_trace_init(
+	struct ca821x_trace      *trace,
+	struct ca821x_trace_slot *slots,
+	size_t                    num_slots
+);
+
+void ca821x_trace_frame(
+	struct ca821x_trace   *trace,
+	enum ca821x_trace_dir  dir,
+	const uint8_t         *buf,
+	size_t                 len,
+	uint64_t               timestamp_ns
+);
+
+int ca821x_trace_dump(
+	struct ca821x_trace  *trace,
+	ca821x_trace_dump_fn  callback,
+	void                 *context
+);
+
+#endif // CA821X_TRACE_H
@@ -80,6 +80,10 @@ struct PanDescriptor {
 	struct SecSpec  Security;
 };
 
+/** Size of a PanDescriptor whose Security.SecurityLevel is 0, as the
+ *  remaining security fields are then omitted */
+#define PAN_DESCRIPTOR_BASE_SIZE    (sizeof(struct PanDescriptor) - sizeof(struct SecSpec) + 1)
+
 struct PendAddrSpec {
 	uint8_t         ShortAddrCount : 3;
 	uint8_t         /* Reserved */ : 1;
@@ -380,6 +384,10 @@ struct MLME_SCAN_confirm_pset {
 	uint8_t            ResultList[DEFAULT_RESULT_LIST_SIZE];
 };
 
+/** Size of an MLME_SCAN_confirm before its result list. The list is sized by
+ *  the message length rather than ResultList, see ca821x_scan.h */
+#define MLME_SCAN_CONFIRM_BASE_SIZE (sizeof(struct MLME_SCAN_confirm_pset)-DEFAULT_RESULT_LIST_SIZE)
+
 /** MLME_COMM_STATUS_indication parameter set */
 struct MLME_COMM_STATUS_indication_pset {
 	uint8_t            PANId[2];
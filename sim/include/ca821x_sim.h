@@ -0,0 +1,243 @@
+/**
+ * @file ca821x_sim.h
+ * @brief Software model of a CA-821X device, usable as a downstream exchange.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SIM_H
+#define CA821X_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ca821x_api.h"
+
+/***************************************************************************//**
+ * \defgroup SimConstants Simulator constants
+ ************************************************************************** @{*/
+/** Duration of one 2.4GHz O-QPSK symbol in nanoseconds */
+#define SIM_SYMBOL_NS           (aSymbolPeriod_us * 1000ULL)
+/** Duration of one octet on air in nanoseconds */
+#define SIM_OCTET_NS            (2 * SIM_SYMBOL_NS)
+/** Synchronisation header + PHY header length in octets */
+#define SIM_PHY_OVERHEAD        (6)
+/** Number of direct transmissions the device can queue */
+#define SIM_DIRECT_QUEUE_SIZE   (4)
+/** Number of indirect transmissions the device can hold */
+#define SIM_INDIRECT_QUEUE_SIZE (8)
+/** Number of SFR pages modelled */
+#define SIM_SFR_PAGES           (4)
+/** Number of HWME attributes modelled */
+#define SIM_HWME_ATTRIBUTES     (0x18)
+/** Number of TDME attributes modelled */
+#define SIM_TDME_ATTRIBUTES     (TDME_MAX_ATTRIBUTE + 1)
+/** Number of entries in the simulated PIB (see sim_pib_descs) */
+#define SIM_PIB_ATTRIBUTES      (50)
+/** Largest non-table PIB attribute, other than macBeaconPayload */
+#define SIM_PIB_MAX_LEN         (8)
+/**@}*/
+
+/******************************************************************************/
+/****** Discrete event engine                                            ******/
+/******************************************************************************/
+typedef void (*ca821x_sim_event_fn)(void *ctx, uintptr_t arg);
+
+/** A scheduled simulator event */
+struct ca821x_sim_event {
+	uint64_t            time_ns; /**< Virtual time the event fires at */
+	uint64_t            seq;     /**< Tie-breaker keeping FIFO order */
+	ca821x_sim_event_fn fn;      /**< Handler */
+	void               *ctx;     /**< Handler context */
+	uintptr_t           arg;     /**< Handler argument */
+};
+
+/***************************************************************************//**
+ * \brief Discrete event engine with a virtual clock
+ *
+ * Events are kept in a binary min-heap ordered by time, then by scheduling
+ * order. Virtual time only moves when events are run, so simulated time passes
+ * as fast as the host can process events.
+ ******************************************************************************/
+struct ca821x_sim_engine {
+	uint64_t                 now_ns;   /**< Current virtual time */
+	uint64_t                 seq;      /**< Next event sequence number */
+	struct ca821x_sim_event *heap;     /**< Pending events */
+	size_t                   count;    /**< Number of pending events */
+	size_t                   capacity; /**< Allocated heap entries */
+};
+
+int  ca821x_sim_engine_init(struct ca821x_sim_engine *engine);
+void ca821x_sim_engine_deinit(struct ca821x_sim_engine *engine);
+int  ca821x_sim_engine_move(
+	struct ca821x_sim_engine *from,
+	struct ca821x_sim_engine *to,
+	void                     *ctx
+);
+int  ca821x_sim_schedule(
+	struct ca821x_sim_engine *engine,
+	uint64_t                  delay_ns,
+	ca821x_sim_event_fn       fn,
+	void                     *ctx,
+	uintptr_t                 arg
+);
+size_t ca821x_sim_run_until(struct ca821x_sim_engine *engine, uint64_t until_ns);
+size_t ca821x_sim_run_for(struct ca821x_sim_engine *engine, uint64_t duration_ns);
+
+/******************************************************************************/
+/****** Simulated device                                                 ******/
+/******************************************************************************/
+
+/** Kinds of frame held in the simulated transmit queues */
+enum ca821x_sim_msdu_kind {
+	SIM_MSDU_DATA,        //!< MCPS-DATA payload
+	SIM_MSDU_ASSOC_REQ,   //!< Association request command
+	SIM_MSDU_ASSOC_RSP,   //!< Association response command
+	SIM_MSDU_DISASSOC,    //!< Disassociation notification command
+	SIM_MSDU_ORPHAN_RSP,  //!< Coordinator realignment in reply to an orphan
+	SIM_MSDU_REALIGN,     //!< Broadcast coordinator realignment
+	SIM_MSDU_PSDU         //!< Raw PSDU of a PCPS-DATA.request, FCS included
+};
+
+/** A queued transmission */
+struct ca821x_sim_msdu {
+	uint8_t         in_use;     /**< Slot is occupied */
+	uint8_t         kind;       /**< See \ref ca821x_sim_msdu_kind */
+	uint8_t         handle;     /**< MsduHandle or PsduHandle (data frames only) */
+	uint8_t         txopts;     /**< TxOptions */
+	uint8_t         src_mode;   /**< Source addressing mode */
+	uint8_t         status;     /**< Status carried by command frames */
+	uint8_t         retries;    /**< Transmission attempts made */
+	uint8_t         dsn;        /**< Sequence number assigned on queueing */
+	struct FullAddr dst;        /**< Destination */
+	uint8_t         len;        /**< Payload length */
+	uint8_t         data[MAX_DATA_SIZE]; /**< Payload */
+	struct SecSpec  security;   /**< Security specification */
+	uint64_t        expiry_ns;  /**< Indirect transaction expiry time */
+};
+
+/** Reception details of a frame delivered to a simulated device */
+struct ca821x_sim_rxinfo {
+	uint8_t src_mode;      /**< Source addressing mode */
+	uint8_t src_pan[2];    /**< Source PAN Id */
+	uint8_t src_addr[8];   /**< Source address */
+	uint8_t lqi;           /**< Link quality of the received frame */
+	uint8_t frame_pending; /**< Frame pending bit of the received frame */
+};
+
+struct ca821x_sim_medium;
+
+/***************************************************************************//**
+ * \brief State of a simulated CA-821X
+ *
+ * Models the PIB (including the security tables), HWME and TDME attributes,
+ * the SFR pages and the direct/indirect MSDU queues. Synchronous commands are
+ * answered immediately. Asynchronous confirms and indications are generated
+ * as events on the engine, at the virtual time a real device would produce
+ * them, and delivered through ca821x_downstream_dispatch.
+ *
+ * Without a medium attached, the device behaves as if a perfect peer were in
+ * range: every acknowledged transmission succeeds after CSMA-CA and air time,
+ * and scans find no beacons. With a medium (see ca821x_sim_medium.h), frames
+ * are exchanged with the other devices on it.
+ *
+ * On CA8211, PSDUs sent with PCPS-DATA.request share the direct queue. A
+ * receiver accepts one if it decodes as a MAC frame addressed to it, and
+ * reports it with a PCPS-DATA.indication.
+ *
+ * The device's clock (see ca821x_clock_t) reads the virtual time of the
+ * engine, so timing measured through the API is reproducible.
+ ******************************************************************************/
+struct ca821x_sim {
+	struct ca821x_dev        *pDeviceRef; /**< Device the simulator serves */
+	struct ca821x_sim_engine *engine;     /**< Event engine and clock */
+	struct ca821x_sim_medium *medium;     /**< Shared radio medium, or NULL */
+	uint32_t                  prng;       /**< xorshift32 state */
+
+	/* PIB */
+	uint8_t  pib[SIM_PIB_ATTRIBUTES][SIM_PIB_MAX_LEN];
+	uint8_t  beacon_payload[aMaxBeaconPayloadLength];
+	struct M_DeviceDescriptor        device_table[DEVICE_TABLE_SIZE];
+	struct M_SecurityLevelDescriptor seclevel_table[SECURITY_LEVEL_TABLE_SIZE];
+	uint8_t  key_table[KEY_TABLE_SIZE][sizeof(struct M_KeyDescriptor)];
+	uint8_t  key_table_len[KEY_TABLE_SIZE];
+
+	/* HWME/TDME */
+	uint8_t  hwme[SIM_HWME_ATTRIBUTES][MAX_HWME_ATTRIBUTE_SIZE];
+	uint8_t  hwme_len[SIM_HWME_ATTRIBUTES];
+	uint8_t  tdme[SIM_TDME_ATTRIBUTES][MAX_TDME_ATTRIBUTE_SIZE];
+	uint8_t  testmode;
+	uint8_t  sfr[SIM_SFR_PAGES][256];
+
+	/* MAC state */
+	struct ca821x_sim_msdu direct[SIM_DIRECT_QUEUE_SIZE];
+	struct ca821x_sim_msdu indirect[SIM_INDIRECT_QUEUE_SIZE];
+	uint8_t  direct_head;    /**< Index of the frame being transmitted */
+	uint8_t  direct_count;   /**< Frames in the direct queue */
+	uint8_t  tx_busy;        /**< A direct transmission is in progress */
+	uint8_t  scan_busy;      /**< A scan is in progress */
+	uint8_t  scan_type;      /**< ScanType of the scan in progress */
+	uint32_t scan_channels;  /**< ScanChannels of the scan in progress */
+	uint8_t  pan_coordinator; /**< Started as PAN coordinator */
+	uint8_t  started;        /**< Started as a (beaconing) coordinator */
+	uint8_t  assoc_pending;  /**< Waiting for an association response */
+	uint8_t  poll_pending;   /**< A polled frame is about to be delivered */
+	uint32_t generation;     /**< Incremented on reset to discard stale events */
+	struct FullAddr          assoc_coord; /**< Coordinator being associated to */
+	struct ca821x_sim_msdu   poll_msdu;   /**< Frame retrieved by the last poll */
+	struct ca821x_sim_rxinfo poll_info;   /**< Reception details of poll_msdu */
+	struct MAC_Message       scan_cnf;    /**< Scan confirm being assembled */
+	uint8_t                  wait_cmdid;  /**< Command awaited by wait_for_message */
+	uint8_t                 *wait_buf;    /**< Its destination, NULL if not waiting */
+
+	/** Background ED level per channel reported by energy scans */
+	uint8_t  channel_ed[M_MaximumChannel - M_MinimumChannel + 1];
+
+	/* Statistics */
+	uint32_t frames_tx;      /**< Frames that went on air */
+	uint32_t frames_rx;      /**< Frames received from the medium */
+	uint32_t upstream_count; /**< Messages delivered to dispatch */
+};
+
+int ca821x_sim_init(
+	struct ca821x_sim        *sim,
+	struct ca821x_sim_engine *engine,
+	uint32_t                  seed,
+	struct ca821x_dev        *pDeviceRef
+);
+
+int ca821x_sim_exchange(
+	const uint8_t     *buf,
+	size_t             len,
+	uint8_t           *response,
+	struct ca821x_dev *pDeviceRef
+);
+
+int ca821x_sim_wait_for_message(
+	uint8_t            cmdid,
+	int                timeout_ms,
+	uint8_t           *buf,
+	struct ca821x_dev *pDeviceRef
+);
+
+uint8_t ca821x_sim_get_pib(
+	struct ca821x_sim *sim,
+	uint8_t            attribute,
+	uint8_t            index,
+	uint8_t           *len,
+	uint8_t           *value
+);
+
+#endif // CA821X_SIM_H
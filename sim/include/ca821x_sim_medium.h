@@ -0,0 +1,138 @@
+/**
+ * @file ca821x_sim_medium.h
+ * @brief Shared radio medium connecting many simulated CA-821X devices.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SIM_MEDIUM_H
+#define CA821X_SIM_MEDIUM_H
+
+#include <stdint.h>
+
+#include "ca821x_api.h"
+#include "ca821x_sim.h"
+
+/***************************************************************************//**
+ * \defgroup SimMediumDefaults Simulated medium defaults
+ ************************************************************************** @{*/
+/** Path loss at the 1m reference distance (dB) */
+#define SIM_MEDIUM_DEF_PL0_DB           (40.0)
+/** Log-distance path loss exponent */
+#define SIM_MEDIUM_DEF_EXPONENT         (3.0)
+/** Standard deviation of per-link log-normal shadowing (dB) */
+#define SIM_MEDIUM_DEF_SHADOWING_DB     (0.0)
+/** Weakest signal that can be received (dBm) */
+#define SIM_MEDIUM_DEF_SENSITIVITY_DBM  (-97.0)
+/** Energy above which CCA reports the channel busy (dBm) */
+#define SIM_MEDIUM_DEF_CCA_DBM          (-82.0)
+/** Signal to interference ratio needed to receive a frame (dB) */
+#define SIM_MEDIUM_DEF_CAPTURE_DB       (5.0)
+/** Receiver noise floor (dBm) */
+#define SIM_MEDIUM_DEF_NOISE_DBM        (-100.0)
+/** Highest transmit power assumed when building the link table (dBm) */
+#define SIM_MEDIUM_MAX_TX_DBM           (10)
+/** Virtual time between synchronisation points of the partitions */
+#define SIM_MEDIUM_DEF_EPOCH_NS         (10000000ULL)
+/**@}*/
+
+/** Radio propagation parameters of a medium */
+struct ca821x_sim_radio {
+	double pl0_db;          /**< Path loss at 1m */
+	double exponent;        /**< Path loss exponent */
+	double shadowing_db;    /**< Per-link shadowing standard deviation */
+	double sensitivity_dbm; /**< Receiver sensitivity */
+	double cca_dbm;         /**< CCA energy threshold */
+	double capture_db;      /**< Required signal to interference ratio */
+	double noise_dbm;       /**< Noise floor */
+};
+
+/** Counters accumulated over the lifetime of a medium */
+struct ca821x_sim_medium_stats {
+	uint64_t frames;        /**< Frames put on air (excluding acks) */
+	uint64_t acks;          /**< Acknowledgements put on air */
+	uint64_t receptions;    /**< Frames received intact */
+	uint64_t collisions;    /**< Receptions lost to interference */
+	uint64_t cca_busy;      /**< CCAs that found the channel busy */
+	uint64_t ack_timeouts;  /**< Transmissions that saw no acknowledgement */
+	uint64_t polls;         /**< Data requests resolved */
+	uint64_t moves;         /**< Devices that changed partition */
+	uint64_t epochs;        /**< Synchronisation points passed */
+};
+
+/***************************************************************************//**
+ * \brief A shared simulated radio medium
+ *
+ * Devices are placed at fixed 2D positions (in metres). Link gains follow a
+ * log-distance path loss model with optional symmetric shadowing and are
+ * computed once, using a spatial grid, before the first run after devices
+ * are added. Transmissions raise the energy seen by every device in range;
+ * this drives CCA, collisions (a reception fails if its signal to
+ * interference ratio falls below capture_db) and the reported LQI.
+ *
+ * Devices that cannot hear each other are never simulated together. The
+ * medium is split into partitions, one per channel and connected component
+ * of the link graph, each with its own event engine. Partitions run in
+ * parallel on worker threads for one epoch at a time. Channel changes and
+ * scan results, which cross partitions, are applied at the next epoch
+ * boundary, so they may be delayed by up to one epoch.
+ *
+ * Device callbacks run on worker threads and may only issue requests to
+ * their own device. Between runs, any device may be used from the calling
+ * thread. Data requests to a coordinator are resolved at the instant they
+ * are made, including for the automatic request after association.
+ ******************************************************************************/
+struct ca821x_sim_medium;
+
+struct ca821x_sim_medium *ca821x_sim_medium_create(
+	const struct ca821x_sim_radio *radio,
+	uint32_t                       seed,
+	unsigned                       num_threads
+);
+
+void ca821x_sim_medium_destroy(struct ca821x_sim_medium *medium);
+
+struct ca821x_dev *ca821x_sim_medium_add_node(
+	struct ca821x_sim_medium *medium,
+	double                    x,
+	double                    y
+);
+
+uint32_t ca821x_sim_medium_num_nodes(struct ca821x_sim_medium *medium);
+
+struct ca821x_dev *ca821x_sim_medium_get_dev(
+	struct ca821x_sim_medium *medium,
+	uint32_t                  id
+);
+
+struct ca821x_sim *ca821x_sim_medium_get_sim(
+	struct ca821x_sim_medium *medium,
+	uint32_t                  id
+);
+
+void ca821x_sim_medium_set_epoch(struct ca821x_sim_medium *medium, uint64_t epoch_ns);
+
+int ca821x_sim_medium_run_until(struct ca821x_sim_medium *medium, uint64_t until_ns);
+
+int ca821x_sim_medium_run_for(struct ca821x_sim_medium *medium, uint64_t duration_ns);
+
+uint64_t ca821x_sim_medium_now(struct ca821x_sim_medium *medium);
+
+void ca821x_sim_medium_get_stats(
+	struct ca821x_sim_medium       *medium,
+	struct ca821x_sim_medium_stats *stats
+);
+
+#endif // CA821X_SIM_MEDIUM_H
@@ -0,0 +1,1862 @@
+/**
+ * @file ca821x_sim.c
+ * @brief Software model of a CA-821X device, usable as a downstream exchange.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_fcs.h"
+#include "ca821x_frame.h"
+#include "ca821x_sim.h"
+#include "ca821x_sim_private.h"
+
+/** Pack an event argument, tagging it with the current generation */
+#define SIM_ARG(sim, v)     ((((uintptr_t)(sim)->generation & 0xFFFF) << 16) | ((v) & 0xFFFF))
+/** Extract the value from a packed event argument */
+#define SIM_ARG_VAL(arg)    ((arg) & 0xFFFF)
+/** True if a packed event argument predates the last reset */
+#define SIM_ARG_STALE(sim, arg) ((((arg) >> 16) & 0xFFFF) != ((sim)->generation & 0xFFFF))
+
+/** Description of a non-table PIB attribute */
+struct sim_pib_desc {
+	uint8_t  attribute; /**< PIB attribute id */
+	uint8_t  len;       /**< Length in octets */
+	uint32_t def;       /**< Default, little-endian (fill octet if len > 4) */
+};
+
+/** Simulated PIB attributes and their 802.15.4-2006 defaults */
+static const struct sim_pib_desc sim_pib_descs[] = {
+	{phyCurrentChannel,             1, 11},
+	{phyChannelsSupport,            4, M_ValidChannels},
+	{phyTransmitPower,              1, 8},
+	{phyCCAMode,                    1, 1},
+	{phyCurrentPage,                1, 0},
+	{phyMaxFrameDuration,           2, MAX_FRAME_DURATION},
+	{phySHRDuration,                1, 10},
+	{phySymbolsPerOctet,            1, 2},
+	{macAckWaitDuration,            1, 54},
+	{macAssociationPermit,          1, 0},
+	{macAutoRequest,                1, 1},
+	{macBattLifeExt,                1, 0},
+	{macBattLifeExtPeriods,         1, 6},
+	{macBeaconPayload,              0, 0},
+	{macBeaconPayloadLength,        1, 0},
+	{macBeaconOrder,                1, 15},
+	{macBeaconTxTime,               4, 0},
+	{macBSN,                        1, 0},
+	{macCoordExtendedAddress,       8, 0},
+	{macCoordShortAddress,          2, 0xFFFF},
+	{macDSN,                        1, 0},
+	{macGTSPermit,                  1, 0},
+	{macMaxCSMABackoffs,            1, 4},
+	{macMinBE,                      1, 3},
+	{macPANId,                      2, 0xFFFF},
+	{macPromiscuousMode,            1, 0},
+	{macRxOnWhenIdle,               1, 0},
+	{macShortAddress,               2, 0xFFFF},
+	{macSuperframeOrder,            1, 15},
+	{macTransactionPersistenceTime, 2, 0x01F4},
+	{macAssociatedPANCoord,         1, 0},
+	{macMaxBE,                      1, 5},
+	{macMaxFrameTotalWaitTime,      2, 1220},
+	{macMaxFrameRetries,            1, 3},
+	{macResponseWaitTime,           1, 32},
+	{macSyncSymbolOffset,           2, 0},
+	{macTimestampSupported,         1, 1},
+	{macSecurityEnabled,            1, 0},
+	{macKeyTableEntries,            1, 0},
+	{macDeviceTableEntries,         1, 0},
+	{macSecurityLevelTableEntries,  1, 0},
+	{macFrameCounter,               4, 0},
+	{macAutoRequestSecurityLevel,   1, 6},
+	{macAutoRequestKeyIdMode,       1, 0},
+	{macAutoRequestKeySource,       8, 0xFF},
+	{macAutoRequestKeyIndex,        1, 0},
+	{macDefaultKeySource,           8, 0xFF},
+	{macPANCoordExtendedAddress,    8, 0},
+	{macPANCoordShortAddress,       2, 0},
+	{nsIEEEAddress,                 8, 0},
+};
+
+typedef char sim_pib_size_check[
+	(sizeof(sim_pib_descs) / sizeof(sim_pib_descs[0]) == SIM_PIB_ATTRIBUTES) ? 1 : -1];
+
+static int sim_pib_index(uint8_t attribute)
+{
+	int i;
+
+	for (i = 0; i < SIM_PIB_ATTRIBUTES; i++) {
+		if (sim_pib_descs[i].attribute == attribute)
+			return i;
+	}
+	return -1;
+}
+
+static uint8_t *sim_pib(struct ca821x_sim *sim, uint8_t attribute)
+{
+	int i = sim_pib_index(attribute);
+
+	return i < 0 ? NULL : sim->pib[i];
+}
+
+static uint8_t sim_pib_u8(struct ca821x_sim *sim, uint8_t attribute)
+{
+	return sim_pib(sim, attribute)[0];
+}
+
+static uint16_t sim_pib_u16(struct ca821x_sim *sim, uint8_t attribute)
+{
+	return GETLE16(sim_pib(sim, attribute));
+}
+
+static uint32_t sim_rand(struct ca821x_sim *sim)
+{
+	uint32_t x = sim->prng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->prng = x;
+	return x;
+}
+
+static uint32_t sim_symbol_time(struct ca821x_sim *sim)
+{
+	return (uint32_t)(sim->engine->now_ns / SIM_SYMBOL_NS);
+}
+
+/** Device clock backed by the simulator's virtual time */
+static uint64_t sim_clock(struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_sim *sim = pDeviceRef->clock_context;
+
+	return sim->engine->now_ns;
+}
+
+/** Current channel of a simulated device */
+uint8_t ca821x_sim_channel(struct ca821x_sim *sim)
+{
+	return sim_pib_u8(sim, phyCurrentChannel);
+}
+
+/** Transmit power of a simulated device in dBm */
+int8_t ca821x_sim_tx_power(struct ca821x_sim *sim)
+{
+	uint8_t power = sim_pib_u8(sim, phyTransmitPower) & 0x3F;
+
+	/* 6-bit two's complement */
+	return (int8_t)(power & 0x20 ? power | 0xC0 : power);
+}
+
+uint8_t ca821x_sim_pib_u8(struct ca821x_sim *sim, uint8_t attribute)
+{
+	return sim_pib_u8(sim, attribute);
+}
+
+uint16_t ca821x_sim_pib_u16(struct ca821x_sim *sim, uint8_t attribute)
+{
+	return sim_pib_u16(sim, attribute);
+}
+
+const uint8_t *ca821x_sim_extaddr(struct ca821x_sim *sim)
+{
+	return sim_pib(sim, nsIEEEAddress);
+}
+
+uint32_t ca821x_sim_rand(struct ca821x_sim *sim)
+{
+	return sim_rand(sim);
+}
+
+static void sim_reset_pib(struct ca821x_sim *sim)
+{
+	int i;
+	uint8_t extaddr[8];
+
+	/* The IEEE address is burnt in and survives a PIB reset */
+	memcpy(extaddr, sim_pib(sim, nsIEEEAddress), 8);
+	for (i = 0; i < SIM_PIB_ATTRIBUTES; i++) {
+		const struct sim_pib_desc *desc = &sim_pib_descs[i];
+		if (desc->len > 4)
+			memset(sim->pib[i], desc->def & 0xFF, SIM_PIB_MAX_LEN);
+		else
+			PUTLE32(desc->def, sim->pib[i]);
+	}
+	memcpy(sim_pib(sim, nsIEEEAddress), extaddr, 8);
+	sim_pib(sim, macDSN)[0] = sim_rand(sim);
+	sim_pib(sim, macBSN)[0] = sim_rand(sim);
+
+	memset(sim->beacon_payload, 0, sizeof(sim->beacon_payload));
+	memset(sim->device_table, 0, sizeof(sim->device_table));
+	memset(sim->seclevel_table, 0, sizeof(sim->seclevel_table));
+	memset(sim->key_table, 0, sizeof(sim->key_table));
+	memset(sim->key_table_len, 0, sizeof(sim->key_table_len));
+	sim->pan_coordinator = 0;
+}
+
+static void sim_reset_mac(struct ca821x_sim *sim)
+{
+	memset(sim->direct, 0, sizeof(sim->direct));
+	memset(sim->indirect, 0, sizeof(sim->indirect));
+	sim->direct_head = 0;
+	sim->direct_count = 0;
+	sim->tx_busy = 0;
+	sim->scan_busy = 0;
+	sim->assoc_pending = 0;
+	sim->poll_pending = 0;
+	if (sim->medium)
+		ca821x_sim_medium_reset(sim);
+	/* Invalidate any events still pending from before the reset */
+	sim->generation++;
+}
+
+/******************************************************************************/
+/****** Upstream message generation                                      ******/
+/******************************************************************************/
+
+static void sim_upstream(struct ca821x_sim *sim, struct MAC_Message *msg)
+{
+	sim->upstream_count++;
+	if (sim->wait_buf && msg->CommandId == sim->wait_cmdid) {
+		/* Consumed by ca821x_sim_wait_for_message */
+		memcpy(sim->wait_buf, &msg->CommandId, msg->Length + 2);
+		sim->wait_buf = NULL;
+		return;
+	}
+	ca821x_downstream_dispatch(&msg->CommandId, msg->Length + 2, sim->pDeviceRef);
+}
+
+static void sim_send_data_confirm(struct ca821x_sim *sim, uint8_t handle,
+                                  uint8_t status)
+{
+	struct MAC_Message msg;
+	uint32_t timestamp = sim_symbol_time(sim);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_CONFIRM;
+	msg.Length = sizeof(struct MCPS_DATA_confirm_pset);
+	msg.PData.DataCnf.MsduHandle = handle;
+	msg.PData.DataCnf.Status = status;
+	PUTLE32(timestamp, msg.PData.DataCnf.TimeStamp);
+	sim_upstream(sim, &msg);
+}
+
+static void sim_send_assoc_confirm(struct ca821x_sim *sim, uint16_t shortaddr,
+                                   uint8_t status)
+{
+	struct MAC_Message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MLME_ASSOCIATE_CONFIRM;
+	msg.Length = sizeof(struct MLME_ASSOCIATE_confirm_pset) -
+	             sizeof(struct SecSpec) + 1;
+	PUTLE16(shortaddr, msg.PData.AssocCnf.AssocShortAddress);
+	msg.PData.AssocCnf.Status = status;
+	sim_upstream(sim, &msg);
+}
+
+static void sim_send_disassoc_confirm(struct ca821x_sim *sim,
+                                      struct FullAddr *addr, uint8_t status)
+{
+	struct MAC_Message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MLME_DISASSOCIATE_CONFIRM;
+	msg.Length = sizeof(struct MLME_DISASSOCIATE_confirm_pset);
+	msg.PData.DisassocCnf.Status = status;
+	msg.PData.DisassocCnf.Address = *addr;
+	sim_upstream(sim, &msg);
+}
+
+static void sim_send_comm_status(struct ca821x_sim *sim, struct FullAddr *dst,
+                                 uint8_t status)
+{
+	struct MAC_Message msg;
+	struct MLME_COMM_STATUS_indication_pset *ind = &msg.PData.CommStatusInd;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MLME_COMM_STATUS_INDICATION;
+	msg.Length = sizeof(struct MLME_COMM_STATUS_indication_pset) -
+	             sizeof(struct SecSpec) + 1;
+	memcpy(ind->PANId, sim_pib(sim, macPANId), 2);
+	ind->SrcAddrMode = MAC_MODE_LONG_ADDR;
+	memcpy(ind->SrcAddr, sim_pib(sim, nsIEEEAddress), 8);
+	ind->DstAddrMode = dst->AddressMode;
+	memcpy(ind->DstAddr, dst->Address, 8);
+	ind->Status = status;
+	sim_upstream(sim, &msg);
+}
+
+static void sim_send_data_indication(struct ca821x_sim *sim,
+                                     const struct ca821x_sim_msdu *msdu,
+                                     const struct ca821x_sim_rxinfo *info)
+{
+	struct MAC_Message msg;
+	struct MCPS_DATA_indication_pset *ind = &msg.PData.DataInd;
+	uint32_t timestamp = sim_symbol_time(sim);
+	uint8_t len = msdu->len < MAX_DATA_SIZE ? msdu->len : MAX_DATA_SIZE - 1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	ind->Src.AddressMode = info->src_mode;
+	memcpy(ind->Src.PANId, info->src_pan, 2);
+	memcpy(ind->Src.Address, info->src_addr, 8);
+	ind->Dst = msdu->dst;
+	ind->MsduLength = len;
+	ind->MpduLinkQuality = info->lqi;
+	ind->DSN = msdu->dsn;
+	PUTLE32(timestamp, ind->TimeStamp);
+#if CASCODA_CA_VER == 8211
+	ind->FramePending = info->frame_pending;
+#endif
+	memcpy(ind->Msdu, msdu->data, len);
+	/* Trailing SecSpec, unsecured */
+	ind->Msdu[len] = 0;
+	msg.Length = offsetof(struct MCPS_DATA_indication_pset, Msdu) + len + 1;
+	sim_upstream(sim, &msg);
+}
+
+#if CASCODA_CA_VER >= 8211
+static void sim_send_pcps_confirm(struct ca821x_sim *sim, uint8_t handle,
+                                  uint8_t status)
+{
+	struct MAC_Message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_PCPS_DATA_CONFIRM;
+	msg.Length = sizeof(struct PCPS_DATA_confirm_pset);
+	msg.PData.PhyDataCnf.PsduHandle = handle;
+	msg.PData.PhyDataCnf.Status = status;
+	sim_upstream(sim, &msg);
+}
+
+static void sim_send_pcps_indication(struct ca821x_sim *sim,
+                                     const struct ca821x_sim_msdu *msdu,
+                                     const struct ca821x_sim_rxinfo *info)
+{
+	struct MAC_Message msg;
+	struct PCPS_DATA_indication_pset *ind = &msg.PData.PhyDataInd;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_PCPS_DATA_INDICATION;
+	ind->CS = info->lqi;
+	ind->ED = info->lqi;
+	ind->PsduLength = msdu->len;
+	memcpy(ind->Psdu, msdu->data, msdu->len);
+	msg.Length = offsetof(struct PCPS_DATA_indication_pset, Psdu) + msdu->len;
+	sim_upstream(sim, &msg);
+}
+#endif
+
+/** Report the outcome of a queued transmission in the appropriate way */
+static void sim_msdu_complete(struct ca821x_sim *sim,
+                              struct ca821x_sim_msdu *msdu, uint8_t status)
+{
+	switch (msdu->kind) {
+	case SIM_MSDU_DATA:
+		sim_send_data_confirm(sim, msdu->handle, status);
+		break;
+	case SIM_MSDU_ASSOC_REQ:
+		sim_send_assoc_confirm(sim, 0xFFFF, status);
+		break;
+	case SIM_MSDU_DISASSOC:
+		sim_send_disassoc_confirm(sim, &msdu->dst, status);
+		break;
+	case SIM_MSDU_ASSOC_RSP:
+	case SIM_MSDU_ORPHAN_RSP:
+		sim_send_comm_status(sim, &msdu->dst, status);
+		break;
+#if CASCODA_CA_VER >= 8211
+	case SIM_MSDU_PSDU:
+		sim_send_pcps_confirm(sim, msdu->handle, status);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+/** Deferred confirm for a frame that was never queued */
+static void sim_event_reject(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+
+	if (SIM_ARG_STALE(sim, arg))
+		return;
+	sim_send_data_confirm(sim, SIM_ARG_VAL(arg) >> 8, SIM_ARG_VAL(arg) & 0xFF);
+}
+
+#if CASCODA_CA_VER >= 8211
+/** Deferred confirm for a PSDU that was never queued */
+static void sim_event_pcps_reject(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+
+	if (SIM_ARG_STALE(sim, arg))
+		return;
+	sim_send_pcps_confirm(sim, SIM_ARG_VAL(arg) >> 8, SIM_ARG_VAL(arg) & 0xFF);
+}
+#endif
+
+/** Apply the PAN Id, channel and short address carried by a realignment */
+static void sim_apply_realign(struct ca821x_sim *sim, const uint8_t *payload)
+{
+	memcpy(sim_pib(sim, macPANId), payload, 2);
+	sim_pib(sim, phyCurrentChannel)[0] = payload[4];
+	if (GETLE16(payload + 5) != 0xFFFF)
+		memcpy(sim_pib(sim, macShortAddress), payload + 5, 2);
+	if (sim->medium)
+		ca821x_sim_medium_sync_channel(sim);
+}
+
+/******************************************************************************/
+/****** Transmission                                                     ******/
+/******************************************************************************/
+
+/** Estimate the PSDU length of a queued frame, including MHR and FCS */
+uint8_t ca821x_sim_psdu_len(struct ca821x_sim *sim,
+                            const struct ca821x_sim_msdu *msdu)
+{
+	static const uint8_t addr_len[4] = {0, 0, 2, 8};
+	static const uint8_t keyid_len[4] = {0, 1, 5, 9};
+	static const uint8_t mic_len[8] = {0, 4, 8, 16, 0, 4, 8, 16};
+	unsigned len = 2 + 1 + 2; /* FC, DSN, FCS */
+
+	(void)sim;
+	if (msdu->kind == SIM_MSDU_PSDU)
+		return msdu->len;
+	len += addr_len[msdu->dst.AddressMode & 3];
+	if (msdu->dst.AddressMode)
+		len += 2;
+	len += addr_len[msdu->src_mode & 3];
+	if (msdu->src_mode && !msdu->dst.AddressMode)
+		len += 2;
+	if (msdu->security.SecurityLevel) {
+		len += 1 + 4 + keyid_len[msdu->security.KeyIdMode & 3];
+		len += mic_len[msdu->security.SecurityLevel & 7];
+	}
+	if (msdu->kind != SIM_MSDU_DATA)
+		len += 1; /* Command frame identifier */
+	len += msdu->len;
+
+	return len > 0xFF ? 0xFF : (uint8_t)len;
+}
+
+/** Time taken by unslotted CSMA-CA to find the channel clear first time */
+static uint64_t sim_csma_ns(struct ca821x_sim *sim)
+{
+	uint8_t be = sim_pib_u8(sim, macMinBE);
+	uint32_t backoffs = be ? sim_rand(sim) & ((1u << be) - 1) : 0;
+
+	return SYMBOLS_NS(backoffs * aUnitBackoffPeriod + CCA_SYMBOLS + aTurnaroundTime);
+}
+
+static void sim_tx_kick(struct ca821x_sim *sim);
+
+/** Association response wait has elapsed: request the response */
+static void sim_event_assoc_wait(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+	uint8_t status = MAC_NO_DATA;
+
+	if (SIM_ARG_STALE(sim, arg) || !sim->assoc_pending)
+		return;
+	if (sim->medium) {
+		status = ca821x_sim_medium_poll(sim, &sim->assoc_coord);
+		/* On success, the confirm is sent when the response arrives */
+		if (status == MAC_SUCCESS)
+			return;
+	}
+	sim->assoc_pending = 0;
+	sim_send_assoc_confirm(sim, 0xFFFF, status);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Complete the transmission at the head of the direct queue
+ *******************************************************************************
+ * \param sim - Simulated device
+ * \param status - Outcome of the transmission
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sim_tx_done(struct ca821x_sim *sim, uint8_t status)
+{
+	struct ca821x_sim_msdu msdu = sim->direct[sim->direct_head];
+
+	if (status != MAC_CHANNEL_ACCESS_FAILURE)
+		sim->frames_tx++;
+	sim->tx_busy = 0;
+	sim->direct[sim->direct_head].in_use = 0;
+	sim->direct_head = (sim->direct_head + 1) % SIM_DIRECT_QUEUE_SIZE;
+	sim->direct_count--;
+
+	switch (msdu.kind) {
+	case SIM_MSDU_ASSOC_REQ:
+		if (status != MAC_SUCCESS) {
+			sim_msdu_complete(sim, &msdu, status);
+			break;
+		}
+		/* The response is requested once macResponseWaitTime has passed */
+		sim->assoc_pending = 1;
+		ca821x_sim_schedule(sim->engine,
+			SYMBOLS_NS((uint32_t)sim_pib_u8(sim, macResponseWaitTime) *
+			           aBaseSuperframeDuration),
+			sim_event_assoc_wait, sim, SIM_ARG(sim, 0));
+		break;
+	case SIM_MSDU_REALIGN:
+		/* The coordinator moves once the realignment has gone out */
+		sim_apply_realign(sim, msdu.data);
+		break;
+	default:
+		sim_msdu_complete(sim, &msdu, status);
+		break;
+	}
+	sim_tx_kick(sim);
+}
+
+static void sim_event_tx_done(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+
+	if (SIM_ARG_STALE(sim, arg))
+		return;
+	ca821x_sim_tx_done(sim, MAC_SUCCESS);
+}
+
+/** Start transmitting the head of the direct queue, if idle */
+static void sim_tx_kick(struct ca821x_sim *sim)
+{
+	struct ca821x_sim_msdu *msdu;
+	uint64_t duration;
+
+	if (sim->tx_busy || !sim->direct_count)
+		return;
+
+	msdu = &sim->direct[sim->direct_head];
+	sim->tx_busy = 1;
+	if (sim->medium) {
+		ca821x_sim_medium_tx_start(sim);
+		return;
+	}
+
+	duration = sim_csma_ns(sim) + AIRTIME_NS(ca821x_sim_psdu_len(sim, msdu));
+	if (msdu->txopts & TXOPT_ACKREQ)
+		duration += SYMBOLS_NS(aTurnaroundTime) + AIRTIME_NS(ACK_PSDU_LEN);
+
+	ca821x_sim_schedule(sim->engine, duration, sim_event_tx_done, sim,
+	                    SIM_ARG(sim, 0));
+}
+
+static struct ca821x_sim_msdu *sim_direct_alloc(struct ca821x_sim *sim)
+{
+	struct ca821x_sim_msdu *msdu;
+
+	if (sim->direct_count >= SIM_DIRECT_QUEUE_SIZE)
+		return NULL;
+	msdu = &sim->direct[(sim->direct_head + sim->direct_count) % SIM_DIRECT_QUEUE_SIZE];
+	memset(msdu, 0, sizeof(*msdu));
+	msdu->in_use = 1;
+	msdu->dsn = sim_pib(sim, macDSN)[0]++;
+	return msdu;
+}
+
+static void sim_direct_commit(struct ca821x_sim *sim)
+{
+	sim->direct_count++;
+	sim_tx_kick(sim);
+}
+
+/** Indirect slot states (values of in_use) */
+#define SIM_INDIRECT_QUEUED (1)
+#define SIM_INDIRECT_SENT   (2)
+
+static void sim_event_expire(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+	struct ca821x_sim_msdu *msdu;
+
+	if (SIM_ARG_STALE(sim, arg))
+		return;
+	msdu = &sim->indirect[SIM_ARG_VAL(arg)];
+	/* The slot may have been polled out or purged and reused since */
+	if (msdu->in_use != SIM_INDIRECT_QUEUED || msdu->expiry_ns != sim->engine->now_ns)
+		return;
+	msdu->in_use = 0;
+	sim_msdu_complete(sim, msdu, MAC_TRANSACTION_EXPIRED);
+}
+
+static struct ca821x_sim_msdu *sim_indirect_alloc(struct ca821x_sim *sim)
+{
+	int i;
+
+	for (i = 0; i < SIM_INDIRECT_QUEUE_SIZE; i++) {
+		if (!sim->indirect[i].in_use) {
+			memset(&sim->indirect[i], 0, sizeof(sim->indirect[i]));
+			sim->indirect[i].in_use = SIM_INDIRECT_QUEUED;
+			sim->indirect[i].dsn = sim_pib(sim, macDSN)[0]++;
+			return &sim->indirect[i];
+		}
+	}
+	return NULL;
+}
+
+static void sim_indirect_commit(struct ca821x_sim *sim,
+                                struct ca821x_sim_msdu *msdu)
+{
+	uint64_t persistence;
+	uint8_t bo = sim_pib_u8(sim, macBeaconOrder);
+
+	/* Persistence time unit is one superframe (or base superframe) */
+	persistence = (uint64_t)sim_pib_u16(sim, macTransactionPersistenceTime) *
+	              aBaseSuperframeDuration;
+	if (bo < 15)
+		persistence <<= bo;
+	msdu->expiry_ns = sim->engine->now_ns + SYMBOLS_NS(persistence);
+	ca821x_sim_schedule(sim->engine, SYMBOLS_NS(persistence), sim_event_expire,
+	                    sim, SIM_ARG(sim, msdu - sim->indirect));
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Find a queued indirect frame for a device
+ *******************************************************************************
+ * \param coord - Simulated coordinator holding the frames
+ * \param extaddr - Extended address of the requesting device
+ * \param shortaddr - Short address of the requesting device (0xFFFE or
+ *                    0xFFFF if it has none)
+ * \param start - Slot to start searching from
+ *******************************************************************************
+ * \return Slot index of the oldest matching frame, or -1
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_indirect_find(
+	struct ca821x_sim *coord,
+	const uint8_t     *extaddr,
+	uint16_t           shortaddr,
+	int                start
+)
+{
+	struct ca821x_sim_msdu *msdu;
+	int i, found = -1;
+
+	for (i = start; i < SIM_INDIRECT_QUEUE_SIZE; i++) {
+		msdu = &coord->indirect[i];
+		if (msdu->in_use != SIM_INDIRECT_QUEUED)
+			continue;
+		if (msdu->dst.AddressMode == MAC_MODE_LONG_ADDR) {
+			if (memcmp(msdu->dst.Address, extaddr, 8))
+				continue;
+		} else if (msdu->dst.AddressMode == MAC_MODE_SHORT_ADDR) {
+			if (shortaddr >= 0xFFFE || GETLE16(msdu->dst.Address) != shortaddr)
+				continue;
+		} else {
+			continue;
+		}
+		if (found < 0 || msdu->expiry_ns < coord->indirect[found].expiry_ns)
+			found = i;
+	}
+	return found;
+}
+
+static void sim_event_indirect_sent(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+	struct ca821x_sim_msdu *msdu;
+
+	if (SIM_ARG_STALE(sim, arg))
+		return;
+	msdu = &sim->indirect[SIM_ARG_VAL(arg)];
+	if (msdu->in_use != SIM_INDIRECT_SENT)
+		return;
+	msdu->in_use = 0;
+	sim->frames_tx++;
+	sim_msdu_complete(sim, msdu, MAC_SUCCESS);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Mark an indirect frame as extracted by a poll
+ *******************************************************************************
+ * The slot stays reserved until its completion is reported delay_ns later.
+ *******************************************************************************
+ * \param coord - Simulated coordinator holding the frame
+ * \param slot - Slot returned by ca821x_sim_indirect_find
+ * \param delay_ns - Time until the exchange with the device completes
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sim_indirect_sent(struct ca821x_sim *coord, int slot, uint64_t delay_ns)
+{
+	coord->indirect[slot].in_use = SIM_INDIRECT_SENT;
+	ca821x_sim_schedule(coord->engine, delay_ns, sim_event_indirect_sent,
+	                    coord, SIM_ARG(coord, slot));
+}
+
+/******************************************************************************/
+/****** Reception                                                        ******/
+/******************************************************************************/
+
+/** Apply the receive address filter */
+static int sim_rx_accept(struct ca821x_sim *sim, const struct ca821x_sim_msdu *msdu,
+                         const struct ca821x_sim_rxinfo *info)
+{
+	uint16_t pan = sim_pib_u16(sim, macPANId);
+	uint16_t dst_pan = GETLE16(msdu->dst.PANId);
+
+	if (sim_pib_u8(sim, macPromiscuousMode))
+		return 1;
+	if (msdu->kind == SIM_MSDU_PSDU) {
+		struct ca821x_frame frame;
+
+		/* Only well-formed frames get past the address filter */
+		if (ca821x_frame_decode(&frame, msdu->data, msdu->len, 1))
+			return 0;
+	}
+
+	switch (msdu->dst.AddressMode) {
+	case MAC_MODE_NO_ADDR:
+		/* Only the PAN coordinator accepts frames without a destination */
+		return sim->pan_coordinator && GETLE16(info->src_pan) == pan;
+	case MAC_MODE_SHORT_ADDR:
+		if (dst_pan != MAC_BROADCAST_ADDRESS && dst_pan != pan)
+			return 0;
+		return GETLE16(msdu->dst.Address) == MAC_BROADCAST_ADDRESS ||
+		       GETLE16(msdu->dst.Address) == sim_pib_u16(sim, macShortAddress);
+	case MAC_MODE_LONG_ADDR:
+		if (dst_pan != MAC_BROADCAST_ADDRESS && dst_pan != pan)
+			return 0;
+		return !memcmp(msdu->dst.Address, sim_pib(sim, nsIEEEAddress), 8);
+	}
+	return 0;
+}
+
+/** Generate the indication for an accepted frame */
+static void sim_rx_deliver(struct ca821x_sim *sim, const struct ca821x_sim_msdu *msdu,
+                           const struct ca821x_sim_rxinfo *info)
+{
+	struct MAC_Message msg;
+
+	sim->frames_rx++;
+	memset(&msg, 0, sizeof(msg));
+	switch (msdu->kind) {
+	case SIM_MSDU_DATA:
+		sim_send_data_indication(sim, msdu, info);
+		break;
+	case SIM_MSDU_ASSOC_REQ:
+		if (!sim_pib_u8(sim, macAssociationPermit))
+			break;
+		msg.CommandId = SPI_MLME_ASSOCIATE_INDICATION;
+		msg.Length = sizeof(struct MLME_ASSOCIATE_indication_pset) -
+		             sizeof(struct SecSpec) + 1;
+		memcpy(msg.PData.AssocInd.DeviceAddress, info->src_addr, 8);
+		msg.PData.AssocInd.CapabilityInformation = msdu->data[0];
+		sim_upstream(sim, &msg);
+		break;
+	case SIM_MSDU_DISASSOC:
+		msg.CommandId = SPI_MLME_DISASSOCIATE_INDICATION;
+		msg.Length = sizeof(struct MLME_DISASSOCIATE_indication_pset) -
+		             sizeof(struct SecSpec) + 1;
+		memcpy(msg.PData.DisassocInd.DevAddr, info->src_addr, 8);
+		msg.PData.DisassocInd.Reason = msdu->data[0];
+		sim_upstream(sim, &msg);
+		break;
+	case SIM_MSDU_REALIGN:
+		/* Follow our own coordinator only */
+		if (info->src_mode == MAC_MODE_LONG_ADDR &&
+		    !memcmp(info->src_addr, sim_pib(sim, macCoordExtendedAddress), 8))
+			sim_apply_realign(sim, msdu->data);
+		break;
+#if CASCODA_CA_VER >= 8211
+	case SIM_MSDU_PSDU:
+		sim_send_pcps_indication(sim, msdu, info);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Offer a frame received from the medium to a simulated device
+ *******************************************************************************
+ * \param sim - Receiving device
+ * \param msdu - Frame as queued by the transmitting device
+ * \param info - Source addressing and link quality of the frame
+ *******************************************************************************
+ * \return 1 if the frame was accepted and must be acknowledged, else 0
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_rx_frame(
+	struct ca821x_sim              *sim,
+	const struct ca821x_sim_msdu   *msdu,
+	const struct ca821x_sim_rxinfo *info
+)
+{
+	if (!sim_rx_accept(sim, msdu, info))
+		return 0;
+	sim_rx_deliver(sim, msdu, info);
+
+	return (msdu->txopts & TXOPT_ACKREQ) &&
+	       !(msdu->dst.AddressMode == MAC_MODE_SHORT_ADDR &&
+	         GETLE16(msdu->dst.Address) == MAC_BROADCAST_ADDRESS);
+}
+
+static void sim_event_polled(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+	const struct ca821x_sim_msdu *msdu = &sim->poll_msdu;
+	uint16_t shortaddr;
+
+	if (SIM_ARG_STALE(sim, arg) || !sim->poll_pending)
+		return;
+	sim->poll_pending = 0;
+
+	if (msdu->kind == SIM_MSDU_ASSOC_RSP) {
+		if (!sim->assoc_pending)
+			return;
+		sim->assoc_pending = 0;
+		sim->frames_rx++;
+		shortaddr = GETLE16(msdu->data);
+		if (msdu->data[2] == MAC_SUCCESS) {
+			memcpy(sim_pib(sim, macShortAddress), msdu->data, 2);
+			memcpy(sim_pib(sim, macCoordExtendedAddress), sim->poll_info.src_addr, 8);
+		}
+		sim_send_assoc_confirm(sim, shortaddr, msdu->data[2]);
+		return;
+	}
+
+	sim_rx_deliver(sim, msdu, &sim->poll_info);
+	if (sim->assoc_pending) {
+		sim->assoc_pending = 0;
+		sim_send_assoc_confirm(sim, 0xFFFF, MAC_NO_DATA);
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Deliver the frame stored in poll_msdu after a delay
+ *******************************************************************************
+ * \param sim - Device that polled
+ * \param delay_ns - Time until the frame has been received
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sim_poll_deliver(struct ca821x_sim *sim, uint64_t delay_ns)
+{
+	sim->poll_pending = 1;
+	ca821x_sim_schedule(sim->engine, delay_ns, sim_event_polled, sim, SIM_ARG(sim, 0));
+}
+
+/** Source addressing info of a frame sent by this device */
+void ca821x_sim_src_info(struct ca821x_sim *sim, uint8_t src_mode,
+                         struct ca821x_sim_rxinfo *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->src_mode = src_mode;
+	memcpy(info->src_pan, sim_pib(sim, macPANId), 2);
+	if (src_mode == MAC_MODE_SHORT_ADDR)
+		memcpy(info->src_addr, sim_pib(sim, macShortAddress), 2);
+	else if (src_mode == MAC_MODE_LONG_ADDR)
+		memcpy(info->src_addr, sim_pib(sim, nsIEEEAddress), 8);
+}
+
+/** True if the receiver would be on outside of a transaction */
+int ca821x_sim_is_listening(struct ca821x_sim *sim)
+{
+	if (sim->scan_busy)
+		return 0;
+	return sim->started || sim->pan_coordinator ||
+	       sim_pib_u8(sim, macRxOnWhenIdle);
+}
+
+/******************************************************************************/
+/****** Scanning                                                         ******/
+/******************************************************************************/
+
+/** Append an ED result to the scan confirm being assembled */
+void ca821x_sim_scan_add_ed(struct ca821x_sim *sim, uint8_t ed)
+{
+	struct MLME_SCAN_confirm_pset *cnf = &sim->scan_cnf.PData.ScanCnf;
+
+	cnf->ResultList[cnf->ResultListSize++] = ed;
+	sim->scan_cnf.Length++;
+}
+
+static void sim_pan_descriptor(struct ca821x_sim *sim, struct ca821x_sim *coord,
+                               uint8_t lqi, struct PanDescriptor *pd)
+{
+	uint16_t shortaddr = sim_pib_u16(coord, macShortAddress);
+	uint16_t sfspec;
+	uint32_t timestamp = sim_symbol_time(sim);
+
+	memset(pd, 0, sizeof(*pd));
+	if (shortaddr < 0xFFFE) {
+		pd->Coord.AddressMode = MAC_MODE_SHORT_ADDR;
+		PUTLE16(shortaddr, pd->Coord.Address);
+	} else {
+		pd->Coord.AddressMode = MAC_MODE_LONG_ADDR;
+		memcpy(pd->Coord.Address, sim_pib(coord, nsIEEEAddress), 8);
+	}
+	memcpy(pd->Coord.PANId, sim_pib(coord, macPANId), 2);
+	pd->LogicalChannel = sim_pib_u8(coord, phyCurrentChannel);
+	sfspec = sim_pib_u8(coord, macBeaconOrder) |
+	         (sim_pib_u8(coord, macSuperframeOrder) << 4) | (0xF << 8);
+	if (coord->pan_coordinator)
+		sfspec |= 1 << 14;
+	if (sim_pib_u8(coord, macAssociationPermit))
+		sfspec |= 1 << 15;
+	PUTLE16(sfspec, pd->SuperframeSpec);
+	pd->GTSPermit = sim_pib_u8(coord, macGTSPermit);
+	pd->LinkQuality = lqi;
+	PUTLE32(timestamp, pd->TimeStamp);
+}
+
+static void sim_send_beacon_notify(struct ca821x_sim *sim, struct ca821x_sim *coord,
+                                   const uint8_t *pdesc)
+{
+	struct MAC_Message msg;
+	uint8_t *p = msg.PData.Payload;
+	uint8_t nshort = 0, next = 0, *spec;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MLME_BEACON_NOTIFY_INDICATION;
+	*p++ = sim_pib_u8(coord, macBSN);
+	memcpy(p, pdesc, PAN_DESCRIPTOR_BASE_SIZE);
+	p += PAN_DESCRIPTOR_BASE_SIZE;
+
+	/* Pending address specification followed by short then long addresses */
+	spec = p++;
+	for (i = 0; i < SIM_INDIRECT_QUEUE_SIZE && nshort < 7; i++) {
+		const struct ca821x_sim_msdu *msdu = &coord->indirect[i];
+		if (msdu->in_use == SIM_INDIRECT_QUEUED &&
+		    msdu->dst.AddressMode == MAC_MODE_SHORT_ADDR) {
+			memcpy(p, msdu->dst.Address, 2);
+			p += 2;
+			nshort++;
+		}
+	}
+	for (i = 0; i < SIM_INDIRECT_QUEUE_SIZE && nshort + next < 7; i++) {
+		const struct ca821x_sim_msdu *msdu = &coord->indirect[i];
+		if (msdu->in_use == SIM_INDIRECT_QUEUED &&
+		    msdu->dst.AddressMode == MAC_MODE_LONG_ADDR) {
+			memcpy(p, msdu->dst.Address, 8);
+			p += 8;
+			next++;
+		}
+	}
+	*spec = nshort | (next << 4);
+
+	*p = sim_pib_u8(coord, macBeaconPayloadLength);
+	memcpy(p + 1, coord->beacon_payload, *p);
+	p += 1 + *p;
+	msg.Length = p - msg.PData.Payload;
+	sim_upstream(sim, &msg);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Report a beacon heard during an active or passive scan
+ *******************************************************************************
+ * \param sim - Scanning device
+ * \param coord - Coordinator that sent the beacon
+ * \param lqi - Link quality of the beacon
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sim_scan_add_beacon(struct ca821x_sim *sim, struct ca821x_sim *coord,
+                                uint8_t lqi)
+{
+	struct MLME_SCAN_confirm_pset *cnf = &sim->scan_cnf.PData.ScanCnf;
+	struct PanDescriptor pdesc;
+
+	/* Only the first PAN_DESCRIPTOR_BASE_SIZE octets are sent */
+	sim_pan_descriptor(sim, coord, lqi, &pdesc);
+	if (!sim_pib_u8(sim, macAutoRequest) || sim_pib_u8(coord, macBeaconPayloadLength))
+		sim_send_beacon_notify(sim, coord, (const uint8_t *)&pdesc);
+	if (!sim_pib_u8(sim, macAutoRequest))
+		return;
+
+	if (sim->scan_cnf.Length + PAN_DESCRIPTOR_BASE_SIZE > (int)sizeof(sim->scan_cnf.PData)) {
+		cnf->Status = MAC_LIMIT_REACHED;
+		return;
+	}
+	memcpy(sim->scan_cnf.PData.Payload + sim->scan_cnf.Length, &pdesc,
+	       PAN_DESCRIPTOR_BASE_SIZE);
+	sim->scan_cnf.Length += PAN_DESCRIPTOR_BASE_SIZE;
+	cnf->ResultListSize++;
+}
+
+/** Send the scan confirm assembled in scan_cnf and end the scan */
+void ca821x_sim_scan_finish(struct ca821x_sim *sim)
+{
+	struct MLME_SCAN_confirm_pset *cnf = &sim->scan_cnf.PData.ScanCnf;
+
+	sim->scan_busy = 0;
+	if (cnf->ScanType != ENERGY_DETECT && !cnf->ResultListSize &&
+	    cnf->Status == MAC_SUCCESS)
+		cnf->Status = MAC_NO_BEACON;
+	sim_upstream(sim, &sim->scan_cnf);
+}
+
+static void sim_event_scan_done(void *ctx, uintptr_t arg)
+{
+	struct ca821x_sim *sim = ctx;
+	uint8_t channel;
+
+	if (SIM_ARG_STALE(sim, arg))
+		return;
+	if (sim->medium) {
+		ca821x_sim_medium_scan_done(sim);
+		return;
+	}
+
+	if (sim->scan_type == ENERGY_DETECT) {
+		for (channel = M_MinimumChannel; channel <= M_MaximumChannel; channel++) {
+			if (sim->scan_channels & (1UL << channel))
+				ca821x_sim_scan_add_ed(sim,
+					sim->channel_ed[channel - M_MinimumChannel]);
+		}
+	}
+	ca821x_sim_scan_finish(sim);
+}
+
+/******************************************************************************/
+/****** PIB access                                                       ******/
+/******************************************************************************/
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Read an attribute from the simulated PIB
+ *******************************************************************************
+ * \param sim - Simulated device
+ * \param attribute - PIB attribute id
+ * \param index - Index for table attributes
+ * \param len - Populated with the attribute length
+ * \param value - Buffer of at least MAX_ATTRIBUTE_SIZE octets for the value
+ *******************************************************************************
+ * \return 802.15.4 status
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_sim_get_pib(
+	struct ca821x_sim *sim,
+	uint8_t            attribute,
+	uint8_t            index,
+	uint8_t           *len,
+	uint8_t           *value
+)
+{
+	int i;
+
+	switch (attribute) {
+	case macDeviceTable:
+		if (index >= DEVICE_TABLE_SIZE)
+			return MAC_INVALID_INDEX;
+		*len = sizeof(struct M_DeviceDescriptor);
+		memcpy(value, &sim->device_table[index], *len);
+		return MAC_SUCCESS;
+	case macSecurityLevelTable:
+		if (index >= SECURITY_LEVEL_TABLE_SIZE)
+			return MAC_INVALID_INDEX;
+		*len = sizeof(struct M_SecurityLevelDescriptor);
+		memcpy(value, &sim->seclevel_table[index], *len);
+		return MAC_SUCCESS;
+	case macKeyTable:
+		if (index >= KEY_TABLE_SIZE)
+			return MAC_INVALID_INDEX;
+		*len = sim->key_table_len[index];
+		memcpy(value, sim->key_table[index], *len);
+		return MAC_SUCCESS;
+	case macBeaconPayload:
+		*len = sim_pib_u8(sim, macBeaconPayloadLength);
+		memcpy(value, sim->beacon_payload, *len);
+		return MAC_SUCCESS;
+	}
+
+	i = sim_pib_index(attribute);
+	if (i < 0)
+		return MAC_UNSUPPORTED_ATTRIBUTE;
+	*len = sim_pib_descs[i].len;
+	memcpy(value, sim->pib[i], *len);
+	return MAC_SUCCESS;
+}
+
+static uint8_t sim_set_pib(
+	struct ca821x_sim *sim,
+	uint8_t            attribute,
+	uint8_t            index,
+	uint8_t            len,
+	const uint8_t     *value
+)
+{
+	int i;
+
+	switch (attribute) {
+	case macDeviceTable:
+		if (index >= DEVICE_TABLE_SIZE)
+			return MAC_INVALID_INDEX;
+		if (len != sizeof(struct M_DeviceDescriptor))
+			return MAC_INVALID_PARAMETER;
+		memcpy(&sim->device_table[index], value, len);
+		return MAC_SUCCESS;
+	case macSecurityLevelTable:
+		if (index >= SECURITY_LEVEL_TABLE_SIZE)
+			return MAC_INVALID_INDEX;
+		if (len != sizeof(struct M_SecurityLevelDescriptor))
+			return MAC_INVALID_PARAMETER;
+		memcpy(&sim->seclevel_table[index], value, len);
+		return MAC_SUCCESS;
+	case macKeyTable:
+		if (index >= KEY_TABLE_SIZE)
+			return MAC_INVALID_INDEX;
+		if (len < sizeof(struct M_KeyTableEntryFixed) ||
+		    len > sizeof(struct M_KeyDescriptor))
+			return MAC_INVALID_PARAMETER;
+		memcpy(sim->key_table[index], value, len);
+		sim->key_table_len[index] = len;
+		return MAC_SUCCESS;
+	case macBeaconPayload:
+		if (len > aMaxBeaconPayloadLength)
+			return MAC_INVALID_PARAMETER;
+		memcpy(sim->beacon_payload, value, len);
+		return MAC_SUCCESS;
+	}
+
+	i = sim_pib_index(attribute);
+	if (i < 0)
+		return MAC_UNSUPPORTED_ATTRIBUTE;
+	if (len > sim_pib_descs[i].len)
+		return MAC_INVALID_PARAMETER;
+	memset(sim->pib[i], 0, SIM_PIB_MAX_LEN);
+	memcpy(sim->pib[i], value, len);
+	return MAC_SUCCESS;
+}
+
+/******************************************************************************/
+/****** Command handlers                                                 ******/
+/******************************************************************************/
+
+/** Copy an optional trailing SecSpec (1 octet if SecurityLevel is 0) */
+static void sim_get_secspec(struct SecSpec *dst, const struct SecSpec *src)
+{
+	memset(dst, 0, sizeof(*dst));
+	if (src->SecurityLevel)
+		*dst = *src;
+}
+
+static void sim_mcps_data_request(struct ca821x_sim *sim,
+                                  const struct MCPS_DATA_request_pset *req)
+{
+	struct ca821x_sim_msdu *msdu;
+	uint8_t status = MAC_SUCCESS;
+
+	if (req->TxOptions & TXOPT_INDIRECT)
+		msdu = sim_indirect_alloc(sim);
+	else
+		msdu = sim_direct_alloc(sim);
+
+	if (!msdu) {
+		status = MAC_TRANSACTION_OVERFLOW;
+	} else {
+		msdu->kind = SIM_MSDU_DATA;
+		msdu->handle = req->MsduHandle;
+		msdu->txopts = req->TxOptions;
+		msdu->src_mode = req->SrcAddrMode;
+		msdu->dst = req->Dst;
+		msdu->len = req->MsduLength;
+		memcpy(msdu->data, req->Msdu, req->MsduLength);
+		sim_get_secspec(&msdu->security,
+		                (const struct SecSpec *)(req->Msdu + req->MsduLength));
+		if (ca821x_sim_psdu_len(sim, msdu) > aMaxPHYPacketSize) {
+			msdu->in_use = 0;
+			status = MAC_FRAME_TOO_LONG;
+		}
+	}
+
+	if (status != MAC_SUCCESS) {
+		ca821x_sim_schedule(sim->engine, 0, sim_event_reject, sim,
+		                    SIM_ARG(sim, (req->MsduHandle << 8) | status));
+		return;
+	}
+
+	if (req->TxOptions & TXOPT_INDIRECT)
+		sim_indirect_commit(sim, msdu);
+	else
+		sim_direct_commit(sim);
+}
+
+#if CASCODA_CA_VER >= 8211
+/**
+ * Queue a raw PSDU for direct transmission. The addressing used by receivers
+ * and acknowledgements is decoded from the frame itself; TxOpts only selects
+ * whether an acknowledgement is awaited.
+ */
+static void sim_pcps_data_request(struct ca821x_sim *sim,
+                                  const struct PCPS_DATA_request_pset *req)
+{
+	struct ca821x_sim_msdu *msdu;
+	struct ca821x_frame frame;
+	struct FullAddr src;
+	uint8_t status = MAC_SUCCESS;
+
+	if (req->PsduLength < 3 + MAC_FCS_LEN || req->PsduLength > aMaxPHYPacketSize)
+		status = MAC_INVALID_PARAMETER;
+	else if (!(msdu = sim_direct_alloc(sim)))
+		status = MAC_TRANSACTION_OVERFLOW;
+
+	if (status != MAC_SUCCESS) {
+		ca821x_sim_schedule(sim->engine, 0, sim_event_pcps_reject, sim,
+		                    SIM_ARG(sim, (req->PsduHandle << 8) | status));
+		return;
+	}
+
+	msdu->kind = SIM_MSDU_PSDU;
+	msdu->handle = req->PsduHandle;
+	msdu->txopts = req->TxOpts & TXOPT_ACKREQ;
+	msdu->dsn = req->Psdu[2];
+	msdu->len = req->PsduLength;
+	memcpy(msdu->data, req->Psdu, req->PsduLength);
+	/* The transceiver fills in the FCS as the frame goes out */
+	ca821x_fcs_append(msdu->data, msdu->len);
+	if (!ca821x_frame_decode(&frame, msdu->data, msdu->len, 1)) {
+		ca821x_frame_get_addrs(&frame, &src, &msdu->dst);
+		msdu->src_mode = src.AddressMode;
+	}
+	sim_direct_commit(sim);
+}
+#endif
+
+static uint8_t sim_mcps_purge(struct ca821x_sim *sim, uint8_t handle)
+{
+	int i;
+
+	for (i = 0; i < SIM_INDIRECT_QUEUE_SIZE; i++) {
+		struct ca821x_sim_msdu *msdu = &sim->indirect[i];
+		if (msdu->in_use == SIM_INDIRECT_QUEUED && msdu->kind == SIM_MSDU_DATA &&
+		    msdu->handle == handle) {
+			msdu->in_use = 0;
+			return MAC_SUCCESS;
+		}
+	}
+	return MAC_INVALID_HANDLE;
+}
+
+static void sim_mlme_scan_request(struct ca821x_sim *sim,
+                                  const struct MLME_SCAN_request_pset *req)
+{
+	uint32_t channels = GETLE32(req->ScanChannels) & M_ValidChannels;
+	uint32_t nchannels = 0, ch;
+	uint64_t per_channel;
+
+	if (sim->scan_busy)
+		return;
+	for (ch = M_MinimumChannel; ch <= M_MaximumChannel; ch++)
+		nchannels += !!(channels & (1UL << ch));
+
+	sim->scan_busy = 1;
+	sim->scan_type = req->ScanType;
+	sim->scan_channels = channels;
+	memset(&sim->scan_cnf, 0, sizeof(sim->scan_cnf));
+	sim->scan_cnf.CommandId = SPI_MLME_SCAN_CONFIRM;
+	sim->scan_cnf.Length = MLME_SCAN_CONFIRM_BASE_SIZE;
+	sim->scan_cnf.PData.ScanCnf.ScanType = req->ScanType;
+	sim->scan_cnf.PData.ScanCnf.Status = MAC_SUCCESS;
+	if (req->ScanType == ORPHAN_SCAN)
+		per_channel = (uint64_t)sim_pib_u8(sim, macResponseWaitTime) *
+		              aBaseSuperframeDuration;
+	else
+		per_channel = (uint64_t)aBaseSuperframeDuration *
+		              ((1UL << (req->ScanDuration & 0xF)) + 1);
+	ca821x_sim_schedule(sim->engine, SYMBOLS_NS(per_channel * nchannels),
+	                    sim_event_scan_done, sim, SIM_ARG(sim, 0));
+}
+
+static uint8_t sim_mlme_start_request(struct ca821x_sim *sim,
+                                      const struct MLME_START_request_pset *req)
+{
+	struct ca821x_sim_msdu *msdu;
+	uint8_t realign[7];
+
+	if (sim_pib_u16(sim, macShortAddress) == 0xFFFF)
+		return MAC_NO_SHORT_ADDRESS;
+	if (req->LogicalChannel < M_MinimumChannel ||
+	    req->LogicalChannel > M_MaximumChannel ||
+	    req->BeaconOrder > 15 || req->SuperframeOrder > req->BeaconOrder)
+		return MAC_INVALID_PARAMETER;
+
+	sim_pib(sim, macBeaconOrder)[0] = req->BeaconOrder;
+	sim_pib(sim, macSuperframeOrder)[0] = req->SuperframeOrder;
+	sim->pan_coordinator = req->PANCoordinator;
+	sim->started = 1;
+
+	/* PANId, coordinator short address, channel, short address */
+	memcpy(realign, req->PANId, 2);
+	memcpy(realign + 2, sim_pib(sim, macShortAddress), 2);
+	realign[4] = req->LogicalChannel;
+	PUTLE16(MAC_BROADCAST_ADDRESS, realign + 5);
+
+	if (req->CoordRealignment && (msdu = sim_direct_alloc(sim))) {
+		/* Realignment goes out on the old channel before the move */
+		msdu->kind = SIM_MSDU_REALIGN;
+		msdu->src_mode = MAC_MODE_LONG_ADDR;
+		msdu->dst.AddressMode = MAC_MODE_SHORT_ADDR;
+		memcpy(msdu->dst.PANId, sim_pib(sim, macPANId), 2);
+		PUTLE16(MAC_BROADCAST_ADDRESS, msdu->dst.Address);
+		msdu->len = sizeof(realign);
+		memcpy(msdu->data, realign, sizeof(realign));
+		sim_get_secspec(&msdu->security, &req->CoordRealignSecurity);
+		sim_direct_commit(sim);
+	} else {
+		sim_apply_realign(sim, realign);
+	}
+	return MAC_SUCCESS;
+}
+
+static void sim_mlme_associate_request(struct ca821x_sim *sim,
+                                       const struct MLME_ASSOCIATE_request_pset *req)
+{
+	struct ca821x_sim_msdu *msdu = sim_direct_alloc(sim);
+
+	if (!msdu) {
+		sim_send_assoc_confirm(sim, 0xFFFF, MAC_TRANSACTION_OVERFLOW);
+		return;
+	}
+	sim_pib(sim, phyCurrentChannel)[0] = req->LogicalChannel;
+	memcpy(sim_pib(sim, macPANId), req->Dst.PANId, 2);
+	sim->assoc_coord = req->Dst;
+	if (req->Dst.AddressMode == MAC_MODE_SHORT_ADDR)
+		memcpy(sim_pib(sim, macCoordShortAddress), req->Dst.Address, 2);
+	else
+		memcpy(sim_pib(sim, macCoordExtendedAddress), req->Dst.Address, 8);
+
+	msdu->kind = SIM_MSDU_ASSOC_REQ;
+	msdu->txopts = TXOPT_ACKREQ;
+	msdu->src_mode = MAC_MODE_LONG_ADDR;
+	msdu->dst = req->Dst;
+	msdu->len = 1;
+	msdu->data[0] = req->CapabilityInfo;
+	sim_get_secspec(&msdu->security, &req->Security);
+	sim_direct_commit(sim);
+}
+
+static void sim_mlme_associate_response(struct ca821x_sim *sim,
+                                        const struct MLME_ASSOCIATE_response_pset *rsp)
+{
+	struct ca821x_sim_msdu *msdu = sim_indirect_alloc(sim);
+	struct FullAddr dst;
+
+	dst.AddressMode = MAC_MODE_LONG_ADDR;
+	memcpy(dst.PANId, sim_pib(sim, macPANId), 2);
+	memcpy(dst.Address, rsp->DeviceAddress, 8);
+	if (!msdu) {
+		sim_send_comm_status(sim, &dst, MAC_TRANSACTION_OVERFLOW);
+		return;
+	}
+	msdu->kind = SIM_MSDU_ASSOC_RSP;
+	msdu->txopts = TXOPT_ACKREQ | TXOPT_INDIRECT;
+	msdu->src_mode = MAC_MODE_LONG_ADDR;
+	msdu->dst = dst;
+	msdu->status = rsp->Status;
+	msdu->len = 3;
+	memcpy(msdu->data, rsp->AssocShortAddress, 2);
+	msdu->data[2] = rsp->Status;
+	sim_get_secspec(&msdu->security, &rsp->Security);
+	sim_indirect_commit(sim, msdu);
+}
+
+static void sim_mlme_disassociate_request(struct ca821x_sim *sim,
+                                          const struct MLME_DISASSOCIATE_request_pset *req)
+{
+	struct ca821x_sim_msdu *msdu;
+
+	msdu = req->TxIndirect ? sim_indirect_alloc(sim) : sim_direct_alloc(sim);
+	if (!msdu) {
+		struct FullAddr addr = req->DevAddr;
+		sim_send_disassoc_confirm(sim, &addr, MAC_TRANSACTION_OVERFLOW);
+		return;
+	}
+	msdu->kind = SIM_MSDU_DISASSOC;
+	msdu->txopts = TXOPT_ACKREQ | (req->TxIndirect ? TXOPT_INDIRECT : 0);
+	msdu->src_mode = MAC_MODE_LONG_ADDR;
+	msdu->dst = req->DevAddr;
+	msdu->len = 1;
+	msdu->data[0] = req->DisassociateReason;
+	sim_get_secspec(&msdu->security, &req->Security);
+	if (req->TxIndirect)
+		sim_indirect_commit(sim, msdu);
+	else
+		sim_direct_commit(sim);
+}
+
+static void sim_mlme_orphan_response(struct ca821x_sim *sim,
+                                     const struct MLME_ORPHAN_response_pset *rsp)
+{
+	struct ca821x_sim_msdu *msdu;
+
+	if (!rsp->AssociatedMember)
+		return;
+	msdu = sim_direct_alloc(sim);
+	if (!msdu)
+		return;
+	msdu->kind = SIM_MSDU_ORPHAN_RSP;
+	msdu->src_mode = MAC_MODE_LONG_ADDR;
+	msdu->dst.AddressMode = MAC_MODE_LONG_ADDR;
+	PUTLE16(MAC_BROADCAST_ADDRESS, msdu->dst.PANId);
+	memcpy(msdu->dst.Address, rsp->OrphanAddress, 8);
+	msdu->len = 7;
+	memcpy(msdu->data, sim_pib(sim, macPANId), 2);
+	memcpy(msdu->data + 2, sim_pib(sim, macShortAddress), 2);
+	msdu->data[4] = sim_pib_u8(sim, phyCurrentChannel);
+	memcpy(msdu->data + 5, rsp->ShortAddress, 2);
+	sim_get_secspec(&msdu->security, &rsp->Security);
+	sim_direct_commit(sim);
+}
+
+static uint8_t sim_hwme_get(struct ca821x_sim *sim, uint8_t attribute,
+                            uint8_t *len, uint8_t *value)
+{
+	uint32_t timer;
+
+	if (attribute >= SIM_HWME_ATTRIBUTES)
+		return HWME_UNKNOWN;
+
+	switch (attribute) {
+	case HWME_EDVALUE:
+	case HWME_EDVALLP:
+		*len = 1;
+		value[0] = sim->channel_ed[(sim_pib_u8(sim, phyCurrentChannel) -
+		                            M_MinimumChannel) & 0xF];
+		return HWME_SUCCESS;
+	case HWME_MACTIMER:
+		timer = sim_symbol_time(sim);
+		*len = 4;
+		PUTLE32(timer, value);
+		return HWME_SUCCESS;
+	case HWME_RANDOMNUM:
+		*len = 1;
+		value[0] = sim_rand(sim);
+		return HWME_SUCCESS;
+	case HWME_HSKEY:
+		return HWME_NO_ACCESS;
+	}
+
+	if (!sim->hwme_len[attribute])
+		return HWME_UNKNOWN;
+	*len = sim->hwme_len[attribute];
+	memcpy(value, sim->hwme[attribute], *len);
+	return HWME_SUCCESS;
+}
+
+static uint8_t sim_hwme_set(struct ca821x_sim *sim, uint8_t attribute,
+                            uint8_t len, const uint8_t *value)
+{
+	if (attribute >= SIM_HWME_ATTRIBUTES)
+		return HWME_UNKNOWN;
+	if (!len || len > MAX_HWME_ATTRIBUTE_SIZE)
+		return HWME_INVALID;
+	switch (attribute) {
+	case HWME_CHIPID:
+	case HWME_EDVALUE:
+	case HWME_CSVALUE:
+	case HWME_EDVALLP:
+	case HWME_CSVALLP:
+	case HWME_FREQOFFS:
+	case HWME_MACTIMER:
+	case HWME_RANDOMNUM:
+	case HWME_TEMPERATURE:
+		return HWME_NO_ACCESS;
+	}
+	memcpy(sim->hwme[attribute], value, len);
+	sim->hwme_len[attribute] = len;
+	return HWME_SUCCESS;
+}
+
+static void sim_reset_hwme(struct ca821x_sim *sim)
+{
+	static const uint8_t defaults[][3] = {
+		/* attribute, length, value */
+		{HWME_POWERCON,    1, 0x00},
+		{HWME_CHIPID,      2, 0x01},
+		{HWME_TXPOWER,     1, 0x08},
+		{HWME_CCAMODE,     1, CCAM_ED},
+		{HWME_EDTHRESHOLD, 1, 0x80},
+		{HWME_CSTHRESHOLD, 1, 0x90},
+		{HWME_CSVALUE,     1, 0xC0},
+		{HWME_CSVALLP,     1, 0xC0},
+		{HWME_FREQOFFS,    1, 0x00},
+		{HWME_TEMPERATURE, 1, 25},
+		{HWME_SYSCLKOUT,   1, 0x00},
+		{HWME_LQIMODE,     1, HWME_LQIMODE_CS},
+		{HWME_LQILIMIT,    1, 0x00},
+	};
+	size_t i;
+
+	memset(sim->hwme, 0, sizeof(sim->hwme));
+	memset(sim->hwme_len, 0, sizeof(sim->hwme_len));
+	for (i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+		sim->hwme[defaults[i][0]][0] = defaults[i][2];
+		sim->hwme_len[defaults[i][0]] = defaults[i][1];
+	}
+#if CASCODA_CA_VER == 8211
+	sim->hwme[HWME_MAXDIRECTS][0] = SIM_DIRECT_QUEUE_SIZE;
+	sim->hwme_len[HWME_MAXDIRECTS] = 1;
+	sim->hwme[HWME_MAXINDIRECTS][0] = SIM_INDIRECT_QUEUE_SIZE;
+	sim->hwme_len[HWME_MAXINDIRECTS] = 1;
+#endif
+}
+
+static uint8_t sim_tdme_txpkt(struct ca821x_sim *sim,
+                              const struct TDME_TXPKT_request_pset *req,
+                              struct TDME_TXPKT_confirm_pset *cnf)
+{
+	uint8_t i, len = req->TestPacketLength;
+
+	if (req->TestPacketDataType > TDME_MAX_TXD || len > aMaxPHYPacketSize)
+		return TDME_INVALID;
+
+	cnf->TestPacketSequenceNumber = req->TestPacketSequenceNumber;
+	cnf->TestPacketLength = len;
+	for (i = 0; i < len; i++) {
+		switch (req->TestPacketDataType) {
+		case TDME_TXD_APPENDED:
+			cnf->TestPacketData[i] = req->TestPacketData[i];
+			break;
+		case TDME_TXD_COUNT:
+			cnf->TestPacketData[i] = i;
+			break;
+		case TDME_TXD_SEQRANDOM:
+			cnf->TestPacketData[i] = i ? sim_rand(sim) :
+			                             req->TestPacketSequenceNumber;
+			break;
+		default:
+			cnf->TestPacketData[i] = sim_rand(sim);
+			break;
+		}
+	}
+	sim->frames_tx++;
+	return TDME_SUCCESS;
+}
+
+/******************************************************************************/
+/****** Public interface                                                 ******/
+/******************************************************************************/
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a simulated device and connect it to a ca821x_dev
+ *******************************************************************************
+ * The device's downstream function is set to ca821x_sim_exchange and its
+ * exchange_context to the simulator, so the API can be used immediately. Its
+ * clock is set to the engine's virtual time.
+ * The IEEE address is derived from the seed.
+ *******************************************************************************
+ * \param sim - Simulator state to initialise
+ * \param engine - Event engine the device schedules its events on
+ * \param seed - Seed for the device's random number generator
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return 0: Success
+ *         -EINVAL: Invalid parameter
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_init(
+	struct ca821x_sim        *sim,
+	struct ca821x_sim_engine *engine,
+	uint32_t                  seed,
+	struct ca821x_dev        *pDeviceRef
+)
+{
+	uint8_t *extaddr;
+	int i;
+
+	if (!sim || !engine || !pDeviceRef)
+		return -EINVAL;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->engine = engine;
+	sim->pDeviceRef = pDeviceRef;
+	sim->prng = seed ? seed : 0x1D872B41;
+
+	extaddr = sim->pib[sim_pib_index(nsIEEEAddress)];
+	for (i = 0; i < 8; i++)
+		extaddr[i] = sim_rand(sim);
+	sim_reset_pib(sim);
+	sim_reset_hwme(sim);
+	sim_reset_mac(sim);
+	for (i = 0; i < (int)sizeof(sim->channel_ed); i++)
+		sim->channel_ed[i] = 0x10;
+
+	pDeviceRef->exchange_context = sim;
+	pDeviceRef->ca821x_api_downstream = ca821x_sim_exchange;
+	pDeviceRef->clock = sim_clock;
+	pDeviceRef->clock_context = sim;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Wait for a message from a simulated device in virtual time
+ *******************************************************************************
+ * Conforms to ca821x_wait_for_message. Runs the device's event engine until
+ * the device sends a message with the given command id, which is copied to buf
+ * instead of being dispatched, or until timeout_ms of virtual time has passed.
+ * Only for devices on a standalone engine: devices on a medium are advanced
+ * by ca821x_sim_medium_run_until.
+ *******************************************************************************
+ * \param cmdid - The id of the command to wait for
+ * \param timeout_ms - Timeout for the wait in virtual milliseconds
+ * \param buf - The buffer to populate with the received message
+ * \param pDeviceRef - Pointer to a device initialised by ca821x_sim_init
+ *******************************************************************************
+ * \return 0: Message received
+ *         -ETIMEDOUT: No message within the timeout
+ *         -EINVAL: Device is not simulated standalone
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_wait_for_message(
+	uint8_t            cmdid,
+	int                timeout_ms,
+	uint8_t           *buf,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct ca821x_sim *sim = pDeviceRef->exchange_context;
+	struct ca821x_sim_engine *engine;
+	uint64_t deadline;
+
+	if (!sim || sim->medium || pDeviceRef->ca821x_api_downstream != ca821x_sim_exchange)
+		return -EINVAL;
+
+	engine = sim->engine;
+	deadline = engine->now_ns + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000;
+	sim->wait_cmdid = cmdid;
+	sim->wait_buf = buf;
+	/* Run one instant at a time so nothing after the message is processed */
+	while (sim->wait_buf && engine->count && engine->heap[0].time_ns <= deadline)
+		ca821x_sim_run_until(engine, engine->heap[0].time_ns);
+	if (!sim->wait_buf)
+		return 0;
+
+	sim->wait_buf = NULL;
+	ca821x_sim_run_until(engine, deadline);
+	return -ETIMEDOUT;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Downstream exchange function backed by a simulated device
+ *******************************************************************************
+ * Conforms to ca821x_api_downstream_t. pDeviceRef->exchange_context must point
+ * to a ca821x_sim initialised by ca821x_sim_init. Synchronous commands are
+ * answered in response; everything else is answered later through the event
+ * engine.
+ *******************************************************************************
+ * \param buf - The buffer containing the command to send downstream
+ * \param len - The length of the command in octets
+ * \param response - The buffer to populate with a synchronous response
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return 0: Exchange successful
+ *         -EINVAL: Malformed or unsupported command
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_exchange(
+	const uint8_t     *buf,
+	size_t             len,
+	uint8_t           *response,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct ca821x_sim *sim = pDeviceRef->exchange_context;
+	struct MAC_Message command;
+	struct MAC_Message *rsp = (struct MAC_Message *)response;
+
+	if (!sim || len < 2 || len > sizeof(command) || buf[1] + 2u != len)
+		return -EINVAL;
+	memset(&command, 0, sizeof(command));
+	memcpy(&command, buf, len);
+
+	if (command.CommandId & SPI_SYN) {
+		if (!rsp)
+			return -EINVAL;
+		memset(rsp, 0, sizeof(*rsp));
+		rsp->CommandId = sync_pairings[command.CommandId & SPI_MID_MASK];
+		rsp->Length = 1;
+	}
+
+	switch (command.CommandId) {
+	case SPI_MCPS_DATA_REQUEST:
+		sim_mcps_data_request(sim, &command.PData.DataReq);
+		break;
+#if CASCODA_CA_VER >= 8211
+	case SPI_PCPS_DATA_REQUEST:
+		sim_pcps_data_request(sim, &command.PData.PhyDataReq);
+		break;
+#endif
+	case SPI_MCPS_PURGE_REQUEST:
+		rsp->Length = sizeof(struct MCPS_PURGE_confirm_pset);
+		rsp->PData.PurgeCnf.MsduHandle = command.PData.u8Param;
+		rsp->PData.PurgeCnf.Status = sim_mcps_purge(sim, command.PData.u8Param);
+		break;
+	case SPI_MLME_ASSOCIATE_REQUEST:
+		sim_mlme_associate_request(sim, &command.PData.AssocReq);
+		break;
+	case SPI_MLME_ASSOCIATE_RESPONSE:
+		sim_mlme_associate_response(sim, &command.PData.AssocRsp);
+		break;
+	case SPI_MLME_DISASSOCIATE_REQUEST:
+		sim_mlme_disassociate_request(sim, &command.PData.DisassocReq);
+		break;
+	case SPI_MLME_GET_REQUEST:
+		rsp->PData.GetCnf.PIBAttribute = command.PData.GetReq.PIBAttribute;
+		rsp->PData.GetCnf.PIBAttributeIndex = command.PData.GetReq.PIBAttributeIndex;
+		rsp->PData.GetCnf.Status = ca821x_sim_get_pib(sim,
+			command.PData.GetReq.PIBAttribute,
+			command.PData.GetReq.PIBAttributeIndex,
+			&rsp->PData.GetCnf.PIBAttributeLength,
+			rsp->PData.GetCnf.PIBAttributeValue);
+		if (rsp->PData.GetCnf.Status != MAC_SUCCESS)
+			rsp->PData.GetCnf.PIBAttributeLength = 0;
+		rsp->Length = MLME_GET_CONFIRM_BASE_SIZE + rsp->PData.GetCnf.PIBAttributeLength;
+		break;
+	case SPI_MLME_ORPHAN_RESPONSE:
+		sim_mlme_orphan_response(sim, &command.PData.OrphanRsp);
+		break;
+	case SPI_MLME_RESET_REQUEST:
+		if (command.PData.u8Param)
+			sim_reset_pib(sim);
+		sim_reset_mac(sim);
+		rsp->PData.Status = MAC_SUCCESS;
+		break;
+	case SPI_MLME_RX_ENABLE_REQUEST:
+		rsp->PData.Status = MAC_SUCCESS;
+		break;
+	case SPI_MLME_SCAN_REQUEST:
+		sim_mlme_scan_request(sim, &command.PData.ScanReq);
+		break;
+	case SPI_MLME_SET_REQUEST:
+		rsp->PData.Status = sim_set_pib(sim,
+			command.PData.SetReq.PIBAttribute,
+			command.PData.SetReq.PIBAttributeIndex,
+			command.PData.SetReq.PIBAttributeLength,
+			command.PData.SetReq.PIBAttributeValue);
+		break;
+	case SPI_MLME_START_REQUEST:
+		rsp->PData.Status = sim_mlme_start_request(sim, &command.PData.StartReq);
+		break;
+	case SPI_MLME_POLL_REQUEST:
+		/* Standalone: the coordinator acknowledges but has nothing pending */
+		rsp->PData.Status = MAC_NO_DATA;
+		if (sim->medium)
+			rsp->PData.Status = ca821x_sim_medium_poll(sim,
+				&command.PData.PollReq.CoordAddress);
+		break;
+	case SPI_HWME_SET_REQUEST:
+		rsp->Length = sizeof(struct HWME_SET_confirm_pset);
+		rsp->PData.HWMESetCnf.HWAttribute = command.PData.HWMESetReq.HWAttribute;
+		rsp->PData.HWMESetCnf.Status = sim_hwme_set(sim,
+			command.PData.HWMESetReq.HWAttribute,
+			command.PData.HWMESetReq.HWAttributeLength,
+			command.PData.HWMESetReq.HWAttributeValue);
+		break;
+	case SPI_HWME_GET_REQUEST:
+		rsp->PData.HWMEGetCnf.HWAttribute = command.PData.HWMEGetReq.HWAttribute;
+		rsp->PData.HWMEGetCnf.Status = sim_hwme_get(sim,
+			command.PData.HWMEGetReq.HWAttribute,
+			&rsp->PData.HWMEGetCnf.HWAttributeLength,
+			rsp->PData.HWMEGetCnf.HWAttributeValue);
+		rsp->Length = 3 + rsp->PData.HWMEGetCnf.HWAttributeLength;
+		break;
+	case SPI_HWME_HAES_REQUEST:
+		/* The hardware AES engine is not modelled */
+		rsp->Length = sizeof(struct HWME_HAES_confirm_pset);
+		rsp->PData.HWMEHAESCnf.Status = HWME_UNKNOWN;
+		break;
+	case SPI_TDME_SETSFR_REQUEST:
+		rsp->Length = sizeof(struct TDME_SETSFR_confirm_pset);
+		rsp->PData.TDMESetSFRCnf.SFRPage = command.PData.TDMESetSFRReq.SFRPage;
+		rsp->PData.TDMESetSFRCnf.SFRAddress = command.PData.TDMESetSFRReq.SFRAddress;
+		if (command.PData.TDMESetSFRReq.SFRPage >= SIM_SFR_PAGES) {
+			rsp->PData.TDMESetSFRCnf.Status = TDME_INVALID;
+			break;
+		}
+		sim->sfr[command.PData.TDMESetSFRReq.SFRPage]
+		        [command.PData.TDMESetSFRReq.SFRAddress] =
+			command.PData.TDMESetSFRReq.SFRValue;
+		rsp->PData.TDMESetSFRCnf.Status = TDME_SUCCESS;
+		break;
+	case SPI_TDME_GETSFR_REQUEST:
+		rsp->Length = sizeof(struct TDME_GETSFR_confirm_pset);
+		rsp->PData.TDMEGetSFRCnf.SFRPage = command.PData.TDMEGetSFRReq.SFRPage;
+		rsp->PData.TDMEGetSFRCnf.SFRAddress = command.PData.TDMEGetSFRReq.SFRAddress;
+		if (command.PData.TDMEGetSFRReq.SFRPage >= SIM_SFR_PAGES) {
+			rsp->PData.TDMEGetSFRCnf.Status = TDME_INVALID;
+			break;
+		}
+		rsp->PData.TDMEGetSFRCnf.SFRValue =
+			sim->sfr[command.PData.TDMEGetSFRReq.SFRPage]
+			        [command.PData.TDMEGetSFRReq.SFRAddress];
+		rsp->PData.TDMEGetSFRCnf.Status = TDME_SUCCESS;
+		break;
+	case SPI_TDME_TESTMODE_REQUEST:
+		rsp->Length = sizeof(struct TDME_TESTMODE_confirm_pset);
+		rsp->PData.TDMETestModeCnf.TestMode = command.PData.TDMETestModeReq.TestMode;
+		if (command.PData.TDMETestModeReq.TestMode > TDME_MAX_TESTMODE) {
+			rsp->PData.TDMETestModeCnf.Status = TDME_INVALID;
+			break;
+		}
+		sim->testmode = command.PData.TDMETestModeReq.TestMode;
+		rsp->PData.TDMETestModeCnf.Status = TDME_SUCCESS;
+		break;
+	case SPI_TDME_SET_REQUEST:
+		rsp->Length = sizeof(struct TDME_SET_confirm_pset);
+		rsp->PData.TDMESetCnf.TDAttribute = command.PData.TDMESetReq.TDAttribute;
+		if (command.PData.TDMESetReq.TDAttribute >= SIM_TDME_ATTRIBUTES ||
+		    command.PData.TDMESetReq.TDAttributeLength > MAX_TDME_ATTRIBUTE_SIZE) {
+			rsp->PData.TDMESetCnf.Status = TDME_INVALID;
+			break;
+		}
+		memcpy(sim->tdme[command.PData.TDMESetReq.TDAttribute],
+		       command.PData.TDMESetReq.TDAttributeValue,
+		       command.PData.TDMESetReq.TDAttributeLength);
+		rsp->PData.TDMESetCnf.Status = TDME_SUCCESS;
+		break;
+	case SPI_TDME_TXPKT_REQUEST:
+		rsp->PData.TDMETxPktCnf.Status = sim_tdme_txpkt(sim,
+			&command.PData.TDMETxPktReq, &rsp->PData.TDMETxPktCnf);
+		rsp->Length = 3 + rsp->PData.TDMETxPktCnf.TestPacketLength;
+		break;
+	case SPI_TDME_LOTLK_REQUEST:
+		rsp->Length = sizeof(struct TDME_LOTLK_confirm_pset);
+		rsp->PData.TDMELOTlkCnf.Status = TDME_SUCCESS;
+		rsp->PData.TDMELOTlkCnf.TestChannel = command.PData.TDMELOTlkReq.TestChannel;
+		rsp->PData.TDMELOTlkCnf.TestRxTxb = command.PData.TDMELOTlkReq.TestRxTxb;
+		rsp->PData.TDMELOTlkCnf.TestLOFDACValue = 0x20;
+		rsp->PData.TDMELOTlkCnf.TestLOAMPValue = 0x0A;
+		rsp->PData.TDMELOTlkCnf.TestLOTXCALValue = sim->sfr[1][0xBF];
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* Channel changes from SET, START and ASSOCIATE take effect on the medium */
+	if (sim->medium)
+		ca821x_sim_medium_sync_channel(sim);
+	return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * @file ca821x_sim_engine.c
+ * @brief Discrete event engine for the CA-821X simulator.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ca821x_sim.h"
+
+/** Initial number of heap entries allocated by an engine */
+#define SIM_ENGINE_INITIAL_CAPACITY (64)
+
+static int event_before(const struct ca821x_sim_event *a,
+                        const struct ca821x_sim_event *b)
+{
+	if (a->time_ns != b->time_ns)
+		return a->time_ns < b->time_ns;
+	return a->seq < b->seq;
+}
+
+static void heap_sift_up(struct ca821x_sim_event *heap, size_t i)
+{
+	struct ca821x_sim_event ev = heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!event_before(&ev, &heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = ev;
+}
+
+static void heap_sift_down(struct ca821x_sim_event *heap, size_t count, size_t i)
+{
+	struct ca821x_sim_event ev = heap[i];
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && event_before(&heap[child + 1], &heap[child]))
+			child++;
+		if (!event_before(&heap[child], &ev))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = ev;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise an event engine with its clock at zero
+ *******************************************************************************
+ * \param engine - Engine to initialise
+ *******************************************************************************
+ * \return 0: Success
+ *         -ENOMEM: Allocation failed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_engine_init(struct ca821x_sim_engine *engine)
+{
+	memset(engine, 0, sizeof(*engine));
+	engine->heap = malloc(SIM_ENGINE_INITIAL_CAPACITY * sizeof(*engine->heap));
+	if (!engine->heap)
+		return -ENOMEM;
+	engine->capacity = SIM_ENGINE_INITIAL_CAPACITY;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Free an event engine, discarding any pending events
+ *******************************************************************************
+ * \param engine - Engine to free
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sim_engine_deinit(struct ca821x_sim_engine *engine)
+{
+	free(engine->heap);
+	memset(engine, 0, sizeof(*engine));
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Schedule an event relative to the current virtual time
+ *******************************************************************************
+ * Events scheduled for the same time run in the order they were scheduled.
+ *******************************************************************************
+ * \param engine - Engine to schedule on
+ * \param delay_ns - Delay from now in nanoseconds
+ * \param fn - Handler to call
+ * \param ctx - Handler context
+ * \param arg - Handler argument
+ *******************************************************************************
+ * \return 0: Success
+ *         -ENOMEM: Allocation failed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_schedule(
+	struct ca821x_sim_engine *engine,
+	uint64_t                  delay_ns,
+	ca821x_sim_event_fn       fn,
+	void                     *ctx,
+	uintptr_t                 arg
+)
+{
+	struct ca821x_sim_event *ev;
+
+	if (engine->count == engine->capacity) {
+		size_t capacity = engine->capacity ? engine->capacity * 2 :
+		                                     SIM_ENGINE_INITIAL_CAPACITY;
+		ev = realloc(engine->heap, capacity * sizeof(*engine->heap));
+		if (!ev)
+			return -ENOMEM;
+		engine->heap = ev;
+		engine->capacity = capacity;
+	}
+
+	ev = &engine->heap[engine->count];
+	ev->time_ns = engine->now_ns + delay_ns;
+	ev->seq = engine->seq++;
+	ev->fn = fn;
+	ev->ctx = ctx;
+	ev->arg = arg;
+	heap_sift_up(engine->heap, engine->count++);
+	return 0;
+}
+
+static int event_compare(const void *a, const void *b)
+{
+	if (event_before(a, b))
+		return -1;
+	return event_before(b, a);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Move all pending events with a given context to another engine
+ *******************************************************************************
+ * Used when a simulated device changes partition. Events keep their absolute
+ * time and relative order, so both engines should read the same time.
+ *******************************************************************************
+ * \param from - Engine to take events from
+ * \param to - Engine to move events to
+ * \param ctx - Context of the events to move
+ *******************************************************************************
+ * \return Number of events moved, or -ENOMEM if allocation failed (in which
+ *         case no events are moved)
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_engine_move(
+	struct ca821x_sim_engine *from,
+	struct ca821x_sim_engine *to,
+	void                     *ctx
+)
+{
+	struct ca821x_sim_event *moved, *heap;
+	size_t i, kept = 0, count = 0;
+
+	for (i = 0; i < from->count; i++)
+		count += (from->heap[i].ctx == ctx);
+	if (!count)
+		return 0;
+
+	if (to->count + count > to->capacity) {
+		size_t capacity = to->capacity ? to->capacity : SIM_ENGINE_INITIAL_CAPACITY;
+		while (capacity < to->count + count)
+			capacity *= 2;
+		heap = realloc(to->heap, capacity * sizeof(*heap));
+		if (!heap)
+			return -ENOMEM;
+		to->heap = heap;
+		to->capacity = capacity;
+	}
+	moved = malloc(count * sizeof(*moved));
+	if (!moved)
+		return -ENOMEM;
+
+	count = 0;
+	for (i = 0; i < from->count; i++) {
+		if (from->heap[i].ctx == ctx)
+			moved[count++] = from->heap[i];
+		else
+			from->heap[kept++] = from->heap[i];
+	}
+	from->count = kept;
+	for (i = kept / 2; i-- > 0;)
+		heap_sift_down(from->heap, from->count, i);
+
+	qsort(moved, count, sizeof(*moved), event_compare);
+	for (i = 0; i < count; i++) {
+		moved[i].seq = to->seq++;
+		to->heap[to->count] = moved[i];
+		heap_sift_up(to->heap, to->count++);
+	}
+	free(moved);
+
+	return (int)count;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Run all events up to and including a virtual time
+ *******************************************************************************
+ * Handlers may schedule further events, which are run in turn if they fall
+ * within the window. On return the clock reads until_ns.
+ *******************************************************************************
+ * \param engine - Engine to run
+ * \param until_ns - Absolute virtual time to run to
+ *******************************************************************************
+ * \return Number of events run
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_sim_run_until(struct ca821x_sim_engine *engine, uint64_t until_ns)
+{
+	struct ca821x_sim_event ev;
+	size_t ran = 0;
+
+	while (engine->count && engine->heap[0].time_ns <= until_ns) {
+		ev = engine->heap[0];
+		engine->heap[0] = engine->heap[--engine->count];
+		if (engine->count)
+			heap_sift_down(engine->heap, engine->count, 0);
+
+		engine->now_ns = ev.time_ns;
+		ev.fn(ev.ctx, ev.arg);
+		ran++;
+	}
+	if (until_ns > engine->now_ns)
+		engine->now_ns = until_ns;
+
+	return ran;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Run all events in the next duration_ns of virtual time
+ *******************************************************************************
+ * \param engine - Engine to run
+ * \param duration_ns - Length of virtual time to simulate
+ *******************************************************************************
+ * \return Number of events run
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_sim_run_for(struct ca821x_sim_engine *engine, uint64_t duration_ns)
+{
+	return ca821x_sim_run_until(engine, engine->now_ns + duration_ns);
+}
@@ -0,0 +1,1391 @@
+/**
+ * @file ca821x_sim_medium.c
+ * @brief Shared radio medium connecting many simulated CA-821X devices.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_sim.h"
+#include "ca821x_sim_medium.h"
+#include "ca821x_sim_private.h"
+
+/** Component of devices added since the link table was last built */
+#define COMPONENT_PENDING   (UINT32_MAX)
+/** Number of channels a partition key reserves */
+#define PARTITION_CHANNELS  (32)
+
+/** Transmitter state of a node */
+enum sim_tx_state {
+	TX_IDLE,       //!< Nothing to send
+	TX_DEFERRED,   //!< Waiting for the node to reach its channel
+	TX_BACKOFF,    //!< In CSMA-CA backoff
+	TX_TURNAROUND, //!< CCA passed, switching to transmit
+	TX_AIR,        //!< Frame on air
+	TX_WAIT_ACK    //!< Waiting for an acknowledgement
+};
+
+/** What a node currently has on air */
+enum sim_air {
+	AIR_NONE,
+	AIR_DATA,
+	AIR_ACK
+};
+
+/** A link from one node to another */
+struct sim_link {
+	uint32_t node;     /**< Id of the other node */
+	float    gain_db;  /**< Negative path loss */
+	float    gain_lin; /**< gain_db as a linear factor */
+};
+
+struct sim_partition;
+
+/** A device on the medium. sim must stay first (see NODE()). */
+struct sim_node {
+	struct ca821x_sim         sim;
+	struct ca821x_dev         dev;
+	struct ca821x_sim_medium *medium;
+	uint32_t                  id;
+	uint32_t                  component;
+	double                    x, y;
+	struct sim_link          *links;
+	uint32_t                  num_links;
+	struct sim_partition     *part;
+
+	/* Receiver */
+	double                    energy_mw;    /**< Sum of signals on air here */
+	uint32_t                  energy_count; /**< Number of those signals */
+	struct sim_node          *rx_from;      /**< Node being received */
+	double                    rx_mw;        /**< Power of that signal */
+	float                     rx_dbm;       /**< Power of that signal (dBm) */
+	uint8_t                   rx_ok;        /**< Not yet corrupted */
+
+	/* Transmitter */
+	uint8_t                   tx_state;
+	uint8_t                   nb, be, attempts;
+	uint16_t                  tx_token;
+	uint8_t                   air;
+	uint32_t                  air_version;
+	uint32_t                  air_slot;
+	double                    air_mw;
+	uint8_t                   ack_pending;
+	uint8_t                   ack_dsn;
+	uint16_t                  ack_token;
+	struct sim_node          *ack_to;
+
+	/* Requests to the next epoch boundary */
+	uint8_t                   queued;
+	uint8_t                   move_requested;
+	uint8_t                   scan_requested;
+};
+
+#define NODE(s) ((struct sim_node *)(s))
+
+/** Devices on one channel within one connected component */
+struct sim_partition {
+	struct ca821x_sim_engine engine;
+	uint32_t                 component;
+	uint8_t                  channel;
+	uint32_t                 num_nodes;
+	struct sim_node        **air;         /**< Nodes currently on air */
+	uint32_t                 num_air, cap_air;
+	struct sim_node        **requests;    /**< Nodes with boundary requests */
+	uint32_t                 num_requests, cap_requests;
+	struct sim_node        **scratch;     /**< Receivers of a frame */
+	uint32_t                 cap_scratch;
+	uint64_t                 busy_ns;     /**< Air time in the current epoch */
+	uint8_t                  ed;          /**< Occupancy of the last epoch */
+	struct ca821x_sim_medium_stats stats;
+};
+
+struct ca821x_sim_medium {
+	struct ca821x_sim_radio  radio;
+	double                   noise_mw, cca_mw, capture_lin;
+	uint32_t                 seed;
+	uint64_t                 now_ns;
+	uint64_t                 epoch_ns;
+	uint64_t                 epochs;
+
+	struct sim_node        **nodes;
+	uint32_t                 num_nodes, cap_nodes;
+	int                      topology_dirty;
+	uint32_t                 topology_version;
+
+	struct sim_partition   **parts;
+	uint32_t                 num_parts, cap_parts;
+	uint32_t                *part_hash;     /**< Index into parts + 1, 0 if free */
+	uint32_t                 hash_size;
+
+	/* Epoch execution */
+	struct sim_partition   **ready;
+	uint32_t                 num_ready, cap_ready;
+	atomic_uint              next_ready;
+	uint64_t                 epoch_end;
+	struct sim_node        **barrier_list;
+	uint32_t                 cap_barrier;
+
+	/* Worker pool */
+	pthread_t               *threads;
+	unsigned                 num_threads;
+	pthread_mutex_t          lock;
+	pthread_cond_t           start_cv, done_cv;
+	uint64_t                 epoch_gen;
+	unsigned                 busy_workers;
+	int                      shutdown;
+};
+
+static void medium_begin_csma(struct sim_node *node);
+
+/******************************************************************************/
+/****** Helpers                                                          ******/
+/******************************************************************************/
+
+static double dbm_to_mw(double dbm)
+{
+	return pow(10.0, dbm / 10.0);
+}
+
+static int grow(void *array, uint32_t *cap, uint32_t need, size_t size)
+{
+	void **p = array;
+	uint32_t n = *cap ? *cap : 16;
+	void *q;
+
+	if (need <= *cap)
+		return 0;
+	while (n < need)
+		n *= 2;
+	q = realloc(*p, (size_t)n * size);
+	if (!q)
+		return -ENOMEM;
+	*p = q;
+	*cap = n;
+	return 0;
+}
+
+static uint32_t hash32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+/** Symmetric shadowing of the link between two nodes */
+static double link_shadowing(struct ca821x_sim_medium *m, uint32_t a, uint32_t b)
+{
+	uint32_t lo = a < b ? a : b, hi = a < b ? b : a;
+	uint32_t h1 = hash32(m->seed ^ hash32(lo * 0x9E3779B1u ^ hash32(hi)));
+	uint32_t h2 = hash32(h1 ^ 0x68E31DA4);
+	double u1 = (h1 + 1.0) / 4294967297.0, u2 = h2 / 4294967296.0;
+
+	if (m->radio.shadowing_db <= 0)
+		return 0;
+	return m->radio.shadowing_db * sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+static uint8_t clamp_u8(double v)
+{
+	if (v < 0)
+		return 0;
+	if (v > 255)
+		return 255;
+	return (uint8_t)v;
+}
+
+/** LQI reported for a frame, following the device's HWME_LQIMODE */
+static uint8_t link_quality(struct ca821x_sim_medium *m, struct sim_node *rx,
+                            double rx_dbm)
+{
+	if (rx->sim.hwme[HWME_LQIMODE][0] == HWME_LQIMODE_ED)
+		return clamp_u8(2.0 * (rx_dbm + 128.0));
+	/* Carrier sense: scales with margin over sensitivity, saturating at 40dB */
+	return clamp_u8((rx_dbm - m->radio.sensitivity_dbm) * 255.0 / 40.0);
+}
+
+static const struct sim_link *find_link(struct sim_node *node, uint32_t other)
+{
+	uint32_t lo = 0, hi = node->num_links;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (node->links[mid].node == other)
+			return &node->links[mid];
+		if (node->links[mid].node < other)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/******************************************************************************/
+/****** Partitions                                                       ******/
+/******************************************************************************/
+
+static uint32_t part_slot(struct ca821x_sim_medium *m, uint32_t component,
+                          uint8_t channel)
+{
+	uint64_t key = (uint64_t)component * PARTITION_CHANNELS + channel;
+
+	return hash32((uint32_t)key ^ hash32((uint32_t)(key >> 32))) & (m->hash_size - 1);
+}
+
+static struct sim_partition *find_partition(struct ca821x_sim_medium *m,
+                                            uint32_t component, uint8_t channel)
+{
+	uint32_t i = part_slot(m, component, channel);
+	struct sim_partition *p;
+
+	while (m->part_hash[i]) {
+		p = m->parts[m->part_hash[i] - 1];
+		if (p->component == component && p->channel == channel)
+			return p;
+		i = (i + 1) & (m->hash_size - 1);
+	}
+	return NULL;
+}
+
+static int rehash(struct ca821x_sim_medium *m, uint32_t size)
+{
+	uint32_t *hash = calloc(size, sizeof(*hash));
+	uint32_t i, j;
+
+	if (!hash)
+		return -ENOMEM;
+	free(m->part_hash);
+	m->part_hash = hash;
+	m->hash_size = size;
+	for (i = 0; i < m->num_parts; i++) {
+		j = part_slot(m, m->parts[i]->component, m->parts[i]->channel);
+		while (m->part_hash[j])
+			j = (j + 1) & (size - 1);
+		m->part_hash[j] = i + 1;
+	}
+	return 0;
+}
+
+static struct sim_partition *get_partition(struct ca821x_sim_medium *m,
+                                           uint32_t component, uint8_t channel)
+{
+	struct sim_partition *p = find_partition(m, component, channel);
+	uint32_t i;
+
+	if (p)
+		return p;
+	if ((m->num_parts + 1) * 2 > m->hash_size && rehash(m, m->hash_size * 2))
+		return NULL;
+	if (grow(&m->parts, &m->cap_parts, m->num_parts + 1, sizeof(*m->parts)) ||
+	    grow(&m->ready, &m->cap_ready, m->num_parts + 1, sizeof(*m->ready)))
+		return NULL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	if (ca821x_sim_engine_init(&p->engine)) {
+		free(p);
+		return NULL;
+	}
+	p->engine.now_ns = m->now_ns;
+	p->component = component;
+	p->channel = channel;
+	m->parts[m->num_parts++] = p;
+
+	i = part_slot(m, component, channel);
+	while (m->part_hash[i])
+		i = (i + 1) & (m->hash_size - 1);
+	m->part_hash[i] = m->num_parts;
+	return p;
+}
+
+static void free_partition(struct sim_partition *p)
+{
+	ca821x_sim_engine_deinit(&p->engine);
+	free(p->air);
+	free(p->requests);
+	free(p->scratch);
+	free(p);
+}
+
+/** Ask for the node to be looked at on the next epoch boundary */
+static void queue_request(struct sim_node *node)
+{
+	struct sim_partition *p = node->part;
+
+	if (node->queued)
+		return;
+	if (grow(&p->requests, &p->cap_requests, p->num_requests + 1,
+	         sizeof(*p->requests)))
+		return;
+	p->requests[p->num_requests++] = node;
+	node->queued = 1;
+}
+
+/******************************************************************************/
+/****** Air interface                                                    ******/
+/******************************************************************************/
+
+static int sinr_ok(struct ca821x_sim_medium *m, struct sim_node *rx, double signal_mw)
+{
+	double interference = rx->energy_mw - signal_mw;
+
+	if (interference < 0)
+		interference = 0;
+	return signal_mw >= (interference + m->noise_mw) * m->capture_lin;
+}
+
+static int node_listening(struct sim_node *node)
+{
+	return node->tx_state == TX_WAIT_ACK || ca821x_sim_is_listening(&node->sim);
+}
+
+/** Put a frame on air, updating the energy and receptions of every neighbour */
+static void air_start(struct sim_node *node, uint8_t kind, uint8_t psdu_len)
+{
+	struct ca821x_sim_medium *m = node->medium;
+	struct sim_partition *p = node->part;
+	double tx_dbm = ca821x_sim_tx_power(&node->sim);
+	uint32_t i;
+
+	if (grow(&p->air, &p->cap_air, p->num_air + 1, sizeof(*p->air)))
+		return;
+	node->air = kind;
+	node->air_mw = dbm_to_mw(tx_dbm);
+	node->air_version = m->topology_version;
+	node->air_slot = p->num_air;
+	p->air[p->num_air++] = node;
+	p->busy_ns += AIRTIME_NS(psdu_len);
+	if (kind == AIR_ACK)
+		p->stats.acks++;
+	else
+		p->stats.frames++;
+
+	/* Half duplex: anything being received is lost */
+	node->rx_from = NULL;
+
+	for (i = 0; i < node->num_links; i++) {
+		const struct sim_link *link = &node->links[i];
+		struct sim_node *rx = m->nodes[link->node];
+		double signal = node->air_mw * link->gain_lin;
+		double rx_dbm = tx_dbm + link->gain_db;
+
+		if (rx->part != p)
+			continue;
+		rx->energy_mw += signal;
+		rx->energy_count++;
+
+		if (rx->rx_from) {
+			if (rx->rx_ok && !sinr_ok(m, rx, rx->rx_mw)) {
+				rx->rx_ok = 0;
+				p->stats.collisions++;
+			}
+			continue;
+		}
+		if (rx->air || rx_dbm < m->radio.sensitivity_dbm || !node_listening(rx))
+			continue;
+		rx->rx_from = node;
+		rx->rx_mw = signal;
+		rx->rx_dbm = (float)rx_dbm;
+		rx->rx_ok = sinr_ok(m, rx, signal);
+		if (!rx->rx_ok)
+			p->stats.collisions++;
+	}
+}
+
+/**
+ * Take a frame off air. Neighbours that received it intact are collected in
+ * the partition's scratch list, and the number of them is returned.
+ */
+static uint32_t air_end(struct sim_node *node)
+{
+	struct ca821x_sim_medium *m = node->medium;
+	struct sim_partition *p = node->part;
+	uint32_t i, count = 0;
+	int tracked = node->air_version == m->topology_version;
+
+	p->air[node->air_slot] = p->air[--p->num_air];
+	p->air[node->air_slot]->air_slot = node->air_slot;
+	node->air = AIR_NONE;
+
+	for (i = 0; tracked && i < node->num_links; i++) {
+		struct sim_node *rx = m->nodes[node->links[i].node];
+
+		if (rx->part != p)
+			continue;
+		if (rx->energy_count && --rx->energy_count)
+			rx->energy_mw -= node->air_mw * node->links[i].gain_lin;
+		else
+			rx->energy_mw = 0;
+
+		if (rx->rx_from != node)
+			continue;
+		rx->rx_from = NULL;
+		if (!rx->rx_ok)
+			continue;
+		if (grow(&p->scratch, &p->cap_scratch, count + 1, sizeof(*p->scratch)))
+			continue;
+		p->scratch[count++] = rx;
+		p->stats.receptions++;
+	}
+	return count;
+}
+
+static void medium_finish(struct sim_node *node, uint8_t status)
+{
+	node->tx_state = TX_IDLE;
+	node->tx_token++;
+	ca821x_sim_tx_done(&node->sim, status);
+}
+
+static void ev_ack_air(void *ctx, uintptr_t arg);
+static void ev_ack_end(void *ctx, uintptr_t arg);
+
+static void ev_ack_timeout(void *ctx, uintptr_t arg)
+{
+	struct sim_node *node = ctx;
+
+	if ((uint16_t)arg != node->tx_token || node->tx_state != TX_WAIT_ACK)
+		return;
+	node->part->stats.ack_timeouts++;
+	if (++node->attempts > ca821x_sim_pib_u8(&node->sim, macMaxFrameRetries)) {
+		medium_finish(node, MAC_NO_ACK);
+		return;
+	}
+	medium_begin_csma(node);
+}
+
+static void ev_tx_end(void *ctx, uintptr_t arg)
+{
+	struct sim_node *node = ctx;
+	const struct ca821x_sim_msdu *msdu = &node->sim.direct[node->sim.direct_head];
+	struct sim_partition *p = node->part;
+	struct ca821x_sim_rxinfo info;
+	uint32_t i, count;
+	int unicast;
+
+	count = air_end(node);
+	/* A reset during transmission discards the frame */
+	if ((uint16_t)arg != node->tx_token || node->tx_state != TX_AIR)
+		return;
+
+	ca821x_sim_src_info(&node->sim, msdu->src_mode, &info);
+	for (i = 0; i < count; i++) {
+		struct sim_node *rx = p->scratch[i];
+		info.lqi = link_quality(node->medium, rx, rx->rx_dbm);
+		if (!ca821x_sim_rx_frame(&rx->sim, msdu, &info))
+			continue;
+		/* Acknowledge after the turnaround time */
+		rx->ack_pending = 1;
+		rx->ack_to = node;
+		rx->ack_dsn = msdu->dsn;
+		ca821x_sim_schedule(rx->sim.engine, SYMBOLS_NS(aTurnaroundTime),
+		                    ev_ack_air, rx, ++rx->ack_token);
+	}
+
+	unicast = msdu->dst.AddressMode == MAC_MODE_LONG_ADDR ||
+	          (msdu->dst.AddressMode == MAC_MODE_SHORT_ADDR &&
+	           GETLE16(msdu->dst.Address) != MAC_BROADCAST_ADDRESS);
+	if (!(msdu->txopts & TXOPT_ACKREQ) || !unicast) {
+		medium_finish(node, MAC_SUCCESS);
+		return;
+	}
+	node->tx_state = TX_WAIT_ACK;
+	ca821x_sim_schedule(node->sim.engine,
+		SYMBOLS_NS(ca821x_sim_pib_u8(&node->sim, macAckWaitDuration)),
+		ev_ack_timeout, node, node->tx_token);
+}
+
+static void ev_ack_air(void *ctx, uintptr_t arg)
+{
+	struct sim_node *node = ctx;
+
+	if ((uint16_t)arg != node->ack_token || !node->ack_pending)
+		return;
+	node->ack_pending = 0;
+	if (node->air)
+		return;
+	air_start(node, AIR_ACK, ACK_PSDU_LEN);
+	ca821x_sim_schedule(node->sim.engine, AIRTIME_NS(ACK_PSDU_LEN), ev_ack_end,
+	                    node, 0);
+}
+
+static void ev_ack_end(void *ctx, uintptr_t arg)
+{
+	struct sim_node *node = ctx;
+	struct sim_partition *p = node->part;
+	uint32_t i, count = air_end(node);
+
+	(void)arg;
+	for (i = 0; i < count; i++) {
+		struct sim_node *rx = p->scratch[i];
+		if (rx != node->ack_to || rx->tx_state != TX_WAIT_ACK)
+			continue;
+		if (rx->sim.direct[rx->sim.direct_head].dsn != node->ack_dsn)
+			continue;
+		medium_finish(rx, MAC_SUCCESS);
+	}
+}
+
+static void ev_tx_air(void *ctx, uintptr_t arg)
+{
+	struct sim_node *node = ctx;
+	const struct ca821x_sim_msdu *msdu = &node->sim.direct[node->sim.direct_head];
+	uint8_t len;
+
+	if ((uint16_t)arg != node->tx_token || node->tx_state != TX_TURNAROUND)
+		return;
+	if (node->air || node->ack_pending) {
+		/* An acknowledgement took the radio: back off again */
+		medium_begin_csma(node);
+		return;
+	}
+	len = ca821x_sim_psdu_len(&node->sim, msdu);
+	node->tx_state = TX_AIR;
+	air_start(node, AIR_DATA, len);
+	ca821x_sim_schedule(node->sim.engine, AIRTIME_NS(len), ev_tx_end, node,
+	                    node->tx_token);
+}
+
+static void medium_backoff(struct sim_node *node);
+
+static void ev_cca(void *ctx, uintptr_t arg)
+{
+	struct sim_node *node = ctx;
+	struct ca821x_sim_medium *m = node->medium;
+
+	if ((uint16_t)arg != node->tx_token || node->tx_state != TX_BACKOFF)
+		return;
+	if (node->air || node->ack_pending || node->energy_mw >= m->cca_mw) {
+		node->part->stats.cca_busy++;
+		node->nb++;
+		if (node->be < ca821x_sim_pib_u8(&node->sim, macMaxBE))
+			node->be++;
+		if (node->nb > ca821x_sim_pib_u8(&node->sim, macMaxCSMABackoffs)) {
+			medium_finish(node, MAC_CHANNEL_ACCESS_FAILURE);
+			return;
+		}
+		medium_backoff(node);
+		return;
+	}
+	node->tx_state = TX_TURNAROUND;
+	ca821x_sim_schedule(node->sim.engine, SYMBOLS_NS(aTurnaroundTime), ev_tx_air,
+	                    node, node->tx_token);
+}
+
+static void medium_backoff(struct sim_node *node)
+{
+	uint32_t backoffs = ca821x_sim_rand(&node->sim) & ((1u << node->be) - 1);
+
+	node->tx_state = TX_BACKOFF;
+	ca821x_sim_schedule(node->sim.engine,
+		SYMBOLS_NS(backoffs * aUnitBackoffPeriod + CCA_SYMBOLS),
+		ev_cca, node, node->tx_token);
+}
+
+static void medium_begin_csma(struct sim_node *node)
+{
+	node->nb = 0;
+	node->be = ca821x_sim_pib_u8(&node->sim, macMinBE);
+	node->tx_token++;
+	medium_backoff(node);
+}
+
+/******************************************************************************/
+/****** Device hooks (see ca821x_sim_private.h)                          ******/
+/******************************************************************************/
+
+/** Start sending the frame at the head of a device's direct queue */
+void ca821x_sim_medium_tx_start(struct ca821x_sim *sim)
+{
+	struct sim_node *node = NODE(sim);
+
+	node->attempts = 0;
+	if (node->medium->topology_dirty ||
+	    ca821x_sim_channel(sim) != node->part->channel) {
+		node->tx_state = TX_DEFERRED;
+		node->move_requested = 1;
+		queue_request(node);
+		return;
+	}
+	medium_begin_csma(node);
+}
+
+/** Abandon any transaction in progress after an MLME-RESET */
+void ca821x_sim_medium_reset(struct ca821x_sim *sim)
+{
+	struct sim_node *node = NODE(sim);
+
+	node->tx_state = TX_IDLE;
+	node->tx_token++;
+	node->ack_pending = 0;
+	node->ack_token++;
+	ca821x_sim_medium_sync_channel(sim);
+}
+
+/** Request a partition move if the device's channel has changed */
+void ca821x_sim_medium_sync_channel(struct ca821x_sim *sim)
+{
+	struct sim_node *node = NODE(sim);
+
+	if (ca821x_sim_channel(sim) == node->part->channel)
+		return;
+	node->move_requested = 1;
+	queue_request(node);
+}
+
+/** Scan time has elapsed: results are gathered at the epoch boundary */
+void ca821x_sim_medium_scan_done(struct ca821x_sim *sim)
+{
+	struct sim_node *node = NODE(sim);
+
+	node->scan_requested = 1;
+	queue_request(node);
+}
+
+static int coord_matches(struct sim_node *coord, const struct FullAddr *addr)
+{
+	struct ca821x_sim *c = &coord->sim;
+	uint16_t pan = GETLE16(addr->PANId);
+
+	if (pan != MAC_BROADCAST_ADDRESS && pan != ca821x_sim_pib_u16(c, macPANId))
+		return 0;
+	if (addr->AddressMode == MAC_MODE_SHORT_ADDR)
+		return GETLE16(addr->Address) == ca821x_sim_pib_u16(c, macShortAddress);
+	if (addr->AddressMode == MAC_MODE_LONG_ADDR)
+		return !memcmp(addr->Address, ca821x_sim_extaddr(c), 8);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Send a data request to a coordinator and retrieve a pending frame
+ *******************************************************************************
+ * The exchange is resolved immediately: if the coordinator is in range and
+ * holds a frame for the device, the frame is delivered to the device and the
+ * coordinator's transaction is completed after the air time it would take.
+ *******************************************************************************
+ * \param sim - Polling device
+ * \param coord - Coordinator address
+ *******************************************************************************
+ * \return MAC_SUCCESS, MAC_NO_DATA or MAC_NO_ACK
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_sim_medium_poll(struct ca821x_sim *sim, const struct FullAddr *coord)
+{
+	struct sim_node *node = NODE(sim), *c = NULL;
+	struct ca821x_sim_medium *m = node->medium;
+	const struct ca821x_sim_msdu *msdu;
+	double tx_dbm = ca821x_sim_tx_power(sim);
+	uint64_t delay;
+	uint32_t i;
+	int slot;
+
+	if (m->topology_dirty || ca821x_sim_channel(sim) != node->part->channel)
+		return MAC_NO_ACK;
+	node->part->stats.polls++;
+
+	for (i = 0; i < node->num_links; i++) {
+		struct sim_node *n = m->nodes[node->links[i].node];
+		double gain = node->links[i].gain_db;
+
+		if (n->part != node->part || !coord_matches(n, coord))
+			continue;
+		if (tx_dbm + gain < m->radio.sensitivity_dbm ||
+		    ca821x_sim_tx_power(&n->sim) + gain < m->radio.sensitivity_dbm ||
+		    !ca821x_sim_is_listening(&n->sim))
+			continue;
+		c = n;
+		break;
+	}
+	if (!c)
+		return MAC_NO_ACK;
+	if (sim->poll_pending)
+		return MAC_NO_DATA;
+
+	slot = ca821x_sim_indirect_find(&c->sim, ca821x_sim_extaddr(sim),
+	                                ca821x_sim_pib_u16(sim, macShortAddress), 0);
+	if (slot < 0)
+		return MAC_NO_DATA;
+
+	msdu = &c->sim.indirect[slot];
+	sim->poll_msdu = *msdu;
+	ca821x_sim_src_info(&c->sim, msdu->src_mode ? msdu->src_mode : MAC_MODE_LONG_ADDR,
+	                    &sim->poll_info);
+	sim->poll_info.lqi = link_quality(m, node, ca821x_sim_tx_power(&c->sim) +
+	                                           node->links[i].gain_db);
+
+	/* Data request, ack, then the frame itself and its ack */
+	delay = AIRTIME_NS(DATAREQ_PSDU_LEN) + SYMBOLS_NS(aTurnaroundTime) +
+	        AIRTIME_NS(ACK_PSDU_LEN) + SYMBOLS_NS(aTurnaroundTime) +
+	        AIRTIME_NS(ca821x_sim_psdu_len(&c->sim, msdu));
+	ca821x_sim_indirect_sent(&c->sim, slot, delay + SYMBOLS_NS(aTurnaroundTime) +
+	                                        AIRTIME_NS(ACK_PSDU_LEN));
+	sim->poll_info.frame_pending =
+		ca821x_sim_indirect_find(&c->sim, ca821x_sim_extaddr(sim),
+		                         ca821x_sim_pib_u16(sim, macShortAddress), 0) >= 0;
+	ca821x_sim_poll_deliver(sim, delay);
+	node->part->stats.receptions++;
+	return MAC_SUCCESS;
+}
+
+/******************************************************************************/
+/****** Epoch boundary                                                   ******/
+/******************************************************************************/
+
+static void resolve_scan(struct ca821x_sim_medium *m, struct sim_node *node)
+{
+	struct ca821x_sim *sim = &node->sim;
+	struct sim_partition *p;
+	double tx_dbm = ca821x_sim_tx_power(sim);
+	uint8_t channel, ed;
+	uint32_t i;
+
+	for (channel = M_MinimumChannel; channel <= M_MaximumChannel; channel++) {
+		if (!(sim->scan_channels & (1UL << channel)))
+			continue;
+		p = find_partition(m, node->component, channel);
+
+		if (sim->scan_type == ENERGY_DETECT) {
+			ed = sim->channel_ed[channel - M_MinimumChannel];
+			if (p && p->ed > ed)
+				ed = p->ed;
+			ca821x_sim_scan_add_ed(sim, ed);
+			continue;
+		}
+		if (!p || (sim->scan_type != ACTIVE_SCAN && sim->scan_type != PASSIVE_SCAN))
+			continue;
+
+		for (i = 0; i < node->num_links; i++) {
+			struct sim_node *c = m->nodes[node->links[i].node];
+			double rx_dbm = ca821x_sim_tx_power(&c->sim) + node->links[i].gain_db;
+
+			if (c->part != p || !c->sim.started)
+				continue;
+			if (rx_dbm < m->radio.sensitivity_dbm)
+				continue;
+			/* Passive scans only hear beacon-enabled networks; active
+			 * scans need the beacon request to reach the coordinator */
+			if (sim->scan_type == PASSIVE_SCAN &&
+			    ca821x_sim_pib_u8(&c->sim, macBeaconOrder) == 15)
+				continue;
+			if (sim->scan_type == ACTIVE_SCAN &&
+			    tx_dbm + node->links[i].gain_db < m->radio.sensitivity_dbm)
+				continue;
+			ca821x_sim_scan_add_beacon(sim, &c->sim, link_quality(m, node, rx_dbm));
+		}
+	}
+	ca821x_sim_scan_finish(sim);
+}
+
+static int node_can_move(struct sim_node *node)
+{
+	return !node->air && !node->ack_pending &&
+	       (node->tx_state == TX_IDLE || node->tx_state == TX_DEFERRED);
+}
+
+/** Move a node to the partition matching its component and channel */
+static int move_node(struct ca821x_sim_medium *m, struct sim_node *node)
+{
+	struct sim_partition *from = node->part, *to;
+	uint32_t i;
+
+	to = get_partition(m, node->component, ca821x_sim_channel(&node->sim));
+	if (!to)
+		return -ENOMEM;
+	if (to != from) {
+		if (ca821x_sim_engine_move(&from->engine, &to->engine, &node->sim) < 0)
+			return -ENOMEM;
+		node->sim.engine = &to->engine;
+		from->num_nodes--;
+		to->num_nodes++;
+		node->part = to;
+		to->stats.moves++;
+	}
+
+	/* Pick up the energy of frames already on air in the new partition */
+	node->rx_from = NULL;
+	node->energy_mw = 0;
+	node->energy_count = 0;
+	for (i = 0; i < to->num_air; i++) {
+		struct sim_node *tx = to->air[i];
+		const struct sim_link *link;
+		if (tx->air_version != m->topology_version)
+			continue;
+		link = find_link(node, tx->id);
+		if (!link)
+			continue;
+		node->energy_mw += tx->air_mw * link->gain_lin;
+		node->energy_count++;
+	}
+	return 0;
+}
+
+/** Handle requests queued by devices during the last epoch */
+static void medium_barrier(struct ca821x_sim_medium *m)
+{
+	uint32_t i, j, first, last, carried = 0;
+	struct sim_node *node;
+	int again = 1;
+
+	while (again) {
+		/* Nodes carried over to the next boundary stay at the front */
+		last = carried;
+		for (i = 0; i < m->num_parts; i++) {
+			struct sim_partition *p = m->parts[i];
+			if (!p->num_requests)
+				continue;
+			if (grow(&m->barrier_list, &m->cap_barrier, last + p->num_requests,
+			         sizeof(*m->barrier_list)))
+				return;
+			memcpy(m->barrier_list + last, p->requests,
+			       p->num_requests * sizeof(*p->requests));
+			last += p->num_requests;
+			p->num_requests = 0;
+		}
+
+		for (first = carried, j = first; j < last; j++) {
+			node = m->barrier_list[j];
+			node->queued = 0;
+			if (node->scan_requested) {
+				node->scan_requested = 0;
+				resolve_scan(m, node);
+			}
+			if (!node->move_requested)
+				continue;
+			if (!node_can_move(node) || move_node(m, node)) {
+				m->barrier_list[carried++] = node;
+				continue;
+			}
+			node->move_requested = 0;
+			if (node->tx_state == TX_DEFERRED)
+				medium_begin_csma(node);
+		}
+
+		/* Callbacks run above may have queued more requests */
+		again = 0;
+		for (i = 0; i < m->num_parts && !again; i++)
+			again = m->parts[i]->num_requests != 0;
+	}
+
+	for (j = 0; j < carried; j++)
+		queue_request(m->barrier_list[j]);
+}
+
+/******************************************************************************/
+/****** Link table                                                       ******/
+/******************************************************************************/
+
+static uint32_t uf_find(uint32_t *parent, uint32_t x)
+{
+	while (parent[x] != x) {
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+static int link_compare(const void *a, const void *b)
+{
+	const struct sim_link *la = a, *lb = b;
+
+	return (la->node > lb->node) - (la->node < lb->node);
+}
+
+/** Build every node's link list with a uniform grid, then the partitions */
+static int medium_build(struct ca821x_sim_medium *m)
+{
+	struct ca821x_sim_radio *r = &m->radio;
+	double floor_dbm = r->noise_dbm - 10.0;
+	double max_pl = SIM_MEDIUM_MAX_TX_DBM - floor_dbm + 3.0 * r->shadowing_db;
+	double range = pow(10.0, (max_pl - r->pl0_db) / (10.0 * r->exponent));
+	double minx = 0, miny = 0, maxx = 0, maxy = 0, cell;
+	uint32_t *cell_start = NULL, *cell_nodes = NULL, *parent = NULL, *rename = NULL;
+	uint32_t gx, gy, i, pass, ncomp = 0;
+	int ret = -ENOMEM;
+
+	if (range < 1.0)
+		range = 1.0;
+	for (i = 0; i < m->num_nodes; i++) {
+		struct sim_node *n = m->nodes[i];
+		if (!i || n->x < minx) minx = n->x;
+		if (!i || n->y < miny) miny = n->y;
+		if (!i || n->x > maxx) maxx = n->x;
+		if (!i || n->y > maxy) maxy = n->y;
+	}
+	cell = range;
+	for (;;) {
+		gx = (uint32_t)((maxx - minx) / cell) + 1;
+		gy = (uint32_t)((maxy - miny) / cell) + 1;
+		if ((uint64_t)gx * gy <= 4ULL * m->num_nodes + 16)
+			break;
+		cell *= 2;
+	}
+
+	cell_start = calloc((size_t)gx * gy + 1, sizeof(*cell_start));
+	cell_nodes = malloc((m->num_nodes + 1) * sizeof(*cell_nodes));
+	parent = malloc((m->num_nodes + 1) * sizeof(*parent));
+	rename = malloc((m->num_nodes + 1) * sizeof(*rename));
+	if (!cell_start || !cell_nodes || !parent || !rename)
+		goto exit;
+
+#define CELL_OF(n) ((uint32_t)(((n)->y - miny) / cell) * gx + \
+                    (uint32_t)(((n)->x - minx) / cell))
+	for (i = 0; i < m->num_nodes; i++)
+		cell_start[CELL_OF(m->nodes[i]) + 1]++;
+	for (i = 0; i < gx * gy; i++)
+		cell_start[i + 1] += cell_start[i];
+	for (i = 0; i < m->num_nodes; i++) {
+		uint32_t c = CELL_OF(m->nodes[i]);
+		cell_nodes[cell_start[c]++] = i;
+	}
+	for (i = gx * gy; i > 0; i--)
+		cell_start[i] = cell_start[i - 1];
+	cell_start[0] = 0;
+
+	/* Pass 0 counts links, pass 1 fills them */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < m->num_nodes; i++) {
+			struct sim_node *n = m->nodes[i];
+			int cx = (int)((n->x - minx) / cell), cy = (int)((n->y - miny) / cell);
+			int dx, dy;
+			uint32_t k, count = 0;
+
+			if (pass) {
+				free(n->links);
+				n->links = malloc((n->num_links + 1) * sizeof(*n->links));
+				if (!n->links)
+					goto exit;
+			}
+			for (dy = -1; dy <= 1; dy++) {
+				for (dx = -1; dx <= 1; dx++) {
+					uint32_t c;
+					if (cx + dx < 0 || cy + dy < 0 ||
+					    cx + dx >= (int)gx || cy + dy >= (int)gy)
+						continue;
+					c = (uint32_t)(cy + dy) * gx + (uint32_t)(cx + dx);
+					for (k = cell_start[c]; k < cell_start[c + 1]; k++) {
+						struct sim_node *o = m->nodes[cell_nodes[k]];
+						double d = hypot(n->x - o->x, n->y - o->y), pl;
+						if (o == n)
+							continue;
+						pl = r->pl0_db + 10.0 * r->exponent * log10(d < 1.0 ? 1.0 : d) +
+						     link_shadowing(m, n->id, o->id);
+						if (SIM_MEDIUM_MAX_TX_DBM - pl < floor_dbm)
+							continue;
+						if (pass) {
+							n->links[count].node = o->id;
+							n->links[count].gain_db = (float)-pl;
+							n->links[count].gain_lin = (float)dbm_to_mw(-pl);
+						}
+						count++;
+					}
+				}
+			}
+			n->num_links = count;
+			if (pass)
+				qsort(n->links, count, sizeof(*n->links), link_compare);
+		}
+	}
+#undef CELL_OF
+
+	/* Connected components, numbered in order of their lowest node id */
+	for (i = 0; i < m->num_nodes; i++)
+		parent[i] = i;
+	for (i = 0; i < m->num_nodes; i++) {
+		struct sim_node *n = m->nodes[i];
+		uint32_t k;
+		for (k = 0; k < n->num_links; k++) {
+			uint32_t a = uf_find(parent, i), b = uf_find(parent, n->links[k].node);
+			if (a != b)
+				parent[a > b ? a : b] = a < b ? a : b;
+		}
+	}
+	for (i = 0; i < m->num_nodes; i++) {
+		uint32_t root = uf_find(parent, i);
+		rename[i] = (root == i) ? ncomp++ : rename[root];
+	}
+
+	m->topology_version++;
+	m->topology_dirty = 0;
+	for (i = 0; i < m->num_nodes; i++) {
+		struct sim_node *n = m->nodes[i];
+		n->component = rename[i];
+		if (move_node(m, n))
+			goto exit;
+		if (n->tx_state == TX_DEFERRED &&
+		    ca821x_sim_channel(&n->sim) == n->part->channel)
+			medium_begin_csma(n);
+	}
+	ret = 0;
+
+exit:
+	free(cell_start);
+	free(cell_nodes);
+	free(parent);
+	free(rename);
+	return ret;
+}
+
+/******************************************************************************/
+/****** Execution                                                        ******/
+/******************************************************************************/
+
+static void medium_run_ready(struct ca821x_sim_medium *m)
+{
+	unsigned i;
+
+	while ((i = atomic_fetch_add(&m->next_ready, 1)) < m->num_ready)
+		ca821x_sim_run_until(&m->ready[i]->engine, m->epoch_end);
+}
+
+static void *medium_worker(void *arg)
+{
+	struct ca821x_sim_medium *m = arg;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&m->lock);
+	for (;;) {
+		while (m->epoch_gen == seen && !m->shutdown)
+			pthread_cond_wait(&m->start_cv, &m->lock);
+		if (m->shutdown)
+			break;
+		seen = m->epoch_gen;
+		pthread_mutex_unlock(&m->lock);
+
+		medium_run_ready(m);
+
+		pthread_mutex_lock(&m->lock);
+		if (--m->busy_workers == 0)
+			pthread_cond_signal(&m->done_cv);
+	}
+	pthread_mutex_unlock(&m->lock);
+	return NULL;
+}
+
+/** Run the ready partitions up to epoch_end, on the workers if worthwhile */
+static void medium_run_epoch(struct ca821x_sim_medium *m)
+{
+	atomic_store(&m->next_ready, 0);
+	if (!m->num_threads || m->num_ready < 2) {
+		medium_run_ready(m);
+		return;
+	}
+	pthread_mutex_lock(&m->lock);
+	m->busy_workers = m->num_threads;
+	m->epoch_gen++;
+	pthread_cond_broadcast(&m->start_cv);
+	pthread_mutex_unlock(&m->lock);
+
+	medium_run_ready(m);
+
+	pthread_mutex_lock(&m->lock);
+	while (m->busy_workers)
+		pthread_cond_wait(&m->done_cv, &m->lock);
+	pthread_mutex_unlock(&m->lock);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Advance the whole medium to a virtual time
+ *******************************************************************************
+ * Rebuilds the link table first if devices were added. Epochs in which no
+ * partition has events are skipped.
+ *******************************************************************************
+ * \param medium - Medium to run
+ * \param until_ns - Absolute virtual time to run to
+ *******************************************************************************
+ * \return 0: Success
+ *         -ENOMEM: Allocation failed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_medium_run_until(struct ca821x_sim_medium *medium, uint64_t until_ns)
+{
+	struct ca821x_sim_medium *m = medium;
+	uint64_t next, start, end;
+	uint32_t i;
+
+	if (m->topology_dirty && medium_build(m))
+		return -ENOMEM;
+	medium_barrier(m);
+
+	while (m->now_ns < until_ns) {
+		next = UINT64_MAX;
+		for (i = 0; i < m->num_parts; i++) {
+			struct ca821x_sim_engine *e = &m->parts[i]->engine;
+			if (e->count && e->heap[0].time_ns < next)
+				next = e->heap[0].time_ns;
+		}
+		start = next > m->now_ns ? next : m->now_ns;
+		if (start > until_ns)
+			start = until_ns;
+		end = start + m->epoch_ns;
+		if (end > until_ns || end < start)
+			end = until_ns;
+
+		m->num_ready = 0;
+		for (i = 0; i < m->num_parts; i++) {
+			struct sim_partition *p = m->parts[i];
+			if (p->engine.count && p->engine.heap[0].time_ns <= end)
+				m->ready[m->num_ready++] = p;
+			else
+				p->engine.now_ns = end;
+		}
+		m->epoch_end = end;
+		medium_run_epoch(m);
+
+		for (i = 0; i < m->num_parts; i++) {
+			struct sim_partition *p = m->parts[i];
+			p->ed = clamp_u8(255.0 * p->busy_ns / (end - m->now_ns + 1));
+			p->busy_ns = 0;
+		}
+		m->now_ns = end;
+		m->epochs++;
+		medium_barrier(m);
+	}
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Advance the whole medium by a duration of virtual time
+ *******************************************************************************
+ * \param medium - Medium to run
+ * \param duration_ns - Virtual time to simulate
+ *******************************************************************************
+ * \return 0: Success
+ *         -ENOMEM: Allocation failed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sim_medium_run_for(struct ca821x_sim_medium *medium, uint64_t duration_ns)
+{
+	return ca821x_sim_medium_run_until(medium, medium->now_ns + duration_ns);
+}
+
+/******************************************************************************/
+/****** Construction                                                     ******/
+/******************************************************************************/
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Create an empty medium
+ *******************************************************************************
+ * \param radio - Propagation parameters, or NULL for the SIM_MEDIUM_DEF_*
+ *                defaults
+ * \param seed - Seed for device addresses, backoffs and shadowing
+ * \param num_threads - Number of worker threads besides the caller
+ *******************************************************************************
+ * \return The new medium, or NULL if allocation failed
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_sim_medium *ca821x_sim_medium_create(
+	const struct ca821x_sim_radio *radio,
+	uint32_t                       seed,
+	unsigned                       num_threads
+)
+{
+	struct ca821x_sim_medium *m = calloc(1, sizeof(*m));
+	unsigned i;
+
+	if (!m)
+		return NULL;
+	if (radio) {
+		m->radio = *radio;
+	} else {
+		m->radio.pl0_db = SIM_MEDIUM_DEF_PL0_DB;
+		m->radio.exponent = SIM_MEDIUM_DEF_EXPONENT;
+		m->radio.shadowing_db = SIM_MEDIUM_DEF_SHADOWING_DB;
+		m->radio.sensitivity_dbm = SIM_MEDIUM_DEF_SENSITIVITY_DBM;
+		m->radio.cca_dbm = SIM_MEDIUM_DEF_CCA_DBM;
+		m->radio.capture_db = SIM_MEDIUM_DEF_CAPTURE_DB;
+		m->radio.noise_dbm = SIM_MEDIUM_DEF_NOISE_DBM;
+	}
+	m->noise_mw = dbm_to_mw(m->radio.noise_dbm);
+	m->cca_mw = dbm_to_mw(m->radio.cca_dbm);
+	m->capture_lin = dbm_to_mw(m->radio.capture_db);
+	m->seed = seed;
+	m->epoch_ns = SIM_MEDIUM_DEF_EPOCH_NS;
+	atomic_init(&m->next_ready, 0);
+	if (rehash(m, 64))
+		goto error;
+
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->start_cv, NULL);
+	pthread_cond_init(&m->done_cv, NULL);
+	if (num_threads) {
+		m->threads = calloc(num_threads, sizeof(*m->threads));
+		if (!m->threads)
+			goto error;
+	}
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&m->threads[i], NULL, medium_worker, m))
+			break;
+		m->num_threads++;
+	}
+	return m;
+
+error:
+	free(m->part_hash);
+	free(m);
+	return NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Stop the workers and free a medium and all of its devices
+ *******************************************************************************
+ * \param medium - Medium to destroy
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sim_medium_destroy(struct ca821x_sim_medium *medium)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&medium->lock);
+	medium->shutdown = 1;
+	pthread_cond_broadcast(&medium->start_cv);
+	pthread_mutex_unlock(&medium->lock);
+	for (i = 0; i < medium->num_threads; i++)
+		pthread_join(medium->threads[i], NULL);
+	pthread_mutex_destroy(&medium->lock);
+	pthread_cond_destroy(&medium->start_cv);
+	pthread_cond_destroy(&medium->done_cv);
+
+	for (i = 0; i < medium->num_parts; i++)
+		free_partition(medium->parts[i]);
+	for (i = 0; i < medium->num_nodes; i++) {
+		free(medium->nodes[i]->links);
+		free(medium->nodes[i]);
+	}
+	free(medium->parts);
+	free(medium->ready);
+	free(medium->part_hash);
+	free(medium->nodes);
+	free(medium->barrier_list);
+	free(medium->threads);
+	free(medium);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Add a simulated device to the medium
+ *******************************************************************************
+ * The returned device is initialised with ca821x_api_init and connected to
+ * its simulator. Its IEEE address is random, derived from the medium seed.
+ * It can be used straight away; links are computed on the next run.
+ *******************************************************************************
+ * \param medium - Medium to add to
+ * \param x - X position in metres
+ * \param y - Y position in metres
+ *******************************************************************************
+ * \return The device, or NULL if allocation failed
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_dev *ca821x_sim_medium_add_node(
+	struct ca821x_sim_medium *medium,
+	double                    x,
+	double                    y
+)
+{
+	struct ca821x_sim_medium *m = medium;
+	struct sim_partition *p;
+	struct sim_node *node;
+
+	if (grow(&m->nodes, &m->cap_nodes, m->num_nodes + 1, sizeof(*m->nodes)))
+		return NULL;
+	/* All devices start on the default channel, 11 */
+	p = get_partition(m, COMPONENT_PENDING, M_MinimumChannel);
+	if (!p)
+		return NULL;
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		return NULL;
+
+	node->medium = m;
+	node->id = m->num_nodes;
+	node->component = COMPONENT_PENDING;
+	node->x = x;
+	node->y = y;
+	node->part = p;
+	p->num_nodes++;
+	ca821x_api_init(&node->dev);
+	ca821x_sim_init(&node->sim, &p->engine, hash32(m->seed + node->id) | 1, &node->dev);
+	node->sim.medium = m;
+
+	m->nodes[m->num_nodes++] = node;
+	m->topology_dirty = 1;
+	return &node->dev;
+}
+
+uint32_t ca821x_sim_medium_num_nodes(struct ca821x_sim_medium *medium)
+{
+	return medium->num_nodes;
+}
+
+struct ca821x_dev *ca821x_sim_medium_get_dev(struct ca821x_sim_medium *medium,
+                                             uint32_t id)
+{
+	return id < medium->num_nodes ? &medium->nodes[id]->dev : NULL;
+}
+
+struct ca821x_sim *ca821x_sim_medium_get_sim(struct ca821x_sim_medium *medium,
+                                             uint32_t id)
+{
+	return id < medium->num_nodes ? &medium->nodes[id]->sim : NULL;
+}
+
+/** Set the virtual time between partition synchronisation points */
+void ca821x_sim_medium_set_epoch(struct ca821x_sim_medium *medium, uint64_t epoch_ns)
+{
+	medium->epoch_ns = epoch_ns ? epoch_ns : 1;
+}
+
+uint64_t ca821x_sim_medium_now(struct ca821x_sim_medium *medium)
+{
+	return medium->now_ns;
+}
+
+/** Sum the counters of every partition. Only call between runs. */
+void ca821x_sim_medium_get_stats(
+	struct ca821x_sim_medium       *medium,
+	struct ca821x_sim_medium_stats *stats
+)
+{
+	uint32_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < medium->num_parts; i++) {
+		struct ca821x_sim_medium_stats *s = &medium->parts[i]->stats;
+		stats->frames += s->frames;
+		stats->acks += s->acks;
+		stats->receptions += s->receptions;
+		stats->collisions += s->collisions;
+		stats->cca_busy += s->cca_busy;
+		stats->ack_timeouts += s->ack_timeouts;
+		stats->polls += s->polls;
+		stats->moves += s->moves;
+	}
+	stats->epochs = medium->epochs;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file ca821x_sim_private.h
+ * @brief Interface between the simulated device and the simulated medium.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CA821X_SIM_PRIVATE_H
+#define CA821X_SIM_PRIVATE_H
+
+#include <stdint.h>
+
+#include "ca821x_sim.h"
+
+/** Duration of a number of symbols in nanoseconds */
+#define SYMBOLS_NS(x)       ((uint64_t)(x) * SIM_SYMBOL_NS)
+/** Air time of a PSDU of the given length in nanoseconds */
+#define AIRTIME_NS(psdulen) ((uint64_t)(SIM_PHY_OVERHEAD + (psdulen)) * SIM_OCTET_NS)
+/** Length of an acknowledgement PSDU */
+#define ACK_PSDU_LEN        (5)
+/** Length of a data request command PSDU with extended source address */
+#define DATAREQ_PSDU_LEN    (18)
+/** Symbols taken by a clear channel assessment */
+#define CCA_SYMBOLS         (8)
+
+/* Provided by ca821x_sim.c for the medium */
+uint8_t ca821x_sim_channel(struct ca821x_sim *sim);
+int8_t  ca821x_sim_tx_power(struct ca821x_sim *sim);
+uint8_t ca821x_sim_pib_u8(struct ca821x_sim *sim, uint8_t attribute);
+uint16_t ca821x_sim_pib_u16(struct ca821x_sim *sim, uint8_t attribute);
+const uint8_t *ca821x_sim_extaddr(struct ca821x_sim *sim);
+uint32_t ca821x_sim_rand(struct ca821x_sim *sim);
+uint8_t ca821x_sim_psdu_len(struct ca821x_sim *sim, const struct ca821x_sim_msdu *msdu);
+int     ca821x_sim_is_listening(struct ca821x_sim *sim);
+void    ca821x_sim_src_info(struct ca821x_sim *sim, uint8_t src_mode,
+                            struct ca821x_sim_rxinfo *info);
+void    ca821x_sim_tx_done(struct ca821x_sim *sim, uint8_t status);
+int     ca821x_sim_rx_frame(struct ca821x_sim *sim,
+                            const struct ca821x_sim_msdu *msdu,
+                            const struct ca821x_sim_rxinfo *info);
+int     ca821x_sim_indirect_find(struct ca821x_sim *coord, const uint8_t *extaddr,
+                                 uint16_t shortaddr, int start);
+void    ca821x_sim_indirect_sent(struct ca821x_sim *coord, int slot, uint64_t delay_ns);
+void    ca821x_sim_poll_deliver(struct ca821x_sim *sim, uint64_t delay_ns);
+void    ca821x_sim_scan_add_ed(struct ca821x_sim *sim, uint8_t ed);
+void    ca821x_sim_scan_add_beacon(struct ca821x_sim *sim, struct ca821x_sim *coord,
+                                   uint8_t lqi);
+void    ca821x_sim_scan_finish(struct ca821x_sim *sim);
+
+/* Provided by ca821x_sim_medium.c for the device */
+void    ca821x_sim_medium_tx_start(struct ca821x_sim *sim);
+void    ca821x_sim_medium_reset(struct ca821x_sim *sim);
+void    ca821x_sim_medium_sync_channel(struct ca821x_sim *sim);
+void    ca821x_sim_medium_scan_done(struct ca821x_sim *sim);
+uint8_t ca821x_sim_medium_poll(struct ca821x_sim *sim, const struct FullAddr *coord);
+
+#endif // CA821X_SIM_PRIVATE_H
@@ -48,15 +48,22 @@
  * Shorthand for MLME-POLL Request parameter set
  ******************************************************************************/
 #include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 
 #include "mac_messages.h"
 #include "ca821x_api.h"
-
-/** LQI limit, below which received frames should be rejected */
-#define API_LQI_LIMIT    (75)
+#include "ca821x_dedup.h"
+#include "ca821x_link.h"
+#include "ca821x_neighbour.h"
+#include "ca821x_pcps.h"
+#include "ca821x_rxfilter.h"
+#include "ca821x_scan.h"
+#include "ca821x_subscribe.h"
+#include "ca821x_sync_stats.h"
+#include "ca821x_trace.h"
 
 /**
  * @brief Table for pairing synchronous requests with their confirms. Each
@@ -129,10 +136,105 @@ int ca821x_api_init(struct ca821x_dev *pDeviceRef)
 	memset(pDeviceRef, 0, sizeof(*pDeviceRef));
 	pDeviceRef->shortaddr = 0xFFFF;
 	pDeviceRef->lqi_mode = HWME_LQIMODE_CS;
+	pDeviceRef->lqi_limit = API_LQI_LIMIT;
 
 	return 0;
 }
 
+uint64_t ca821x_get_time_ns(struct ca821x_dev *pDeviceRef)
+{
+	if (pDeviceRef->clock == NULL)
+		return 0;
+
+	return pDeviceRef->clock(pDeviceRef);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Pass a command to ca821x_api_downstream
+ *******************************************************************************
+ * Records the command and any response in pDeviceRef->trace if attached.
+ *******************************************************************************
+ * \param Command - Command to send
+ * \param Response - Buffer for the synchronous response, or NULL
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Status of ca821x_api_downstream
+ *******************************************************************************
+ ******************************************************************************/
+static int ca821x_exchange(
+	struct MAC_Message *Command,
+	struct MAC_Message *Response,
+	struct ca821x_dev  *pDeviceRef
+)
+{
+	struct ca821x_trace *trace = pDeviceRef->trace;
+	int ret;
+
+	if (trace)
+		ca821x_trace_frame(trace, CA821X_TRACE_DOWNSTREAM, &Command->CommandId,
+		                   Command->Length + 2, ca821x_get_time_ns(pDeviceRef));
+
+	ret = pDeviceRef->ca821x_api_downstream(&Command->CommandId,
+	                                        Command->Length + 2,
+	                                        Response ? &Response->CommandId : NULL,
+	                                        pDeviceRef);
+
+	if (trace) {
+		if (ret && trace->on_error)
+			trace->on_error(trace, pDeviceRef);
+		else if (!ret && Response)
+			ca821x_trace_frame(trace, CA821X_TRACE_RESPONSE, &Response->CommandId,
+			                   Response->Length + 2, ca821x_get_time_ns(pDeviceRef));
+	}
+
+	return ret;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Exchange a synchronous command and check the paired confirm
+ *******************************************************************************
+ * Records the exchange in pDeviceRef->sync_stats if attached, and reports a
+ * mismatched response to the on_error hook of pDeviceRef->trace.
+ *******************************************************************************
+ * \param Command - Command to send
+ * \param Response - Buffer for the synchronous response
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return 0: Response is the confirm paired with the command (see
+ *         sync_pairings), nonzero otherwise
+ *******************************************************************************
+ ******************************************************************************/
+static int ca821x_sync_exchange(
+	struct MAC_Message *Command,
+	struct MAC_Message *Response,
+	struct ca821x_dev  *pDeviceRef
+)
+{
+	struct ca821x_sync_stats *stats = pDeviceRef->sync_stats;
+	enum ca821x_sync_result result = SYNC_RESULT_OK;
+	uint64_t start = 0;
+
+	if (stats)
+		start = ca821x_get_time_ns(pDeviceRef);
+
+	if (ca821x_exchange(Command, Response, pDeviceRef))
+		result = SYNC_RESULT_TRANSPORT;
+	else if (Response->CommandId != sync_pairings[Command->CommandId & SPI_MID_MASK])
+		result = SYNC_RESULT_MISMATCH;
+
+	if (result == SYNC_RESULT_MISMATCH && pDeviceRef->trace &&
+	    pDeviceRef->trace->on_error)
+		pDeviceRef->trace->on_error(pDeviceRef->trace, pDeviceRef);
+
+	if (stats)
+		ca821x_sync_stats_record(stats, Command->CommandId,
+		                         ca821x_get_time_ns(pDeviceRef) - start, result);
+
+	return result != SYNC_RESULT_OK;
+}
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief MCPS_DATA_request (Send Data) according to API Spec
@@ -180,9 +282,14 @@ uint8_t MCPS_DATA_request(
 		Command.Length += sizeof(struct SecSpec);
 	}
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                       NULL, pDeviceRef))
+	/* Before the exchange: the confirm may be dispatched before it returns */
+	if (pDeviceRef->links && pDeviceRef->neighbours)
+		ca821x_link_tx(pDeviceRef->links, pDeviceRef->neighbours, &DstAddr, MsduHandle);
+	if (ca821x_exchange(&Command, NULL, pDeviceRef)) {
+		if (pDeviceRef->links && pDeviceRef->neighbours)
+			ca821x_link_tx_cancel(pDeviceRef->links, MsduHandle);
 		return MAC_SYSTEM_ERROR;
+	}
 
 	return MAC_SUCCESS;
 	#undef DATAREQ
@@ -208,11 +315,7 @@ uint8_t MCPS_PURGE_request_sync(
 	Command.Length = 1;
 	Command.PData.u8Param = *MsduHandle;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_MCPS_PURGE_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	*MsduHandle = Response.PData.PurgeCnf.MsduHandle;
@@ -224,6 +327,10 @@ uint8_t MCPS_PURGE_request_sync(
 /***************************************************************************//**
  * \brief PCPS_DATA_request (Send Data) according to API Spec
  *******************************************************************************
+ * Sends one PSDU under a handle chosen by the caller. To keep several PSDUs
+ * in flight with handles allocated and confirms matched, submit them through
+ * a transmitter instead (see ca821x_pcps.h).
+ *******************************************************************************
  * \param PsduHandle - User-assigned handle to identify data request
  * \param TxOpts - TxOpts (such as for sending indirectly)
  * \param PsduLength - Length of Data
@@ -254,8 +361,7 @@ uint8_t PCPS_DATA_request(
 	memcpy(DATAREQ.Psdu, pPsdu, PsduLength);
 	Command.Length = PsduLength + sizeof(struct PCPS_DATA_request_pset) - aMaxPHYPacketSize;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                       NULL, pDeviceRef))
+	if (ca821x_exchange(&Command, NULL, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return MAC_SUCCESS;
@@ -305,8 +411,7 @@ uint8_t MLME_ASSOCIATE_request(
 		ASSOCREQ.Security = *pSecurity;
 	}
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                       NULL, pDeviceRef))
+	if (ca821x_exchange(&Command, NULL, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return MAC_SUCCESS;
@@ -349,10 +454,13 @@ uint8_t MLME_ASSOCIATE_response(
 		ASSOCRSP.Security = *pSecurity;
 	}
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                       NULL, pDeviceRef))
+	if (ca821x_exchange(&Command, NULL, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
+	if (pDeviceRef->neighbours && Status == MAC_SUCCESS)
+		ca821x_neighbour_learn(pDeviceRef->neighbours, pDeviceAddress,
+		                       pDeviceRef->neighbours->pan_id,
+		                       ASSOCRSP.AssocShortAddress);
 	return MAC_SUCCESS;
 	#undef ASSOCRSP
 } // End of MLME_ASSOCIATE_response()
@@ -393,8 +501,7 @@ uint8_t MLME_DISASSOCIATE_request(
 		Command.PData.DisassocReq.Security = *pSecurity;
 	}
 
-	if(pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      NULL, pDeviceRef))
+	if (ca821x_exchange(&Command, NULL, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return MAC_SUCCESS;
@@ -433,11 +540,7 @@ uint8_t MLME_GET_request_sync(
 		GETREQ.PIBAttribute = PIBAttribute;
 		GETREQ.PIBAttributeIndex = PIBAttributeIndex;
 
-		if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-		                                      &Response.CommandId, pDeviceRef))
-			return MAC_SYSTEM_ERROR;
-
-		if (Response.CommandId != SPI_MLME_GET_CONFIRM)
+		if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 			return MAC_SYSTEM_ERROR;
 
 		if (GETCNF.Status == MAC_SUCCESS) {
@@ -487,10 +590,13 @@ uint8_t MLME_ORPHAN_response(
 		ORPHANRSP.Security = *pSecurity;
 	}
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                       NULL, pDeviceRef))
+	if (ca821x_exchange(&Command, NULL, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
+	if (pDeviceRef->neighbours && AssociatedMember)
+		ca821x_neighbour_learn(pDeviceRef->neighbours, pOrphanAddress,
+		                       pDeviceRef->neighbours->pan_id,
+		                       ORPHANRSP.ShortAddress);
 	return MAC_SUCCESS;
 	#undef ORPHANRSP
 } // End of MLME_ORPHAN_response()
@@ -515,17 +621,17 @@ uint8_t MLME_RESET_request_sync(uint8_t SetDefaultPIB, struct ca821x_dev *pDevic
 	Command.Length = 1;
 	SIMPLEREQ.u8Param = SetDefaultPIB;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_MLME_RESET_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	status = SIMPLECNF.Status;
 
 	if (SetDefaultPIB && status == MAC_SUCCESS) {
 		pDeviceRef->shortaddr = 0xFFFF;
+		if (pDeviceRef->neighbours) {
+			ca821x_neighbour_set_device_entries(pDeviceRef->neighbours, 0);
+			memset(pDeviceRef->neighbours->pan_id, 0xFF, 2);
+		}
 	}
 
 	/* reset COORD Bit for Channel Filtering as Coordinator */
@@ -570,11 +676,7 @@ uint8_t MLME_RX_ENABLE_request_sync(
 	Command.PData.RxEnableReq.RxOnDuration[2] = LS2_BYTE(RxOnDuration);
 	Command.PData.RxEnableReq.RxOnDuration[3] = LS3_BYTE(RxOnDuration);
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_MLME_RX_ENABLE_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return Response.PData.Status;
@@ -618,14 +720,42 @@ uint8_t MLME_SCAN_request(
 		SCANREQ.Security = *pSecurity;
 	}
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                       NULL, pDeviceRef))
+	if (ca821x_exchange(&Command, NULL, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return MAC_SUCCESS;
 	#undef SCANREQ
 } // End of MLME_SCAN_request()
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Keeps a neighbour table coherent with a PIB attribute set
+ *******************************************************************************
+ * \param PIBAttribute - Attribute set
+ * \param PIBAttributeIndex - Index within the table for table attributes
+ * \param PIBAttributeLength - Length of the value
+ * \param pPIBAttributeValue - Value set
+ * \param nb - Neighbour table of the device
+ *******************************************************************************
+ ******************************************************************************/
+static void set_neighbours(
+	uint8_t                   PIBAttribute,
+	uint8_t                   PIBAttributeIndex,
+	uint8_t                   PIBAttributeLength,
+	const void               *pPIBAttributeValue,
+	struct ca821x_neighbours *nb
+)
+{
+	if (PIBAttribute == macDeviceTable &&
+	    PIBAttributeLength >= sizeof(struct M_DeviceDescriptor)) {
+		ca821x_neighbour_set_device(nb, PIBAttributeIndex, pPIBAttributeValue);
+	} else if (PIBAttribute == macDeviceTableEntries && PIBAttributeLength >= 1) {
+		ca821x_neighbour_set_device_entries(nb, *(const uint8_t*)pPIBAttributeValue);
+	} else if (PIBAttribute == macPANId && PIBAttributeLength >= 2) {
+		memcpy(nb->pan_id, pPIBAttributeValue, 2);
+	}
+}
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief MLME_SET_request/confirm according to API Spec
@@ -671,11 +801,7 @@ uint8_t MLME_SET_request_sync(
 	SETREQ.PIBAttributeLength = PIBAttributeLength;
 	memcpy( SETREQ.PIBAttributeValue, pPIBAttributeValue, PIBAttributeLength );
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_MLME_SET_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	if (SIMPLECNF.Status == MAC_SUCCESS) {
@@ -684,6 +810,9 @@ uint8_t MLME_SET_request_sync(
 		} else if (PIBAttribute == nsIEEEAddress) {
 			memcpy(pDeviceRef->extaddr, pPIBAttributeValue, 8);
 		}
+		if (pDeviceRef->neighbours)
+			set_neighbours(PIBAttribute, PIBAttributeIndex, PIBAttributeLength,
+			               pPIBAttributeValue, pDeviceRef->neighbours);
 	}
 
 	return SIMPLECNF.Status;
@@ -757,13 +886,11 @@ uint8_t MLME_START_request_sync(
 		*pBS = *pBeaconSecurity;
 	}
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_MLME_START_CONFIRM )
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
+	if (pDeviceRef->neighbours && Response.PData.Status == MAC_SUCCESS)
+		memcpy(pDeviceRef->neighbours->pan_id, STARTREQ.PANId, 2);
 	return Response.PData.Status;
 	#undef STARTREQ
 } // End of MLME_START_request_sync()
@@ -807,11 +934,7 @@ uint8_t MLME_POLL_request_sync(
 		POLLREQ.Security = *pSecurity;
 	}
 
-	if(pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                     &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_MLME_POLL_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return Response.PData.Status;
@@ -844,11 +967,7 @@ uint8_t HWME_SET_request_sync(
 	Command.PData.HWMESetReq.HWAttributeLength = HWAttributeLength;
 	memcpy(Command.PData.HWMESetReq.HWAttributeValue, pHWAttributeValue, HWAttributeLength);
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_HWME_SET_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	if (HWAttribute == HWME_LQIMODE && Response.PData.Status == MAC_SUCCESS)
@@ -881,11 +1000,7 @@ uint8_t HWME_GET_request_sync(
 	Command.Length = 1;
 	Command.PData.HWMEGetReq.HWAttribute = HWAttribute;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_HWME_GET_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	if (Response.PData.HWMEGetCnf.Status == MAC_SUCCESS) {
@@ -919,11 +1034,7 @@ uint8_t HWME_HAES_request_sync(
 	Command.PData.HWMEHAESReq.HAESMode = HAESMode;
 	memcpy(Command.PData.HWMEHAESReq.HAESData, pHAESData, 16);
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_HWME_HAES_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	if (Response.PData.HWMEHAESCnf.Status == MAC_SUCCESS)
@@ -958,11 +1069,7 @@ uint8_t TDME_SETSFR_request_sync(
 	Command.PData.TDMESetSFRReq.SFRAddress = SFRAddress;
 	Command.PData.TDMESetSFRReq.SFRValue   = SFRValue;
 	Response.CommandId = 0xFF;
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_TDME_SETSFR_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return Response.PData.TDMESetSFRCnf.Status;
@@ -993,11 +1100,7 @@ uint8_t TDME_GETSFR_request_sync(
 	Command.PData.TDMEGetSFRReq.SFRPage = SFRPage;
 	Command.PData.TDMEGetSFRReq.SFRAddress = SFRAddress;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_TDME_GETSFR_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	*SFRValue = Response.PData.TDMEGetSFRCnf.SFRValue;
@@ -1025,11 +1128,7 @@ uint8_t TDME_TESTMODE_request_sync(
 	Command.Length = 1;
 	Command.PData.TDMETestModeReq.TestMode = TestMode;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_TDME_TESTMODE_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return Response.PData.TDMETestModeCnf.Status;
@@ -1068,11 +1167,7 @@ uint8_t TDME_SET_request_sync(
 	Command.PData.TDMESetReq.TDAttributeLength = TestAttributeLength;
 	memcpy(Command.PData.TDMESetReq.TDAttributeValue, pTestAttributeValue, TestAttributeLength);
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_TDME_SET_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	return Response.PData.TDMESetCnf.Status;
@@ -1114,11 +1209,7 @@ uint8_t TDME_TXPKT_request_sync(
 	if (TestPacketDataType == TDME_TXD_APPENDED)
 		memcpy(Command.PData.TDMETxPktReq.TestPacketData, pTestPacketData, *TestPacketLength);
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_TDME_TXPKT_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	if (Response.PData.TDMETxPktCnf.Status == TDME_SUCCESS) {
@@ -1159,11 +1250,7 @@ uint8_t TDME_LOTLK_request_sync(
 	Command.PData.TDMELOTlkReq.TestChannel = *TestChannel;
 	Command.PData.TDMELOTlkReq.TestRxTxb = *TestRxTxb;
 
-	if (pDeviceRef->ca821x_api_downstream(&Command.CommandId, Command.Length + 2,
-	                                      &Response.CommandId, pDeviceRef))
-		return MAC_SYSTEM_ERROR;
-
-	if (Response.CommandId != SPI_TDME_LOTLK_CONFIRM)
+	if (ca821x_sync_exchange(&Command, &Response, pDeviceRef))
 		return MAC_SYSTEM_ERROR;
 
 	if (Response.PData.TDMELOTlkCnf.Status == TDME_SUCCESS) {
@@ -1502,6 +1589,25 @@ void ca821x_register_callbacks(struct ca821x_api_callbacks *in_callbacks,
 	memcpy(&(pDeviceRef->callbacks), in_callbacks, sizeof(struct ca821x_api_callbacks));
 }
 
+void ca821x_register_tap(struct ca821x_tap *tap, struct ca821x_dev *pDeviceRef)
+{
+	tap->next = pDeviceRef->taps;
+	pDeviceRef->taps = tap;
+}
+
+void ca821x_unregister_tap(struct ca821x_tap *tap, struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_tap **link;
+
+	for (link = &pDeviceRef->taps; *link; link = &(*link)->next) {
+		if (*link == tap) {
+			*link = tap->next;
+			tap->next = NULL;
+			break;
+		}
+	}
+}
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Checks a data indication to ensure that its destination address
@@ -1566,18 +1672,18 @@ static void get_assoccnf_shortaddr(struct MLME_ASSOCIATE_confirm_pset *assoc_cnf
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Checks a scan confirm for pan descriptor entries that have a beacon
- *        LQI below API_LQI_LIMIT and remove them.
+ *        LQI at or below the device's lqi_limit and remove them.
  *******************************************************************************
- * \param *scan_cnf - Scan confirm message buffer
+ * \param *buf - Scan confirm message buffer
+ * \param len - Length of the message buffer
  *******************************************************************************
  ******************************************************************************/
-static void verify_scancnf_results(struct MAC_Message *scan_cnf,
+static void verify_scancnf_results(uint8_t *buf, size_t len,
                                    struct ca821x_dev *pDeviceRef)
 {
+	struct MAC_Message *scan_cnf = (struct MAC_Message*)buf;
 	struct MLME_SCAN_confirm_pset *scan_cnf_pset;
-	struct PanDescriptor *pdesc;
-	int pdesc_index, pdesc_length;
-	bool list_modified = false;
+	uint8_t results;
 
 	scan_cnf_pset = &scan_cnf->PData.ScanCnf;
 	if (pDeviceRef->lqi_mode == HWME_LQIMODE_ED) /* Cannot filter by ED */
@@ -1585,33 +1691,14 @@ static void verify_scancnf_results(struct MAC_Message *scan_cnf,
 	if (scan_cnf_pset->ScanType != ACTIVE_SCAN
 		&& scan_cnf_pset->ScanType != PASSIVE_SCAN)
 		return;
+	if (len < 2 || scan_cnf->Length > len - 2)
+		return;
 
-	pdesc = (struct PanDescriptor*)scan_cnf_pset->ResultList;
-	pdesc_index = 0;
-	while (pdesc_index < scan_cnf_pset->ResultListSize) {
-		pdesc_length = 22;
-		if (pdesc->Security.SecurityLevel > 0) {
-			pdesc_length += 10;
-		}
-		if (pdesc->LinkQuality > API_LQI_LIMIT) {
-			/* LQI is acceptable, move to next entry */
-			pdesc = (struct PanDescriptor*)((uint8_t*)pdesc + pdesc_length);
-			pdesc_index++;
-			continue;
-		}
-		list_modified = true;
-		/* Copy rest of list forward one index */
-		memcpy(
-			pdesc,
-			(uint8_t*)pdesc + pdesc_length,
-			scan_cnf->Length - (7 + pdesc_length)
-		);
-		/* Update ResultListSize and command length */
-		scan_cnf_pset->ResultListSize--;
-		scan_cnf->Length -= pdesc_length;
-	}
+	results = scan_cnf_pset->ResultListSize;
+	scan_cnf->Length = (uint8_t)ca821x_scan_filter_lqi(
+		scan_cnf_pset, scan_cnf->Length, pDeviceRef->lqi_limit);
 	if (scan_cnf_pset->ResultListSize == 0 &&
-	    list_modified &&
+	    results != 0 &&
 	    (scan_cnf_pset->Status == MAC_SUCCESS ||
 	     scan_cnf_pset->Status == MAC_LIMIT_REACHED)) {
 		scan_cnf_pset->Status = MAC_NO_BEACON;
@@ -1688,6 +1775,49 @@ union ca821x_api_callback* ca821x_get_callback(uint8_t cmdid, struct ca821x_dev
 	return rval;
 }
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Updates the link statistics of the neighbour a frame concerns
+ *******************************************************************************
+ * \param *buf - Message buffer
+ * \param len - Length of the message buffer
+ *******************************************************************************
+ ******************************************************************************/
+static void track_links(const uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
+{
+	const struct MAC_Message *msg = (const struct MAC_Message*)buf;
+	struct ca821x_links *links = pDeviceRef->links;
+	struct ca821x_neighbours *nb = pDeviceRef->neighbours;
+
+	switch (buf[0]) {
+	case SPI_MCPS_DATA_INDICATION:
+		if (len >= 2 + offsetof(struct MCPS_DATA_indication_pset, DSN))
+			ca821x_link_rx(links, nb, &msg->PData.DataInd.Src,
+			               msg->PData.DataInd.MpduLinkQuality,
+			               ca821x_get_time_ns(pDeviceRef));
+		break;
+	case SPI_MLME_BEACON_NOTIFY_INDICATION:
+		if (len >= 2 + 1 + PAN_DESCRIPTOR_BASE_SIZE)
+			ca821x_link_rx(links, nb, &msg->PData.BeaconInd.PanDescriptor.Coord,
+			               msg->PData.BeaconInd.PanDescriptor.LinkQuality,
+			               ca821x_get_time_ns(pDeviceRef));
+		break;
+#if CASCODA_CA_VER >= 8211
+	case SPI_MLME_POLL_INDICATION:
+		if (len >= 2 + offsetof(struct MLME_POLL_indication_pset, DSN))
+			ca821x_link_rx(links, nb, &msg->PData.PollInd.Src, msg->PData.PollInd.LQI,
+			               ca821x_get_time_ns(pDeviceRef));
+		break;
+#endif
+	case SPI_MCPS_DATA_CONFIRM:
+		if (len >= 2 + 2)
+			ca821x_link_confirm(links, nb, msg->PData.DataCnf.MsduHandle,
+			                    msg->PData.DataCnf.Status,
+			                    ca821x_get_time_ns(pDeviceRef));
+		break;
+	}
+}
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Call the relevant callback routine if populated or the
@@ -1705,11 +1835,24 @@ union ca821x_api_callback* ca821x_get_callback(uint8_t cmdid, struct ca821x_dev
 int ca821x_downstream_dispatch(uint8_t *buf, size_t len, struct ca821x_dev *pDeviceRef)
 {
 	int ret = 0;
+	union ca821x_api_callback* rval;
+	struct ca821x_tap *tap;
+
+	if (pDeviceRef->trace)
+		ca821x_trace_frame(pDeviceRef->trace, CA821X_TRACE_UPSTREAM, buf, len,
+		                   ca821x_get_time_ns(pDeviceRef));
+	/* Irrelevant frames are dropped before anything else sees them */
+	if (pDeviceRef->rxfilter && !ca821x_rxfilter_check(pDeviceRef->rxfilter, buf, len))
+		return 0;
+	for (tap = pDeviceRef->taps; tap; tap = tap->next)
+		tap->callback(buf, len, tap->context, pDeviceRef);
 
-	union ca821x_api_callback* rval = ca821x_get_callback(buf[0], pDeviceRef);
+	rval = ca821x_get_callback(buf[0], pDeviceRef);
 
 	if(!rval) //Unrecognised command ID
 	{
+		if (pDeviceRef->trace && pDeviceRef->trace->on_error)
+			pDeviceRef->trace->on_error(pDeviceRef->trace, pDeviceRef);
 #ifdef __unix__
 		return -EINVAL;
 #else
@@ -1728,16 +1871,38 @@ int ca821x_downstream_dispatch(uint8_t *buf, size_t len, struct ca821x_dev *pDev
 			return ret;
 		}
 #endif
+		/* A retransmission whose acknowledgement was lost is not passed on */
+		if (pDeviceRef->dedup &&
+		    len >= 2 + offsetof(struct MCPS_DATA_indication_pset, TimeStamp) &&
+		    ca821x_dedup_check(pDeviceRef->dedup,
+		                       &((struct MCPS_DATA_indication_pset*)(buf + 2))->Src,
+		                       ((struct MCPS_DATA_indication_pset*)(buf + 2))->DSN,
+		                       ca821x_get_time_ns(pDeviceRef)))
+			return 0;
 		break;
 	case SPI_MLME_ASSOCIATE_CONFIRM:
 		get_assoccnf_shortaddr((struct MLME_ASSOCIATE_confirm_pset*)(buf + 2),
 		                       pDeviceRef);
 		break;
 	case SPI_MLME_SCAN_CONFIRM:
-		verify_scancnf_results((struct MAC_Message*)buf, pDeviceRef);
+		verify_scancnf_results(buf, len, pDeviceRef);
 		break;
+#if CASCODA_CA_VER >= 8211
+	case SPI_PCPS_DATA_CONFIRM:
+		if (pDeviceRef->pcps_tx &&
+		    len >= 2 + sizeof(struct PCPS_DATA_confirm_pset))
+			ca821x_pcps_tx_confirm(pDeviceRef->pcps_tx,
+			                       (struct PCPS_DATA_confirm_pset*)(buf + 2),
+			                       pDeviceRef);
+		break;
+#endif
 	}
 
+	if (pDeviceRef->links && pDeviceRef->neighbours)
+		track_links(buf, len, pDeviceRef);
+	if (pDeviceRef->subs)
+		ca821x_subs_dispatch(pDeviceRef->subs, buf, len, pDeviceRef);
+
 	//If there is a callback registered, call it. Otherwise, call the generic dispatch.
 	if (rval->generic_callback)
 	{
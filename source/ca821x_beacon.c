@@ -0,0 +1,146 @@
+/**
+ * @file ca821x_beacon.c
+ * @brief Parsing of the variable fields of an MLME-BEACON-NOTIFY indication.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_beacon.h"
+#include "ca821x_scan.h"
+
+/** Pending address specification: number of short addresses */
+#define PEND_SHORT_COUNT(spec)  ((spec) & 0x07)
+/** Pending address specification: number of extended addresses */
+#define PEND_EXT_COUNT(spec)    (((spec) >> 4) & 0x07)
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Locate the variable fields of a beacon notify indication
+ *******************************************************************************
+ * \param view - Receives the fields, pointing into ind
+ * \param ind - Beacon notify parameter set
+ * \param len - Length of the parameter set (the Length field of the message,
+ *              or CA821X_BEACON_IND_LEN in a callback)
+ *******************************************************************************
+ * \return 0: Fields located
+ *         -1: The indication is shorter than its fields require
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_beacon_parse(
+	struct ca821x_beacon_view                       *view,
+	const struct MLME_BEACON_NOTIFY_indication_pset *ind,
+	size_t                                           len
+)
+{
+	const uint8_t *p = (const uint8_t *)ind;
+	const uint8_t *end = p + len;
+	uint8_t spec;
+
+	if (len < 1 + PAN_DESCRIPTOR_BASE_SIZE)
+		return -1;
+	view->bsn = ind->BSN;
+	view->pan = &ind->PanDescriptor;
+	p += 1 + ca821x_pan_descriptor_len(view->pan);
+
+	/* Address specification and payload length are at least present */
+	if (end - p < 2)
+		return -1;
+	spec = *p++;
+	view->num_short = PEND_SHORT_COUNT(spec);
+	view->num_ext = PEND_EXT_COUNT(spec);
+	if (end - p < 2 * view->num_short + 8 * view->num_ext + 1)
+		return -1;
+	view->short_addrs = p;
+	p += 2 * view->num_short;
+	view->ext_addrs = p;
+	p += 8 * view->num_ext;
+
+	view->payload_len = *p++;
+	if (end - p < view->payload_len)
+		return -1;
+	view->payload = p;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Check whether a beacon lists an address as having data pending
+ *******************************************************************************
+ * \param view - Parsed beacon notify
+ * \param shortaddr - Short address to look for, or 0xFFFE/0xFFFF for none
+ * \param extaddr - Extended address to look for (8 octets, as in the PIB),
+ *                  or NULL for none
+ *******************************************************************************
+ * \return 1 if either address is pending, 0 otherwise
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_beacon_addr_pending(
+	const struct ca821x_beacon_view *view,
+	uint16_t                         shortaddr,
+	const uint8_t                   *extaddr
+)
+{
+	const uint8_t *a;
+	uint8_t lo = LS_BYTE(shortaddr), hi = MS_BYTE(shortaddr);
+	int i;
+
+	if (shortaddr < 0xFFFE) {
+		for (i = 0, a = view->short_addrs; i < view->num_short; i++, a += 2) {
+			if (a[0] == lo && a[1] == hi)
+				return 1;
+		}
+	}
+	if (extaddr) {
+		for (i = 0, a = view->ext_addrs; i < view->num_ext; i++, a += 8) {
+			if (!memcmp(a, extaddr, 8))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Check whether a beacon lists a device as having data pending
+ *******************************************************************************
+ * Uses the short and extended addresses mirrored from the device's PIB. This
+ * is the test a polling device runs on each beacon to decide whether to send
+ * an MLME-POLL.request.
+ *******************************************************************************
+ * \param view - Parsed beacon notify
+ * \param pDeviceRef - Device receiving the beacon
+ *******************************************************************************
+ * \return 1 if the device has data pending, 0 otherwise
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_beacon_dev_pending(
+	const struct ca821x_beacon_view *view,
+	struct ca821x_dev               *pDeviceRef
+)
+{
+	static const uint8_t unset[8] = {0};
+	const uint8_t *extaddr = pDeviceRef->extaddr;
+
+	if (!view->num_short && !view->num_ext)
+		return 0;
+	if (!memcmp(extaddr, unset, sizeof(unset)))
+		extaddr = NULL;
+	return ca821x_beacon_addr_pending(view, pDeviceRef->shortaddr, extaddr);
+}
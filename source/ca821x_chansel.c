@@ -0,0 +1,282 @@
+/**
+ * @file ca821x_chansel.c
+ * @brief Automatic channel selection and coordinator channel migration.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_chansel.h"
+
+/** Index into the per-channel arrays for an 802.15.4 channel number */
+#define CHANSEL_INDEX(ch)   ((ch) - M_MinimumChannel)
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a channel selection engine
+ *******************************************************************************
+ * All thresholds are set to their CHANSEL_DEF_* defaults and may be adjusted
+ * in the structure directly after this call.
+ *******************************************************************************
+ * \param cs - Channel selection state to initialise
+ * \param current_channel - Channel the coordinator was started on
+ * \param channel_mask - Channels that may be migrated to (ScanChannels
+ *                       format, masked with M_ValidChannels)
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_chansel_init(
+	struct ca821x_chansel *cs,
+	uint8_t                current_channel,
+	uint32_t               channel_mask
+)
+{
+	memset(cs, 0, sizeof(*cs));
+	cs->current_channel = current_channel;
+	cs->channel_mask = channel_mask & M_ValidChannels;
+	cs->degrade_threshold = CHANSEL_DEF_DEGRADE_THRESHOLD;
+	cs->hysteresis = CHANSEL_DEF_HYSTERESIS;
+	cs->min_samples = CHANSEL_DEF_MIN_SAMPLES;
+	cs->holdoff = CHANSEL_DEF_HOLDOFF;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Feed the results of an energy detect scan into the engine
+ *******************************************************************************
+ * The ED result list contains one entry per scanned channel in ascending
+ * channel order, so the channel mask that was passed to MLME_SCAN_request is
+ * needed to attribute each result. Channels reported in UnscannedChannels are
+ * skipped.
+ *******************************************************************************
+ * \param cs - Channel selection state
+ * \param ScanChannels - Channel mask that the scan was requested with
+ * \param scan_cnf - Scan confirm parameter set
+ *******************************************************************************
+ * \return 0: Results processed
+ *         -1: Not an energy detect scan confirm
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_chansel_process_scan(
+	struct ca821x_chansel               *cs,
+	uint32_t                             ScanChannels,
+	const struct MLME_SCAN_confirm_pset *scan_cnf
+)
+{
+	uint32_t scanned;
+	uint8_t channel, result = 0;
+	uint16_t sample, *score;
+
+	if (scan_cnf->ScanType != ENERGY_DETECT)
+		return -1;
+
+	scanned = ScanChannels & M_ValidChannels & ~GETLE32(scan_cnf->UnscannedChannels);
+	for (channel = M_MinimumChannel; channel <= M_MaximumChannel; channel++) {
+		if (!(scanned & (1UL << channel)))
+			continue;
+		if (result >= scan_cnf->ResultListSize)
+			break;
+
+		sample = CHANSEL_SCORE_ED(scan_cnf->ResultList[result++]);
+		score = &cs->score[CHANSEL_INDEX(channel)];
+		if (cs->scored_mask & (1UL << channel)) {
+			/* EWMA with alpha = 1/4 */
+			*score = (uint16_t)(((uint32_t)*score * 3 + sample) >> 2);
+		} else {
+			*score = sample;
+			cs->scored_mask |= (1UL << channel);
+		}
+	}
+
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Feed an MCPS-DATA confirm into the engine
+ *******************************************************************************
+ * Only MAC_CHANNEL_ACCESS_FAILURE and MAC_NO_ACK count as failures, as these
+ * are the statuses caused by a busy or noisy channel.
+ *******************************************************************************
+ * \param cs - Channel selection state
+ * \param data_cnf - Data confirm parameter set
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_chansel_process_datacnf(
+	struct ca821x_chansel               *cs,
+	const struct MCPS_DATA_confirm_pset *data_cnf
+)
+{
+	if (cs->tx_attempts == UINT16_MAX)
+		return;
+
+	cs->tx_attempts++;
+	if (data_cnf->Status == MAC_CHANNEL_ACCESS_FAILURE ||
+	    data_cnf->Status == MAC_NO_ACK)
+		cs->tx_failures++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Get the current smoothed score of a channel
+ *******************************************************************************
+ * \param cs - Channel selection state
+ * \param channel - 802.15.4 channel number
+ *******************************************************************************
+ * \return Score in 8.8 fixed point ED units, 0xFFFF if the channel has not
+ *         been scored or is out of range
+ *******************************************************************************
+ ******************************************************************************/
+uint16_t ca821x_chansel_get_score(struct ca821x_chansel *cs, uint8_t channel)
+{
+	if (channel < M_MinimumChannel || channel > M_MaximumChannel)
+		return 0xFFFF;
+	if (!(cs->scored_mask & (1UL << channel)))
+		return 0xFFFF;
+	return cs->score[CHANSEL_INDEX(channel)];
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Decide whether the coordinator should move channel
+ *******************************************************************************
+ * Should be called periodically. Each call that has at least min_samples
+ * data confirms available closes the current failure window. If the score of
+ * the failure ratio (CHANSEL_SCORE_RATIO) reaches degrade_threshold, the
+ * current channel's score is raised to it and the best scored candidate is
+ * returned, provided that it beats
+ * the current channel by at least the hysteresis margin. After a move, no
+ * further move is recommended for holdoff evaluations.
+ *******************************************************************************
+ * \param cs - Channel selection state
+ *******************************************************************************
+ * \return Channel to migrate to, or 0 if the coordinator should stay put
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_chansel_evaluate(struct ca821x_chansel *cs)
+{
+	uint8_t channel, best_channel = 0;
+	uint16_t failure_score, current_score, best_score = 0xFFFF;
+	uint32_t ratio;
+	uint16_t *score;
+
+	if (cs->holdoff_count) {
+		cs->holdoff_count--;
+		return 0;
+	}
+	if (cs->tx_attempts < cs->min_samples)
+		return 0;
+
+	ratio = ((uint32_t)cs->tx_failures << 8) / cs->tx_attempts;
+	failure_score = CHANSEL_SCORE_RATIO(ratio);
+	cs->tx_attempts = 0;
+	cs->tx_failures = 0;
+	if (failure_score < cs->degrade_threshold)
+		return 0;
+
+	/* Fold the observed failure ratio into the current channel's score */
+	if (cs->current_channel >= M_MinimumChannel &&
+	    cs->current_channel <= M_MaximumChannel) {
+		score = &cs->score[CHANSEL_INDEX(cs->current_channel)];
+		if (*score < failure_score)
+			*score = failure_score;
+		cs->scored_mask |= (1UL << cs->current_channel);
+		current_score = *score;
+	} else {
+		current_score = 0xFFFF;
+	}
+
+	for (channel = M_MinimumChannel; channel <= M_MaximumChannel; channel++) {
+		if (channel == cs->current_channel)
+			continue;
+		if (!(cs->channel_mask & cs->scored_mask & (1UL << channel)))
+			continue;
+		if (cs->score[CHANSEL_INDEX(channel)] < best_score) {
+			best_score = cs->score[CHANSEL_INDEX(channel)];
+			best_channel = channel;
+		}
+	}
+
+	if (!best_channel)
+		return 0;
+	if ((uint32_t)best_score + cs->hysteresis >= current_score)
+		return 0;
+
+	return best_channel;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Move the PAN to a new channel using a coordinator realignment
+ *******************************************************************************
+ * Issues MLME_START_request_sync with CoordRealignment set, so that the
+ * coordinator broadcasts a realignment command on the old channel before
+ * switching. On success the engine's failure window is cleared and the
+ * holdoff period is started.
+ *******************************************************************************
+ * \param cs - Channel selection state
+ * \param LogicalChannel - Channel to move to (see ca821x_chansel_evaluate)
+ * \param PANId - PAN Identifier
+ * \param BeaconOrder - Beacon Order
+ * \param SuperframeOrder - Superframe Order
+ * \param pCoordRealignSecurity - Pointer to Security Structure or NULLP for
+ *                                coordinator realignment frames
+ * \param pBeaconSecurity - Pointer to Security Structure or NULLP for beacon
+ *                          frames
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return 802.15.4 status of MLME-START confirm
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_chansel_migrate(
+	struct ca821x_chansel *cs,
+	uint8_t                LogicalChannel,
+	uint16_t               PANId,
+	uint8_t                BeaconOrder,
+	uint8_t                SuperframeOrder,
+	struct SecSpec        *pCoordRealignSecurity,
+	struct SecSpec        *pBeaconSecurity,
+	struct ca821x_dev     *pDeviceRef
+)
+{
+	uint8_t status;
+
+	if (LogicalChannel < M_MinimumChannel || LogicalChannel > M_MaximumChannel)
+		return MAC_INVALID_PARAMETER;
+
+	status = MLME_START_request_sync(
+		PANId,
+		LogicalChannel,
+		BeaconOrder,
+		SuperframeOrder,
+		1,
+		0,
+		1,
+		pCoordRealignSecurity,
+		pBeaconSecurity,
+		pDeviceRef
+	);
+	if (status != MAC_SUCCESS)
+		return status;
+
+	cs->current_channel = LogicalChannel;
+	cs->tx_attempts = 0;
+	cs->tx_failures = 0;
+	cs->holdoff_count = cs->holdoff;
+
+	return MAC_SUCCESS;
+}
@@ -0,0 +1,236 @@
+/**
+ * @file ca821x_dedup.c
+ * @brief Per-source suppression of duplicate data indications.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_dedup.h"
+
+#define DEDUP_SLOT_BITS     (7)
+#define DEDUP_SLOT_MASK     (CA821X_DEDUP_SLOTS - 1)
+
+#if (1 << DEDUP_SLOT_BITS) != CA821X_DEDUP_SLOTS || \
+    CA821X_DEDUP_SLOTS < 2 * CA821X_DEDUP_SOURCES || CA821X_DEDUP_SOURCES > 255
+#error "CA821X_DEDUP_SLOTS must be 1 << DEDUP_SLOT_BITS and twice CA821X_DEDUP_SOURCES"
+#endif
+
+#ifdef CA821X_HAVE_ATOMICS
+#define DEDUP_INIT(p)       atomic_init((p), 0)
+#define DEDUP_INC(p)        atomic_fetch_add_explicit((p), 1, memory_order_relaxed)
+#else
+#define DEDUP_INIT(p)       (*(p) = 0)
+#define DEDUP_INC(p)        ((*(p))++)
+#endif
+
+/** Home slot of a source: the top bits of a Fibonacci hash */
+static unsigned dedup_hash(uint64_t key, uint8_t mode)
+{
+	return (unsigned)(((key ^ mode) * 0x9E3779B97F4A7C15ULL) >> (64 - DEDUP_SLOT_BITS));
+}
+
+/**
+ * Probe the index for a source, returning 1 and its slot in pos if found, or
+ * 0 and the empty slot ending the probe
+ */
+static int dedup_probe(struct ca821x_dedup *dedup, uint64_t key, uint8_t mode,
+                       unsigned *pos)
+{
+	const struct ca821x_dedup_source *s;
+	unsigned i = dedup_hash(key, mode);
+
+	while (dedup->slots[i]) {
+		s = &dedup->sources[dedup->slots[i] - 1];
+		if (s->key == key && s->mode == mode) {
+			*pos = i;
+			return 1;
+		}
+		i = (i + 1) & DEDUP_SLOT_MASK;
+	}
+	*pos = i;
+	return 0;
+}
+
+/** Remove a source from the index, shifting back the rest of its probe run */
+static void dedup_remove(struct ca821x_dedup *dedup, const struct ca821x_dedup_source *s)
+{
+	const struct ca821x_dedup_source *t;
+	unsigned i, j, home;
+
+	if (!dedup_probe(dedup, s->key, s->mode, &i))
+		return;
+	for (j = (i + 1) & DEDUP_SLOT_MASK; dedup->slots[j]; j = (j + 1) & DEDUP_SLOT_MASK) {
+		t = &dedup->sources[dedup->slots[j] - 1];
+		home = dedup_hash(t->key, t->mode);
+		/* Move it if its home is not cyclically within (i, j] */
+		if (((j - home) & DEDUP_SLOT_MASK) >= ((j - i) & DEDUP_SLOT_MASK)) {
+			dedup->slots[i] = dedup->slots[j];
+			i = j;
+		}
+	}
+	dedup->slots[i] = 0;
+}
+
+static void dedup_unlink(struct ca821x_dedup *dedup, uint8_t pos)
+{
+	struct ca821x_dedup_source *s = &dedup->sources[pos];
+
+	if (s->newer != CA821X_DEDUP_NONE)
+		dedup->sources[s->newer].older = s->older;
+	else
+		dedup->newest = s->older;
+	if (s->older != CA821X_DEDUP_NONE)
+		dedup->sources[s->older].newer = s->newer;
+	else
+		dedup->oldest = s->newer;
+}
+
+static void dedup_push(struct ca821x_dedup *dedup, uint8_t pos)
+{
+	struct ca821x_dedup_source *s = &dedup->sources[pos];
+
+	s->newer = CA821X_DEDUP_NONE;
+	s->older = dedup->newest;
+	if (dedup->newest != CA821X_DEDUP_NONE)
+		dedup->sources[dedup->newest].newer = pos;
+	else
+		dedup->oldest = pos;
+	dedup->newest = pos;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a duplicate filter with no sources
+ *******************************************************************************
+ * \param dedup - Filter to initialise
+ * \param max_age_ns - Time after which a source is forgotten, 0 for never.
+ *                     Only effective if the device has a clock
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_dedup_init(struct ca821x_dedup *dedup, uint64_t max_age_ns)
+{
+	memset(dedup, 0, sizeof(*dedup));
+	dedup->max_age_ns = max_age_ns;
+	dedup->newest = CA821X_DEDUP_NONE;
+	dedup->oldest = CA821X_DEDUP_NONE;
+	DEDUP_INIT(&dedup->frames);
+	DEDUP_INIT(&dedup->duplicates);
+	DEDUP_INIT(&dedup->evictions);
+}
+
+/** Record dsn as received from s, returning 1 if it already was */
+static int dedup_window(struct ca821x_dedup_source *s, uint8_t dsn)
+{
+	uint8_t behind = (uint8_t)(s->dsn - dsn), ahead = (uint8_t)(dsn - s->dsn);
+	uint32_t bit;
+
+	if (!behind)
+		return 1;
+	if (behind <= CA821X_DEDUP_WINDOW) {
+		bit = 1u << (behind - 1);
+		if (s->window & bit)
+			return 1;
+		s->window |= bit;
+		return 0;
+	}
+	if (ahead < 128) {
+		/* The previous newest DSN is now ahead - 1 bits back */
+		if (ahead < CA821X_DEDUP_WINDOW)
+			s->window = (s->window << ahead) | (1u << (ahead - 1));
+		else
+			s->window = ahead == CA821X_DEDUP_WINDOW ? 1u << (ahead - 1) : 0;
+	} else {
+		/* Far behind: the sender has most likely restarted */
+		s->window = 0;
+	}
+	s->dsn = dsn;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Check whether a data indication repeats one already received
+ *******************************************************************************
+ * Called by ca821x_downstream_dispatch for each MCPS-DATA.indication. The
+ * DSN is recorded against the source either way.
+ *******************************************************************************
+ * \param dedup - Filter
+ * \param src - Source address of the frame
+ * \param dsn - Data sequence number of the frame
+ * \param now_ns - Device clock
+ *******************************************************************************
+ * \return 1: Duplicate, to be dropped<br>
+ *         0: Not received before, or no source address
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_dedup_check(
+	struct ca821x_dedup   *dedup,
+	const struct FullAddr *src,
+	uint8_t                dsn,
+	uint64_t               now_ns
+)
+{
+	struct ca821x_dedup_source *s;
+	uint64_t key;
+	unsigned slot;
+	uint8_t pos;
+	int dup = 0;
+
+	if (src->AddressMode == MAC_MODE_LONG_ADDR)
+		memcpy(&key, src->Address, 8);
+	else if (src->AddressMode == MAC_MODE_SHORT_ADDR)
+		key = ((uint64_t)GETLE16(src->PANId) << 16) | GETLE16(src->Address);
+	else
+		return 0;
+	DEDUP_INC(&dedup->frames);
+
+	if (dedup_probe(dedup, key, src->AddressMode, &slot)) {
+		pos = dedup->slots[slot] - 1;
+		s = &dedup->sources[pos];
+		dedup_unlink(dedup, pos);
+		if (dedup->max_age_ns && now_ns - s->seen_ns > dedup->max_age_ns) {
+			s->dsn = dsn;
+			s->window = 0;
+		} else {
+			dup = dedup_window(s, dsn);
+		}
+	} else {
+		if (dedup->count < CA821X_DEDUP_SOURCES) {
+			pos = dedup->count++;
+		} else {
+			pos = dedup->oldest;
+			dedup_unlink(dedup, pos);
+			dedup_remove(dedup, &dedup->sources[pos]);
+			DEDUP_INC(&dedup->evictions);
+			/* The removal may have shifted the slot found by the probe */
+			dedup_probe(dedup, key, src->AddressMode, &slot);
+		}
+		s = &dedup->sources[pos];
+		s->key = key;
+		s->mode = src->AddressMode;
+		s->dsn = dsn;
+		s->window = 0;
+		dedup->slots[slot] = pos + 1;
+	}
+	s->seen_ns = now_ns;
+	dedup_push(dedup, pos);
+	if (dup)
+		DEDUP_INC(&dedup->duplicates);
+	return dup;
+}
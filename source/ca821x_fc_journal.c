@@ -0,0 +1,366 @@
+/**
+ * @file ca821x_fc_journal.c
+ * @brief Crash-safe journal of security frame counter high-water marks.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ca821x_api.h"
+#include "ca821x_fc_journal.h"
+#include "ca821x_sec_mirror.h"
+#include "mac_messages.h"
+
+#define FCJ_MAGIC           "CA821XJ2"
+/** Each copy of the marks has a page of its own */
+#define FCJ_PAGE            (4096)
+/** Device entries in a copy, the largest DEVICE_TABLE_SIZE of any device */
+#define FCJ_DEVICES         (32)
+
+#if DEVICE_TABLE_SIZE > FCJ_DEVICES
+#error "FCJ_DEVICES is smaller than the device table"
+#endif
+
+/** Mark of one device table entry */
+struct fcj_device {
+	uint8_t  ext[8];   /**< ExtAddress of the device */
+	uint32_t counter;  /**< FrameCounter, at most the device's own */
+	uint32_t used;
+};
+
+/** One copy of the marks, as written to the file */
+struct fcj_marks {
+	char              magic[8];
+	uint64_t          seq;     /**< Copies are written with increasing seq */
+	/** No outgoing frame has used this counter or a later one */
+	uint32_t          tx_next;
+	uint32_t          reserved;
+	struct fcj_device dev[FCJ_DEVICES];
+	uint32_t          check;   /**< CRC-32 of the copy up to here */
+};
+
+struct ca821x_fc_journal {
+	pthread_mutex_t  lock;
+	int              fd;
+	uint8_t         *map;     /**< Both copies */
+	unsigned         next;    /**< Copy to write next, the older one */
+	uint32_t         stride;
+	uint64_t         writes;  /**< Copies written since opening */
+	struct fcj_marks marks;   /**< Contents of the newer copy */
+};
+
+/** CRC-32 (IEEE 802.3) of the copy up to its check */
+static uint32_t fcj_check(const struct fcj_marks *marks)
+{
+	const uint8_t *p = (const uint8_t *)marks;
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i;
+	int bit;
+
+	/* Bitwise: a copy is only checked when written or opened */
+	for (i = 0; i < offsetof(struct fcj_marks, check); i++) {
+		crc ^= p[i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static int fcj_valid(const struct fcj_marks *marks)
+{
+	return !memcmp(marks->magic, FCJ_MAGIC, 8) && marks->check == fcj_check(marks);
+}
+
+/** Write marks over the older copy, making it the newer one */
+static int fcj_write(struct ca821x_fc_journal *journal, struct fcj_marks *marks)
+{
+	uint8_t *page = journal->map + journal->next * FCJ_PAGE;
+
+	marks->seq = journal->marks.seq + 1;
+	marks->check = fcj_check(marks);
+	memcpy(page, marks, sizeof(*marks));
+	if (msync(page, FCJ_PAGE, MS_SYNC))
+		return -errno;
+	journal->marks = *marks;
+	journal->next ^= 1;
+	journal->writes++;
+	return 1;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Open a frame counter journal
+ *******************************************************************************
+ * The marks are loaded from the newer intact copy in the file, which is
+ * created if needed. A new or unreadable file holds no marks.
+ *******************************************************************************
+ * \param path - Journal file
+ * \param stride - Counter advance between writes, 0:
+ *                 CA821X_FC_JOURNAL_DEF_STRIDE
+ *******************************************************************************
+ * \return The journal, or NULL with errno set
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_fc_journal *ca821x_fc_journal_open(const char *path, uint32_t stride)
+{
+	struct ca821x_fc_journal *journal;
+	const struct fcj_marks *copy[2];
+	struct stat st;
+	int error;
+	unsigned i;
+
+	journal = calloc(1, sizeof(*journal));
+	if (!journal)
+		return NULL;
+	journal->stride = stride ? stride : CA821X_FC_JOURNAL_DEF_STRIDE;
+	journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (journal->fd < 0) {
+		error = errno;
+		goto fail;
+	}
+	if (fstat(journal->fd, &st)) {
+		error = errno;
+		goto fail_close;
+	}
+	/* Allocate up front, so running out of space fails here, not as SIGBUS */
+	if (st.st_size < 2 * FCJ_PAGE &&
+	    (error = posix_fallocate(journal->fd, 0, 2 * FCJ_PAGE)))
+		goto fail_close;
+	journal->map = mmap(NULL, 2 * FCJ_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                    journal->fd, 0);
+	if (journal->map == MAP_FAILED) {
+		error = errno;
+		goto fail_close;
+	}
+
+	memcpy(journal->marks.magic, FCJ_MAGIC, 8);
+	for (i = 0; i < 2; i++) {
+		copy[i] = (const struct fcj_marks *)(journal->map + i * FCJ_PAGE);
+		if (fcj_valid(copy[i]) && copy[i]->seq >= journal->marks.seq) {
+			journal->marks = *copy[i];
+			journal->next = i ^ 1;
+		}
+	}
+	pthread_mutex_init(&journal->lock, NULL);
+	return journal;
+
+fail_close:
+	close(journal->fd);
+fail:
+	free(journal);
+	errno = error;
+	return NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Close a frame counter journal
+ *******************************************************************************
+ * \param journal - Journal to close, freed on return
+ *******************************************************************************
+ * \return 0, or negative errno if the file could not be closed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_fc_journal_close(struct ca821x_fc_journal *journal)
+{
+	int ret = 0;
+
+	munmap(journal->map, 2 * FCJ_PAGE);
+	if (close(journal->fd))
+		ret = -errno;
+	pthread_mutex_destroy(&journal->lock);
+	free(journal);
+	return ret;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Note the outgoing frame counter
+ *******************************************************************************
+ * Call with the counter of each secured frame before sending it, or at least
+ * before sending one whose counter reaches the last mark. The frame must not
+ * be sent if this fails.
+ *******************************************************************************
+ * \param journal - Journal
+ * \param counter - Frame counter about to be used
+ *******************************************************************************
+ * \return 0: Already covered by the mark<br>
+ *         1: A new mark was written<br>
+ *         Negative errno: The mark could not be written
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_fc_journal_note_tx(struct ca821x_fc_journal *journal, uint32_t counter)
+{
+	struct fcj_marks marks;
+	int ret = 0;
+
+	pthread_mutex_lock(&journal->lock);
+	if (counter >= journal->marks.tx_next) {
+		marks = journal->marks;
+		marks.tx_next = counter + journal->stride < counter ?
+		                UINT32_MAX : counter + journal->stride;
+		ret = fcj_write(journal, &marks);
+	}
+	pthread_mutex_unlock(&journal->lock);
+	return ret;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Note the frame counter of a device descriptor
+ *******************************************************************************
+ * Call with the FrameCounter of a device table entry as it advances, for
+ * instance from each secured frame received from the device. A new device at
+ * the index replaces the mark of the old one.
+ *******************************************************************************
+ * \param journal - Journal
+ * \param index - Index of the entry in macDeviceTable
+ * \param ext_addr - ExtAddress of the entry
+ * \param counter - FrameCounter of the entry
+ *******************************************************************************
+ * \return 0: Within stride of the mark<br>
+ *         1: A new mark was written<br>
+ *         Negative errno: index is out of range or the mark could not be
+ *         written
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_fc_journal_note_device(
+	struct ca821x_fc_journal *journal,
+	uint8_t                   index,
+	const uint8_t            *ext_addr,
+	uint32_t                  counter
+)
+{
+	const struct fcj_device *dev;
+	struct fcj_marks marks;
+	int ret = 0;
+
+	if (index >= DEVICE_TABLE_SIZE)
+		return -EINVAL;
+	dev = &journal->marks.dev[index];
+	pthread_mutex_lock(&journal->lock);
+	if (!dev->used || memcmp(dev->ext, ext_addr, 8) ||
+	    (counter > dev->counter && counter - dev->counter >= journal->stride)) {
+		marks = journal->marks;
+		memcpy(marks.dev[index].ext, ext_addr, 8);
+		marks.dev[index].counter = counter;
+		marks.dev[index].used = 1;
+		ret = fcj_write(journal, &marks);
+	}
+	pthread_mutex_unlock(&journal->lock);
+	return ret;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Restore frame counters from the journal
+ *******************************************************************************
+ * Raises the FrameCounter of each device descriptor in tables to the mark of
+ * the device with its ExtAddress, wherever in the table it was noted.
+ *******************************************************************************
+ * \param journal - Journal
+ * \param tables - Tables to update, typically before ca821x_sec_mirror_sync
+ *******************************************************************************
+ * \return Outgoing frame counter to resume at, 0 if none was noted
+ *******************************************************************************
+ ******************************************************************************/
+uint32_t ca821x_fc_journal_restore(
+	struct ca821x_fc_journal *journal,
+	struct ca821x_sec_tables *tables
+)
+{
+	const struct fcj_device *dev;
+	uint32_t tx_next;
+	unsigned i, j;
+
+	pthread_mutex_lock(&journal->lock);
+	for (i = 0; i < tables->device_entries && i < DEVICE_TABLE_SIZE; i++) {
+		for (j = 0; j < DEVICE_TABLE_SIZE; j++) {
+			dev = &journal->marks.dev[j];
+			if (!dev->used || memcmp(dev->ext, tables->devices[i].ExtAddress, 8))
+				continue;
+			if (dev->counter > GETLE32(tables->devices[i].FrameCounter))
+				PUTLE32(dev->counter, tables->devices[i].FrameCounter);
+			break;
+		}
+	}
+	tx_next = journal->marks.tx_next;
+	pthread_mutex_unlock(&journal->lock);
+	return tx_next;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Restore frame counters and write them to a device
+ *******************************************************************************
+ * Sets macFrameCounter, then restores the device descriptors of tables as
+ * ca821x_fc_journal_restore and writes the tables with
+ * ca821x_sec_mirror_sync, which only sends the SETs that differ from mirror.
+ * After a reset, with an empty mirror, that is one SET per table entry.
+ *******************************************************************************
+ * \param journal - Journal
+ * \param tables - Tables the device should hold, counters updated
+ * \param mirror - What the device holds
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Status of the first MLME-SET.confirm that failed, or MAC_SUCCESS
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_fc_journal_restore_sync(
+	struct ca821x_fc_journal *journal,
+	struct ca821x_sec_tables *tables,
+	struct ca821x_sec_mirror *mirror,
+	struct ca821x_dev        *pDeviceRef
+)
+{
+	uint32_t tx_next = ca821x_fc_journal_restore(journal, tables);
+	uint8_t counter[4];
+	uint8_t status;
+
+	PUTLE32(tx_next, counter);
+	status = MLME_SET_request_sync(macFrameCounter, 0, 4, counter, pDeviceRef);
+	if (status != MAC_SUCCESS)
+		return status;
+	return ca821x_sec_mirror_sync(mirror, tables, pDeviceRef);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Number of copies of the marks written
+ *******************************************************************************
+ * \param journal - Journal
+ *******************************************************************************
+ * \return Writes, each with an msync, since the journal was opened
+ *******************************************************************************
+ ******************************************************************************/
+uint64_t ca821x_fc_journal_writes(struct ca821x_fc_journal *journal)
+{
+	uint64_t writes;
+
+	pthread_mutex_lock(&journal->lock);
+	writes = journal->writes;
+	pthread_mutex_unlock(&journal->lock);
+	return writes;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file ca821x_frame.c
+ * @brief Decoding and building of raw 802.15.4 MAC frames (PSDUs).
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_frame.h"
+
+/** Frame control, then sequence number */
+#define FRAME_ADDR_OFFSET   (3)
+
+/** Octets of an address of the given mode */
+#define ADDR_LEN(m)         ((m) == MAC_MODE_SHORT_ADDR ? 2 : (m) == MAC_MODE_LONG_ADDR ? 8 : 0)
+/** Octets of a PAN id and address of the given mode */
+#define FIELD_LEN(m)        ((m) ? 2 + ADDR_LEN(m) : 0)
+
+/**
+ * Offsets of the addressing fields from the start of the frame, for one pair
+ * of addressing modes without PAN id compression. Absent fields are 0, and
+ * end is 0 if either mode is reserved.
+ */
+struct frame_layout {
+	uint8_t dst_pan;
+	uint8_t dst_addr;
+	uint8_t src_pan;
+	uint8_t src_addr;
+	uint8_t end;
+};
+
+#define LAYOUT(d, s) { \
+	(d) ? FRAME_ADDR_OFFSET : 0, \
+	(d) ? FRAME_ADDR_OFFSET + 2 : 0, \
+	(s) ? FRAME_ADDR_OFFSET + FIELD_LEN(d) : 0, \
+	(s) ? FRAME_ADDR_OFFSET + FIELD_LEN(d) + 2 : 0, \
+	((d) == MAC_MODE_RESERVED || (s) == MAC_MODE_RESERVED) ? 0 : \
+		FRAME_ADDR_OFFSET + FIELD_LEN(d) + FIELD_LEN(s) }
+
+/** Indexed by the destination and source addressing modes, see FRAME_LAYOUT */
+static const struct frame_layout frame_layouts[16] = {
+	LAYOUT(0, 0), LAYOUT(0, 1), LAYOUT(0, 2), LAYOUT(0, 3),
+	LAYOUT(1, 0), LAYOUT(1, 1), LAYOUT(1, 2), LAYOUT(1, 3),
+	LAYOUT(2, 0), LAYOUT(2, 1), LAYOUT(2, 2), LAYOUT(2, 3),
+	LAYOUT(3, 0), LAYOUT(3, 1), LAYOUT(3, 2), LAYOUT(3, 3)
+};
+
+/** Layout for a frame control field */
+#define FRAME_LAYOUT(fc)    (&frame_layouts[(MAC_FC_DAM(fc) << 2) | MAC_FC_SAM(fc)])
+
+/** Octets of the key identifier, by key identifier mode */
+static const uint8_t key_id_lens[4] = {0, 1, 5, 9};
+/** Octets of the MIC, by the low bits of the security level */
+static const uint8_t mic_lens[4] = {0, 4, 8, 16};
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Decode a MAC frame in place
+ *******************************************************************************
+ * Frames of the 2003 and 2006 versions of the standard are decoded; 2015
+ * frames, whose PAN id rules differ, are rejected. The frame is not
+ * decrypted, and the FCS is not checked (see ca821x_fcs_check).
+ *******************************************************************************
+ * \param frame - Receives the decoded fields
+ * \param psdu - Frame, starting with the frame control field
+ * \param len - Length of the frame
+ * \param has_fcs - Nonzero if the frame ends with an FCS (as in a
+ *                  PCPS-DATA.indication)
+ *******************************************************************************
+ * \return 0: Frame decoded
+ *         -1: Malformed or unsupported frame
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_frame_decode(
+	struct ca821x_frame *frame,
+	const uint8_t       *psdu,
+	size_t               len,
+	int                  has_fcs
+)
+{
+	const struct frame_layout *layout;
+	const uint8_t *p;
+	uint8_t sc;
+	size_t hdr_len;
+
+	if (has_fcs) {
+		if (len < MAC_FCS_LEN)
+			return -1;
+		len -= MAC_FCS_LEN;
+	}
+	if (len < FRAME_ADDR_OFFSET || len > aMaxPHYPacketSize)
+		return -1;
+	frame->fc = GETLE16(psdu);
+	if (MAC_FC_VER(frame->fc) > 1)
+		return -1;
+	layout = FRAME_LAYOUT(frame->fc);
+	hdr_len = layout->end;
+	if (!hdr_len || len < hdr_len)
+		return -1;
+
+	frame->type = frame->fc & MAC_FC_FT_MASK;
+	frame->dsn = psdu[2];
+	frame->dst_mode = MAC_FC_DAM(frame->fc);
+	frame->src_mode = MAC_FC_SAM(frame->fc);
+	frame->dst_pan = layout->dst_pan ? psdu + layout->dst_pan : NULL;
+	frame->dst_addr = layout->dst_addr ? psdu + layout->dst_addr : NULL;
+	frame->src_pan = layout->src_pan ? psdu + layout->src_pan : NULL;
+	frame->src_addr = layout->src_addr ? psdu + layout->src_addr : NULL;
+	if ((frame->fc & MAC_FC_PAN_COMP) && frame->dst_mode && frame->src_mode) {
+		frame->src_pan = frame->dst_pan;
+		frame->src_addr -= 2;
+		hdr_len -= 2;
+	}
+
+	frame->sec_level = 0;
+	frame->key_id_mode = 0;
+	frame->frame_counter = 0;
+	frame->key_source = NULL;
+	frame->key_index = 0;
+	frame->mic_len = 0;
+	if (frame->fc & MAC_FC_SEC_ENA) {
+		if (MAC_FC_VER(frame->fc) == 0 || len < hdr_len + 5)
+			return -1;
+		p = psdu + hdr_len;
+		sc = p[0];
+		frame->sec_level = MAC_SC_LEVEL(sc);
+		frame->key_id_mode = MAC_SC_KEYIDMODE(sc);
+		frame->frame_counter = GETLE32(p + 1);
+		frame->mic_len = mic_lens[frame->sec_level & 3];
+		hdr_len += 5 + key_id_lens[frame->key_id_mode];
+		if (len < hdr_len + frame->mic_len)
+			return -1;
+		if (frame->key_id_mode > 1)
+			frame->key_source = p + 5;
+		if (frame->key_id_mode)
+			frame->key_index = psdu[hdr_len - 1];
+	}
+
+	frame->hdr_len = (uint8_t)hdr_len;
+	frame->payload = psdu + hdr_len;
+	frame->payload_len = (uint8_t)(len - hdr_len);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Build a MAC frame
+ *******************************************************************************
+ * The frame is written without an FCS (see ca821x_fcs_append), and for a
+ * secured frame without encrypting the payload or appending a MIC. The
+ * version is 2006 for a secured frame and 2003 otherwise, unless hdr->fc
+ * selects 2006.
+ *******************************************************************************
+ * \param buf - Buffer to write the frame to
+ * \param size - Size of buf
+ * \param hdr - Header fields
+ * \param payload - MAC payload
+ * \param payload_len - Length of the payload
+ *******************************************************************************
+ * \return Length of the frame, or -1 if an address mode is reserved or the
+ *         frame does not fit in buf or in a PSDU with its FCS
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_frame_build(
+	uint8_t                       *buf,
+	size_t                         size,
+	const struct ca821x_frame_hdr *hdr,
+	const uint8_t                 *payload,
+	size_t                         payload_len
+)
+{
+	const struct SecSpec *sec = &hdr->security;
+	uint8_t dam = hdr->dst.AddressMode & 3, sam = hdr->src.AddressMode & 3;
+	uint16_t fc = (hdr->fc & (MAC_FC_FT_MASK | MAC_FC_FP | MAC_FC_ACK_REQ | MAC_FC_VER_MASK)) |
+	              (dam << 10) | (sam << 14);
+	const struct frame_layout *layout = FRAME_LAYOUT(fc);
+	size_t len = layout->end, sec_len = 0;
+	uint8_t *p;
+
+	if (!len)
+		return -1;
+	if (dam && sam && !memcmp(hdr->dst.PANId, hdr->src.PANId, 2)) {
+		fc |= MAC_FC_PAN_COMP;
+		len -= 2;
+	}
+	if (sec->SecurityLevel) {
+		fc |= MAC_FC_SEC_ENA;
+		if (!MAC_FC_VER(fc))
+			fc |= MAC_FC_VER2006;
+		sec_len = 5 + key_id_lens[sec->KeyIdMode & 3];
+	}
+	if (len + sec_len + payload_len > size ||
+	    len + sec_len + payload_len + MAC_FCS_LEN > aMaxPHYPacketSize)
+		return -1;
+
+	PUTLE16(fc, buf);
+	buf[2] = hdr->dsn;
+	if (dam) {
+		memcpy(buf + layout->dst_pan, hdr->dst.PANId, 2);
+		memcpy(buf + layout->dst_addr, hdr->dst.Address, ADDR_LEN(dam));
+	}
+	if (sam) {
+		p = buf + len - ADDR_LEN(sam);
+		if (!(fc & MAC_FC_PAN_COMP))
+			memcpy(p - 2, hdr->src.PANId, 2);
+		memcpy(p, hdr->src.Address, ADDR_LEN(sam));
+	}
+
+	p = buf + len;
+	if (sec_len) {
+		*p++ = (sec->SecurityLevel & 7) | ((sec->KeyIdMode & 3) << 3);
+		PUTLE32(hdr->frame_counter, p);
+		p += 4;
+		if ((sec->KeyIdMode & 3) == 2) {
+			memcpy(p, sec->KeySource, 4);
+			p += 4;
+		} else if ((sec->KeyIdMode & 3) == 3) {
+			memcpy(p, sec->KeySource, 8);
+			p += 8;
+		}
+		if (sec->KeyIdMode & 3)
+			*p++ = sec->KeyIndex;
+	}
+	if (payload_len)
+		memcpy(p, payload, payload_len);
+	return (int)(p - buf + payload_len);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Copy the addressing of a decoded frame
+ *******************************************************************************
+ * \param frame - Decoded frame
+ * \param src - Receives the source addressing, AddressMode 0 if absent
+ * \param dst - Receives the destination addressing, AddressMode 0 if absent
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_frame_get_addrs(
+	const struct ca821x_frame *frame,
+	struct FullAddr           *src,
+	struct FullAddr           *dst
+)
+{
+	memset(src, 0, sizeof(*src));
+	memset(dst, 0, sizeof(*dst));
+	if (frame->src_addr) {
+		src->AddressMode = frame->src_mode;
+		memcpy(src->PANId, frame->src_pan, 2);
+		memcpy(src->Address, frame->src_addr, ADDR_LEN(frame->src_mode));
+	}
+	if (frame->dst_addr) {
+		dst->AddressMode = frame->dst_mode;
+		memcpy(dst->PANId, frame->dst_pan, 2);
+		memcpy(dst->Address, frame->dst_addr, ADDR_LEN(frame->dst_mode));
+	}
+}
@@ -0,0 +1,155 @@
+/**
+ * @file ca821x_haes.c
+ * @brief Multi-block use of the hardware AES engine through HWME-HAES.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_haes.h"
+#include "hwme_tdme.h"
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Encrypt or decrypt consecutive blocks with the hardware AES engine
+ *******************************************************************************
+ * The blocks are processed in place, independently (ECB). On failure the
+ * blocks before the failing one have been processed and the rest are
+ * unchanged.
+ *******************************************************************************
+ * \param mode - HAES_MODE_ENCRYPT or HAES_MODE_DECRYPT
+ * \param data - Blocks to process
+ * \param nblocks - Number of 16 octet blocks
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Status of the first HWME-HAES.confirm that failed, or HWME_SUCCESS
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_haes_blocks(
+	uint8_t            mode,
+	uint8_t           *data,
+	size_t             nblocks,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	uint8_t status;
+
+	for (; nblocks; nblocks--, data += CA821X_HAES_BLOCK) {
+		status = HWME_HAES_request_sync(mode, data, pDeviceRef);
+		if (status != HWME_SUCCESS)
+			return status;
+	}
+	return HWME_SUCCESS;
+}
+
+/** Advance the two octet big-endian counter ending a CCM* counter block */
+static void haes_ctr_inc(uint8_t *ctr)
+{
+	if (!++ctr[CA821X_HAES_BLOCK - 1])
+		ctr[CA821X_HAES_BLOCK - 2]++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Encrypt or decrypt in counter mode with the hardware AES engine
+ *******************************************************************************
+ * The keystream for up to CA821X_HAES_CTR_BLOCKS blocks is generated into a
+ * buffer, one synchronous exchange per block, then XORed into the data.
+ *******************************************************************************
+ * \param ctr - Counter block for the first block of data. Advanced past the
+ *              blocks used, including a final partial one
+ * \param data - Data to process in place
+ * \param len - Length of data
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Status of the first HWME-HAES.confirm that failed, or HWME_SUCCESS.
+ *         On failure data is only partly processed
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_haes_ctr(
+	uint8_t           *ctr,
+	uint8_t           *data,
+	size_t             len,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	uint8_t stream[CA821X_HAES_CTR_BLOCKS * CA821X_HAES_BLOCK];
+	size_t nblocks, i, n;
+	uint8_t status;
+
+	while (len) {
+		nblocks = (len + CA821X_HAES_BLOCK - 1) / CA821X_HAES_BLOCK;
+		if (nblocks > CA821X_HAES_CTR_BLOCKS)
+			nblocks = CA821X_HAES_CTR_BLOCKS;
+		for (i = 0; i < nblocks; i++) {
+			memcpy(stream + i * CA821X_HAES_BLOCK, ctr, CA821X_HAES_BLOCK);
+			haes_ctr_inc(ctr);
+		}
+		status = ca821x_haes_blocks(HAES_MODE_ENCRYPT, stream, nblocks, pDeviceRef);
+		if (status != HWME_SUCCESS)
+			return status;
+
+		n = nblocks * CA821X_HAES_BLOCK;
+		if (n > len)
+			n = len;
+		for (i = 0; i < n; i++)
+			data[i] ^= stream[i];
+		data += n;
+		len -= n;
+	}
+	return HWME_SUCCESS;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Run CBC-MAC over data with the hardware AES engine
+ *******************************************************************************
+ * The data is padded with zeros to a whole number of blocks, as CCM* pads
+ * the authentication data and the message separately.
+ *******************************************************************************
+ * \param mac - Chaining value, all zeros to start a MAC. Receives the MAC
+ * \param data - Data to authenticate
+ * \param len - Length of data
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Status of the first HWME-HAES.confirm that failed, or HWME_SUCCESS
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_haes_cbc_mac(
+	uint8_t           *mac,
+	const uint8_t     *data,
+	size_t             len,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	size_t i, n;
+	uint8_t status;
+
+	while (len) {
+		n = len < CA821X_HAES_BLOCK ? len : CA821X_HAES_BLOCK;
+		for (i = 0; i < n; i++)
+			mac[i] ^= data[i];
+		status = HWME_HAES_request_sync(HAES_MODE_ENCRYPT, mac, pDeviceRef);
+		if (status != HWME_SUCCESS)
+			return status;
+		data += n;
+		len -= n;
+	}
+	return HWME_SUCCESS;
+}
@@ -0,0 +1,258 @@
+/**
+ * @file ca821x_link.c
+ * @brief Per-neighbour link quality tracking from dispatched indications.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_link.h"
+#include "ca821x_neighbour.h"
+
+#ifdef CA821X_HAVE_ATOMICS
+#define LINK_INIT(p)        atomic_init((p), 0)
+#define LINK_LOAD(p)        atomic_load_explicit((p), memory_order_relaxed)
+#define LINK_STORE(p, v)    atomic_store_explicit((p), (v), memory_order_relaxed)
+#define LINK_INC(p)         atomic_fetch_add_explicit((p), 1, memory_order_relaxed)
+#define LINK_TAKE(p)        atomic_exchange_explicit((p), 0, memory_order_relaxed)
+#else
+#define LINK_INIT(p)        (*(p) = 0)
+#define LINK_LOAD(p)        (*(p))
+#define LINK_STORE(p, v)    (*(p) = (v))
+#define LINK_INC(p)         ((*(p))++)
+#define LINK_TAKE(p)        link_take(p)
+
+static uint64_t link_take(ca821x_atomic64_t *p)
+{
+	uint64_t v = *p;
+
+	*p = 0;
+	return v;
+}
+#endif
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise link statistics with nothing recorded
+ *******************************************************************************
+ * \param links - Statistics to initialise
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_link_init(struct ca821x_links *links)
+{
+	unsigned i;
+
+	for (i = 0; i < CA821X_NEIGHBOUR_MAX; i++) {
+		LINK_INIT(&links->lqi[i]);
+		LINK_INIT(&links->rx[i]);
+		LINK_INIT(&links->tx[i]);
+		LINK_INIT(&links->tx_acked[i]);
+		LINK_INIT(&links->tx_cca[i]);
+		LINK_INIT(&links->last_seen_ns[i]);
+		LINK_INIT(&links->epoch[i]);
+	}
+	for (i = 0; i < 256; i++)
+		LINK_INIT(&links->handles[i]);
+}
+
+/** Start the statistics of a position afresh if it has a new neighbour */
+static void link_claim(struct ca821x_links *links, const struct ca821x_neighbours *nb,
+                       unsigned pos)
+{
+	if (LINK_LOAD(&links->epoch[pos]) == nb->epochs[pos])
+		return;
+	LINK_STORE(&links->lqi[pos], 0);
+	LINK_STORE(&links->rx[pos], 0);
+	LINK_STORE(&links->tx[pos], 0);
+	LINK_STORE(&links->tx_acked[pos], 0);
+	LINK_STORE(&links->tx_cca[pos], 0);
+	LINK_STORE(&links->last_seen_ns[pos], 0);
+	LINK_STORE(&links->epoch[pos], nb->epochs[pos]);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Record a frame received from a neighbour
+ *******************************************************************************
+ * Called by ca821x_downstream_dispatch for each indication carrying an LQI.
+ *******************************************************************************
+ * \param links - Link statistics
+ * \param nb - Neighbour table
+ * \param src - Source address of the frame
+ * \param lqi - LQI of the frame
+ * \param now_ns - Device clock
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_link_rx(
+	struct ca821x_links      *links,
+	struct ca821x_neighbours *nb,
+	const struct FullAddr    *src,
+	uint8_t                   lqi,
+	uint64_t                  now_ns
+)
+{
+	struct ca821x_neighbour *n = ca821x_neighbour_find(nb, src);
+	uint32_t sample = (uint32_t)lqi << CA821X_LINK_LQI_FRAC, avg;
+	unsigned pos;
+
+	if (!n)
+		return;
+	pos = (unsigned)(n - nb->entries);
+	link_claim(links, nb, pos);
+	avg = LINK_LOAD(&links->lqi[pos]);
+	if (!LINK_LOAD(&links->rx[pos]))
+		avg = sample;
+	else if (sample >= avg)
+		avg += (sample - avg) >> CA821X_LINK_LQI_SHIFT;
+	else
+		avg -= (avg - sample) >> CA821X_LINK_LQI_SHIFT;
+	LINK_STORE(&links->lqi[pos], avg);
+	LINK_INC(&links->rx[pos]);
+	LINK_STORE(&links->last_seen_ns[pos], now_ns);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Record the destination of an MSDU about to be sent
+ *******************************************************************************
+ * Called by MCPS_DATA_request before the request is exchanged, so that its
+ * confirm can be attributed whichever thread dispatches it.
+ *******************************************************************************
+ * \param links - Link statistics
+ * \param nb - Neighbour table
+ * \param dst - Destination of the MSDU
+ * \param handle - MsduHandle of the request
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_link_tx(
+	struct ca821x_links      *links,
+	struct ca821x_neighbours *nb,
+	const struct FullAddr    *dst,
+	uint8_t                   handle
+)
+{
+	struct ca821x_neighbour *n = ca821x_neighbour_find(nb, dst);
+	unsigned pos;
+
+	if (!n) {
+		LINK_STORE(&links->handles[handle], 0);
+		return;
+	}
+	pos = (unsigned)(n - nb->entries);
+	LINK_STORE(&links->handles[handle], ((uint64_t)nb->epochs[pos] << 8) | (pos + 1));
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Forget the destination of an MSDU that was not sent
+ *******************************************************************************
+ * Called by MCPS_DATA_request when the exchange recorded by ca821x_link_tx
+ * fails, so that no confirm is attributed to it.
+ *******************************************************************************
+ * \param links - Link statistics
+ * \param handle - MsduHandle of the request
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_link_tx_cancel(struct ca821x_links *links, uint8_t handle)
+{
+	LINK_STORE(&links->handles[handle], 0);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Record the outcome of an MSDU sent to a neighbour
+ *******************************************************************************
+ * Called by ca821x_downstream_dispatch for each MCPS-DATA.confirm. Confirms
+ * for handles not recorded by ca821x_link_tx are ignored.
+ *******************************************************************************
+ * \param links - Link statistics
+ * \param nb - Neighbour table
+ * \param handle - MsduHandle of the confirm
+ * \param status - Status of the confirm
+ * \param now_ns - Device clock
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_link_confirm(
+	struct ca821x_links      *links,
+	struct ca821x_neighbours *nb,
+	uint8_t                   handle,
+	uint8_t                   status,
+	uint64_t                  now_ns
+)
+{
+	uint64_t sent = LINK_TAKE(&links->handles[handle]);
+	unsigned pos = (sent & 0xFF) - 1;
+
+	/* Not recorded, or the neighbour has since been replaced */
+	if (!sent || pos >= CA821X_NEIGHBOUR_MAX || (sent >> 8) != nb->epochs[pos])
+		return;
+	link_claim(links, nb, pos);
+	LINK_INC(&links->tx[pos]);
+	if (status == MAC_SUCCESS) {
+		LINK_INC(&links->tx_acked[pos]);
+		LINK_STORE(&links->last_seen_ns[pos], now_ns);
+	} else if (status == MAC_CHANNEL_ACCESS_FAILURE) {
+		LINK_INC(&links->tx_cca[pos]);
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Copy the statistics of a neighbour
+ *******************************************************************************
+ * Each statistic is read atomically, but they are not read together: a frame
+ * dispatched meanwhile may be counted in some and not others.
+ *******************************************************************************
+ * \param links - Link statistics
+ * \param nb - Neighbour table
+ * \param n - Neighbour, from nb
+ * \param snapshot - Receives the statistics
+ *******************************************************************************
+ * \return 0: Success<br>
+ *         -1: n is not a known neighbour
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_link_snapshot(
+	struct ca821x_links            *links,
+	const struct ca821x_neighbours *nb,
+	const struct ca821x_neighbour  *n,
+	struct ca821x_link_snapshot    *snapshot
+)
+{
+	unsigned pos = (unsigned)(n - nb->entries);
+	uint32_t passed;
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	if (pos >= CA821X_NEIGHBOUR_MAX || !n->used)
+		return -1;
+	if (LINK_LOAD(&links->epoch[pos]) != nb->epochs[pos])
+		return 0;
+	snapshot->lqi = (uint8_t)((LINK_LOAD(&links->lqi[pos]) +
+	                          (1u << (CA821X_LINK_LQI_FRAC - 1))) >> CA821X_LINK_LQI_FRAC);
+	snapshot->rx = LINK_LOAD(&links->rx[pos]);
+	snapshot->tx = LINK_LOAD(&links->tx[pos]);
+	snapshot->tx_acked = LINK_LOAD(&links->tx_acked[pos]);
+	snapshot->tx_cca = LINK_LOAD(&links->tx_cca[pos]);
+	snapshot->last_seen_ns = LINK_LOAD(&links->last_seen_ns[pos]);
+	passed = snapshot->tx - snapshot->tx_cca;
+	if (passed)
+		snapshot->ack_permille = (uint16_t)((uint64_t)snapshot->tx_acked * 1000 / passed);
+	if (snapshot->tx)
+		snapshot->cca_permille = (uint16_t)((uint64_t)snapshot->tx_cca * 1000 / snapshot->tx);
+	return 0;
+}
@@ -0,0 +1,364 @@
+/**
+ * @file ca821x_neighbour.c
+ * @brief Hashed index of neighbours by extended and short address.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_neighbour.h"
+
+#define NB_SLOT_BITS        (7)
+#define NB_SLOT_MASK        (CA821X_NEIGHBOUR_SLOTS - 1)
+
+#if (1 << NB_SLOT_BITS) != CA821X_NEIGHBOUR_SLOTS || \
+    CA821X_NEIGHBOUR_SLOTS < 2 * CA821X_NEIGHBOUR_MAX
+#error "CA821X_NEIGHBOUR_SLOTS must be 1 << NB_SLOT_BITS and twice CA821X_NEIGHBOUR_MAX"
+#endif
+#if CA821X_NEIGHBOUR_MAX < DEVICE_TABLE_SIZE || CA821X_NEIGHBOUR_MAX > 255
+#error "CA821X_NEIGHBOUR_MAX is out of range"
+#endif
+
+/** Index by extended address or by PAN id and short address */
+enum nb_index {
+	NB_BY_EXT,
+	NB_BY_SHORT
+};
+
+static uint64_t ext_key(const uint8_t *ext_addr)
+{
+	uint64_t key;
+
+	memcpy(&key, ext_addr, 8);
+	return key;
+}
+
+static uint64_t short_key(const uint8_t *pan_id, const uint8_t *short_addr)
+{
+	return ((uint64_t)GETLE16(pan_id) << 16) | GETLE16(short_addr);
+}
+
+/** Key of a neighbour in an index */
+static uint64_t nb_key(const struct ca821x_neighbour *n, enum nb_index index)
+{
+	return index == NB_BY_EXT ? ext_key(n->ext_addr) :
+	                            short_key(n->pan_id, n->short_addr);
+}
+
+/** Home slot of a key: the top bits of a Fibonacci hash */
+static unsigned nb_hash(uint64_t key)
+{
+	return (unsigned)((key * 0x9E3779B97F4A7C15ULL) >> (64 - NB_SLOT_BITS));
+}
+
+static uint8_t *nb_slots(struct ca821x_neighbours *nb, enum nb_index index)
+{
+	return index == NB_BY_EXT ? nb->by_ext : nb->by_short;
+}
+
+/**
+ * Probe an index for a key, returning 1 and its slot in pos if found, or 0
+ * and the empty slot ending the probe. An index is never more than half full,
+ * so an empty slot is always reached.
+ */
+static int nb_probe(
+	struct ca821x_neighbours *nb,
+	enum nb_index             index,
+	uint64_t                  key,
+	unsigned                 *pos
+)
+{
+	const uint8_t *slots = nb_slots(nb, index);
+	unsigned i = nb_hash(key);
+
+	while (slots[i]) {
+		if (nb_key(&nb->entries[slots[i] - 1], index) == key) {
+			*pos = i;
+			return 1;
+		}
+		i = (i + 1) & NB_SLOT_MASK;
+	}
+	*pos = i;
+	return 0;
+}
+
+static void nb_insert(struct ca821x_neighbours *nb, enum nb_index index,
+                      struct ca821x_neighbour *n)
+{
+	unsigned pos;
+
+	nb_probe(nb, index, nb_key(n, index), &pos);
+	nb_slots(nb, index)[pos] = (uint8_t)(n - nb->entries + 1);
+}
+
+/**
+ * Remove a neighbour from an index. Later entries of its probe run are
+ * shifted back over the gap, so no tombstones are needed and lookups of
+ * absent keys stay short.
+ */
+static void nb_remove(struct ca821x_neighbours *nb, enum nb_index index,
+                      const struct ca821x_neighbour *n)
+{
+	uint8_t *slots = nb_slots(nb, index);
+	unsigned i, j, home;
+
+	if (!nb_probe(nb, index, nb_key(n, index), &i))
+		return;
+	for (j = (i + 1) & NB_SLOT_MASK; slots[j]; j = (j + 1) & NB_SLOT_MASK) {
+		home = nb_hash(nb_key(&nb->entries[slots[j] - 1], index));
+		/* Move it if its home is not cyclically within (i, j] */
+		if (((j - home) & NB_SLOT_MASK) >= ((j - i) & NB_SLOT_MASK)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i] = 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise an empty neighbour table
+ *******************************************************************************
+ * \param nb - Table to initialise
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_neighbour_init(struct ca821x_neighbours *nb)
+{
+	memset(nb, 0, sizeof(*nb));
+	nb->pan_id[0] = 0xFF;
+	nb->pan_id[1] = 0xFF;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Find the neighbour with an address
+ *******************************************************************************
+ * \param nb - Table
+ * \param addr - Extended address, or short address and PAN id, as received
+ *******************************************************************************
+ * \return The neighbour, or NULL if it is not known or addr has no address
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_neighbour *ca821x_neighbour_find(
+	struct ca821x_neighbours *nb,
+	const struct FullAddr    *addr
+)
+{
+	unsigned pos;
+
+	if (addr->AddressMode == MAC_MODE_LONG_ADDR) {
+		if (nb_probe(nb, NB_BY_EXT, ext_key(addr->Address), &pos))
+			return &nb->entries[nb->by_ext[pos] - 1];
+	} else if (addr->AddressMode == MAC_MODE_SHORT_ADDR) {
+		if (nb_probe(nb, NB_BY_SHORT, short_key(addr->PANId, addr->Address), &pos))
+			return &nb->entries[nb->by_short[pos] - 1];
+	}
+	return NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Forget a neighbour
+ *******************************************************************************
+ * Its device table entry, if any, is no longer mapped to a neighbour.
+ *******************************************************************************
+ * \param nb - Table
+ * \param n - Neighbour to forget
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_neighbour_forget(struct ca821x_neighbours *nb, struct ca821x_neighbour *n)
+{
+	if (!n->used)
+		return;
+	if (n->has_ext)
+		nb_remove(nb, NB_BY_EXT, n);
+	if (n->has_short)
+		nb_remove(nb, NB_BY_SHORT, n);
+	if (n->device_index != CA821X_NEIGHBOUR_NO_DEVICE)
+		nb->by_device[n->device_index] = 0;
+	memset(n, 0, sizeof(*n));
+	nb->count--;
+}
+
+/** Take a short address from the neighbour holding it, which was reassigned */
+static void nb_drop_short(struct ca821x_neighbours *nb, struct ca821x_neighbour *n)
+{
+	nb_remove(nb, NB_BY_SHORT, n);
+	n->has_short = 0;
+	if (!n->has_ext && n->device_index == CA821X_NEIGHBOUR_NO_DEVICE)
+		ca821x_neighbour_forget(nb, n);
+}
+
+/** ca821x_neighbour_learn, without marking the neighbour as learned */
+static struct ca821x_neighbour *nb_learn(
+	struct ca821x_neighbours *nb,
+	const uint8_t            *ext_addr,
+	const uint8_t            *pan_id,
+	const uint8_t            *short_addr
+)
+{
+	struct ca821x_neighbour *n = NULL, *holder = NULL;
+	uint64_t key = 0;
+	unsigned pos, i;
+
+	if (short_addr && GETLE16(short_addr) >= 0xFFFE)
+		short_addr = NULL;
+	/* Nothing would find the neighbour */
+	if (!ext_addr && !short_addr)
+		return NULL;
+	if (ext_addr && nb_probe(nb, NB_BY_EXT, ext_key(ext_addr), &pos))
+		n = &nb->entries[nb->by_ext[pos] - 1];
+	if (short_addr) {
+		key = short_key(pan_id, short_addr);
+		if (nb_probe(nb, NB_BY_SHORT, key, &pos))
+			holder = &nb->entries[nb->by_short[pos] - 1];
+		/* Give an extended address to a neighbour known by short address */
+		if (!n && holder && (!ext_addr || !holder->has_ext))
+			n = holder;
+	}
+
+	if (!n) {
+		for (i = 0; i < CA821X_NEIGHBOUR_MAX && nb->entries[i].used; i++)
+			;
+		if (i == CA821X_NEIGHBOUR_MAX)
+			return NULL;
+		n = &nb->entries[i];
+		n->used = 1;
+		n->device_index = CA821X_NEIGHBOUR_NO_DEVICE;
+		nb->epochs[i]++;
+		nb->count++;
+	}
+	if (ext_addr && !n->has_ext) {
+		memcpy(n->ext_addr, ext_addr, 8);
+		n->has_ext = 1;
+		nb_insert(nb, NB_BY_EXT, n);
+	}
+	if (short_addr && (!n->has_short || nb_key(n, NB_BY_SHORT) != key)) {
+		if (holder && holder != n)
+			nb_drop_short(nb, holder);
+		if (n->has_short)
+			nb_remove(nb, NB_BY_SHORT, n);
+		memcpy(n->pan_id, pan_id, 2);
+		memcpy(n->short_addr, short_addr, 2);
+		n->has_short = 1;
+		nb_insert(nb, NB_BY_SHORT, n);
+	}
+	return n;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Learn the addresses of a neighbour
+ *******************************************************************************
+ * Adds the neighbour, or the address it did not have to a known one. A short
+ * address held by another neighbour is taken from it.
+ *******************************************************************************
+ * \param nb - Table
+ * \param ext_addr - Extended address, or NULL if not known
+ * \param pan_id - PAN id of short_addr
+ * \param short_addr - Short address, or NULL if not known. 0xFFFE and 0xFFFF
+ *                     are not addresses and are ignored
+ *******************************************************************************
+ * \return The neighbour, or NULL if the table is full or neither address is
+ *         given
+ *******************************************************************************
+ ******************************************************************************/
+struct ca821x_neighbour *ca821x_neighbour_learn(
+	struct ca821x_neighbours *nb,
+	const uint8_t            *ext_addr,
+	const uint8_t            *pan_id,
+	const uint8_t            *short_addr
+)
+{
+	struct ca821x_neighbour *n = nb_learn(nb, ext_addr, pan_id, short_addr);
+
+	if (n)
+		n->learned = 1;
+	return n;
+}
+
+/** Unmap a device table entry, forgetting a neighbour known only from it */
+static void nb_detach(struct ca821x_neighbours *nb, uint8_t index)
+{
+	struct ca821x_neighbour *n;
+
+	if (!nb->by_device[index])
+		return;
+	n = &nb->entries[nb->by_device[index] - 1];
+	nb->by_device[index] = 0;
+	n->device_index = CA821X_NEIGHBOUR_NO_DEVICE;
+	if (!n->learned)
+		ca821x_neighbour_forget(nb, n);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Record a macDeviceTable entry
+ *******************************************************************************
+ * Called by MLME_SET_request_sync for each entry written to a device with a
+ * table attached. The neighbour previously at index is unmapped.
+ *******************************************************************************
+ * \param nb - Table
+ * \param index - Index of the entry
+ * \param desc - Entry written
+ *******************************************************************************
+ * \return 0: Success<br>
+ *         -1: index is out of range, or the table is full
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_neighbour_set_device(
+	struct ca821x_neighbours        *nb,
+	uint8_t                          index,
+	const struct M_DeviceDescriptor *desc
+)
+{
+	struct ca821x_neighbour *n;
+
+	if (index >= DEVICE_TABLE_SIZE)
+		return -1;
+	n = nb->by_device[index] ? &nb->entries[nb->by_device[index] - 1] : NULL;
+	if (n && memcmp(n->ext_addr, desc->ExtAddress, 8))
+		nb_detach(nb, index);
+
+	n = nb_learn(nb, desc->ExtAddress, desc->PANId, desc->ShortAddress);
+	if (!n)
+		return -1;
+	if (n->device_index != CA821X_NEIGHBOUR_NO_DEVICE && n->device_index != index)
+		nb->by_device[n->device_index] = 0;
+	n->device_index = index;
+	nb->by_device[index] = (uint8_t)(n - nb->entries + 1);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Record a change of macDeviceTableEntries
+ *******************************************************************************
+ * Entries from the new count on are unmapped.
+ *******************************************************************************
+ * \param nb - Table
+ * \param entries - Entries in macDeviceTable
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_neighbour_set_device_entries(struct ca821x_neighbours *nb, uint8_t entries)
+{
+	unsigned i;
+
+	for (i = entries; i < DEVICE_TABLE_SIZE; i++)
+		nb_detach(nb, (uint8_t)i);
+}
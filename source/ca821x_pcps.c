@@ -0,0 +1,235 @@
+/**
+ * @file ca821x_pcps.c
+ * @brief Windowed transmission of raw PSDUs through PCPS-DATA.request.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_pcps.h"
+
+#if CASCODA_CA_VER >= 8211
+
+#ifdef CA821X_HAVE_ATOMICS
+#define PCPS_INIT(p, v)     atomic_init((p), (v))
+#define PCPS_INC(p)         atomic_fetch_add_explicit((p), 1, memory_order_relaxed)
+#define PCPS_LOAD(p)        atomic_load_explicit((p), memory_order_acquire)
+#define PCPS_PUBLISH(p, v)  atomic_store_explicit((p), (v), memory_order_release)
+#else
+#define PCPS_INIT(p, v)     (*(p) = (v))
+#define PCPS_INC(p)         ((*(p))++)
+#define PCPS_LOAD(p)        (*(p))
+#define PCPS_PUBLISH(p, v)  (*(p) = (v))
+#endif
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a PSDU transmitter
+ *******************************************************************************
+ * \param tx - Transmitter to initialise
+ * \param window - PSDUs allowed in flight, 1 to CA821X_PCPS_MAX_WINDOW
+ * \param on_confirm - Called with each matched confirm, or NULL
+ *******************************************************************************
+ * \return 0: Success<br>
+ *         -1: window is out of range
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_pcps_tx_init(
+	struct ca821x_pcps_tx  *tx,
+	uint8_t                 window,
+	ca821x_pcps_confirm_fn  on_confirm
+)
+{
+	unsigned i;
+
+	if (!window || window > CA821X_PCPS_MAX_WINDOW)
+		return -1;
+	memset(tx, 0, sizeof(*tx));
+	tx->window = window;
+	tx->on_confirm = on_confirm;
+	for (i = 0; i < CA821X_PCPS_MAX_WINDOW; i++)
+		PCPS_INIT(&tx->slots[i].state, 0);
+	PCPS_INIT(&tx->submitted, 0);
+	PCPS_INIT(&tx->confirmed, 0);
+	PCPS_INIT(&tx->failed, 0);
+	PCPS_INIT(&tx->unmatched, 0);
+	return 0;
+}
+
+/** Find the slot in flight with a handle, or the first free one for -1 */
+static struct ca821x_pcps_slot *pcps_find(struct ca821x_pcps_tx *tx, int handle)
+{
+	uint32_t want = handle < 0 ? 0 : CA821X_PCPS_BUSY | (uint32_t)handle;
+	unsigned i;
+
+	for (i = 0; i < tx->window; i++) {
+		if (PCPS_LOAD(&tx->slots[i].state) == want)
+			return &tx->slots[i];
+	}
+	return NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Submit a PSDU for transmission
+ *******************************************************************************
+ * The PSDU is sent with PCPS_DATA_request under a handle not held by any
+ * other PSDU in flight.
+ *******************************************************************************
+ * \param psdu - PSDU to send
+ * \param len - Length of the PSDU
+ * \param txopts - TxOpts of the request
+ * \param context - Passed to on_confirm with the PSDU's confirm
+ * \param pDeviceRef - Device with a transmitter attached
+ *******************************************************************************
+ * \return PsduHandle of the PSDU, or -1 if the device has no transmitter,
+ *         the window is full, the PSDU is too long or the exchange failed
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_pcps_tx_submit(
+	const uint8_t     *psdu,
+	uint8_t            len,
+	uint8_t            txopts,
+	void              *context,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct ca821x_pcps_tx *tx = pDeviceRef->pcps_tx;
+	struct ca821x_pcps_slot *slot;
+	uint8_t handle;
+
+	if (!tx || len > aMaxPHYPacketSize || !(slot = pcps_find(tx, -1)))
+		return -1;
+
+	/* At most window - 1 other handles are taken, so this terminates */
+	handle = tx->next_handle;
+	while (pcps_find(tx, handle))
+		handle++;
+	tx->next_handle = handle + 1;
+
+	/* Publish the slot first: the confirm may be dispatched on another
+	 * thread before PCPS_DATA_request returns */
+	slot->context = context;
+	slot->submit_ns = tx->latency ? ca821x_get_time_ns(pDeviceRef) : 0;
+	PCPS_PUBLISH(&slot->state, CA821X_PCPS_BUSY | handle);
+
+	if (PCPS_DATA_request(handle, txopts, len, (uint8_t *)psdu, pDeviceRef) !=
+	    MAC_SUCCESS) {
+		PCPS_PUBLISH(&slot->state, 0);
+		return -1;
+	}
+	PCPS_INC(&tx->submitted);
+	return handle;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Submit several PSDUs for transmission
+ *******************************************************************************
+ * Submits PSDUs in order until one cannot be, typically because the window
+ * is full. The rest can be submitted once confirms have freed the window.
+ * Each PSDU is still a separate PCPS_DATA_request exchange: this saves the
+ * caller a loop, not round trips.
+ *******************************************************************************
+ * \param psdus - PSDUs to send
+ * \param count - Number of PSDUs
+ * \param pDeviceRef - Device with a transmitter attached
+ *******************************************************************************
+ * \return Number of PSDUs submitted
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_pcps_tx_submit_batch(
+	const struct ca821x_pcps_psdu *psdus,
+	size_t                         count,
+	struct ca821x_dev             *pDeviceRef
+)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (ca821x_pcps_tx_submit(psdus[i].psdu, psdus[i].len, psdus[i].txopts,
+		                          psdus[i].context, pDeviceRef) < 0)
+			break;
+	}
+	return i;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Match a PCPS-DATA.confirm to the PSDU it completes
+ *******************************************************************************
+ * Called by ca821x_downstream_dispatch when the device has a transmitter
+ * attached.
+ *******************************************************************************
+ * \param tx - Transmitter
+ * \param params - Confirm parameter set
+ * \param pDeviceRef - Device the confirm was received from
+ *******************************************************************************
+ * \return 0: The confirm completed a PSDU in flight<br>
+ *         -1: No PSDU in flight holds the handle
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_pcps_tx_confirm(
+	struct ca821x_pcps_tx               *tx,
+	const struct PCPS_DATA_confirm_pset *params,
+	struct ca821x_dev                   *pDeviceRef
+)
+{
+	struct ca821x_pcps_slot *slot = pcps_find(tx, params->PsduHandle);
+	void *context;
+
+	if (!slot) {
+		PCPS_INC(&tx->unmatched);
+		return -1;
+	}
+	context = slot->context;
+	if (tx->latency)
+		ca821x_sync_stats_record(tx->latency, SPI_PCPS_DATA_REQUEST,
+		                         ca821x_get_time_ns(pDeviceRef) - slot->submit_ns,
+		                         SYNC_RESULT_OK);
+	PCPS_INC(params->Status == MAC_SUCCESS ? &tx->confirmed : &tx->failed);
+	/* The handle may be reused from here on */
+	PCPS_PUBLISH(&slot->state, 0);
+
+	if (tx->on_confirm)
+		tx->on_confirm(tx, params, context, pDeviceRef);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Number of PSDUs submitted and not yet confirmed
+ *******************************************************************************
+ * \param tx - Transmitter
+ *******************************************************************************
+ * \return PSDUs in flight
+ *******************************************************************************
+ ******************************************************************************/
+unsigned ca821x_pcps_tx_in_flight(struct ca821x_pcps_tx *tx)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < tx->window; i++) {
+		if (PCPS_LOAD(&tx->slots[i].state))
+			count++;
+	}
+	return count;
+}
+
+#endif // CASCODA_CA_VER >= 8211
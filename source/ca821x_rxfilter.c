@@ -0,0 +1,366 @@
+/**
+ * @file ca821x_rxfilter.c
+ * @brief Host-side receive filter compiled to bytecode, for promiscuous mode.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_frame.h"
+#include "ca821x_rxfilter.h"
+
+#ifdef CA821X_HAVE_ATOMICS
+#define RXF_INIT(p)         atomic_init((p), 0)
+#define RXF_INC(p)          atomic_fetch_add_explicit((p), 1, memory_order_relaxed)
+#else
+#define RXF_INIT(p)         (*(p) = 0)
+#define RXF_INC(p)          ((*(p))++)
+#endif
+
+/** Instructions of a filter program */
+enum rxf_op {
+	RXF_OP_RETURN, //!< Return arg
+	RXF_OP_LEN,    //!< lo <= length <= hi
+	RXF_OP_LQI,    //!< Link quality >= lo
+	RXF_OP_TYPE,   //!< Frame type bit in lo
+	RXF_OP_PAN,    //!< Destination PAN id is lo, hi (little-endian)
+	RXF_OP_SRC_IN, //!< Source address in set arg
+	RXF_OP_DST_IN  //!< Destination address in set arg
+};
+
+/** Bits of a Bloom filter */
+#define RXF_BLOOM_BITS      (CA821X_RXF_BLOOM_WORDS * 64)
+
+/** Fields of an indication the program tests */
+struct rxf_view {
+	uint8_t        type_bit;  /**< 1 << frame type, 0 if malformed */
+	uint8_t        len;
+	uint8_t        lqi;
+	uint8_t        src_mode;
+	uint8_t        dst_mode;
+	const uint8_t *src_pan;
+	const uint8_t *src_addr;
+	const uint8_t *dst_pan;   /**< NULL if absent */
+	const uint8_t *dst_addr;
+};
+
+/** Key of an address in a set: PAN id and short address, or extended address */
+static uint64_t rxf_key(uint8_t mode, const uint8_t *pan, const uint8_t *addr)
+{
+	if (mode == MAC_MODE_SHORT_ADDR)
+		return ((uint32_t)GETLE16(pan) << 16) | GETLE16(addr);
+	return ((uint64_t)GETLE32(addr + 4) << 32) | GETLE32(addr);
+}
+
+/** Bloom filter bits of a key, from the top of its Fibonacci hash */
+static uint64_t rxf_hash(uint64_t key, uint8_t mode)
+{
+	return (key ^ mode) * 0x9E3779B97F4A7C15ULL;
+}
+
+#define BLOOM_BIT1(h)       ((unsigned)((h) >> 55))
+#define BLOOM_BIT2(h)       ((unsigned)((h) >> 46) & (RXF_BLOOM_BITS - 1))
+#define BLOOM_TEST(b, i)    (((b)[(i) >> 6] >> ((i) & 63)) & 1)
+
+/** Binary search a sorted array of keys */
+#define RXF_SEARCH(keys, n, key, found) do { \
+	unsigned lo_ = 0, hi_ = (n); \
+	(found) = 0; \
+	while (lo_ < hi_) { \
+		unsigned mid_ = (lo_ + hi_) / 2; \
+		if ((keys)[mid_] == (key)) { (found) = 1; break; } \
+		if ((keys)[mid_] < (key)) lo_ = mid_ + 1; else hi_ = mid_; \
+	} \
+} while (0)
+
+/** Whether an address is in a set */
+static int rxf_in_set(
+	const struct ca821x_rxf_set *set,
+	uint8_t                      mode,
+	const uint8_t               *pan,
+	const uint8_t               *addr
+)
+{
+	uint64_t key, h;
+	int found;
+
+	if (mode != MAC_MODE_SHORT_ADDR && mode != MAC_MODE_LONG_ADDR)
+		return 0;
+	key = rxf_key(mode, pan, addr);
+	h = rxf_hash(key, mode);
+	if (!BLOOM_TEST(set->bloom, BLOOM_BIT1(h)) || !BLOOM_TEST(set->bloom, BLOOM_BIT2(h)))
+		return 0;
+	if (mode == MAC_MODE_SHORT_ADDR)
+		RXF_SEARCH(set->shorts, set->num_short, (uint32_t)key, found);
+	else
+		RXF_SEARCH(set->exts, set->num_ext, key, found);
+	return found;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a receive filter with no rules or addresses
+ *******************************************************************************
+ * \param filter - Filter to initialise
+ * \param default_action - enum ca821x_rxf_action for frames no rule matches
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_rxfilter_init(struct ca821x_rxfilter *filter, uint8_t default_action)
+{
+	memset(filter, 0, sizeof(*filter));
+	filter->program[0].op = RXF_OP_RETURN;
+	filter->program[0].arg = default_action;
+	filter->num_insns = 1;
+	RXF_INIT(&filter->accepted);
+	RXF_INIT(&filter->dropped);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Add an address to an address set of a filter
+ *******************************************************************************
+ * \param filter - Filter
+ * \param set - Index of the set, below CA821X_RXF_SETS
+ * \param addr - Address, with its PAN id if short
+ *******************************************************************************
+ * \return 0: Success, or the address was already in the set<br>
+ *         -1: Invalid set or address mode, or the set is full
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_rxfilter_add_addr(
+	struct ca821x_rxfilter *filter,
+	uint8_t                 set,
+	const struct FullAddr  *addr
+)
+{
+	struct ca821x_rxf_set *s;
+	uint64_t key, h;
+	unsigned i;
+
+	if (set >= CA821X_RXF_SETS)
+		return -1;
+	s = &filter->sets[set];
+	if (rxf_in_set(s, addr->AddressMode, addr->PANId, addr->Address))
+		return 0;
+	key = rxf_key(addr->AddressMode, addr->PANId, addr->Address);
+	if (addr->AddressMode == MAC_MODE_SHORT_ADDR) {
+		if (s->num_short == CA821X_RXF_SET_MAX)
+			return -1;
+		for (i = s->num_short++; i && s->shorts[i - 1] > key; i--)
+			s->shorts[i] = s->shorts[i - 1];
+		s->shorts[i] = (uint32_t)key;
+	} else if (addr->AddressMode == MAC_MODE_LONG_ADDR) {
+		if (s->num_ext == CA821X_RXF_SET_MAX)
+			return -1;
+		for (i = s->num_ext++; i && s->exts[i - 1] > key; i--)
+			s->exts[i] = s->exts[i - 1];
+		s->exts[i] = key;
+	} else {
+		return -1;
+	}
+	h = rxf_hash(key, addr->AddressMode);
+	s->bloom[BLOOM_BIT1(h) >> 6] |= 1ULL << (BLOOM_BIT1(h) & 63);
+	s->bloom[BLOOM_BIT2(h) >> 6] |= 1ULL << (BLOOM_BIT2(h) & 63);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Append a rule to a filter
+ *******************************************************************************
+ * The rule is tried after the rules already added, and before the default
+ * action.
+ *******************************************************************************
+ * \param filter - Filter
+ * \param rule - Rule to compile
+ *******************************************************************************
+ * \return 0: Success<br>
+ *         -1: Invalid set or range, or the program is full
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_rxfilter_add_rule(
+	struct ca821x_rxfilter            *filter,
+	const struct ca821x_rxfilter_rule *rule
+)
+{
+	struct ca821x_rxf_insn code[7], *insn = code;
+	unsigned n, i, start = filter->num_insns - 1;
+
+	if (((rule->match & CA821X_RXF_SRC_IN) && rule->src_set >= CA821X_RXF_SETS) ||
+	    ((rule->match & CA821X_RXF_DST_IN) && rule->dst_set >= CA821X_RXF_SETS) ||
+	    ((rule->match & CA821X_RXF_LEN) && rule->len_min > rule->len_max))
+		return -1;
+
+	/* Cheapest tests first, so most frames are decided early */
+	memset(code, 0, sizeof(code));
+	if (rule->match & CA821X_RXF_LEN) {
+		insn->op = RXF_OP_LEN;
+		insn->lo = rule->len_min;
+		(insn++)->hi = rule->len_max;
+	}
+	if (rule->match & CA821X_RXF_LQI) {
+		insn->op = RXF_OP_LQI;
+		(insn++)->lo = rule->lqi_min;
+	}
+	if (rule->match & CA821X_RXF_TYPE) {
+		insn->op = RXF_OP_TYPE;
+		(insn++)->lo = rule->types;
+	}
+	if (rule->match & CA821X_RXF_PAN) {
+		insn->op = RXF_OP_PAN;
+		insn->lo = rule->pan_id[0];
+		(insn++)->hi = rule->pan_id[1];
+	}
+	if (rule->match & CA821X_RXF_SRC_IN) {
+		insn->op = RXF_OP_SRC_IN;
+		(insn++)->arg = rule->src_set;
+	}
+	if (rule->match & CA821X_RXF_DST_IN) {
+		insn->op = RXF_OP_DST_IN;
+		(insn++)->arg = rule->dst_set;
+	}
+	insn->op = RXF_OP_RETURN;
+	(insn++)->arg = rule->action;
+
+	n = (unsigned)(insn - code);
+	if (start + n + 1 > CA821X_RXF_MAX_INSNS)
+		return -1;
+	/* A failed test moves on to the next rule, or to the default action */
+	for (i = 0; i < n; i++)
+		code[i].fail = (uint8_t)(start + n);
+	filter->program[start + n] = filter->program[start];
+	memcpy(&filter->program[start], code, n * sizeof(code[0]));
+	filter->num_insns = (uint8_t)(start + n + 1);
+	return 0;
+}
+
+/** Fill a view of an indication, returning -1 if it is truncated */
+static int rxf_view(struct rxf_view *v, const uint8_t *buf, size_t len)
+{
+	const struct MCPS_DATA_indication_pset *ind;
+#if CASCODA_CA_VER >= 8211
+	const struct PCPS_DATA_indication_pset *pind;
+	struct ca821x_frame frame;
+	size_t psdu_len;
+#endif
+
+	switch (buf[0]) {
+	case SPI_MCPS_DATA_INDICATION:
+		if (len < 2 + offsetof(struct MCPS_DATA_indication_pset, DSN))
+			return -1;
+		ind = (const struct MCPS_DATA_indication_pset *)(buf + 2);
+		v->type_bit = 1 << MAC_FC_FT_DATA;
+		v->len = ind->MsduLength;
+		v->lqi = ind->MpduLinkQuality;
+		v->src_mode = ind->Src.AddressMode;
+		v->src_pan = ind->Src.PANId;
+		v->src_addr = ind->Src.Address;
+		v->dst_mode = ind->Dst.AddressMode;
+		v->dst_pan = ind->Dst.AddressMode ? ind->Dst.PANId : NULL;
+		v->dst_addr = ind->Dst.Address;
+		return 0;
+#if CASCODA_CA_VER >= 8211
+	case SPI_PCPS_DATA_INDICATION:
+		if (len < 2 + offsetof(struct PCPS_DATA_indication_pset, Psdu))
+			return -1;
+		pind = (const struct PCPS_DATA_indication_pset *)(buf + 2);
+		psdu_len = len - 2 - offsetof(struct PCPS_DATA_indication_pset, Psdu);
+		if (pind->PsduLength < psdu_len)
+			psdu_len = pind->PsduLength;
+		v->len = pind->PsduLength;
+		v->lqi = pind->ED;
+		v->src_mode = v->dst_mode = MAC_MODE_NO_ADDR;
+		v->src_pan = v->src_addr = v->dst_pan = v->dst_addr = NULL;
+		v->type_bit = 0;
+		if (ca821x_frame_decode(&frame, pind->Psdu, psdu_len, 1))
+			return 0;
+		v->type_bit = 1 << frame.type;
+		if (frame.src_addr) {
+			v->src_mode = frame.src_mode;
+			v->src_pan = frame.src_pan;
+			v->src_addr = frame.src_addr;
+		}
+		if (frame.dst_addr) {
+			v->dst_mode = frame.dst_mode;
+			v->dst_pan = frame.dst_pan;
+			v->dst_addr = frame.dst_addr;
+		}
+		return 0;
+#endif
+	}
+	return -1;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Run a filter over a frame
+ *******************************************************************************
+ * Called by ca821x_downstream_dispatch when the device has a filter
+ * attached. Commands other than data indications, and indications too short
+ * to hold the fields tested, are accepted without counting them.
+ *******************************************************************************
+ * \param filter - Filter
+ * \param buf - Frame, starting with its command id
+ * \param len - Length of the frame
+ *******************************************************************************
+ * \return 1: The frame should be dispatched<br>
+ *         0: The frame should be dropped
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_rxfilter_check(
+	struct ca821x_rxfilter *filter,
+	const uint8_t          *buf,
+	size_t                  len
+)
+{
+	const struct ca821x_rxf_insn *insn = filter->program;
+	struct rxf_view v;
+	int pass;
+
+	if (rxf_view(&v, buf, len))
+		return 1;
+	for (;;) {
+		switch (insn->op) {
+		case RXF_OP_LEN:
+			pass = v.len >= insn->lo && v.len <= insn->hi;
+			break;
+		case RXF_OP_LQI:
+			pass = v.lqi >= insn->lo;
+			break;
+		case RXF_OP_TYPE:
+			pass = v.type_bit & insn->lo;
+			break;
+		case RXF_OP_PAN:
+			pass = v.dst_pan && v.dst_pan[0] == insn->lo && v.dst_pan[1] == insn->hi;
+			break;
+		case RXF_OP_SRC_IN:
+			pass = rxf_in_set(&filter->sets[insn->arg], v.src_mode, v.src_pan,
+			                  v.src_addr);
+			break;
+		case RXF_OP_DST_IN:
+			pass = rxf_in_set(&filter->sets[insn->arg], v.dst_mode, v.dst_pan,
+			                  v.dst_addr);
+			break;
+		default:
+			RXF_INC(insn->arg ? &filter->accepted : &filter->dropped);
+			return insn->arg ? 1 : 0;
+		}
+		insn = pass ? insn + 1 : &filter->program[insn->fail];
+	}
+}
@@ -0,0 +1,176 @@
+/**
+ * @file ca821x_scan.c
+ * @brief Iteration over the result list of an MLME-SCAN confirm.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_scan.h"
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Start iterating over the results of a scan confirm
+ *******************************************************************************
+ * \param it - Iterator to initialise
+ * \param scan_cnf - Scan confirm parameter set, followed by its results
+ * \param len - Length of the parameter set (the Length field of the message,
+ *              or CA821X_SCAN_CNF_LEN in a callback)
+ *******************************************************************************
+ * \return 0: Iterator ready
+ *         -1: len is too short for a scan confirm
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_scan_iter_init(
+	struct ca821x_scan_iter             *it,
+	const struct MLME_SCAN_confirm_pset *scan_cnf,
+	size_t                               len
+)
+{
+	if (len < MLME_SCAN_CONFIRM_BASE_SIZE)
+		return -1;
+	it->next = (const uint8_t *)scan_cnf + MLME_SCAN_CONFIRM_BASE_SIZE;
+	it->end = (const uint8_t *)scan_cnf + len;
+	it->remaining = scan_cnf->ResultListSize;
+	it->scan_type = scan_cnf->ScanType;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Size of a PAN descriptor in a result list or beacon notify
+ *******************************************************************************
+ * \param pdesc - PAN descriptor
+ *******************************************************************************
+ * \return Size in bytes, which depends on whether the beacon was secured
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_pan_descriptor_len(const struct PanDescriptor *pdesc)
+{
+	if (pdesc->Security.SecurityLevel)
+		return sizeof(struct PanDescriptor);
+	return PAN_DESCRIPTOR_BASE_SIZE;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Next PAN descriptor of an active or passive scan confirm
+ *******************************************************************************
+ * The security fields after Security.SecurityLevel are only present if
+ * SecurityLevel is nonzero. NULL with it->remaining nonzero means the message
+ * ended before the last descriptor.
+ *******************************************************************************
+ * \param it - Iterator
+ *******************************************************************************
+ * \return The descriptor in place, or NULL at the end of the list
+ *******************************************************************************
+ ******************************************************************************/
+const struct PanDescriptor *ca821x_scan_next_pan(struct ca821x_scan_iter *it)
+{
+	const struct PanDescriptor *pdesc = (const struct PanDescriptor *)it->next;
+	size_t avail = (size_t)(it->end - it->next);
+
+	if (it->scan_type != ACTIVE_SCAN && it->scan_type != PASSIVE_SCAN)
+		return NULL;
+	if (!it->remaining || avail < PAN_DESCRIPTOR_BASE_SIZE ||
+	    avail < ca821x_pan_descriptor_len(pdesc))
+		return NULL;
+	it->next += ca821x_pan_descriptor_len(pdesc);
+	it->remaining--;
+	return pdesc;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Next result of an energy detect scan confirm
+ *******************************************************************************
+ * Results are in ascending order of the channels scanned, see
+ * ca821x_chansel_process_scan.
+ *******************************************************************************
+ * \param it - Iterator
+ *******************************************************************************
+ * \return Energy detected (0-255), or -1 at the end of the list
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_scan_next_ed(struct ca821x_scan_iter *it)
+{
+	if (it->scan_type != ENERGY_DETECT || !it->remaining || it->next >= it->end)
+		return -1;
+	it->remaining--;
+	return *it->next++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Remove the PAN descriptors of weak beacons from a scan confirm
+ *******************************************************************************
+ * The list is compacted in place in a single pass: each run of kept
+ * descriptors is moved once, so the work is linear in the list length and
+ * nothing moves if every descriptor is kept. Results after a truncated
+ * descriptor are kept unchanged. Other scan types are left untouched.
+ *******************************************************************************
+ * \param scan_cnf - Scan confirm parameter set, followed by its results
+ * \param len - Length of the parameter set
+ * \param lqi_limit - Descriptors with a LinkQuality at or below this are
+ *                    removed, 0 keeps every descriptor
+ *******************************************************************************
+ * \return New length of the parameter set. ResultListSize is updated to match
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_scan_filter_lqi(
+	struct MLME_SCAN_confirm_pset *scan_cnf,
+	size_t                         len,
+	uint8_t                        lqi_limit
+)
+{
+	struct ca821x_scan_iter it;
+	const struct PanDescriptor *pdesc;
+	uint8_t *out, *run = NULL;
+	uint8_t kept = 0;
+	size_t size;
+
+	if (!lqi_limit || ca821x_scan_iter_init(&it, scan_cnf, len))
+		return len;
+	out = (uint8_t *)it.next;
+	while ((pdesc = ca821x_scan_next_pan(&it))) {
+		if (pdesc->LinkQuality > lqi_limit) {
+			if (!run)
+				run = (uint8_t *)pdesc;
+			kept++;
+			continue;
+		}
+		if (run) {
+			size = (size_t)((uint8_t *)pdesc - run);
+			if (out != run)
+				memmove(out, run, size);
+			out += size;
+			run = NULL;
+		}
+	}
+
+	/* The last run is followed directly by anything left unparsed */
+	if (!run)
+		run = (uint8_t *)it.next;
+	size = (size_t)(it.end - run);
+	if (out != run)
+		memmove(out, run, size);
+	out += size;
+	scan_cnf->ResultListSize = kept + it.remaining;
+	return (size_t)(out - (uint8_t *)scan_cnf);
+}
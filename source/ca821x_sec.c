@@ -0,0 +1,448 @@
+/**
+ * @file ca821x_sec.c
+ * @brief Host-side 802.15.4 frame security (CCM*) for raw PSDUs.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_aes.h"
+#include "ca821x_api.h"
+#include "ca821x_frame.h"
+#include "ca821x_sec.h"
+
+/** CCM* flags of the counter blocks A_i: L - 1, with two octet lengths */
+#define CCM_FLAGS_CTR       (0x01)
+/** CCM* flags of B_0 for a MIC of mic_len octets, with or without a */
+#define CCM_FLAGS_B0(mic_len, has_a) \
+	(((has_a) ? 0x40 : 0) | ((mic_len) ? (((mic_len) - 2) / 2) << 3 : 0) | CCM_FLAGS_CTR)
+
+/** Octets of the MIC, by the low bits of the security level */
+static const uint8_t sec_mic_lens[4] = {0, 4, 8, 16};
+
+/** CBC-MAC in progress: chaining value, and octets added to its next block */
+struct ccm_mac {
+	uint8_t x[CA821X_AES_BLOCK];
+	size_t  fill;
+};
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise an empty key table
+ *******************************************************************************
+ * \param tab - Key table
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sec_keytab_init(struct ca821x_sec_keytab *tab)
+{
+	memset(tab, 0, sizeof(*tab));
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Write an entry of the key table
+ *******************************************************************************
+ * Mirrors MLME_SET_request_sync(macKeyTable, index, ...). The table grows to
+ * include the entry if it is past the end.
+ *******************************************************************************
+ * \param tab - Key table
+ * \param index - Entry to write
+ * \param desc - Key descriptor
+ *******************************************************************************
+ * \return 0: Success<br>
+ *         -1: index is not below KEY_TABLE_SIZE
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sec_keytab_set(
+	struct ca821x_sec_keytab     *tab,
+	uint8_t                       index,
+	const struct M_KeyDescriptor *desc
+)
+{
+	if (index >= KEY_TABLE_SIZE)
+		return -1;
+	tab->desc[index] = *desc;
+	ca821x_aes_set_key(&tab->sched[index], desc->Fixed.Key);
+	if (tab->entries <= index)
+		tab->entries = index + 1;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Find the key for a frame's key identifier
+ *******************************************************************************
+ * Builds the lookup data for the key identifier mode, in the octet order
+ * fields are transmitted in, and returns the first key with a matching
+ * KeyIdLookupList entry. In implicit mode (0) the lookup data is the
+ * device's address: the destination of an outgoing frame or the source of
+ * an incoming one.
+ *******************************************************************************
+ * \param tab - Key table
+ * \param key_id_mode - Key identifier mode, 0 to 3
+ * \param key_source - Key source (4 octets in mode 2, 8 in mode 3)
+ * \param key_index - Key index, for modes 1 to 3
+ * \param addr - Device address, for mode 0
+ *******************************************************************************
+ * \return Index of the key, or -1 if there is none
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sec_key_lookup(
+	const struct ca821x_sec_keytab *tab,
+	uint8_t                         key_id_mode,
+	const uint8_t                  *key_source,
+	uint8_t                         key_index,
+	const struct FullAddr          *addr
+)
+{
+	const struct M_KeyDescriptor *desc;
+	uint8_t data[9], size_code = 1;
+	unsigned i, j, n;
+
+	switch (key_id_mode) {
+	case 0:
+		if (addr->AddressMode == MAC_MODE_LONG_ADDR) {
+			memcpy(data, addr->Address, 8);
+			data[8] = 0;
+		} else if (addr->AddressMode == MAC_MODE_SHORT_ADDR) {
+			memcpy(data, addr->PANId, 2);
+			memcpy(data + 2, addr->Address, 2);
+			data[4] = 0;
+			size_code = 0;
+		} else {
+			return -1;
+		}
+		break;
+	case 1:
+		memcpy(data, tab->default_key_source, 8);
+		data[8] = key_index;
+		break;
+	case 2:
+		memcpy(data, key_source, 4);
+		data[4] = key_index;
+		size_code = 0;
+		break;
+	case 3:
+		memcpy(data, key_source, 8);
+		data[8] = key_index;
+		break;
+	default:
+		return -1;
+	}
+
+	for (i = 0; i < tab->entries; i++) {
+		desc = &tab->desc[i];
+		n = desc->Fixed.KeyIdLookupListEntries;
+		if (n > LOOKUP_DESC_TABLE_SIZE)
+			n = LOOKUP_DESC_TABLE_SIZE;
+		for (j = 0; j < n; j++) {
+			if (desc->KeyIdLookupList[j].LookupDataSizeCode == size_code &&
+			    !memcmp(desc->KeyIdLookupList[j].LookupData, data, size_code ? 9 : 5))
+				return (int)i;
+		}
+	}
+	return -1;
+}
+
+/** XOR data into a CBC-MAC, encrypting each block as it fills */
+static void ccm_mac_add(const struct ca821x_aes_key *key, struct ccm_mac *mac,
+                        const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	while (len) {
+		for (i = mac->fill; i < CA821X_AES_BLOCK && len; i++, len--)
+			mac->x[i] ^= *data++;
+		mac->fill = i;
+		if (i == CA821X_AES_BLOCK) {
+			ca821x_aes_encrypt(key, mac->x, mac->x);
+			mac->fill = 0;
+		}
+	}
+}
+
+/** Complete a partial block of a CBC-MAC with zeros */
+static void ccm_mac_pad(const struct ca821x_aes_key *key, struct ccm_mac *mac)
+{
+	if (mac->fill) {
+		ca821x_aes_encrypt(key, mac->x, mac->x);
+		mac->fill = 0;
+	}
+}
+
+/** Write a CCM* block: flags, nonce and a two octet count */
+static void ccm_block(uint8_t *block, uint8_t flags, const uint8_t *nonce, size_t n)
+{
+	block[0] = flags;
+	memcpy(block + 1, nonce, CA821X_SEC_NONCE_LEN);
+	block[14] = (uint8_t)(n >> 8);
+	block[15] = (uint8_t)n;
+}
+
+/** Unencrypted authentication tag T of a and the plaintext m */
+static void ccm_tag(const struct ca821x_aes_key *key, const uint8_t *nonce,
+                    const uint8_t *a, size_t a_len, const uint8_t *m,
+                    size_t m_len, uint8_t mic_len, uint8_t *t)
+{
+	struct ccm_mac mac;
+	uint8_t block[CA821X_AES_BLOCK];
+
+	memset(&mac, 0, sizeof(mac));
+	ccm_block(block, CCM_FLAGS_B0(mic_len, a_len), nonce, m_len);
+	ccm_mac_add(key, &mac, block, sizeof(block));
+	if (a_len) {
+		block[0] = (uint8_t)(a_len >> 8);
+		block[1] = (uint8_t)a_len;
+		ccm_mac_add(key, &mac, block, 2);
+		ccm_mac_add(key, &mac, a, a_len);
+		ccm_mac_pad(key, &mac);
+	}
+	ccm_mac_add(key, &mac, m, m_len);
+	ccm_mac_pad(key, &mac);
+	memcpy(t, mac.x, mic_len);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Encrypt and authenticate with CCM*
+ *******************************************************************************
+ * CCM* with two octet length fields, as used by 802.15.4. a and m are limited
+ * to 65279 octets.
+ *******************************************************************************
+ * \param key - Expanded key
+ * \param nonce - CA821X_SEC_NONCE_LEN octet nonce
+ * \param a - Data to authenticate only
+ * \param a_len - Length of a
+ * \param m - Data to authenticate and encrypt in place
+ * \param m_len - Length of m
+ * \param mic - Receives the MIC
+ * \param mic_len - Length of the MIC: 0, 4, 8 or 16
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_ccm_star_seal(
+	const struct ca821x_aes_key *key,
+	const uint8_t               *nonce,
+	const uint8_t               *a,
+	size_t                       a_len,
+	uint8_t                     *m,
+	size_t                       m_len,
+	uint8_t                     *mic,
+	uint8_t                      mic_len
+)
+{
+	uint8_t block[CA821X_AES_BLOCK], t[CA821X_AES_BLOCK];
+	uint8_t i;
+
+	if (mic_len) {
+		ccm_tag(key, nonce, a, a_len, m, m_len, mic_len, t);
+		ccm_block(block, CCM_FLAGS_CTR, nonce, 0);
+		ca821x_aes_encrypt(key, block, block);
+		for (i = 0; i < mic_len; i++)
+			mic[i] = t[i] ^ block[i];
+	}
+	ccm_block(block, CCM_FLAGS_CTR, nonce, 1);
+	ca821x_aes_ctr(key, block, m, m_len);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Decrypt and verify with CCM*
+ *******************************************************************************
+ * The inverse of ca821x_ccm_star_seal. m is decrypted even if the MIC does
+ * not match, and must then be discarded.
+ *******************************************************************************
+ * \param key - Expanded key
+ * \param nonce - CA821X_SEC_NONCE_LEN octet nonce
+ * \param a - Data that was authenticated only
+ * \param a_len - Length of a
+ * \param m - Data to decrypt in place
+ * \param m_len - Length of m
+ * \param mic - Received MIC
+ * \param mic_len - Length of the MIC: 0, 4, 8 or 16
+ *******************************************************************************
+ * \return 0: MIC verified<br>
+ *         -1: MIC does not match
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_ccm_star_open(
+	const struct ca821x_aes_key *key,
+	const uint8_t               *nonce,
+	const uint8_t               *a,
+	size_t                       a_len,
+	uint8_t                     *m,
+	size_t                       m_len,
+	const uint8_t               *mic,
+	uint8_t                      mic_len
+)
+{
+	uint8_t block[CA821X_AES_BLOCK], t[CA821X_AES_BLOCK];
+	uint8_t i, diff = 0;
+
+	ccm_block(block, CCM_FLAGS_CTR, nonce, 1);
+	ca821x_aes_ctr(key, block, m, m_len);
+	if (!mic_len)
+		return 0;
+
+	ccm_tag(key, nonce, a, a_len, m, m_len, mic_len, t);
+	ccm_block(block, CCM_FLAGS_CTR, nonce, 0);
+	ca821x_aes_encrypt(key, block, block);
+	/* Compare every octet, so the time taken does not reveal a prefix */
+	for (i = 0; i < mic_len; i++)
+		diff |= mic[i] ^ t[i] ^ block[i];
+	return diff ? -1 : 0;
+}
+
+/** Build the nonce of a frame from its source's little-endian address */
+static void sec_nonce(uint8_t *nonce, const uint8_t *ext_addr, uint32_t frame_counter,
+                      uint8_t sec_level)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		nonce[i] = ext_addr[7 - i];
+	nonce[8] = (uint8_t)(frame_counter >> 24);
+	nonce[9] = (uint8_t)(frame_counter >> 16);
+	nonce[10] = (uint8_t)(frame_counter >> 8);
+	nonce[11] = (uint8_t)frame_counter;
+	nonce[12] = sec_level;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Build a secured MAC frame
+ *******************************************************************************
+ * As ca821x_frame_build, then if hdr->security.SecurityLevel is nonzero,
+ * appends the MIC and encrypts the payload as the level requires. The key
+ * is looked up from hdr->security, or in implicit mode from hdr->dst. The
+ * frame is written without an FCS.
+ *******************************************************************************
+ * \param tab - Key table
+ * \param buf - Buffer to write the frame to
+ * \param size - Size of buf
+ * \param hdr - Header fields, including the frame counter to use
+ * \param payload - MAC payload
+ * \param payload_len - Length of the payload
+ * \param ext_addr - Extended address of the sender (aExtendedAddress),
+ *                   little-endian
+ *******************************************************************************
+ * \return Length of the frame, or -1 if it cannot be built, does not fit
+ *         with its MIC or has no key
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sec_frame_build(
+	const struct ca821x_sec_keytab *tab,
+	uint8_t                        *buf,
+	size_t                          size,
+	const struct ca821x_frame_hdr  *hdr,
+	const uint8_t                  *payload,
+	size_t                          payload_len,
+	const uint8_t                  *ext_addr
+)
+{
+	const struct SecSpec *sec = &hdr->security;
+	uint8_t nonce[CA821X_SEC_NONCE_LEN], level = sec->SecurityLevel & 7, mic_len;
+	size_t hdr_len;
+	int len, key;
+
+	len = ca821x_frame_build(buf, size, hdr, payload, payload_len);
+	if (len < 0 || !level)
+		return len;
+	mic_len = sec_mic_lens[level & 3];
+	if ((size_t)len + mic_len > size || len + mic_len + MAC_FCS_LEN > aMaxPHYPacketSize)
+		return -1;
+	key = ca821x_sec_key_lookup(tab, sec->KeyIdMode & 3, sec->KeySource,
+	                            sec->KeyIndex, &hdr->dst);
+	if (key < 0)
+		return -1;
+
+	hdr_len = len - payload_len;
+	sec_nonce(nonce, ext_addr, hdr->frame_counter, level);
+	if (level & 4)
+		ca821x_ccm_star_seal(&tab->sched[key], nonce, buf, hdr_len, buf + hdr_len,
+		                     payload_len, buf + len, mic_len);
+	else
+		ca821x_ccm_star_seal(&tab->sched[key], nonce, buf, len, NULL, 0,
+		                     buf + len, mic_len);
+	return len + mic_len;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Decode and unsecure a MAC frame in place
+ *******************************************************************************
+ * As ca821x_frame_decode, then for a secured frame looks up the key from the
+ * auxiliary security header, or in implicit mode from the source address,
+ * decrypts the payload and verifies the MIC. On success frame->payload is
+ * the plaintext and frame->payload_len no longer counts the MIC.
+ *******************************************************************************
+ * \param tab - Key table
+ * \param frame - Receives the decoded fields
+ * \param psdu - Frame, starting with the frame control field
+ * \param len - Length of the frame
+ * \param has_fcs - Nonzero if the frame ends with an FCS
+ * \param src_ext_addr - Extended address of the sender, little-endian, if
+ *                       the frame carries its short address. May be NULL
+ *                       when the frame carries the extended address
+ *******************************************************************************
+ * \return 0: Frame decoded and, if secured, authentic<br>
+ *         -1: Malformed frame, no key, or MIC mismatch
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sec_frame_open(
+	const struct ca821x_sec_keytab *tab,
+	struct ca821x_frame            *frame,
+	uint8_t                        *psdu,
+	size_t                          len,
+	int                             has_fcs,
+	const uint8_t                  *src_ext_addr
+)
+{
+	uint8_t nonce[CA821X_SEC_NONCE_LEN], *p;
+	struct FullAddr src, dst;
+	size_t m_len;
+	int key, ret;
+
+	if (ca821x_frame_decode(frame, psdu, len, has_fcs))
+		return -1;
+	if (!frame->sec_level)
+		return 0;
+	ca821x_frame_get_addrs(frame, &src, &dst);
+	key = ca821x_sec_key_lookup(tab, frame->key_id_mode, frame->key_source,
+	                            frame->key_index, &src);
+	if (key < 0)
+		return -1;
+	if (frame->src_mode == MAC_MODE_LONG_ADDR)
+		src_ext_addr = frame->src_addr;
+	else if (!src_ext_addr)
+		return -1;
+
+	sec_nonce(nonce, src_ext_addr, frame->frame_counter, frame->sec_level);
+	p = psdu + frame->hdr_len;
+	m_len = frame->payload_len - frame->mic_len;
+	if (frame->sec_level & 4)
+		ret = ca821x_ccm_star_open(&tab->sched[key], nonce, psdu, frame->hdr_len,
+		                           p, m_len, p + m_len, frame->mic_len);
+	else
+		ret = ca821x_ccm_star_open(&tab->sched[key], nonce, psdu,
+		                           frame->hdr_len + m_len, NULL, 0, p + m_len,
+		                           frame->mic_len);
+	if (ret)
+		return -1;
+	frame->payload_len = (uint8_t)m_len;
+	return 0;
+}
@@ -0,0 +1,337 @@
+/**
+ * @file ca821x_sec_mirror.c
+ * @brief Host mirror of the MAC security tables, synchronised by difference.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_sec.h"
+#include "ca821x_sec_mirror.h"
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise empty security tables
+ *******************************************************************************
+ * \param tables - Tables to initialise
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sec_tables_init(struct ca821x_sec_tables *tables)
+{
+	memset(tables, 0, sizeof(*tables));
+	ca821x_sec_keytab_init(&tables->keys);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a mirror of a device whose MAC PIB was just reset
+ *******************************************************************************
+ * The entry counts are then 0, and the contents of every entry unknown.
+ *******************************************************************************
+ * \param mirror - Mirror to initialise
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sec_mirror_init(struct ca821x_sec_mirror *mirror)
+{
+	memset(mirror, 0, sizeof(*mirror));
+	ca821x_sec_tables_init(&mirror->dev);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Encode a key descriptor as macKeyTable is written
+ *******************************************************************************
+ * The fixed fields are followed by only the list entries in use.
+ *******************************************************************************
+ * \param desc - Key descriptor
+ * \param buf - Buffer of at least sizeof(struct M_KeyDescriptor) octets
+ *******************************************************************************
+ * \return Length of the encoding
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_sec_key_encode(const struct M_KeyDescriptor *desc, uint8_t *buf)
+{
+	struct M_KeyTableEntryFixed fixed = desc->Fixed;
+	uint8_t *p = buf;
+
+	if (fixed.KeyIdLookupListEntries > LOOKUP_DESC_TABLE_SIZE)
+		fixed.KeyIdLookupListEntries = LOOKUP_DESC_TABLE_SIZE;
+	if (fixed.KeyDeviceListEntries > KEY_DEVICE_TABLE_SIZE)
+		fixed.KeyDeviceListEntries = KEY_DEVICE_TABLE_SIZE;
+	if (fixed.KeyUsageListEntries > SECURITY_LEVEL_TABLE_SIZE)
+		fixed.KeyUsageListEntries = SECURITY_LEVEL_TABLE_SIZE;
+
+	memcpy(p, &fixed, sizeof(fixed));
+	p += sizeof(fixed);
+	memcpy(p, desc->KeyIdLookupList,
+	       fixed.KeyIdLookupListEntries * sizeof(struct M_KeyIdLookupDesc));
+	p += fixed.KeyIdLookupListEntries * sizeof(struct M_KeyIdLookupDesc);
+	memcpy(p, desc->KeyDeviceList,
+	       fixed.KeyDeviceListEntries * sizeof(struct M_KeyDeviceDesc));
+	p += fixed.KeyDeviceListEntries * sizeof(struct M_KeyDeviceDesc);
+	memcpy(p, desc->KeyUsageList,
+	       fixed.KeyUsageListEntries * sizeof(struct M_KeyUsageDesc));
+	p += fixed.KeyUsageListEntries * sizeof(struct M_KeyUsageDesc);
+	return (size_t)(p - buf);
+}
+
+/** Whether device i of want differs from what the device is known to hold.
+ *  The device advances FrameCounter itself, so only a larger one differs */
+static int mirror_device_differs(const struct ca821x_sec_mirror *mirror,
+                                 const struct ca821x_sec_tables *want, unsigned i)
+{
+	const struct M_DeviceDescriptor *a = &want->devices[i];
+	const struct M_DeviceDescriptor *b = &mirror->dev.devices[i];
+
+	if (!(mirror->device_known & (1UL << i)))
+		return 1;
+	return memcmp(a->PANId, b->PANId, 2) ||
+	       memcmp(a->ShortAddress, b->ShortAddress, 2) ||
+	       memcmp(a->ExtAddress, b->ExtAddress, 8) || a->Exempt != b->Exempt ||
+	       GETLE32(a->FrameCounter) > GETLE32(b->FrameCounter);
+}
+
+/** Index of the device table entry known to hold ext_addr, or -1 */
+static int mirror_find_device(const struct ca821x_sec_mirror *mirror,
+                              const uint8_t *ext_addr)
+{
+	unsigned i;
+
+	for (i = 0; i < mirror->dev.device_entries && i < DEVICE_TABLE_SIZE; i++) {
+		if ((mirror->device_known & (1UL << i)) &&
+		    !memcmp(mirror->dev.devices[i].ExtAddress, ext_addr, 8))
+			return i;
+	}
+	return -1;
+}
+
+/** Whether key i of want differs from what the device is known to hold */
+static int mirror_key_differs(const struct ca821x_sec_mirror *mirror,
+                              const struct ca821x_sec_tables *want, unsigned i)
+{
+	uint8_t a[sizeof(struct M_KeyDescriptor)], b[sizeof(struct M_KeyDescriptor)];
+	size_t len;
+
+	if (!(mirror->key_known & (1u << i)))
+		return 1;
+	len = ca821x_sec_key_encode(&want->keys.desc[i], a);
+	return len != ca821x_sec_key_encode(&mirror->dev.keys.desc[i], b) ||
+	       memcmp(a, b, len);
+}
+
+/** Append a SET to a plan, counting it even if the plan is full */
+static void mirror_plan_add(struct ca821x_sec_set *sets, size_t max, size_t *n,
+                            uint8_t attribute, uint8_t index)
+{
+	if (*n < max) {
+		sets[*n].attribute = attribute;
+		sets[*n].index = index;
+	}
+	(*n)++;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief List the MLME-SET.requests that bring a device's tables to want
+ *******************************************************************************
+ * Devices are written first, then security levels, then macDefaultKeySource
+ * and the keys that may refer to them. Each table's entry count is written
+ * before its entries, and entries past the new count are left alone.
+ *******************************************************************************
+ * \param mirror - What the device holds
+ * \param want - Tables the device should hold
+ * \param sets - Receives up to max SETs, in the order to send them
+ * \param max - Size of sets; CA821X_SEC_MAX_SETS always suffices
+ *******************************************************************************
+ * \return Number of SETs needed, which may exceed max
+ *******************************************************************************
+ ******************************************************************************/
+size_t ca821x_sec_mirror_plan(
+	const struct ca821x_sec_mirror *mirror,
+	const struct ca821x_sec_tables *want,
+	struct ca821x_sec_set          *sets,
+	size_t                          max
+)
+{
+	const struct ca821x_sec_tables *dev = &mirror->dev;
+	size_t n = 0;
+	unsigned i;
+
+	if (want->device_entries != dev->device_entries)
+		mirror_plan_add(sets, max, &n, macDeviceTableEntries, 0);
+	for (i = 0; i < want->device_entries && i < DEVICE_TABLE_SIZE; i++) {
+		if (mirror_device_differs(mirror, want, i))
+			mirror_plan_add(sets, max, &n, macDeviceTable, i);
+	}
+
+	if (want->level_entries != dev->level_entries)
+		mirror_plan_add(sets, max, &n, macSecurityLevelTableEntries, 0);
+	for (i = 0; i < want->level_entries && i < SECURITY_LEVEL_TABLE_SIZE; i++) {
+		if (!(mirror->level_known & (1u << i)) ||
+		    memcmp(&want->levels[i], &dev->levels[i], sizeof(want->levels[i])))
+			mirror_plan_add(sets, max, &n, macSecurityLevelTable, i);
+	}
+
+	if (!mirror->key_source_known ||
+	    memcmp(want->keys.default_key_source, dev->keys.default_key_source, 8))
+		mirror_plan_add(sets, max, &n, macDefaultKeySource, 0);
+	if (want->keys.entries != dev->keys.entries)
+		mirror_plan_add(sets, max, &n, macKeyTableEntries, 0);
+	for (i = 0; i < want->keys.entries && i < KEY_TABLE_SIZE; i++) {
+		if (mirror_key_differs(mirror, want, i))
+			mirror_plan_add(sets, max, &n, macKeyTable, i);
+	}
+	return n;
+}
+
+/** Send one planned SET and record it in the mirror if it succeeds. Device
+ *  descriptors are taken from devices rather than want */
+static uint8_t mirror_apply(struct ca821x_sec_mirror *mirror,
+                            const struct ca821x_sec_tables *want,
+                            const struct M_DeviceDescriptor *devices,
+                            const struct ca821x_sec_set *set,
+                            struct ca821x_dev *pDeviceRef)
+{
+	struct ca821x_sec_tables *dev = &mirror->dev;
+	uint8_t buf[sizeof(struct M_KeyDescriptor)], status;
+	const void *value;
+	size_t len = 1;
+
+	switch (set->attribute) {
+	case macDeviceTableEntries:
+		value = &want->device_entries;
+		break;
+	case macDeviceTable:
+		value = &devices[set->index];
+		len = sizeof(devices[0]);
+		break;
+	case macSecurityLevelTableEntries:
+		value = &want->level_entries;
+		break;
+	case macSecurityLevelTable:
+		value = &want->levels[set->index];
+		len = sizeof(want->levels[0]);
+		break;
+	case macDefaultKeySource:
+		value = want->keys.default_key_source;
+		len = 8;
+		break;
+	case macKeyTableEntries:
+		value = &want->keys.entries;
+		break;
+	default:
+		len = ca821x_sec_key_encode(&want->keys.desc[set->index], buf);
+		value = buf;
+		break;
+	}
+
+	status = MLME_SET_request_sync(set->attribute, set->index, (uint8_t)len, value,
+	                               pDeviceRef);
+	if (status != MAC_SUCCESS)
+		return status;
+
+	switch (set->attribute) {
+	case macDeviceTableEntries:
+		dev->device_entries = want->device_entries;
+		break;
+	case macDeviceTable:
+		dev->devices[set->index] = devices[set->index];
+		mirror->device_known |= 1UL << set->index;
+		break;
+	case macSecurityLevelTableEntries:
+		dev->level_entries = want->level_entries;
+		break;
+	case macSecurityLevelTable:
+		dev->levels[set->index] = want->levels[set->index];
+		mirror->level_known |= 1u << set->index;
+		break;
+	case macDefaultKeySource:
+		memcpy(dev->keys.default_key_source, want->keys.default_key_source, 8);
+		mirror->key_source_known = 1;
+		break;
+	case macKeyTableEntries:
+		dev->keys.entries = want->keys.entries;
+		break;
+	default:
+		ca821x_sec_keytab_set(&dev->keys, set->index, &want->keys.desc[set->index]);
+		mirror->key_known |= 1u << set->index;
+		break;
+	}
+	return MAC_SUCCESS;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Bring a device's security tables to want
+ *******************************************************************************
+ * Sends the SETs listed by ca821x_sec_mirror_plan in order, recording each
+ * in the mirror as it succeeds. If one fails, the sync stops there and can
+ * be retried; only the SETs still needed are sent again.
+ *
+ * Each device descriptor to be written whose ExtAddress the device already
+ * holds, at the same index or another, first has that entry read back with
+ * MLME-GET, all before the first SET. The larger of the FrameCounter read and
+ * the one in want is written, so a device shifted to another index keeps the
+ * counter the device has advanced it to.
+ *******************************************************************************
+ * \param mirror - What the device holds, updated to want
+ * \param want - Tables the device should hold
+ * \param pDeviceRef - Pointer to initialised ca821x_device_ref struct
+ *******************************************************************************
+ * \return Status of the first MLME-GET.confirm or MLME-SET.confirm that
+ *         failed, or MAC_SUCCESS
+ *******************************************************************************
+ ******************************************************************************/
+uint8_t ca821x_sec_mirror_sync(
+	struct ca821x_sec_mirror       *mirror,
+	const struct ca821x_sec_tables *want,
+	struct ca821x_dev              *pDeviceRef
+)
+{
+	struct ca821x_sec_set sets[CA821X_SEC_MAX_SETS];
+	struct M_DeviceDescriptor devices[DEVICE_TABLE_SIZE], *desc;
+	const struct M_DeviceDescriptor *held;
+	uint8_t len, status, value[MAX_ATTRIBUTE_SIZE];
+	size_t i, n;
+	int j;
+
+	n = ca821x_sec_mirror_plan(mirror, want, sets, CA821X_SEC_MAX_SETS);
+	for (i = 0; i < n; i++) {
+		if (sets[i].attribute != macDeviceTable)
+			continue;
+		desc = &devices[sets[i].index];
+		*desc = want->devices[sets[i].index];
+		j = mirror_find_device(mirror, desc->ExtAddress);
+		if (j < 0)
+			continue;
+		status = MLME_GET_request_sync(macDeviceTable, j, &len, value, pDeviceRef);
+		if (status != MAC_SUCCESS)
+			return status;
+		held = (const struct M_DeviceDescriptor *)value;
+		if (len == sizeof(*held) &&
+		    GETLE32(held->FrameCounter) > GETLE32(desc->FrameCounter))
+			memcpy(desc->FrameCounter, held->FrameCounter, 4);
+	}
+	for (i = 0; i < n; i++) {
+		status = mirror_apply(mirror, want, devices, &sets[i], pDeviceRef);
+		if (status != MAC_SUCCESS)
+			return status;
+	}
+	return MAC_SUCCESS;
+}
@@ -0,0 +1,314 @@
+/**
+ * @file ca821x_subscribe.c
+ * @brief Registry of filtered handlers for dispatched frames.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_subscribe.h"
+
+/** Field absent from a parameter set */
+#define NO_FIELD            (0xFF)
+
+/** Offsets in a frame, including its command and length octets */
+#define PSET(type, field)   (2 + offsetof(type, field))
+
+/** Octets of an address of the given mode */
+#define ADDR_LEN(m)         ((m) == MAC_MODE_SHORT_ADDR ? 2 : (m) == MAC_MODE_LONG_ADDR ? 8 : 0)
+
+/**
+ * Where the filtered fields of a command's parameter set lie. An address is
+ * its mode octet, followed either by the address (addr_pan NO_FIELD) or as in
+ * struct FullAddr by its PAN id and then the address.
+ */
+struct sub_layout {
+	uint8_t src_mode;
+	uint8_t src_pan;
+	uint8_t dst_mode;
+	uint8_t dst_pan;
+	uint8_t pan;
+	uint8_t handle;
+};
+
+/** Fields of a command, all NO_FIELD if it has none */
+static const struct sub_layout *sub_layout(uint8_t cmdid)
+{
+	static const struct sub_layout none = {
+		NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD
+	};
+	static const struct sub_layout data_ind = {
+		PSET(struct MCPS_DATA_indication_pset, Src),
+		PSET(struct MCPS_DATA_indication_pset, Src.PANId),
+		PSET(struct MCPS_DATA_indication_pset, Dst),
+		PSET(struct MCPS_DATA_indication_pset, Dst.PANId),
+		PSET(struct MCPS_DATA_indication_pset, Dst.PANId),
+		NO_FIELD
+	};
+	static const struct sub_layout comm_status_ind = {
+		PSET(struct MLME_COMM_STATUS_indication_pset, SrcAddrMode),
+		NO_FIELD,
+		PSET(struct MLME_COMM_STATUS_indication_pset, DstAddrMode),
+		NO_FIELD,
+		PSET(struct MLME_COMM_STATUS_indication_pset, PANId),
+		NO_FIELD
+	};
+	static const struct sub_layout beacon_ind = {
+		PSET(struct MLME_BEACON_NOTIFY_indication_pset, PanDescriptor.Coord),
+		PSET(struct MLME_BEACON_NOTIFY_indication_pset, PanDescriptor.Coord.PANId),
+		NO_FIELD,
+		NO_FIELD,
+		PSET(struct MLME_BEACON_NOTIFY_indication_pset, PanDescriptor.Coord.PANId),
+		NO_FIELD
+	};
+	static const struct sub_layout data_cnf = {
+		NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD,
+		PSET(struct MCPS_DATA_confirm_pset, MsduHandle)
+	};
+#if CASCODA_CA_VER >= 8211
+	static const struct sub_layout poll_ind = {
+		PSET(struct MLME_POLL_indication_pset, Src),
+		PSET(struct MLME_POLL_indication_pset, Src.PANId),
+		PSET(struct MLME_POLL_indication_pset, Dst),
+		PSET(struct MLME_POLL_indication_pset, Dst.PANId),
+		PSET(struct MLME_POLL_indication_pset, Dst.PANId),
+		NO_FIELD
+	};
+	static const struct sub_layout pcps_cnf = {
+		NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD, NO_FIELD,
+		PSET(struct PCPS_DATA_confirm_pset, PsduHandle)
+	};
+#endif
+
+	switch (cmdid) {
+	case SPI_MCPS_DATA_INDICATION:
+		return &data_ind;
+	case SPI_MLME_COMM_STATUS_INDICATION:
+		return &comm_status_ind;
+	case SPI_MLME_BEACON_NOTIFY_INDICATION:
+		return &beacon_ind;
+	case SPI_MCPS_DATA_CONFIRM:
+		return &data_cnf;
+#if CASCODA_CA_VER >= 8211
+	case SPI_MLME_POLL_INDICATION:
+		return &poll_ind;
+	case SPI_PCPS_DATA_CONFIRM:
+		return &pcps_cnf;
+#endif
+	}
+	return &none;
+}
+
+/** Add a comparison of len octets at offset, split to fit the checks */
+static int sub_add_check(
+	struct ca821x_sub *sub,
+	uint8_t            offset,
+	const uint8_t     *value,
+	size_t             len
+)
+{
+	struct ca821x_sub_check *check;
+	size_t n;
+
+	while (len) {
+		if (sub->num_checks == CA821X_SUB_CHECKS)
+			return -1;
+		n = len < sizeof(check->value) ? len : sizeof(check->value);
+		check = &sub->checks[sub->num_checks++];
+		check->offset = offset;
+		check->len = (uint8_t)n;
+		memcpy(check->value, value, n);
+		if (offset + n > sub->min_len)
+			sub->min_len = (uint8_t)(offset + n);
+		offset += (uint8_t)n;
+		value += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/** Compile the comparisons matching an address */
+static int sub_add_addr(
+	struct ca821x_sub     *sub,
+	uint8_t                mode_off,
+	uint8_t                pan_off,
+	uint8_t                frame_pan_off,
+	const struct FullAddr *addr
+)
+{
+	uint8_t octets[1 + 2 + 8];
+	uint8_t len = ADDR_LEN(addr->AddressMode);
+
+	if (mode_off == NO_FIELD || addr->AddressMode > MAC_MODE_LONG_ADDR)
+		return -1;
+	octets[0] = addr->AddressMode;
+	if (pan_off == NO_FIELD) {
+		/* Mode then address, with the frame's PAN id elsewhere */
+		memcpy(octets + 1, addr->Address, len);
+		if (sub_add_check(sub, mode_off, octets, 1 + len))
+			return -1;
+		if (addr->AddressMode == MAC_MODE_SHORT_ADDR)
+			return sub_add_check(sub, frame_pan_off, addr->PANId, 2);
+		return 0;
+	}
+	if (addr->AddressMode != MAC_MODE_SHORT_ADDR)
+		return sub_add_check(sub, mode_off, octets, 1) ||
+		       sub_add_check(sub, pan_off + 2, addr->Address, len) ? -1 : 0;
+	/* Mode, PAN id and short address are contiguous */
+	memcpy(octets + 1, addr->PANId, 2);
+	memcpy(octets + 3, addr->Address, 2);
+	return sub_add_check(sub, mode_off, octets, 5);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a subscription registry with no handlers
+ *******************************************************************************
+ * \param subs - Registry to initialise
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_subs_init(struct ca821x_subs *subs)
+{
+	memset(subs, 0, sizeof(*subs));
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Subscribe a handler to the frames of a command id
+ *******************************************************************************
+ * \param subs - Registry
+ * \param cmdid - Command id of the frames, such as SPI_MCPS_DATA_INDICATION
+ * \param filter - Frames to call the handler with, NULL for all of them
+ * \param fn - Handler
+ * \param context - Passed to the handler
+ *******************************************************************************
+ * \return Subscription id for ca821x_unsubscribe, or -1 if the command has
+ *         CA821X_SUB_PER_ROW handlers already or lacks a filtered field
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_subscribe(
+	struct ca821x_subs             *subs,
+	uint8_t                         cmdid,
+	const struct ca821x_sub_filter *filter,
+	ca821x_sub_fn                   fn,
+	void                           *context
+)
+{
+	const struct sub_layout *layout = sub_layout(cmdid);
+	struct ca821x_sub compiled, *row = subs->rows[cmdid & SPI_MID_MASK];
+	unsigned i;
+
+	if (!fn)
+		return -1;
+	memset(&compiled, 0, sizeof(compiled));
+	compiled.fn = fn;
+	compiled.context = context;
+	compiled.cmdid = cmdid;
+	compiled.min_len = 2;
+	compiled.handle_off = NO_FIELD;
+
+	if (filter && (filter->match & CA821X_SUB_SRC) &&
+	    sub_add_addr(&compiled, layout->src_mode, layout->src_pan, layout->pan,
+	                 &filter->src))
+		return -1;
+	if (filter && (filter->match & CA821X_SUB_DST) &&
+	    sub_add_addr(&compiled, layout->dst_mode, layout->dst_pan, layout->pan,
+	                 &filter->dst))
+		return -1;
+	if (filter && (filter->match & CA821X_SUB_PAN) &&
+	    (layout->pan == NO_FIELD ||
+	     sub_add_check(&compiled, layout->pan, filter->pan_id, 2)))
+		return -1;
+	if (filter && (filter->match & CA821X_SUB_HANDLE)) {
+		if (layout->handle == NO_FIELD || filter->handle_min > filter->handle_max)
+			return -1;
+		compiled.handle_off = layout->handle;
+		compiled.handle_min = filter->handle_min;
+		compiled.handle_max = filter->handle_max;
+		if (layout->handle + 1 > compiled.min_len)
+			compiled.min_len = layout->handle + 1;
+	}
+
+	for (i = 0; i < CA821X_SUB_PER_ROW; i++) {
+		if (!row[i].fn) {
+			row[i] = compiled;
+			return (int)((cmdid & SPI_MID_MASK) * CA821X_SUB_PER_ROW + i);
+		}
+	}
+	return -1;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Remove a handler from a registry
+ *******************************************************************************
+ * \param subs - Registry
+ * \param id - Subscription id returned by ca821x_subscribe
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_unsubscribe(struct ca821x_subs *subs, int id)
+{
+	if (id >= 0 && id < CA821X_SUB_ROWS * CA821X_SUB_PER_ROW)
+		subs->rows[id / CA821X_SUB_PER_ROW][id % CA821X_SUB_PER_ROW].fn = NULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Call the handlers subscribed to a frame whose filters match it
+ *******************************************************************************
+ * Called by ca821x_downstream_dispatch when the device has a registry
+ * attached. A frame too short for a handler's filter does not match it.
+ *******************************************************************************
+ * \param subs - Registry
+ * \param buf - Frame, starting with its command id
+ * \param len - Length of the frame
+ * \param pDeviceRef - Device the frame was received from
+ *******************************************************************************
+ * \return Number of handlers called
+ *******************************************************************************
+ ******************************************************************************/
+unsigned ca821x_subs_dispatch(
+	struct ca821x_subs *subs,
+	const uint8_t      *buf,
+	size_t              len,
+	struct ca821x_dev  *pDeviceRef
+)
+{
+	const struct ca821x_sub *sub = subs->rows[buf[0] & SPI_MID_MASK];
+	const struct ca821x_sub_check *check;
+	unsigned i, c, called = 0;
+
+	for (i = 0; i < CA821X_SUB_PER_ROW; i++, sub++) {
+		if (!sub->fn || sub->cmdid != buf[0] || len < sub->min_len)
+			continue;
+		for (c = 0, check = sub->checks; c < sub->num_checks; c++, check++) {
+			if (memcmp(buf + check->offset, check->value, check->len))
+				break;
+		}
+		if (c < sub->num_checks)
+			continue;
+		if (sub->handle_off != NO_FIELD &&
+		    (buf[sub->handle_off] < sub->handle_min ||
+		     buf[sub->handle_off] > sub->handle_max))
+			continue;
+		sub->fn(buf, len, sub->context, pDeviceRef);
+		called++;
+	}
+	return called;
+}
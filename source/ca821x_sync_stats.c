@@ -0,0 +1,276 @@
+/**
+ * @file ca821x_sync_stats.c
+ * @brief Latency histograms for synchronous ca821x commands.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_sync_stats.h"
+
+#ifdef CA821X_HAVE_ATOMICS
+#define STAT_INIT(p)    atomic_init((p), 0)
+#define STAT_INC(p)     atomic_fetch_add_explicit((p), 1, memory_order_relaxed)
+#define STAT_LOAD(p)    atomic_load_explicit((p), memory_order_relaxed)
+#define STAT_TAKE(p)    atomic_exchange_explicit((p), 0, memory_order_relaxed)
+#define STAT_CAS(p, e, v) \
+	atomic_compare_exchange_weak_explicit((p), (e), (v), memory_order_relaxed, \
+	                                      memory_order_relaxed)
+#else
+#define STAT_INIT(p)    (*(p) = 0)
+#define STAT_INC(p)     ((*(p))++)
+#define STAT_LOAD(p)    (*(p))
+static uint32_t stat_take(ca821x_stat_t *p)
+{
+	uint32_t v = *p;
+	*p = 0;
+	return v;
+}
+#define STAT_TAKE(p)    stat_take(p)
+#define STAT_CAS(p, e, v) (*(p) = (v), 1)
+#endif
+
+#define SYNC_STATS_SLOT_ENTRY(id)   [id] = SYNC_SLOT_##id + 1,
+/** Slot of each command id plus one, or 0 for an id with no slot */
+static const uint8_t sync_slots[256] = {
+	SYNC_STATS_IDS(SYNC_STATS_SLOT_ENTRY)
+};
+
+/** Index of the most significant set bit of a nonzero value */
+static unsigned msb64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(v);
+#else
+	unsigned n = 0;
+
+	while (v >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+/** Log-linear bucket of a latency */
+static unsigned bucket_index(uint64_t ns)
+{
+	unsigned msb;
+
+	if (ns < (1u << SYNC_STATS_SUB_BITS))
+		return (unsigned)ns;
+	msb = msb64(ns);
+	if (msb >= SYNC_STATS_MAX_BITS)
+		return SYNC_STATS_BUCKETS - 1;
+	return ((msb - SYNC_STATS_SUB_BITS + 1) << SYNC_STATS_SUB_BITS) |
+	       ((unsigned)(ns >> (msb - SYNC_STATS_SUB_BITS)) &
+	        ((1u << SYNC_STATS_SUB_BITS) - 1));
+}
+
+/** Largest latency that falls in a bucket */
+static uint64_t bucket_upper(unsigned index)
+{
+	unsigned shift;
+	uint64_t lower;
+
+	if (index < (1u << SYNC_STATS_SUB_BITS))
+		return index;
+	shift = (index >> SYNC_STATS_SUB_BITS) - 1;
+	lower = (uint64_t)((1u << SYNC_STATS_SUB_BITS) |
+	                   (index & ((1u << SYNC_STATS_SUB_BITS) - 1))) << shift;
+	return lower + ((uint64_t)1 << shift) - 1;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Zero a set of synchronous command statistics
+ *******************************************************************************
+ * \param stats - Statistics to initialise
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sync_stats_init(struct ca821x_sync_stats *stats)
+{
+	unsigned c, b;
+
+	for (c = 0; c < SYNC_STATS_COMMANDS; c++) {
+		struct ca821x_sync_hist *h = &stats->cmd[c];
+		for (b = 0; b < SYNC_STATS_BUCKETS; b++)
+			STAT_INIT(&h->buckets[b]);
+		STAT_INIT(&h->max_ns);
+		STAT_INIT(&h->transport_errors);
+		STAT_INIT(&h->mismatch_errors);
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Record one synchronous exchange
+ *******************************************************************************
+ * Called by the api for every synchronous command when the device has
+ * statistics attached.
+ *******************************************************************************
+ * \param stats - Statistics to update
+ * \param cmdid - Id of the command sent, which is ignored if it has no slot
+ *                (see SYNC_STATS_IDS)
+ * \param latency_ns - Time spent in the exchange
+ * \param result - Outcome of the exchange
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_sync_stats_record(
+	struct ca821x_sync_stats *stats,
+	uint8_t                   cmdid,
+	uint64_t                  latency_ns,
+	enum ca821x_sync_result   result
+)
+{
+	struct ca821x_sync_hist *h;
+	uint32_t ns = latency_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_ns;
+	uint32_t max;
+
+	if (!sync_slots[cmdid])
+		return;
+	h = &stats->cmd[sync_slots[cmdid] - 1];
+	STAT_INC(&h->buckets[bucket_index(latency_ns)]);
+	if (result == SYNC_RESULT_TRANSPORT)
+		STAT_INC(&h->transport_errors);
+	else if (result == SYNC_RESULT_MISMATCH)
+		STAT_INC(&h->mismatch_errors);
+
+	max = STAT_LOAD(&h->max_ns);
+	while (ns > max && !STAT_CAS(&h->max_ns, &max, ns))
+		;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Copy, and optionally reset, the statistics of one command
+ *******************************************************************************
+ * Each counter is read (and zeroed) atomically, so no exchange is lost or
+ * counted twice across resets, although exchanges recorded during the call
+ * may appear in only some of the counters.
+ *******************************************************************************
+ * \param stats - Statistics to read
+ * \param cmdid - Request command id (e.g. SPI_MLME_GET_REQUEST)
+ * \param reset - Nonzero to zero the counters as they are read
+ * \param snapshot - Receives the counters
+ *******************************************************************************
+ * \return Number of exchanges in the snapshot, or -1 if cmdid has no slot
+ *         (see SYNC_STATS_IDS)
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_sync_stats_snapshot(
+	struct ca821x_sync_stats    *stats,
+	uint8_t                      cmdid,
+	int                          reset,
+	struct ca821x_sync_snapshot *snapshot
+)
+{
+	struct ca821x_sync_hist *h;
+	unsigned b;
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	if (!sync_slots[cmdid])
+		return -1;
+	h = &stats->cmd[sync_slots[cmdid] - 1];
+	for (b = 0; b < SYNC_STATS_BUCKETS; b++) {
+		snapshot->buckets[b] = reset ? STAT_TAKE(&h->buckets[b]) :
+		                               STAT_LOAD(&h->buckets[b]);
+		snapshot->count += snapshot->buckets[b];
+	}
+	snapshot->max_ns = reset ? STAT_TAKE(&h->max_ns) : STAT_LOAD(&h->max_ns);
+	snapshot->transport_errors = reset ? STAT_TAKE(&h->transport_errors) :
+	                                     STAT_LOAD(&h->transport_errors);
+	snapshot->mismatch_errors = reset ? STAT_TAKE(&h->mismatch_errors) :
+	                                    STAT_LOAD(&h->mismatch_errors);
+	return (int)snapshot->count;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Histogram bucket of a latency
+ *******************************************************************************
+ * For histograms with the layout of ca821x_sync_snapshot.buckets kept
+ * elsewhere, such as the callback latencies of a replay.
+ *******************************************************************************
+ * \param latency_ns - Latency
+ *******************************************************************************
+ * \return Index of the bucket, below SYNC_STATS_BUCKETS
+ *******************************************************************************
+ ******************************************************************************/
+unsigned ca821x_sync_stats_bucket(uint64_t latency_ns)
+{
+	return bucket_index(latency_ns);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Latency percentile of a histogram
+ *******************************************************************************
+ * \param buckets - SYNC_STATS_BUCKETS counts, laid out as in
+ *                  ca821x_sync_snapshot
+ * \param count - Sum of the counts
+ * \param max_ns - Largest latency recorded, or 0 if unknown
+ * \param permille - Percentile in tenths of a percent (990 for p99)
+ *******************************************************************************
+ * \return Upper bound of the bucket holding the percentile in ns (at most
+ *         12.5% above the true value, and never above max_ns), or 0 if the
+ *         histogram is empty
+ *******************************************************************************
+ ******************************************************************************/
+uint64_t ca821x_sync_hist_percentile(
+	const uint32_t *buckets,
+	uint32_t        count,
+	uint32_t        max_ns,
+	unsigned        permille
+)
+{
+	uint64_t rank, seen = 0, upper;
+	unsigned b;
+
+	if (!count)
+		return 0;
+	if (permille > 1000)
+		permille = 1000;
+	rank = ((uint64_t)count * permille + 999) / 1000;
+	if (!rank)
+		rank = 1;
+	for (b = 0; b < SYNC_STATS_BUCKETS; b++) {
+		seen += buckets[b];
+		if (seen >= rank)
+			break;
+	}
+	upper = bucket_upper(b < SYNC_STATS_BUCKETS ? b : SYNC_STATS_BUCKETS - 1);
+	return (max_ns && upper > max_ns) ? max_ns : upper;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Latency percentile of a snapshot
+ *******************************************************************************
+ * \param snapshot - Snapshot from ca821x_sync_stats_snapshot
+ * \param permille - Percentile in tenths of a percent (990 for p99)
+ *******************************************************************************
+ * \return See ca821x_sync_hist_percentile
+ *******************************************************************************
+ ******************************************************************************/
+uint64_t ca821x_sync_snapshot_percentile(
+	const struct ca821x_sync_snapshot *snapshot,
+	unsigned                           permille
+)
+{
+	return ca821x_sync_hist_percentile(snapshot->buckets, snapshot->count,
+	                                   snapshot->max_ns, permille);
+}
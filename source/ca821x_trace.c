@@ -0,0 +1,188 @@
+/**
+ * @file ca821x_trace.c
+ * @brief Ring buffer trace of the frames exchanged with a ca821x.
+ *//*
+ * Copyright (C) 2017  Cascoda, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ca821x_api.h"
+#include "ca821x_trace.h"
+
+#ifdef CA821X_HAVE_ATOMICS
+#define TRACE_INIT(p, v)    atomic_init((p), (v))
+#define TRACE_CLAIM(p)      atomic_fetch_add_explicit((p), 1, memory_order_relaxed)
+#define TRACE_LOAD(p)       atomic_load_explicit((p), memory_order_acquire)
+#define TRACE_RELOAD(p)     atomic_load_explicit((p), memory_order_relaxed)
+#define TRACE_STORE(p, v)   atomic_store_explicit((p), (v), memory_order_relaxed)
+#define TRACE_OPEN(p)       (atomic_store_explicit((p), 0, memory_order_relaxed), \
+                             atomic_thread_fence(memory_order_release))
+#define TRACE_PUBLISH(p, v) atomic_store_explicit((p), (v), memory_order_release)
+#define TRACE_FENCE()       atomic_thread_fence(memory_order_acquire)
+#else
+#define TRACE_INIT(p, v)    (*(p) = (v))
+#define TRACE_CLAIM(p)      ((*(p))++)
+#define TRACE_LOAD(p)       (*(p))
+#define TRACE_RELOAD(p)     (*(p))
+#define TRACE_STORE(p, v)   (*(p) = (v))
+#define TRACE_OPEN(p)       (*(p) = 0)
+#define TRACE_PUBLISH(p, v) (*(p) = (v))
+#define TRACE_FENCE()
+#endif
+
+/** Word of a slot holding the record's seq, with len, dir and caplen */
+#define TRACE_SEQ_WORD      (offsetof(struct ca821x_trace_record, seq) / 8)
+
+typedef char trace_slot_size_check[
+	(sizeof(struct ca821x_trace_slot) == sizeof(struct ca821x_trace_record)) ? 1 : -1];
+
+/** A record as the words of a slot */
+union trace_words {
+	struct ca821x_trace_record record;
+	uint64_t                   words[CA821X_TRACE_WORDS];
+};
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Initialise a trace over caller-provided storage
+ *******************************************************************************
+ * \param trace - Trace to initialise
+ * \param slots - Storage for the ring
+ * \param num_slots - Number of slots, a power of two
+ *******************************************************************************
+ * \return 0: Success<br>
+ *         -EINVAL: num_slots is not a nonzero power of two
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_trace_init(
+	struct ca821x_trace      *trace,
+	struct ca821x_trace_slot *slots,
+	size_t                    num_slots
+)
+{
+	size_t i, w;
+
+	if (!num_slots || (num_slots & (num_slots - 1)) || num_slots > UINT32_MAX)
+		return -EINVAL;
+
+	memset(trace, 0, sizeof(*trace));
+	TRACE_INIT(&trace->head, 0);
+	trace->slots = slots;
+	trace->mask = (uint32_t)(num_slots - 1);
+	for (i = 0; i < num_slots; i++) {
+		for (w = 0; w < CA821X_TRACE_WORDS; w++)
+			TRACE_INIT(&slots[i].words[w], 0);
+	}
+
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Append a frame to a trace
+ *******************************************************************************
+ * Called by the api for every frame when the device has a trace attached.
+ *******************************************************************************
+ * \param trace - Trace to append to
+ * \param dir - Direction of the frame
+ * \param buf - Frame, starting with the command id
+ * \param len - Length of the frame in octets
+ * \param timestamp_ns - Time of the frame
+ *******************************************************************************
+ ******************************************************************************/
+void ca821x_trace_frame(
+	struct ca821x_trace   *trace,
+	enum ca821x_trace_dir  dir,
+	const uint8_t         *buf,
+	size_t                 len,
+	uint64_t               timestamp_ns
+)
+{
+	uint32_t idx = TRACE_CLAIM(&trace->head);
+	struct ca821x_trace_slot *slot = &trace->slots[idx & trace->mask];
+	size_t caplen = len < CA821X_TRACE_SNAPLEN ? len : CA821X_TRACE_SNAPLEN;
+	size_t w, words = (offsetof(struct ca821x_trace_record, data) + caplen + 7) / 8;
+	union trace_words r;
+
+	r.record.timestamp_ns = timestamp_ns;
+	r.record.seq = idx + 1;
+	r.record.len = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len;
+	r.record.dir = (uint8_t)dir;
+	r.record.caplen = (uint8_t)caplen;
+	memcpy(r.record.data, buf, caplen);
+
+	/* A seqlock: seq is idx + 1 once the record is complete, and 0 while it
+	 * is being written. Only the words holding the frame are stored */
+	TRACE_OPEN(&slot->words[TRACE_SEQ_WORD]);
+	for (w = 0; w < words; w++) {
+		if (w != TRACE_SEQ_WORD)
+			TRACE_STORE(&slot->words[w], r.words[w]);
+	}
+	TRACE_PUBLISH(&slot->words[TRACE_SEQ_WORD], r.words[TRACE_SEQ_WORD]);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Pass the records of a trace to a callback, oldest first
+ *******************************************************************************
+ * May be called while frames are being traced. Each record is copied before
+ * the callback sees it, and records that were overwritten during the copy are
+ * skipped.
+ *******************************************************************************
+ * \param trace - Trace to dump
+ * \param callback - Called with a copy of each record
+ * \param context - Passed to the callback
+ *******************************************************************************
+ * \return Number of records passed to the callback
+ *******************************************************************************
+ ******************************************************************************/
+int ca821x_trace_dump(
+	struct ca821x_trace  *trace,
+	ca821x_trace_dump_fn  callback,
+	void                 *context
+)
+{
+	uint32_t head = TRACE_RELOAD(&trace->head);
+	uint32_t count = head > trace->mask ? trace->mask + 1 : head;
+	uint32_t idx;
+	int dumped = 0;
+
+	for (idx = head - count; idx != head; idx++) {
+		const struct ca821x_trace_slot *slot = &trace->slots[idx & trace->mask];
+		union trace_words copy;
+		uint64_t seq_word = TRACE_LOAD(&slot->words[TRACE_SEQ_WORD]);
+		size_t w;
+
+		copy.words[TRACE_SEQ_WORD] = seq_word;
+		if (copy.record.seq != idx + 1)
+			continue;
+		/* Words past the frame are copied too, and are left unread */
+		for (w = 0; w < CA821X_TRACE_WORDS; w++) {
+			if (w != TRACE_SEQ_WORD)
+				copy.words[w] = TRACE_RELOAD(&slot->words[w]);
+		}
+		TRACE_FENCE();
+		if (TRACE_RELOAD(&slot->words[TRACE_SEQ_WORD]) != seq_word)
+			continue;
+		callback(&copy.record, context);
+		dumped++;
+	}
+
+	return dumped;
+}
@@ -17,10 +17,37 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <dirent.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "ca821x_aes.h"
 #include "ca821x_api.h"
+#include "ca821x_beacon.h"
+#include "ca821x_capture.h"
+#include "ca821x_chansel.h"
+#include "ca821x_dedup.h"
+#include "ca821x_fc_journal.h"
+#include "ca821x_fcs.h"
+#include "ca821x_haes.h"
+#include "ca821x_frame.h"
+#include "ca821x_link.h"
+#include "ca821x_neighbour.h"
+#include "ca821x_pcps.h"
+#include "ca821x_replay.h"
+#include "ca821x_rxfilter.h"
+#include "ca821x_scan.h"
+#include "ca821x_sec.h"
+#include "ca821x_sec_mirror.h"
+#include "ca821x_sim.h"
+#include "ca821x_sim_medium.h"
+#include "ca821x_store.h"
+#include "ca821x_subscribe.h"
+#include "ca821x_sync_stats.h"
+#include "ca821x_trace.h"
 
 static int sReturnValue;
 
@@ -1393,10 +1420,2929 @@ int api_callbacks_test(void)
 	return 0;
 }
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Downstream function that answers synchronous commands without
+ *        checking them
+ *******************************************************************************
+ * Used by tests of modules built on top of the API functions, where the API
+ * frames themselves have already been verified by api_functions_test.
+ *******************************************************************************
+ * \param buf - Constructed command frame
+ * \param len - Length of frame
+ * \param response - Buffer to populate with synchronous response
+ * \param pDeviceRef - Device reference
+ *******************************************************************************
+ ******************************************************************************/
+int respond_command(
+	const uint8_t *buf,
+	size_t len,
+	uint8_t *response,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	if (response)
+		populate_response(buf[0], response);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Prints the result of a module test step and records failures
+ *******************************************************************************
+ * \param name - Name of the test step
+ * \param pass - Nonzero if the step passed
+ *******************************************************************************
+ ******************************************************************************/
+void check_result(const char *name, int pass)
+{
+	printf("%-35s", name);
+	if (pass) {
+		printf(ANSI_COLOR_GREEN "Success\n" ANSI_COLOR_RESET);
+	} else {
+		printf(ANSI_COLOR_RED "Fail\n" ANSI_COLOR_RESET);
+		sReturnValue = -1;
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Channel selection engine test
+ *******************************************************************************
+ * Feeds an ED scan and a run of failed transmissions into the engine and
+ * checks that it migrates to the quietest channel, not again during the
+ * hold-off, and again once the hold-off has passed.
+ *******************************************************************************
+ ******************************************************************************/
+int chansel_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_chansel cs;
+	struct MAC_Message scan_cnf;
+	struct MCPS_DATA_confirm_pset data_cnf;
+	uint8_t channel;
+	int i;
+	printf(ANSI_COLOR_CYAN "Testing channel selection...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	test_dev.ca821x_api_downstream = respond_command;
+	ca821x_chansel_init(&cs, TEST_CHANNEL, M_ValidChannels);
+
+	/* ED scan of channels 11-26, channel 20 is the quietest */
+	memset(&scan_cnf, 0, sizeof(scan_cnf));
+	scan_cnf.PData.ScanCnf.ScanType = ENERGY_DETECT;
+	scan_cnf.PData.ScanCnf.ResultListSize = 16;
+	for (i = 0; i < 16; i++)
+		scan_cnf.PData.ScanCnf.ResultList[i] = 0x80;
+	scan_cnf.PData.ScanCnf.ResultList[20 - M_MinimumChannel] = 0x10;
+	scan_cnf.PData.ScanCnf.ResultList[TEST_CHANNEL - M_MinimumChannel] = 0x20;
+	ca821x_chansel_process_scan(&cs, M_ValidChannels, &scan_cnf.PData.ScanCnf);
+	check_result("chansel scan scores... ",
+		ca821x_chansel_get_score(&cs, 20) == 0x1000 &&
+		ca821x_chansel_get_score(&cs, 26) == 0x8000);
+
+	/* Healthy channel: no move */
+	data_cnf.Status = MAC_SUCCESS;
+	for (i = 0; i < CHANSEL_DEF_MIN_SAMPLES; i++)
+		ca821x_chansel_process_datacnf(&cs, &data_cnf);
+	check_result("chansel stays when healthy... ", ca821x_chansel_evaluate(&cs) == 0);
+
+	/* Degraded channel: move to 20 */
+	data_cnf.Status = MAC_NO_ACK;
+	for (i = 0; i < CHANSEL_DEF_MIN_SAMPLES; i++)
+		ca821x_chansel_process_datacnf(&cs, &data_cnf);
+	channel = ca821x_chansel_evaluate(&cs);
+	check_result("chansel moves when degraded... ", channel == 20);
+	check_result("chansel migrate... ",
+		ca821x_chansel_migrate(&cs, channel, 0xCA5C, 15, 15, NULL, NULL,
+		                       &test_dev) == MAC_SUCCESS &&
+		cs.current_channel == 20);
+
+	/* Hold-off prevents flapping straight back */
+	for (i = 0; i < CHANSEL_DEF_MIN_SAMPLES; i++)
+		ca821x_chansel_process_datacnf(&cs, &data_cnf);
+	check_result("chansel holdoff... ", ca821x_chansel_evaluate(&cs) == 0);
+
+	/* Once the hold-off has passed, a degraded channel is left again */
+	for (i = 1; i < CHANSEL_DEF_HOLDOFF; i++)
+		ca821x_chansel_evaluate(&cs);
+	for (i = 0; i < CHANSEL_DEF_MIN_SAMPLES; i++)
+		ca821x_chansel_process_datacnf(&cs, &data_cnf);
+	channel = ca821x_chansel_evaluate(&cs);
+	check_result("chansel moves after holdoff... ",
+		channel && channel != 20 && channel != TEST_CHANNEL &&
+		ca821x_chansel_get_score(&cs, 20) == CHANSEL_SCORE_RATIO(256));
+	printf("Channel selection test complete\n\n");
+	return 0;
+}
+
+/** Number of PAN descriptors in the scan_test confirm, more than a MAC_Message holds */
+#define SCAN_TEST_PDESCS    (10)
+/** Descriptor of the scan_test confirm from a secured beacon */
+#define SCAN_TEST_SECURED   (4)
+
+static int scan_test_count, scan_test_ok;
+static uint8_t scan_test_channels[SCAN_TEST_PDESCS];
+
+/** Beacon LQI of the nth descriptor, every third is below the api's limit */
+static uint8_t scan_test_lqi(int n)
+{
+	return (n % 3 == 0) ? 20 : 200;
+}
+
+/** Beacon LQI of the nth descriptor, every third is 0 */
+static uint8_t scan_test_lqi_zero(int n)
+{
+	return (n % 3 == 0) ? 0 : 200;
+}
+
+static int scan_test_confirm(
+	struct MLME_SCAN_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct ca821x_scan_iter it;
+	const struct PanDescriptor *pdesc;
+
+	scan_test_count = 0;
+	scan_test_ok = !ca821x_scan_iter_init(&it, params, CA821X_SCAN_CNF_LEN(params));
+	while ((pdesc = ca821x_scan_next_pan(&it))) {
+		if ((pDeviceRef->lqi_limit && pdesc->LinkQuality <= pDeviceRef->lqi_limit) ||
+		    scan_test_count >= SCAN_TEST_PDESCS)
+			scan_test_ok = 0;
+		else
+			scan_test_channels[scan_test_count++] = pdesc->LogicalChannel;
+	}
+	if (it.remaining || it.next != it.end)
+		scan_test_ok = 0;
+	return 0;
+}
+
+/** Builds an active scan confirm of SCAN_TEST_PDESCS descriptors, returning its length */
+static size_t scan_test_build(uint8_t *buf, uint8_t (*lqi)(int n))
+{
+	struct PanDescriptor *pdesc;
+	uint8_t *p = buf + 2 + MLME_SCAN_CONFIRM_BASE_SIZE;
+	int i;
+
+	memset(buf, 0, 2 + MLME_SCAN_CONFIRM_BASE_SIZE);
+	buf[0] = SPI_MLME_SCAN_CONFIRM;
+	((struct MLME_SCAN_confirm_pset *)(buf + 2))->Status = MAC_SUCCESS;
+	((struct MLME_SCAN_confirm_pset *)(buf + 2))->ScanType = ACTIVE_SCAN;
+	((struct MLME_SCAN_confirm_pset *)(buf + 2))->ResultListSize = SCAN_TEST_PDESCS;
+	for (i = 0; i < SCAN_TEST_PDESCS; i++) {
+		pdesc = (struct PanDescriptor *)p;
+		memset(pdesc, 0, sizeof(*pdesc));
+		pdesc->Coord.AddressMode = MAC_MODE_SHORT_ADDR;
+		PUTLE16(0xCA5C, pdesc->Coord.PANId);
+		PUTLE16(i, pdesc->Coord.Address);
+		pdesc->LogicalChannel = (uint8_t)(M_MinimumChannel + i);
+		pdesc->LinkQuality = lqi(i);
+		if (i == SCAN_TEST_SECURED) {
+			pdesc->Security.SecurityLevel = 5;
+			pdesc->Security.KeyIdMode = 1;
+			pdesc->Security.KeyIndex = 0x42;
+		}
+		p += ca821x_pan_descriptor_len(pdesc);
+	}
+	buf[1] = (uint8_t)(p - buf - 2);
+	return (size_t)(p - buf);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Scan result iterator test
+ *******************************************************************************
+ * Walks an active scan confirm longer than a MAC_Message, with a secured
+ * descriptor in the middle, directly and through the api's LQI filter at
+ * several limits, and checks that truncated lists and energy detect results
+ * are bounded.
+ *******************************************************************************
+ ******************************************************************************/
+int scan_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_scan_iter it;
+	const struct PanDescriptor *pdesc;
+	struct MAC_Message ed_cnf;
+	uint8_t buf[2 + 255];
+	size_t len;
+	int i, count = 0, ok = 1, expected = 0;
+	printf(ANSI_COLOR_CYAN "Testing scan result iterator...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	test_dev.callbacks.MLME_SCAN_confirm = scan_test_confirm;
+
+	len = scan_test_build(buf, scan_test_lqi);
+	ca821x_scan_iter_init(&it, (struct MLME_SCAN_confirm_pset *)(buf + 2), buf[1]);
+	while ((pdesc = ca821x_scan_next_pan(&it))) {
+		if (pdesc->LogicalChannel != M_MinimumChannel + count ||
+		    (count == SCAN_TEST_SECURED && pdesc->Security.KeyIndex != 0x42))
+			ok = 0;
+		count++;
+	}
+	check_result("scan iterates all descriptors... ",
+		len > sizeof(struct MAC_Message) && ok && count == SCAN_TEST_PDESCS &&
+		it.remaining == 0 && ca821x_scan_next_ed(&it) == -1);
+
+	ca821x_scan_iter_init(&it, (struct MLME_SCAN_confirm_pset *)(buf + 2), buf[1] - 5);
+	for (count = 0; ca821x_scan_next_pan(&it); count++)
+		;
+	check_result("scan stops at truncation... ",
+		count == SCAN_TEST_PDESCS - 1 && it.remaining == 1);
+
+	ok = 1;
+	ca821x_downstream_dispatch(buf, len, &test_dev);
+	for (i = 0; i < SCAN_TEST_PDESCS; i++) {
+		if (scan_test_lqi(i) <= API_LQI_LIMIT)
+			continue;
+		if (scan_test_channels[expected++] != M_MinimumChannel + i)
+			ok = 0;
+	}
+	check_result("scan filters low LQI... ",
+		scan_test_ok && ok && scan_test_count == expected &&
+		buf[2 + 6] == expected &&
+		buf[1] == len - 2 - (SCAN_TEST_PDESCS - expected) * PAN_DESCRIPTOR_BASE_SIZE);
+
+	test_dev.lqi_limit = 0;
+	len = scan_test_build(buf, scan_test_lqi_zero);
+	ca821x_downstream_dispatch(buf, len, &test_dev);
+	check_result("scan per-device LQI limit... ",
+		scan_test_ok && scan_test_count == SCAN_TEST_PDESCS &&
+		buf[2 + 6] == SCAN_TEST_PDESCS && buf[1] == len - 2);
+	test_dev.lqi_limit = 255;
+	len = scan_test_build(buf, scan_test_lqi);
+	ca821x_downstream_dispatch(buf, len, &test_dev);
+	check_result("scan all filtered... ",
+		scan_test_count == 0 && buf[1] == MLME_SCAN_CONFIRM_BASE_SIZE &&
+		((struct MLME_SCAN_confirm_pset *)(buf + 2))->Status == MAC_NO_BEACON);
+
+	memset(&ed_cnf, 0, sizeof(ed_cnf));
+	ed_cnf.PData.ScanCnf.ScanType = ENERGY_DETECT;
+	ed_cnf.PData.ScanCnf.ResultListSize = 3;
+	ed_cnf.PData.ScanCnf.ResultList[0] = 0x10;
+	ed_cnf.PData.ScanCnf.ResultList[1] = 0x20;
+	ed_cnf.PData.ScanCnf.ResultList[2] = 0x30;
+	ed_cnf.Length = MLME_SCAN_CONFIRM_BASE_SIZE + 2;
+	ca821x_scan_iter_init(&it, &ed_cnf.PData.ScanCnf, ed_cnf.Length);
+	check_result("scan ED results... ",
+		ca821x_scan_next_pan(&it) == NULL && ca821x_scan_next_ed(&it) == 0x10 &&
+		ca821x_scan_next_ed(&it) == 0x20 && ca821x_scan_next_ed(&it) == -1);
+	printf("Scan result iterator test complete\n\n");
+	return 0;
+}
+
+/** Builds a beacon notify with pending addresses and a payload, returning its parameter length */
+static size_t beacon_test_build(uint8_t *buf, int secured)
+{
+	static const uint8_t ext[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	struct PanDescriptor *pdesc = (struct PanDescriptor *)(buf + 1);
+	uint8_t *p;
+
+	memset(buf, 0, 1 + sizeof(struct PanDescriptor));
+	buf[0] = 0x33;
+	pdesc->Coord.AddressMode = MAC_MODE_SHORT_ADDR;
+	pdesc->LinkQuality = 200;
+	pdesc->Security.SecurityLevel = secured ? 5 : 0;
+	p = buf + 1 + ca821x_pan_descriptor_len(pdesc);
+	*p++ = 2 | (1 << 4);
+	PUTLE16(0x1234, p);
+	PUTLE16(0x0010, p + 2);
+	memcpy(p + 4, ext, 8);
+	p += 12;
+	*p++ = 5;
+	memcpy(p, "hello", 5);
+	return (size_t)(p + 5 - buf);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Beacon notify parser test
+ *******************************************************************************
+ * Parses beacon notifies with and without a secured PAN descriptor, checks
+ * the pending address lookups and that every truncation is rejected.
+ *******************************************************************************
+ ******************************************************************************/
+int beacon_test(void)
+{
+	static const uint8_t ext[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	struct MLME_BEACON_NOTIFY_indication_pset *ind;
+	struct ca821x_beacon_view view;
+	struct ca821x_dev test_dev;
+	uint8_t buf[128], other[8] = {0};
+	size_t len, trunc;
+	int secured, ok;
+	printf(ANSI_COLOR_CYAN "Testing beacon notify parser...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ind = (struct MLME_BEACON_NOTIFY_indication_pset *)buf;
+
+	for (secured = 0; secured <= 1; secured++) {
+		len = beacon_test_build(buf, secured);
+		ok = 1;
+		for (trunc = 0; trunc < len; trunc++)
+			if (ca821x_beacon_parse(&view, ind, trunc) == 0)
+				ok = 0;
+		check_result(secured ? "beacon secured fields... " : "beacon fields... ",
+			ca821x_beacon_parse(&view, ind, len) == 0 && view.bsn == 0x33 &&
+			view.pan->LinkQuality == 200 && view.num_short == 2 &&
+			GETLE16(view.short_addrs + 2) == 0x0010 && view.num_ext == 1 &&
+			!memcmp(view.ext_addrs, ext, 8) && view.payload_len == 5 &&
+			!memcmp(view.payload, "hello", 5) && view.payload + 5 == buf + len);
+		check_result("beacon rejects truncation... ", ok);
+	}
+
+	check_result("beacon pending addresses... ",
+		ca821x_beacon_addr_pending(&view, 0x1234, NULL) &&
+		!ca821x_beacon_addr_pending(&view, 0x4321, other) &&
+		!ca821x_beacon_addr_pending(&view, 0xFFFF, NULL) &&
+		ca821x_beacon_addr_pending(&view, 0xFFFE, ext));
+	ok = !ca821x_beacon_dev_pending(&view, &test_dev);
+	test_dev.shortaddr = 0x0010;
+	ok = ok && ca821x_beacon_dev_pending(&view, &test_dev);
+	test_dev.shortaddr = 0xFFFF;
+	memcpy(test_dev.extaddr, ext, 8);
+	check_result("beacon device pending... ",
+		ok && ca821x_beacon_dev_pending(&view, &test_dev));
+	printf("Beacon notify parser test complete\n\n");
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief MAC frame codec test
+ *******************************************************************************
+ * Builds and decodes frames with every pair of addressing modes, with and
+ * without PAN id compression, and secured frames with every key identifier
+ * mode. Checks that reserved modes, unsupported versions and truncations
+ * are rejected.
+ *******************************************************************************
+ ******************************************************************************/
+int frame_test(void)
+{
+	static const uint8_t ext[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	static const uint8_t payload[4] = {0xde, 0xad, 0xbe, 0xef};
+	static const uint8_t big[aMaxPHYPacketSize] = {0};
+	struct ca821x_frame_hdr hdr;
+	struct ca821x_frame frame;
+	struct FullAddr src, dst;
+	uint8_t buf[aMaxPHYPacketSize];
+	int dam, sam, comp, mode, len, trunc, ok = 1, trunc_ok = 1;
+	printf(ANSI_COLOR_CYAN "Testing MAC frame codec...\n" ANSI_COLOR_RESET);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.fc = MAC_FC_FT_DATA | MAC_FC_ACK_REQ;
+	hdr.dsn = 0x5a;
+	memcpy(hdr.dst.Address, ext, 8);
+	memcpy(hdr.src.Address, ext, 8);
+	hdr.src.Address[0] = 0x99;
+	for (dam = 0; dam <= 3; dam++) {
+		if (dam == MAC_MODE_RESERVED)
+			continue;
+		for (sam = 0; sam <= 3; sam++) {
+			if (sam == MAC_MODE_RESERVED)
+				continue;
+			for (comp = 0; comp <= 1; comp++) {
+				hdr.dst.AddressMode = dam;
+				hdr.src.AddressMode = sam;
+				PUTLE16(0x1aaa, hdr.dst.PANId);
+				PUTLE16(comp ? 0x1aaa : 0x2bbb, hdr.src.PANId);
+				len = ca821x_frame_build(buf, sizeof(buf), &hdr, payload, sizeof(payload));
+				if (len < 0 ||
+				    ca821x_frame_decode(&frame, buf, len, 0) ||
+				    frame.type != MAC_FC_FT_DATA || frame.dsn != 0x5a || !(frame.fc & MAC_FC_ACK_REQ) ||
+				    frame.dst_mode != dam || frame.src_mode != sam ||
+				    frame.payload_len != sizeof(payload) ||
+				    memcmp(frame.payload, payload, sizeof(payload)) ||
+				    frame.payload + sizeof(payload) != buf + len) {
+					ok = 0;
+					continue;
+				}
+				ca821x_frame_get_addrs(&frame, &src, &dst);
+				if (dst.AddressMode != dam || src.AddressMode != sam ||
+				    (dam && (memcmp(dst.PANId, hdr.dst.PANId, 2) ||
+				             memcmp(dst.Address, hdr.dst.Address, dam == MAC_MODE_SHORT_ADDR ? 2 : 8))) ||
+				    (sam && (memcmp(src.PANId, hdr.src.PANId, 2) ||
+				             memcmp(src.Address, hdr.src.Address, sam == MAC_MODE_SHORT_ADDR ? 2 : 8))) ||
+				    (dam && sam && !(frame.fc & MAC_FC_PAN_COMP) != !comp))
+					ok = 0;
+				for (trunc = 0; trunc < frame.hdr_len; trunc++)
+					if (ca821x_frame_decode(&frame, buf, trunc, 0) == 0)
+						trunc_ok = 0;
+			}
+		}
+	}
+	check_result("frame addressing round trip... ", ok);
+	check_result("frame rejects truncated header... ", trunc_ok);
+
+	hdr.dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	hdr.src.AddressMode = MAC_MODE_LONG_ADDR;
+	PUTLE16(0x1aaa, hdr.src.PANId);
+	hdr.security.SecurityLevel = 5;
+	hdr.frame_counter = 0x01020304;
+	memcpy(hdr.security.KeySource, ext, 8);
+	hdr.security.KeyIndex = 7;
+	ok = 1;
+	for (mode = 0; mode <= 3; mode++) {
+		hdr.security.KeyIdMode = mode;
+		len = ca821x_frame_build(buf, sizeof(buf), &hdr, payload, sizeof(payload));
+		if (len != 3 + 2 + 2 + 8 + 5 + (mode ? 1 + 4 * (mode - 1) : 0) + 4 ||
+		    ca821x_frame_decode(&frame, buf, len, 0) ||
+		    MAC_FC_VER(frame.fc) != 1 || !(frame.fc & MAC_FC_SEC_ENA) ||
+		    frame.sec_level != 5 || frame.key_id_mode != mode ||
+		    frame.frame_counter != 0x01020304 || frame.mic_len != 4 ||
+		    frame.key_index != (mode ? 7 : 0) ||
+		    (mode > 1) != (frame.key_source != NULL) ||
+		    (mode > 1 && memcmp(frame.key_source, ext, mode == 2 ? 4 : 8)) ||
+		    frame.payload_len != sizeof(payload))
+			ok = 0;
+	}
+	check_result("frame security header... ", ok);
+	check_result("frame rejects short MIC... ",
+		ca821x_frame_decode(&frame, buf, len - 1, 0) == -1);
+	check_result("frame FCS excluded... ",
+		ca821x_frame_decode(&frame, buf, len + MAC_FCS_LEN, 1) == 0 &&
+		frame.payload_len == sizeof(payload) &&
+		ca821x_frame_decode(&frame, buf, 1, 1) == -1);
+
+	hdr.security.SecurityLevel = 0;
+	len = ca821x_frame_build(buf, sizeof(buf), &hdr, payload, sizeof(payload));
+	ok = len > 0 && MAC_FC_VER(GETLE16(buf)) == 0;
+	ok = ok && ca821x_frame_decode(&frame, buf, len, 0) == 0;
+	buf[1] |= 0x20;
+	ok = ok && ca821x_frame_decode(&frame, buf, len, 0) == -1;
+	buf[1] |= 0x30;
+	ok = ok && ca821x_frame_decode(&frame, buf, len, 0) == -1;
+	buf[1] &= ~0x30;
+	buf[0] |= 0x08;
+	check_result("frame rejects bad versions... ",
+		ok && ca821x_frame_decode(&frame, buf, len, 0) == -1);
+
+	hdr.dst.AddressMode = MAC_MODE_RESERVED;
+	ok = ca821x_frame_build(buf, sizeof(buf), &hdr, NULL, 0) == -1;
+	hdr.dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	ok = ok && ca821x_frame_build(buf, 10, &hdr, payload, sizeof(payload)) == -1;
+	len = ca821x_frame_build(buf, sizeof(buf), &hdr, NULL, 0);
+	ok = ok && len == 15;
+	ok = ok && ca821x_frame_build(buf, sizeof(buf), &hdr, big,
+		aMaxPHYPacketSize - MAC_FCS_LEN - len + 1) == -1;
+	check_result("frame build limits... ", ok &&
+		ca821x_frame_build(buf, sizeof(buf), &hdr, big,
+		aMaxPHYPacketSize - MAC_FCS_LEN - len) == aMaxPHYPacketSize - MAC_FCS_LEN);
+	buf[1] = (buf[1] & ~0x0c) | 0x04;
+	check_result("frame rejects reserved mode... ",
+		ca821x_frame_decode(&frame, buf, len, 0) == -1);
+	printf("MAC frame codec test complete\n\n");
+	return 0;
+}
+
+/** Bit at a time CRC-16/ITU-T, the reference for the FCS implementations */
+static uint16_t fcs_test_reference(uint16_t crc, const uint8_t *buf, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return crc;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief FCS test
+ *******************************************************************************
+ * Checks both FCS implementations against a bitwise reference over many
+ * lengths and alignments, that an FCS can be computed in pieces, and that
+ * appended FCSs verify and detect corruption.
+ *******************************************************************************
+ ******************************************************************************/
+int fcs_test(void)
+{
+	static uint8_t buf[1100];
+	uint16_t crc;
+	size_t len, off, split;
+	int ok = 1;
+	printf(ANSI_COLOR_CYAN "Testing FCS...\n" ANSI_COLOR_RESET);
+	for (len = 0; len < sizeof(buf); len++)
+		buf[len] = (uint8_t)(len * 167 + (len >> 3));
+
+	check_result("fcs check value... ",
+		ca821x_fcs_update(CA821X_FCS_INIT, (const uint8_t *)"123456789", 9) == 0x2189 &&
+		ca821x_fcs_update_portable(CA821X_FCS_INIT, (const uint8_t *)"123456789", 9) == 0x2189);
+	for (off = 0; off < 8; off++) {
+		for (len = 0; len + off <= 1030; len += len < 300 ? 1 : 37) {
+			crc = fcs_test_reference(0x1D0F, buf + off, len);
+			ok &= ca821x_fcs_update(0x1D0F, buf + off, len) == crc &&
+			      ca821x_fcs_update_portable(0x1D0F, buf + off, len) == crc;
+		}
+	}
+	check_result(ca821x_fcs_impl() == CA821X_FCS_CLMUL ?
+		"fcs matches reference (clmul)... " : "fcs matches reference... ", ok);
+
+	ok = 1;
+	crc = fcs_test_reference(CA821X_FCS_INIT, buf, 1000);
+	for (split = 0; split <= 1000; split += 61)
+		ok &= ca821x_fcs_update(ca821x_fcs_update(CA821X_FCS_INIT, buf, split),
+		                        buf + split, 1000 - split) == crc;
+	check_result("fcs in pieces... ", ok);
+
+	ca821x_fcs_append(buf, aMaxPHYPacketSize);
+	ok = ca821x_fcs_check(buf, aMaxPHYPacketSize) && !ca821x_fcs_check(buf, 1);
+	buf[40] ^= 0x10;
+	check_result("fcs append and check... ", ok && !ca821x_fcs_check(buf, aMaxPHYPacketSize));
+	printf("FCS test complete\n\n");
+	return 0;
+}
+
+/** HWME-HAES exchanges answered by haes_test_command, and the one to fail */
+static int haes_test_exchanges, haes_test_fail_at;
+
+/** Stand-in for AES: XOR with a key, then rotate the block by one octet */
+static void haes_test_cipher(uint8_t mode, uint8_t *block)
+{
+	uint8_t tmp[16];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (mode == HAES_MODE_ENCRYPT)
+			tmp[(i + 1) & 15] = block[i] ^ (uint8_t)(0xA5 + i);
+		else
+			tmp[i] = block[(i + 1) & 15] ^ (uint8_t)(0xA5 + i);
+	}
+	memcpy(block, tmp, 16);
+}
+
+static int haes_test_command(
+	const uint8_t *buf,
+	size_t len,
+	uint8_t *response,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct MAC_Message *rsp = (struct MAC_Message *)response;
+
+	rsp->CommandId = SPI_HWME_HAES_CONFIRM;
+	rsp->Length = sizeof(struct HWME_HAES_confirm_pset);
+	rsp->PData.HWMEHAESCnf.Status = HWME_SUCCESS;
+	memcpy(rsp->PData.HWMEHAESCnf.HAESData, buf + 3, 16);
+	if (++haes_test_exchanges == haes_test_fail_at)
+		rsp->PData.HWMEHAESCnf.Status = HWME_UNKNOWN;
+	else
+		haes_test_cipher(buf[2], rsp->PData.HWMEHAESCnf.HAESData);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Multi-block hardware AES test
+ *******************************************************************************
+ * Runs the block, counter mode and CBC-MAC helpers against a device whose
+ * "AES" is an easily computed permutation, and checks them against the same
+ * modes composed by hand.
+ *******************************************************************************
+ ******************************************************************************/
+int haes_test(void)
+{
+	struct ca821x_dev test_dev;
+	uint8_t data[100], ref[100], blocks[48], ctr[16], ctr2[16], stream[16];
+	uint8_t mac[16], mac_ref[16];
+	size_t i, j;
+	uint8_t status;
+	printf(ANSI_COLOR_CYAN "Testing multi-block hardware AES...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	test_dev.ca821x_api_downstream = haes_test_command;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = ref[i] = (uint8_t)(i * 7);
+	memcpy(blocks, data, sizeof(blocks));
+	haes_test_exchanges = 0;
+	haes_test_fail_at = 0;
+	status = ca821x_haes_blocks(HAES_MODE_ENCRYPT, blocks, 3, &test_dev);
+	for (i = 0; i < 3; i++)
+		haes_test_cipher(HAES_MODE_ENCRYPT, ref + i * 16);
+	check_result("haes blocks encrypt... ", status == HWME_SUCCESS &&
+		haes_test_exchanges == 3 && !memcmp(blocks, ref, sizeof(blocks)));
+	status = ca821x_haes_blocks(HAES_MODE_DECRYPT, blocks, 3, &test_dev);
+	check_result("haes blocks decrypt... ", status == HWME_SUCCESS &&
+		!memcmp(blocks, data, sizeof(blocks)));
+
+	haes_test_exchanges = 0;
+	haes_test_fail_at = 2;
+	status = ca821x_haes_blocks(HAES_MODE_ENCRYPT, blocks, 3, &test_dev);
+	check_result("haes blocks error... ", status == HWME_UNKNOWN &&
+		haes_test_exchanges == 2 && !memcmp(blocks, ref, 16) &&
+		!memcmp(blocks + 16, data + 16, 32));
+
+	/* Counter mode over 7 blocks, with a carry into the high counter octet */
+	memset(ctr, 0x11, sizeof(ctr));
+	ctr[14] = 0x00;
+	ctr[15] = 0xFD;
+	memcpy(ctr2, ctr, sizeof(ctr));
+	memcpy(ref, data, sizeof(ref));
+	for (i = 0; i < sizeof(ref); i += 16) {
+		memcpy(stream, ctr2, 16);
+		haes_test_cipher(HAES_MODE_ENCRYPT, stream);
+		for (j = i; j < i + 16 && j < sizeof(ref); j++)
+			ref[j] ^= stream[j - i];
+		if (!++ctr2[15])
+			ctr2[14]++;
+	}
+	haes_test_exchanges = 0;
+	haes_test_fail_at = 0;
+	status = ca821x_haes_ctr(ctr, data, sizeof(data), &test_dev);
+	check_result("haes ctr encrypt... ", status == HWME_SUCCESS &&
+		haes_test_exchanges == 7 && !memcmp(data, ref, sizeof(data)) &&
+		!memcmp(ctr, ctr2, sizeof(ctr)) && ctr[14] == 0x01 && ctr[15] == 0x04);
+	ctr[14] = 0x00;
+	ctr[15] = 0xFD;
+	status = ca821x_haes_ctr(ctr, data, 32, &test_dev);
+	if (status == HWME_SUCCESS)
+		status = ca821x_haes_ctr(ctr, data + 32, sizeof(data) - 32, &test_dev);
+	for (i = 0; i < sizeof(data) && data[i] == (uint8_t)(i * 7); i++)
+		;
+	check_result("haes ctr in pieces... ", status == HWME_SUCCESS &&
+		i == sizeof(data) && !memcmp(ctr, ctr2, sizeof(ctr)));
+
+	/* CBC-MAC of two separately padded pieces */
+	memset(ref, 0, sizeof(ref));
+	memcpy(ref, data, 20);
+	memcpy(ref + 32, data + 20, 37);
+	memset(mac_ref, 0, sizeof(mac_ref));
+	for (i = 0; i < 80; i += 16) {
+		for (j = 0; j < 16; j++)
+			mac_ref[j] ^= ref[i + j];
+		haes_test_cipher(HAES_MODE_ENCRYPT, mac_ref);
+	}
+	memset(mac, 0, sizeof(mac));
+	haes_test_exchanges = 0;
+	status = ca821x_haes_cbc_mac(mac, data, 20, &test_dev);
+	if (status == HWME_SUCCESS)
+		status = ca821x_haes_cbc_mac(mac, data + 20, 37, &test_dev);
+	check_result("haes cbc-mac... ", status == HWME_SUCCESS &&
+		haes_test_exchanges == 5 && !memcmp(mac, mac_ref, sizeof(mac)));
+
+	haes_test_exchanges = 0;
+	haes_test_fail_at = 1;
+	check_result("haes cbc-mac error... ",
+		ca821x_haes_cbc_mac(mac, data, 20, &test_dev) == HWME_UNKNOWN &&
+		haes_test_exchanges == 1);
+	printf("Multi-block hardware AES test complete\n\n");
+	return 0;
+}
+
+/** Secured data frame of IEEE 802.15.4-2006 annex C.2.2, with key C0..CF */
+static const uint8_t sec_test_annex_frame[] = {
+	0x69, 0xDC, 0x84, 0x21, 0x43, 0x02, 0x00, 0x00, 0x00, 0x00, 0x48, 0xDE,
+	0xAC, 0x01, 0x00, 0x00, 0x00, 0x00, 0x48, 0xDE, 0xAC, 0x04, 0x05, 0x00,
+	0x00, 0x00, 0xD4, 0x3E, 0x02, 0x2B
+};
+
+/** Add an implicit (key identifier mode 0) lookup entry for an address */
+static void sec_test_add_lookup(struct M_KeyDescriptor *desc, const uint8_t *ext_addr)
+{
+	struct M_KeyIdLookupDesc *lookup =
+		&desc->KeyIdLookupList[desc->Fixed.KeyIdLookupListEntries++];
+
+	memcpy(lookup->LookupData, ext_addr, 8);
+	lookup->LookupData[8] = 0;
+	lookup->LookupDataSizeCode = 1;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Host frame security test
+ *******************************************************************************
+ * Checks AES against FIPS-197 and both implementations against each other,
+ * CCM* against RFC 3610, then secures and unsecures frames, including the
+ * data frame example of IEEE 802.15.4-2006.
+ *******************************************************************************
+ ******************************************************************************/
+int sec_test(void)
+{
+	static const uint8_t fips_pt[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+	static const uint8_t fips_ct[16] = {
+		0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30,
+		0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A};
+	static const uint8_t rfc_nonce[13] = {
+		0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+	static const uint8_t rfc_out[31] = {
+		0x58, 0x8C, 0x97, 0x9A, 0x61, 0xC6, 0x63, 0xD2, 0xF0, 0x66, 0xD0, 0xC2,
+		0xC0, 0xF9, 0x89, 0x80, 0x6D, 0x5F, 0x6B, 0x61, 0xDA, 0xC3, 0x84, 0x17,
+		0xE8, 0xD1, 0x2C, 0xFD, 0xF9, 0x26, 0xE0};
+	static const uint8_t dst_ext[8] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x48, 0xDE, 0xAC};
+	static const uint8_t src_ext[8] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x48, 0xDE, 0xAC};
+	struct ca821x_sec_keytab tab;
+	struct M_KeyDescriptor desc;
+	struct ca821x_aes_key key;
+	struct ca821x_frame_hdr hdr;
+	struct ca821x_frame frame;
+	uint8_t k[16], in[16], out[16], ref[16], ctr[16], ctr2[16], data[100], mic[8];
+	uint8_t buf[aMaxPHYPacketSize];
+	size_t i, j;
+	int len, ok = 1;
+	printf(ANSI_COLOR_CYAN "Testing host frame security...\n" ANSI_COLOR_RESET);
+
+	for (i = 0; i < 16; i++)
+		k[i] = (uint8_t)i;
+	ca821x_aes_set_key(&key, k);
+	ca821x_aes_encrypt(&key, fips_pt, out);
+	ca821x_aes_encrypt_portable(&key, fips_pt, ref);
+	check_result("aes fips-197... ", !memcmp(out, fips_ct, 16) && !memcmp(ref, fips_ct, 16));
+	for (i = 0; i < 64; i++) {
+		for (j = 0; j < 16; j++) {
+			k[j] = (uint8_t)(i * 31 + j * 7);
+			in[j] = (uint8_t)(i * 13 + j * 101);
+		}
+		ca821x_aes_set_key(&key, k);
+		ca821x_aes_encrypt(&key, in, out);
+		ca821x_aes_encrypt_portable(&key, in, ref);
+		ok &= !memcmp(out, ref, 16);
+	}
+	check_result(ca821x_aes_impl() == CA821X_AES_NI ?
+		"aes implementations agree (aes-ni)... " : "aes implementations agree... ", ok);
+
+	/* Counter mode over 7 blocks, with a carry into the high counter octet */
+	memset(ctr, 0x5A, sizeof(ctr));
+	ctr[15] = 0xFE;
+	memcpy(ctr2, ctr, sizeof(ctr));
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (uint8_t)i;
+	ca821x_aes_ctr(&key, ctr, data, sizeof(data));
+	for (i = 0; i < sizeof(data); i += 16) {
+		ca821x_aes_encrypt_portable(&key, ctr2, out);
+		for (j = i; j < i + 16 && j < sizeof(data); j++)
+			ok &= data[j] == (uint8_t)(j ^ out[j - i]);
+		if (!++ctr2[15])
+			ctr2[14]++;
+	}
+	check_result("aes ctr... ", ok && !memcmp(ctr, ctr2, sizeof(ctr)) &&
+		ctr[14] == 0x5B && ctr[15] == 0x05);
+
+	for (i = 0; i < 16; i++)
+		k[i] = (uint8_t)(0xC0 + i);
+	ca821x_aes_set_key(&key, k);
+	for (i = 0; i < 31; i++)
+		data[i] = (uint8_t)i;
+	ca821x_ccm_star_seal(&key, rfc_nonce, data, 8, data + 8, 23, mic, 8);
+	check_result("ccm* rfc 3610 seal... ", !memcmp(data + 8, rfc_out, 23) &&
+		!memcmp(mic, rfc_out + 23, 8));
+	ok = !ca821x_ccm_star_open(&key, rfc_nonce, data, 8, data + 8, 23, mic, 8);
+	for (i = 0; i < 31 && data[i] == i; i++)
+		;
+	ok &= i == 31;
+	ca821x_aes_ctr(&key, (uint8_t[16]) {0x01, 0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00,
+	               0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x00, 0x01}, data + 8, 23);
+	data[3] ^= 1;
+	check_result("ccm* rfc 3610 open... ", ok &&
+		ca821x_ccm_star_open(&key, rfc_nonce, data, 8, data + 8, 23, mic, 8));
+
+	/* The annex frame uses implicit keys, by destination when sent and by
+	 * source when received */
+	ca821x_sec_keytab_init(&tab);
+	memset(&desc, 0, sizeof(desc));
+	memcpy(desc.Fixed.Key, k, 16);
+	sec_test_add_lookup(&desc, dst_ext);
+	sec_test_add_lookup(&desc, src_ext);
+	check_result("sec key table... ", !ca821x_sec_keytab_set(&tab, 1, &desc) &&
+		tab.entries == 2 && ca821x_sec_keytab_set(&tab, KEY_TABLE_SIZE, &desc));
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.fc = MAC_FC_FT_DATA | MAC_FC_ACK_REQ | MAC_FC_VER2006;
+	hdr.dsn = 0x84;
+	hdr.dst.AddressMode = MAC_MODE_LONG_ADDR;
+	hdr.dst.PANId[0] = 0x21;
+	hdr.dst.PANId[1] = 0x43;
+	memcpy(hdr.dst.Address, dst_ext, 8);
+	hdr.src = hdr.dst;
+	memcpy(hdr.src.Address, src_ext, 8);
+	hdr.security.SecurityLevel = 4;
+	hdr.frame_counter = 5;
+	len = ca821x_sec_frame_build(&tab, buf, sizeof(buf), &hdr, (const uint8_t *)"abcd",
+	                             4, src_ext);
+	check_result("sec build 802.15.4 example... ",
+		len == sizeof(sec_test_annex_frame) && !memcmp(buf, sec_test_annex_frame, len));
+	check_result("sec open 802.15.4 example... ",
+		!ca821x_sec_frame_open(&tab, &frame, buf, len, 0, NULL) &&
+		frame.payload_len == 4 && !memcmp(frame.payload, "abcd", 4));
+
+	/* ENC-MIC-64 and MIC-32 with the default key source and short addresses */
+	memset(&desc, 0, sizeof(desc));
+	for (i = 0; i < 16; i++)
+		desc.Fixed.Key[i] = (uint8_t)(0x40 + i);
+	desc.Fixed.KeyIdLookupListEntries = 1;
+	memset(desc.KeyIdLookupList[0].LookupData, 0xEE, 8);
+	desc.KeyIdLookupList[0].LookupData[8] = 3;
+	desc.KeyIdLookupList[0].LookupDataSizeCode = 1;
+	ca821x_sec_keytab_set(&tab, 0, &desc);
+	memset(tab.default_key_source, 0xEE, 8);
+	hdr.dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	hdr.src.AddressMode = MAC_MODE_SHORT_ADDR;
+	hdr.security.KeyIdMode = 1;
+	hdr.security.KeyIndex = 3;
+	for (i = 0; i < 50; i++)
+		data[i] = (uint8_t)(i * 3);
+
+	hdr.security.SecurityLevel = 6;
+	len = ca821x_sec_frame_build(&tab, buf, sizeof(buf), &hdr, data, 50, src_ext);
+	ok = len == 9 + 6 + 50 + 8 && memcmp(buf + 15, data, 50);
+	ok &= ca821x_sec_frame_open(&tab, &frame, buf, len, 0, NULL) != 0;
+	ok &= !ca821x_sec_frame_open(&tab, &frame, buf, len, 0, src_ext) &&
+	      frame.payload_len == 50 && !memcmp(frame.payload, data, 50);
+	check_result("sec enc-mic-64... ", ok);
+
+	hdr.security.SecurityLevel = 1;
+	len = ca821x_sec_frame_build(&tab, buf, sizeof(buf), &hdr, data, 50, src_ext);
+	ok = len == 9 + 6 + 50 + 4 && !memcmp(buf + 15, data, 50);
+	ok &= !ca821x_sec_frame_open(&tab, &frame, buf, len, 0, src_ext) &&
+	      frame.payload_len == 50;
+	buf[20] ^= 0x80;
+	ok &= ca821x_sec_frame_open(&tab, &frame, buf, len, 0, src_ext) != 0;
+	buf[20] ^= 0x80;
+	buf[14] ^= 1;
+	ok &= ca821x_sec_frame_open(&tab, &frame, buf, len, 0, src_ext) != 0;
+	check_result("sec mic-32 rejects tampering... ", ok);
+
+	hdr.security.KeyIndex = 4;
+	check_result("sec unknown key... ",
+		ca821x_sec_frame_build(&tab, buf, sizeof(buf), &hdr, data, 50, src_ext) < 0);
+	hdr.security.KeyIndex = 3;
+	hdr.security.SecurityLevel = 7;
+	check_result("sec frame too long... ",
+		ca821x_sec_frame_build(&tab, buf, sizeof(buf), &hdr, data, 100, src_ext) < 0);
+	printf("Host frame security test complete\n\n");
+	return 0;
+}
+
+static uint64_t stats_clock_ns;
+
+/** Clock that advances 25us every time it is read */
+static uint64_t stats_clock(struct ca821x_dev *pDeviceRef)
+{
+	return stats_clock_ns += 25000;
+}
+
+static int failing_command(
+	const uint8_t *buf,
+	size_t len,
+	uint8_t *response,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	return -1;
+}
+
+static int mismatched_command(
+	const uint8_t *buf,
+	size_t len,
+	uint8_t *response,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	if (response)
+		populate_response(SPI_MLME_SET_REQUEST, response);
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Synchronous command statistics test
+ *******************************************************************************
+ * Checks that latencies and both kinds of MAC_SYSTEM_ERROR are recorded per
+ * command, and that snapshots reset the counters.
+ *******************************************************************************
+ ******************************************************************************/
+int sync_stats_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_sync_stats stats;
+	struct ca821x_sync_snapshot snap;
+	uint8_t len, value[MAX_ATTRIBUTE_SIZE];
+	uint64_t p99;
+	int i;
+	printf(ANSI_COLOR_CYAN "Testing sync command statistics...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_sync_stats_init(&stats);
+	test_dev.ca821x_api_downstream = respond_command;
+	test_dev.clock = stats_clock;
+	test_dev.sync_stats = &stats;
+
+	for (i = 0; i < 100; i++)
+		MLME_GET_request_sync(macPANId, 0, &len, value, &test_dev);
+	ca821x_sync_stats_snapshot(&stats, SPI_MLME_GET_REQUEST, 0, &snap);
+	p99 = ca821x_sync_snapshot_percentile(&snap, 990);
+	check_result("sync stats latency... ",
+		snap.count == 100 && snap.max_ns == 25000 &&
+		p99 >= 25000 && p99 <= 25000 * 9 / 8);
+
+	test_dev.ca821x_api_downstream = failing_command;
+	check_result("sync stats transport error... ",
+		MLME_GET_request_sync(macPANId, 0, &len, value, &test_dev) ==
+		MAC_SYSTEM_ERROR);
+	test_dev.ca821x_api_downstream = mismatched_command;
+	check_result("sync stats mismatch error... ",
+		MLME_GET_request_sync(macPANId, 0, &len, value, &test_dev) ==
+		MAC_SYSTEM_ERROR);
+	ca821x_sync_stats_snapshot(&stats, SPI_MLME_GET_REQUEST, 1, &snap);
+	check_result("sync stats error counts... ",
+		snap.count == 102 && snap.transport_errors == 1 &&
+		snap.mismatch_errors == 1);
+
+	ca821x_sync_stats_snapshot(&stats, SPI_MLME_GET_REQUEST, 0, &snap);
+	check_result("sync stats reset... ", snap.count == 0 && snap.max_ns == 0 &&
+		ca821x_sync_snapshot_percentile(&snap, 990) == 0);
+	ca821x_sync_stats_snapshot(&stats, SPI_MLME_SET_REQUEST, 0, &snap);
+	check_result("sync stats per command... ", snap.count == 0);
+
+	/* Ids with the same message id code are kept apart, and ids without a
+	 * slot are not recorded */
+	ca821x_sync_stats_record(&stats, SPI_MLME_RESET_REQUEST, 1000, SYNC_RESULT_OK);
+#if CASCODA_CA_VER >= 8211
+	ca821x_sync_stats_record(&stats, SPI_PCPS_DATA_REQUEST, 2000, SYNC_RESULT_OK);
+	ca821x_sync_stats_record(&stats, SPI_PCPS_DATA_REQUEST, 2000, SYNC_RESULT_OK);
+	ca821x_sync_stats_snapshot(&stats, SPI_PCPS_DATA_REQUEST, 0, &snap);
+	i = snap.count == 2 && snap.max_ns == 2000;
+#else
+	i = 1;
+#endif
+	ca821x_sync_stats_record(&stats, SPI_MLME_BEACON_NOTIFY_INDICATION, 3000,
+	                         SYNC_RESULT_OK);
+	ca821x_sync_stats_snapshot(&stats, SPI_MLME_RESET_REQUEST, 0, &snap);
+	i &= snap.count == 1 && snap.max_ns == 1000;
+	check_result("sync stats ids kept apart... ", i &&
+		ca821x_sync_stats_snapshot(&stats, SPI_MLME_BEACON_NOTIFY_INDICATION, 0,
+		                           &snap) == -1);
+	printf("Sync command statistics test complete\n\n");
+	return 0;
+}
+
+/** Accumulates the records passed to it by ca821x_trace_dump */
+struct trace_test_dump {
+	int      count;
+	int      ordered;
+	uint64_t last_ns;
+	uint8_t  first_dir;
+	struct ca821x_trace_record last;
+};
+
+static void trace_test_record(const struct ca821x_trace_record *record,
+                              void *context)
+{
+	struct trace_test_dump *dump = context;
+
+	if (!dump->count)
+		dump->first_dir = record->dir;
+	else if (record->timestamp_ns <= dump->last_ns)
+		dump->ordered = 0;
+	dump->last_ns = record->timestamp_ns;
+	dump->last = *record;
+	dump->count++;
+}
+
+static int trace_test_errors;
+
+static void trace_test_error(struct ca821x_trace *trace,
+                             struct ca821x_dev *pDeviceRef)
+{
+	trace_test_errors++;
+	ca821x_trace_dump(trace, trace_test_record, trace->error_context);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief SPI frame trace test
+ *******************************************************************************
+ * Checks that frames in both directions are traced in order, that the ring
+ * keeps the newest records, and that failed exchanges reach the error hook.
+ *******************************************************************************
+ ******************************************************************************/
+int trace_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_trace trace;
+	struct ca821x_trace_slot slots[8];
+	struct trace_test_dump dump;
+	struct FullAddr dst;
+	uint8_t msdu[100] = {0};
+	uint8_t upstream[2 + sizeof(struct MCPS_DATA_confirm_pset)] = {0};
+	uint8_t len, value[MAX_ATTRIBUTE_SIZE];
+	uint16_t panid = 0xCA5C;
+	int i;
+	printf(ANSI_COLOR_CYAN "Testing SPI frame trace...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	check_result("trace rejects bad size... ",
+		ca821x_trace_init(&trace, slots, 6) != 0);
+	ca821x_trace_init(&trace, slots, 8);
+	test_dev.ca821x_api_downstream = respond_command;
+	test_dev.clock = stats_clock;
+	test_dev.trace = &trace;
+
+	for (i = 0; i < 5; i++)
+		MLME_SET_request_sync(macPANId, 0, 2, &panid, &test_dev);
+	memset(&dump, 0, sizeof(dump));
+	dump.ordered = 1;
+	check_result("trace keeps newest records... ",
+		ca821x_trace_dump(&trace, trace_test_record, &dump) == 8 &&
+		dump.ordered && dump.first_dir == CA821X_TRACE_DOWNSTREAM);
+	check_result("trace sync response... ",
+		dump.last.seq == 10 && dump.last.dir == CA821X_TRACE_RESPONSE &&
+		dump.last.data[0] == SPI_MLME_SET_CONFIRM);
+
+	memset(&dst, 0, sizeof(dst));
+	dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, dst, sizeof(msdu), msdu, 0, 0, NULL,
+	                  &test_dev);
+	memset(&dump, 0, sizeof(dump));
+	ca821x_trace_dump(&trace, trace_test_record, &dump);
+	check_result("trace truncates downstream frame... ",
+		dump.last.dir == CA821X_TRACE_DOWNSTREAM &&
+		dump.last.data[0] == SPI_MCPS_DATA_REQUEST &&
+		dump.last.len > CA821X_TRACE_SNAPLEN &&
+		dump.last.caplen == CA821X_TRACE_SNAPLEN);
+
+	upstream[0] = SPI_MCPS_DATA_CONFIRM;
+	upstream[1] = sizeof(struct MCPS_DATA_confirm_pset);
+	ca821x_downstream_dispatch(upstream, sizeof(upstream), &test_dev);
+	memset(&dump, 0, sizeof(dump));
+	ca821x_trace_dump(&trace, trace_test_record, &dump);
+	check_result("trace upstream frame... ",
+		dump.last.dir == CA821X_TRACE_UPSTREAM &&
+		dump.last.data[0] == SPI_MCPS_DATA_CONFIRM &&
+		dump.last.len == sizeof(upstream));
+
+	memset(&dump, 0, sizeof(dump));
+	trace.on_error = trace_test_error;
+	trace.error_context = &dump;
+	test_dev.ca821x_api_downstream = failing_command;
+	MLME_SET_request_sync(macPANId, 0, 2, &panid, &test_dev);
+	test_dev.ca821x_api_downstream = mismatched_command;
+	MLME_GET_request_sync(macPANId, 0, &len, value, &test_dev);
+	check_result("trace error hook... ", trace_test_errors == 2 &&
+		dump.count == 16 && dump.last.dir == CA821X_TRACE_RESPONSE &&
+		dump.last.data[0] == SPI_MLME_SET_CONFIRM);
+	printf("SPI frame trace test complete\n\n");
+	return 0;
+}
+
+/** Reads a whole file, returning its length or -1 */
+static long read_file(const char *path, uint8_t *buf, size_t size)
+{
+	FILE *f = fopen(path, "rb");
+	long len;
+
+	if (!f)
+		return -1;
+	len = (long)fread(buf, 1, size, f);
+	fclose(f);
+	return len;
+}
+
+/** Finds the nth block of a type in a pcapng file, returning its body */
+static const uint8_t *pcapng_block(const uint8_t *buf, long len, uint32_t type,
+                                   int n, uint32_t *body_len)
+{
+	long off = 0;
+
+	while (off + 12 <= len) {
+		uint32_t total = GETLE32(buf + off + 4);
+		if (total < 12 || off + total > len)
+			return NULL;
+		if (GETLE32(buf + off) == type && n-- == 0) {
+			*body_len = total - 12;
+			return buf + off + 8;
+		}
+		off += total;
+	}
+	return NULL;
+}
+
+/** Dispatches a data indication from 0x0002 to 0x0001 on PAN 0xCA5C */
+static void capture_data_indication(uint8_t dsn, struct ca821x_dev *pDeviceRef)
+{
+	struct MAC_Message msg;
+	struct MCPS_DATA_indication_pset *ind = &msg.PData.DataInd;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	ind->Src.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(0xCA5C, ind->Src.PANId);
+	PUTLE16(0x0002, ind->Src.Address);
+	ind->Dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(0xCA5C, ind->Dst.PANId);
+	PUTLE16(0x0001, ind->Dst.Address);
+	ind->MsduLength = 3;
+	ind->MpduLinkQuality = 0x80;
+	ind->DSN = dsn;
+	memcpy(ind->Msdu, "abc", 3);
+	msg.Length = offsetof(struct MCPS_DATA_indication_pset, Msdu) + 4;
+	ca821x_downstream_dispatch(&msg.CommandId, msg.Length + 2, pDeviceRef);
+}
+
+static uint64_t capture_clock(struct ca821x_dev *pDeviceRef)
+{
+	return 0x123456789ULL;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief pcapng capture test
+ *******************************************************************************
+ * Captures MAC and PHY frames from a device and checks the pcapng blocks and
+ * TAP packets written, then checks rotation by size.
+ *******************************************************************************
+ ******************************************************************************/
+int capture_test(void)
+{
+	static const uint8_t expected_data[] = {
+		0x00, 0x00, 28, 0x00,                         /* TAP header */
+		0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, /* FCS type: none */
+		0x03, 0x00, 0x03, 0x00, 15, 0x00, 0x00, 0x00,   /* Channel 15 */
+		0x0A, 0x00, 0x01, 0x00, 0x80, 0x00, 0x00, 0x00, /* LQI */
+		0x41, 0x98, 0x07, 0x5C, 0xCA, 0x01, 0x00, 0x02, 0x00, 'a', 'b', 'c'
+	};
+	static uint8_t file[16384];
+	struct ca821x_capture_config config;
+	struct ca821x_capture_stats stats;
+	struct ca821x_capture *cap;
+	struct ca821x_dev test_dev;
+	struct MAC_Message msg;
+	const uint8_t *body;
+	uint32_t body_len;
+	char name[64];
+	long len;
+	int i, rotated_ok;
+	printf(ANSI_COLOR_CYAN "Testing pcapng capture...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	test_dev.clock = capture_clock;
+
+	memset(&config, 0, sizeof(config));
+	config.path = "ca821x_capture_test.pcapng";
+	config.channel = 15;
+	cap = ca821x_capture_open(&config);
+	check_result("capture open... ", cap != NULL &&
+		ca821x_capture_attach(cap, &test_dev) == 0);
+	if (!cap)
+		return 0;
+
+	capture_data_indication(7, &test_dev);
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_TDME_RXPKT_INDICATION;
+	msg.PData.TDMERxPktInd.TestPacketEDValue = 0x60;
+	msg.PData.TDMERxPktInd.TestPacketCSValue = 0x90;
+	msg.PData.TDMERxPktInd.TestPacketLength = 5;
+	msg.Length = 5 + 5;
+	ca821x_downstream_dispatch(&msg.CommandId, msg.Length + 2, &test_dev);
+	msg.CommandId = SPI_MCPS_DATA_CONFIRM;
+	msg.Length = sizeof(struct MCPS_DATA_confirm_pset);
+	ca821x_downstream_dispatch(&msg.CommandId, msg.Length + 2, &test_dev);
+	ca821x_capture_flush(cap);
+	ca821x_capture_get_stats(cap, &stats);
+	check_result("capture stats... ", stats.frames == 2 && !stats.dropped &&
+		stats.files == 1 && !stats.error);
+	check_result("capture close... ", ca821x_capture_close(cap) == 0);
+
+	len = read_file(config.path, file, sizeof(file));
+	body = pcapng_block(file, len, 0x00000001, 0, &body_len);
+	check_result("capture interface block... ",
+		GETLE32(file) == 0x0A0D0D0A && GETLE32(file + 8) == 0x1A2B3C4D &&
+		body && GETLE16(body) == CA821X_CAPTURE_LINKTYPE);
+	body = pcapng_block(file, len, 0x00000006, 0, &body_len);
+	check_result("capture MAC data frame... ", body &&
+		GETLE32(body + 4) == 0x1 && GETLE32(body + 8) == 0x23456789 &&
+		GETLE32(body + 12) == sizeof(expected_data) &&
+		!memcmp(body + 20, expected_data, sizeof(expected_data)));
+	body = pcapng_block(file, len, 0x00000006, 1, &body_len);
+	check_result("capture PHY test frame... ", body &&
+		GETLE32(body + 12) == 4 + 4 * 8 + 5 &&
+		body[24] == 0x00 && body[28] == 0x01 &&          /* 16-bit FCS */
+		GETLE32(body + 36) == 0xC2A00000 &&              /* RSS -80dBm */
+		body[48] == 0x0A && body[52] == 0x90);           /* LQI from CS */
+	check_result("capture skips other frames... ",
+		pcapng_block(file, len, 0x00000006, 2, &body_len) == NULL);
+	remove(config.path);
+
+	config.path = "ca821x_capture_test.pcapng";
+	config.rotate_bytes = 400;
+	config.max_files = 2;
+	cap = ca821x_capture_open(&config);
+	ca821x_capture_attach(cap, &test_dev);
+	for (i = 0; i < 20; i++)
+		capture_data_indication((uint8_t)i, &test_dev);
+	ca821x_capture_flush(cap);
+	ca821x_capture_get_stats(cap, &stats);
+	ca821x_capture_close(cap);
+	rotated_ok = stats.frames == 20 && stats.files > 2;
+	for (i = 0; i < (int)stats.files; i++) {
+		sprintf(name, "ca821x_capture_test_%05d.pcapng", i);
+		len = read_file(name, file, sizeof(file));
+		if (i < (int)stats.files - 2)
+			rotated_ok &= len < 0;
+		else
+			rotated_ok &= len > 0 && len <= 400 &&
+			              pcapng_block(file, len, 0x00000001, 0, &body_len) != NULL;
+		remove(name);
+	}
+	check_result("capture rotation... ", rotated_ok);
+	printf("pcapng capture test complete\n\n");
+	return 0;
+}
+
+/** Source of the nth frame stored by store_test, spread over 200 nodes */
+static uint16_t store_test_src(int n)
+{
+	return (uint16_t)(1 + (n * 7919) % 200);
+}
+
+static uint64_t store_test_now;
+
+static uint64_t store_test_clock(struct ca821x_dev *pDeviceRef)
+{
+	return store_test_now;
+}
+
+struct store_test_results {
+	int      count;
+	int      ok;
+	uint16_t src;
+	uint64_t start_ns, end_ns;
+};
+
+static int store_test_frame(const struct ca821x_store_frame *frame, void *context)
+{
+	struct store_test_results *r = context;
+	struct FullAddr src, dst;
+
+	r->count++;
+	if (ca821x_store_frame_addrs(frame, &src, &dst) ||
+	    GETLE16(src.Address) != r->src || frame->timestamp_ns < r->start_ns ||
+	    frame->timestamp_ns >= r->end_ns)
+		r->ok = 0;
+	return 0;
+}
+
+static void remove_store_dir(const char *path)
+{
+	char name[300];
+	struct dirent *entry;
+	DIR *dir = opendir(path);
+
+	if (!dir)
+		return;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+		unlink(name);
+	}
+	closedir(dir);
+	rmdir(path);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Indexed capture store test
+ *******************************************************************************
+ * Stores frames from many nodes over several segments, then checks that a
+ * query by source address and time finds exactly the right frames while the
+ * index skips most of the store.
+ *******************************************************************************
+ ******************************************************************************/
+int store_test(void)
+{
+	const char *dir = "ca821x_store_test";
+	struct ca821x_store_config config;
+	struct ca821x_store_query query;
+	struct ca821x_store_query_stats stats;
+	struct store_test_results results;
+	struct ca821x_store *store;
+	struct ca821x_dev test_dev;
+	struct MAC_Message msg;
+	struct MCPS_DATA_indication_pset *ind = &msg.PData.DataInd;
+	int i, expected = 0, segments;
+	printf(ANSI_COLOR_CYAN "Testing capture store...\n" ANSI_COLOR_RESET);
+	remove_store_dir(dir);
+	ca821x_api_init(&test_dev);
+	test_dev.clock = store_test_clock;
+
+	memset(&config, 0, sizeof(config));
+	config.dir = dir;
+	config.segment_size = CA821X_STORE_MIN_SEGMENT_SIZE;
+	store = ca821x_store_open(&config);
+	check_result("store open... ", store && ca821x_store_attach(store, &test_dev) == 0);
+	if (!store)
+		return 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	ind->Src.AddressMode = MAC_MODE_SHORT_ADDR;
+	ind->Dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(0xCA5C, ind->Src.PANId);
+	PUTLE16(0xCA5C, ind->Dst.PANId);
+	ind->MsduLength = 3;
+	msg.Length = offsetof(struct MCPS_DATA_indication_pset, Msdu) + 4;
+	for (i = 0; i < 5000; i++) {
+		store_test_now = 1000000ULL * i;
+		PUTLE16(store_test_src(i), ind->Src.Address);
+		ind->DSN = (uint8_t)i;
+		ca821x_downstream_dispatch(&msg.CommandId, msg.Length + 2, &test_dev);
+		if (i >= 2000 && i < 2500 && store_test_src(i) == 42)
+			expected++;
+	}
+	check_result("store close... ", ca821x_store_close(store) == 0);
+	check_result("store spare removed... ",
+		access("ca821x_store_test/spare.tmp", F_OK) != 0);
+
+	memset(&query, 0, sizeof(query));
+	query.start_ns = 2000 * 1000000ULL;
+	query.end_ns = 2500 * 1000000ULL;
+	query.addr.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(0xCA5C, query.addr.PANId);
+	PUTLE16(42, query.addr.Address);
+	query.match = CA821X_STORE_MATCH_SRC;
+	memset(&results, 0, sizeof(results));
+	results.ok = 1;
+	results.src = 42;
+	results.start_ns = query.start_ns;
+	results.end_ns = query.end_ns;
+	check_result("store query by address and time... ",
+		ca821x_store_query(dir, &query, store_test_frame, &results, &stats) ==
+		expected && results.count == expected && results.ok && expected > 0);
+	check_result("store index skips... ", stats.segments > 3 &&
+		stats.segments_scanned <= 2 && stats.records_scanned < 500);
+	segments = (int)stats.segments;
+
+	query.match = CA821X_STORE_MATCH_DST;
+	check_result("store query by destination... ",
+		ca821x_store_query(dir, &query, store_test_frame, &results, NULL) == 0);
+
+	store = ca821x_store_open(&config);
+	ca821x_store_append(store, 0, &msg.CommandId, msg.Length + 2, 0);
+	ca821x_store_close(store);
+	memset(&query, 0, sizeof(query));
+	check_result("store reopen appends... ",
+		ca821x_store_query(dir, &query, store_test_frame, &results, &stats) ==
+		5001 && (int)stats.segments == segments + 1);
+	remove_store_dir(dir);
+	printf("Capture store test complete\n\n");
+	return 0;
+}
+
+static int replay_test_count, replay_test_ordered, replay_test_last_dsn;
+static uint64_t replay_test_now;
+
+static uint64_t replay_test_clock(struct ca821x_dev *pDeviceRef)
+{
+	return replay_test_now;
+}
+
+static int replay_test_indication(
+	struct MCPS_DATA_indication_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	if (params->DSN != (uint8_t)(replay_test_last_dsn + 1))
+		replay_test_ordered = 0;
+	replay_test_last_dsn = params->DSN;
+	replay_test_count++;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Capture replay test
+ *******************************************************************************
+ * Records a command and a run of data indications in a trace and a store,
+ * replays them into a simulated device and checks the callbacks, the
+ * re-issued command and the pacing.
+ *******************************************************************************
+ ******************************************************************************/
+int replay_test(void)
+{
+	const char *dir = "ca821x_replay_test";
+	struct ca821x_dev record_dev, replay_dev;
+	struct ca821x_trace trace;
+	struct ca821x_trace_slot slots[16];
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct ca821x_replay_latency latency;
+	struct ca821x_store_config store_config;
+	struct ca821x_store *store;
+	struct ca821x_replay *replay;
+	struct ca821x_replay_config config;
+	struct ca821x_replay_stats stats;
+	struct FullAddr dst;
+	uint8_t msdu[100] = {0};
+	uint8_t len, value[MAX_ATTRIBUTE_SIZE];
+	uint16_t panid = 0x1234;
+	uint64_t paced_ns;
+	int i;
+	printf(ANSI_COLOR_CYAN "Testing capture replay...\n" ANSI_COLOR_RESET);
+	remove_store_dir(dir);
+	ca821x_api_init(&record_dev);
+	ca821x_trace_init(&trace, slots, 16);
+	record_dev.ca821x_api_downstream = respond_command;
+	record_dev.clock = replay_test_clock;
+	record_dev.trace = &trace;
+	memset(&store_config, 0, sizeof(store_config));
+	store_config.dir = dir;
+	store_config.segment_size = CA821X_STORE_MIN_SEGMENT_SIZE;
+	store = ca821x_store_open(&store_config);
+	ca821x_store_attach(store, &record_dev);
+
+	/* A state-setting command, indications 1 ms apart and a truncated frame */
+	replay_test_now = 0;
+	MLME_SET_request_sync(macPANId, 0, 2, &panid, &record_dev);
+	for (i = 1; i <= 4; i++) {
+		replay_test_now = 1000000ULL * i;
+		capture_data_indication((uint8_t)i, &record_dev);
+	}
+	memset(&dst, 0, sizeof(dst));
+	dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, dst, sizeof(msdu), msdu, 0, 0, NULL,
+	                  &record_dev);
+	ca821x_store_close(store);
+
+	ca821x_api_init(&replay_dev);
+	ca821x_sim_engine_init(&engine);
+	ca821x_sim_init(&sim, &engine, 1, &replay_dev);
+	replay_dev.callbacks.MCPS_DATA_indication = replay_test_indication;
+
+	replay = ca821x_replay_create();
+	check_result("replay loads trace... ",
+		ca821x_replay_load_trace(replay, &trace) == 5 &&
+		ca821x_replay_len(replay) == 5);
+	memset(&config, 0, sizeof(config));
+	config.record_latency = 1;
+	replay_test_count = replay_test_last_dsn = 0;
+	replay_test_ordered = 1;
+	check_result("replay as fast as possible... ",
+		ca821x_replay_run(replay, &config, &stats, &replay_dev) == 0 &&
+		stats.upstream == 4 && stats.downstream == 1 && stats.errors == 0 &&
+		replay_test_count == 4 && replay_test_ordered);
+	check_result("replay re-issues commands... ",
+		MLME_GET_request_sync(macPANId, 0, &len, value, &replay_dev) ==
+		MAC_SUCCESS && len == 2 && GETLE16(value) == panid);
+	check_result("replay callback latency... ",
+		ca821x_replay_latency(replay, SPI_MCPS_DATA_INDICATION, &latency) == 4 &&
+		latency.errors == 0 && latency.max_ns > 0 &&
+		ca821x_sync_hist_percentile(latency.buckets, latency.count,
+		                            latency.max_ns, 500) <= latency.max_ns &&
+		ca821x_replay_latency(replay, SPI_MLME_SET_REQUEST, NULL) == 0);
+
+	config.speed = 1.0;
+	ca821x_replay_run(replay, &config, &stats, &replay_dev);
+	paced_ns = stats.elapsed_ns;
+	config.speed = 10.0;
+	ca821x_replay_run(replay, &config, &stats, &replay_dev);
+	check_result("replay paces frames... ",
+		paced_ns >= 3000000 && stats.elapsed_ns >= 300000 &&
+		stats.elapsed_ns < paced_ns && stats.upstream_per_sec > 0);
+	ca821x_replay_destroy(replay);
+
+	replay = ca821x_replay_create();
+	replay_test_count = replay_test_last_dsn = 0;
+	replay_test_ordered = 1;
+	config.speed = 0;
+	check_result("replay loads store... ",
+		ca821x_replay_load_store(replay, dir, NULL) == 4 &&
+		ca821x_replay_run(replay, &config, &stats, &replay_dev) == 0 &&
+		replay_test_count == 4 && replay_test_ordered);
+	ca821x_replay_destroy(replay);
+
+	/* Upstream ids whose message id codes collide keep separate latencies */
+	ca821x_trace_init(&trace, slots, 16);
+	memset(value, 0, sizeof(value));
+	value[0] = SPI_MLME_BEACON_NOTIFY_INDICATION;
+	value[1] = 1 + PAN_DESCRIPTOR_BASE_SIZE;
+	ca821x_trace_frame(&trace, CA821X_TRACE_UPSTREAM, value, 2 + value[1], 0);
+	value[0] = SPI_TDME_ERROR_INDICATION;
+	value[1] = 1;
+	ca821x_trace_frame(&trace, CA821X_TRACE_UPSTREAM, value, 2 + value[1], 0);
+	ca821x_trace_frame(&trace, CA821X_TRACE_UPSTREAM, value, 2 + value[1], 0);
+	replay = ca821x_replay_create();
+	ca821x_replay_load_trace(replay, &trace);
+	ca821x_replay_run(replay, &config, &stats, &replay_dev);
+	check_result("replay latency per command id... ", stats.upstream == 3 &&
+		ca821x_replay_latency(replay, SPI_MLME_BEACON_NOTIFY_INDICATION,
+		                      NULL) == 1 &&
+		ca821x_replay_latency(replay, SPI_TDME_ERROR_INDICATION, NULL) == 2);
+	ca821x_replay_destroy(replay);
+	ca821x_sim_engine_deinit(&engine);
+	remove_store_dir(dir);
+	printf("Capture replay test complete\n\n");
+	return 0;
+}
+
+static int sim_data_confirms, sim_data_status, sim_scan_confirms, sim_scan_ed;
+
+static int sim_data_confirm(
+	struct MCPS_DATA_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	sim_data_confirms++;
+	sim_data_status = params->Status;
+	return 0;
+}
+
+static int sim_scan_confirm(
+	struct MLME_SCAN_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	sim_scan_confirms++;
+	sim_scan_ed = params->ResultListSize ? params->ResultList[0] : -1;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Simulated device test
+ *******************************************************************************
+ * Drives a simulated CA-821X through the API and checks synchronous responses
+ * and the virtual timing of asynchronous confirms.
+ *******************************************************************************
+ ******************************************************************************/
+int sim_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct FullAddr dst;
+	struct MAC_Message msg;
+	uint64_t start_ns;
+	uint8_t msdu[4] = {0xAA, 0xBB, 0xCC, 0xDD};
+	uint8_t len, value[MAX_ATTRIBUTE_SIZE];
+	uint16_t panid = 0xCA5C;
+	printf(ANSI_COLOR_CYAN "Testing simulated device...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_sim_engine_init(&engine);
+	ca821x_sim_init(&sim, &engine, 1, &test_dev);
+	test_dev.callbacks.MCPS_DATA_confirm = sim_data_confirm;
+	test_dev.callbacks.MLME_SCAN_confirm = sim_scan_confirm;
+
+	check_result("sim reset... ",
+		MLME_RESET_request_sync(1, &test_dev) == MAC_SUCCESS);
+	MLME_SET_request_sync(macPANId, 0, 2, &panid, &test_dev);
+	check_result("sim PIB set/get... ",
+		MLME_GET_request_sync(macPANId, 0, &len, value, &test_dev) == MAC_SUCCESS &&
+		len == 2 && GETLE16(value) == panid);
+	check_result("sim unsupported attribute... ",
+		MLME_GET_request_sync(0x70, 0, &len, value, &test_dev) ==
+		MAC_UNSUPPORTED_ATTRIBUTE);
+	check_result("sim start without address... ",
+		MLME_START_request_sync(panid, TEST_CHANNEL, 15, 15, 1, 0, 0, NULL,
+		                        NULL, &test_dev) == MAC_NO_SHORT_ADDRESS);
+
+	/* Data confirm arrives after CSMA and air time, not before */
+	dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(panid, dst.PANId);
+	PUTLE16(0x0001, dst.Address);
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, dst, sizeof(msdu), msdu, 0x42,
+	                  TXOPT_ACKREQ, NULL, &test_dev);
+	ca821x_sim_run_for(&engine, 100000);
+	check_result("sim data not early... ", sim_data_confirms == 0);
+	ca821x_sim_run_for(&engine, 10000000);
+	check_result("sim data confirm... ",
+		sim_data_confirms == 1 && sim_data_status == MAC_SUCCESS);
+
+	/* Reset discards the pending transmission */
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, dst, sizeof(msdu), msdu, 0x43,
+	                  TXOPT_ACKREQ, NULL, &test_dev);
+	MLME_RESET_request_sync(0, &test_dev);
+	ca821x_sim_run_for(&engine, 10000000);
+	check_result("sim reset drops pending... ", sim_data_confirms == 1);
+
+	sim.channel_ed[TEST_CHANNEL - M_MinimumChannel] = 0x55;
+	MLME_SCAN_request(ENERGY_DETECT, 1UL << TEST_CHANNEL, 2, NULL, &test_dev);
+	ca821x_sim_run_for(&engine, 1000000000);
+	check_result("sim ED scan... ", sim_scan_confirms == 1 && sim_scan_ed == 0x55);
+
+	/* Device clock and waits follow virtual time */
+	check_result("sim clock... ", ca821x_get_time_ns(&test_dev) == engine.now_ns);
+	ca821x_wait_for_message = ca821x_sim_wait_for_message;
+	start_ns = engine.now_ns;
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, dst, sizeof(msdu), msdu, 0x44,
+	                  TXOPT_ACKREQ, NULL, &test_dev);
+	check_result("sim wait for message... ",
+		ca821x_wait_for_message(SPI_MCPS_DATA_CONFIRM, 1000, &msg.CommandId,
+		                        &test_dev) == 0 &&
+		msg.PData.DataCnf.MsduHandle == 0x44 && sim_data_confirms == 1 &&
+		ca821x_get_time_ns(&test_dev) - start_ns < 10000000);
+	start_ns = engine.now_ns;
+	check_result("sim wait timeout... ",
+		ca821x_wait_for_message(SPI_MCPS_DATA_CONFIRM, 5000, &msg.CommandId,
+		                        &test_dev) != 0 &&
+		ca821x_get_time_ns(&test_dev) - start_ns == 5000000000ULL);
+	ca821x_wait_for_message = NULL;
+
+	ca821x_sim_engine_deinit(&engine);
+	printf("Simulated device test complete\n\n");
+	return 0;
+}
+
+/** Security tables for n devices sharing one key restricted to them */
+static void sec_mirror_test_tables(struct ca821x_sec_tables *tables, int n)
+{
+	struct M_KeyDescriptor *key = &tables->keys.desc[0];
+	int i;
+
+	ca821x_sec_tables_init(tables);
+	memset(tables->keys.default_key_source, 0xCA, 8);
+	tables->device_entries = n;
+	for (i = 0; i < n; i++) {
+		PUTLE16(0xCA5C, tables->devices[i].PANId);
+		PUTLE16(0x1000 + i, tables->devices[i].ShortAddress);
+		memset(tables->devices[i].ExtAddress, i, 8);
+		key->KeyDeviceList[i].Flags = i;
+	}
+	tables->level_entries = 1;
+	tables->levels[0].FrameType = MAC_FC_FT_DATA;
+	tables->levels[0].SecurityMinimum = 5;
+	memset(key->Fixed.Key, 0x42, 16);
+	key->Fixed.KeyIdLookupListEntries = 1;
+	memset(key->KeyIdLookupList[0].LookupData, 0xCA, 8);
+	key->KeyIdLookupList[0].LookupData[8] = 1;
+	key->KeyIdLookupList[0].LookupDataSizeCode = 1;
+	key->Fixed.KeyDeviceListEntries = n;
+	key->Fixed.KeyUsageListEntries = 1;
+	key->KeyUsageList[0].Flags = MAC_FC_FT_DATA;
+	tables->keys.entries = 1;
+}
+
+/** MLME-SET.requests sent since the last call */
+static uint32_t sec_mirror_test_sets(struct ca821x_sync_stats *stats)
+{
+	struct ca821x_sync_snapshot snap;
+
+	ca821x_sync_stats_snapshot(stats, SPI_MLME_SET_REQUEST, 1, &snap);
+	return snap.count;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Security table mirror test
+ *******************************************************************************
+ * Fills a simulated device's security tables, then checks that rewriting the
+ * host tables whole for a join or a leave only sends the SETs that changed.
+ *******************************************************************************
+ ******************************************************************************/
+int sec_mirror_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct ca821x_sync_stats stats;
+	struct ca821x_sec_mirror mirror;
+	struct ca821x_sec_tables tables;
+	struct ca821x_sec_set sets[CA821X_SEC_MAX_SETS];
+	struct ca821x_aes_key aes;
+	uint8_t len, value[MAX_ATTRIBUTE_SIZE], key[sizeof(struct M_KeyDescriptor)];
+	size_t n;
+	printf(ANSI_COLOR_CYAN "Testing security table mirror...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_sim_engine_init(&engine);
+	ca821x_sim_init(&sim, &engine, 1, &test_dev);
+	ca821x_sync_stats_init(&stats);
+	test_dev.sync_stats = &stats;
+	MLME_RESET_request_sync(1, &test_dev);
+	sec_mirror_test_sets(&stats);
+
+	ca821x_sec_mirror_init(&mirror);
+	sec_mirror_test_tables(&tables, DEVICE_TABLE_SIZE - 1);
+	n = ca821x_sec_mirror_plan(&mirror, &tables, sets, 2);
+	check_result("sec mirror plan... ", n == DEVICE_TABLE_SIZE + 5 &&
+		sets[0].attribute == macDeviceTableEntries &&
+		sets[1].attribute == macDeviceTable && sets[1].index == 0);
+	check_result("sec mirror initial sync... ",
+		ca821x_sec_mirror_sync(&mirror, &tables, &test_dev) == MAC_SUCCESS &&
+		sec_mirror_test_sets(&stats) == n &&
+		!ca821x_sec_mirror_plan(&mirror, &tables, sets, CA821X_SEC_MAX_SETS));
+	MLME_GET_request_sync(macKeyTable, 0, &len, value, &test_dev);
+	n = ca821x_sec_key_encode(&tables.keys.desc[0], key);
+	check_result("sec mirror key written... ", n == len && !memcmp(value, key, n) &&
+		n == sizeof(struct M_KeyTableEntryFixed) + sizeof(struct M_KeyIdLookupDesc) +
+		     DEVICE_TABLE_SIZE - 1 + 1);
+	MLME_GET_request_sync(macDeviceTable, 7, &len, value, &test_dev);
+	check_result("sec mirror device written... ",
+		len == sizeof(struct M_DeviceDescriptor) &&
+		!memcmp(value, &tables.devices[7], len));
+
+	/* A join adds a device and lists it against the key */
+	sec_mirror_test_tables(&tables, DEVICE_TABLE_SIZE);
+	check_result("sec mirror join... ",
+		ca821x_sec_mirror_sync(&mirror, &tables, &test_dev) == MAC_SUCCESS &&
+		sec_mirror_test_sets(&stats) == 3);
+	MLME_GET_request_sync(macDeviceTableEntries, 0, &len, value, &test_dev);
+	check_result("sec mirror entry count... ", value[0] == DEVICE_TABLE_SIZE);
+
+	/* A leave of the last device only shrinks the counts */
+	sec_mirror_test_tables(&tables, DEVICE_TABLE_SIZE - 1);
+	check_result("sec mirror leave... ",
+		ca821x_sec_mirror_sync(&mirror, &tables, &test_dev) == MAC_SUCCESS &&
+		sec_mirror_test_sets(&stats) == 2);
+	/* Rejoining reuses the entry the device still holds */
+	sec_mirror_test_tables(&tables, DEVICE_TABLE_SIZE);
+	check_result("sec mirror rejoin... ",
+		ca821x_sec_mirror_sync(&mirror, &tables, &test_dev) == MAC_SUCCESS &&
+		sec_mirror_test_sets(&stats) == 2);
+	ca821x_aes_set_key(&aes, tables.keys.desc[0].Fixed.Key);
+	check_result("sec mirror keys expanded... ",
+		!memcmp(&mirror.dev.keys.sched[0], &aes, sizeof(aes)));
+
+	/* A leave from the middle shifts the later devices down, keeping the
+	 * counters the device has advanced them to */
+	memcpy(value, &tables.devices[5], sizeof(struct M_DeviceDescriptor));
+	PUTLE32(500, ((struct M_DeviceDescriptor *)value)->FrameCounter);
+	MLME_SET_request_sync(macDeviceTable, 5, sizeof(struct M_DeviceDescriptor),
+	                      value, &test_dev);
+	sec_mirror_test_sets(&stats);
+	memmove(&tables.devices[2], &tables.devices[3],
+	        (DEVICE_TABLE_SIZE - 3) * sizeof(tables.devices[0]));
+	tables.device_entries--;
+	check_result("sec mirror shifted leave... ",
+		ca821x_sec_mirror_sync(&mirror, &tables, &test_dev) == MAC_SUCCESS &&
+		sec_mirror_test_sets(&stats) == DEVICE_TABLE_SIZE - 3 + 1);
+	MLME_GET_request_sync(macDeviceTable, 4, &len, value, &test_dev);
+	check_result("sec mirror shifted counter kept... ",
+		value[offsetof(struct M_DeviceDescriptor, ExtAddress)] == 5 &&
+		GETLE32(((struct M_DeviceDescriptor *)value)->FrameCounter) == 500 &&
+		!ca821x_sec_mirror_plan(&mirror, &tables, sets, CA821X_SEC_MAX_SETS));
+	tables.keys.default_key_source[0] = 0;
+	check_result("sec mirror key source change... ",
+		ca821x_sec_mirror_plan(&mirror, &tables, sets, CA821X_SEC_MAX_SETS) == 1 &&
+		sets[0].attribute == macDefaultKeySource);
+
+	ca821x_sim_engine_deinit(&engine);
+	printf("Security table mirror test complete\n\n");
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Frame counter journal test
+ *******************************************************************************
+ * Notes counters through a journal with a stride of 100, then checks they are
+ * restored after reopening, and from the older copy after the newer one is
+ * damaged as by a crash during its write.
+ *******************************************************************************
+ ******************************************************************************/
+int fc_journal_test(void)
+{
+	const char *path = "ca821x_fc_journal_test";
+	struct ca821x_fc_journal *journal;
+	struct ca821x_dev test_dev;
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct ca821x_sec_mirror mirror;
+	struct ca821x_sec_tables tables;
+	uint8_t ext[8], len, value[MAX_ATTRIBUTE_SIZE];
+	uint32_t i, tx_next;
+	FILE *file;
+	int ok;
+	printf(ANSI_COLOR_CYAN "Testing frame counter journal...\n" ANSI_COLOR_RESET);
+	unlink(path);
+	memset(ext, 0x5A, 8);
+
+	journal = ca821x_fc_journal_open(path, 100);
+	check_result("fc journal open... ", journal != NULL);
+	if (!journal)
+		return 0;
+	ok = 1;
+	for (i = 0; i < 1000; i++)
+		ok &= ca821x_fc_journal_note_tx(journal, i) == (i % 100 == 0);
+	check_result("fc journal tx stride... ", ok &&
+		ca821x_fc_journal_writes(journal) == 10);
+	for (i = 0; i < 250; i++)
+		ok &= ca821x_fc_journal_note_device(journal, 3, ext, i) >= 0;
+	check_result("fc journal device stride... ", ok &&
+		ca821x_fc_journal_writes(journal) == 13 &&
+		ca821x_fc_journal_note_device(journal, DEVICE_TABLE_SIZE, ext, 0) == -EINVAL);
+	ca821x_fc_journal_close(journal);
+
+	/* Restore on boot, with the device at another index */
+	ca821x_api_init(&test_dev);
+	ca821x_sim_engine_init(&engine);
+	ca821x_sim_init(&sim, &engine, 1, &test_dev);
+	MLME_RESET_request_sync(1, &test_dev);
+	journal = ca821x_fc_journal_open(path, 100);
+	sec_mirror_test_tables(&tables, 6);
+	memcpy(tables.devices[5].ExtAddress, ext, 8);
+	ca821x_sec_mirror_init(&mirror);
+	check_result("fc journal restore sync... ", journal &&
+		ca821x_fc_journal_restore_sync(journal, &tables, &mirror, &test_dev) ==
+		MAC_SUCCESS && GETLE32(tables.devices[5].FrameCounter) == 200 &&
+		GETLE32(tables.devices[4].FrameCounter) == 0);
+	MLME_GET_request_sync(macFrameCounter, 0, &len, value, &test_dev);
+	check_result("fc journal tx restored... ", len == 4 && GETLE32(value) == 1000);
+	MLME_GET_request_sync(macDeviceTable, 5, &len, value, &test_dev);
+	check_result("fc journal device restored... ",
+		len == sizeof(struct M_DeviceDescriptor) &&
+		GETLE32(((struct M_DeviceDescriptor *)value)->FrameCounter) == 200);
+	ca821x_sim_engine_deinit(&engine);
+	if (journal)
+		ca821x_fc_journal_close(journal);
+
+	/* The 13th copy, holding the device's mark of 200, went to the first page */
+	file = fopen(path, "r+b");
+	if (file) {
+		fseek(file, 16, SEEK_SET);
+		fputc(0xFF, file);
+		fclose(file);
+	}
+	journal = ca821x_fc_journal_open(path, 100);
+	sec_mirror_test_tables(&tables, 6);
+	memcpy(tables.devices[5].ExtAddress, ext, 8);
+	tx_next = journal ? ca821x_fc_journal_restore(journal, &tables) : 0;
+	check_result("fc journal damaged copy... ", file && tx_next == 1000 &&
+		GETLE32(tables.devices[5].FrameCounter) == 100);
+	if (journal)
+		ca821x_fc_journal_close(journal);
+	unlink(path);
+	printf("Frame counter journal test complete\n\n");
+	return 0;
+}
+
+/** Address of the neighbour test, with the first octets alike to crowd the
+ *  hash */
+static void neighbour_test_addr(struct FullAddr *addr, uint8_t mode, unsigned i)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->AddressMode = mode;
+	PUTLE16(0xCA5C, addr->PANId);
+	if (mode == MAC_MODE_LONG_ADDR) {
+		memset(addr->Address, 0x77, 8);
+		addr->Address[7] = (uint8_t)i;
+	} else {
+		PUTLE16(0x1000 + i, addr->Address);
+	}
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Neighbour table test
+ *******************************************************************************
+ * Checks lookups by either address through learning, reassignment and removal
+ * of neighbours, then that a table attached to a simulated device follows its
+ * device table and the short addresses it grants.
+ *******************************************************************************
+ ******************************************************************************/
+int neighbour_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct ca821x_sec_mirror mirror;
+	struct ca821x_sec_tables tables;
+	struct ca821x_neighbours nb;
+	struct ca821x_neighbour *n;
+	struct FullAddr ext, shrt;
+	unsigned i;
+	int ok;
+	printf(ANSI_COLOR_CYAN "Testing neighbour table...\n" ANSI_COLOR_RESET);
+	ca821x_neighbour_init(&nb);
+
+	neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, 1);
+	neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, 1);
+	n = ca821x_neighbour_learn(&nb, NULL, shrt.PANId, shrt.Address);
+	check_result("neighbour learn short... ", n &&
+		ca821x_neighbour_find(&nb, &shrt) == n && !ca821x_neighbour_find(&nb, &ext));
+	check_result("neighbour learn ext... ",
+		ca821x_neighbour_learn(&nb, ext.Address, shrt.PANId, shrt.Address) == n &&
+		ca821x_neighbour_find(&nb, &ext) == n && nb.count == 1 &&
+		n->device_index == CA821X_NEIGHBOUR_NO_DEVICE);
+	/* The short address is granted to another device */
+	neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, 2);
+	n = ca821x_neighbour_learn(&nb, ext.Address, shrt.PANId, shrt.Address);
+	neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, 1);
+	check_result("neighbour short reassigned... ", n &&
+		ca821x_neighbour_find(&nb, &shrt) == n &&
+		!ca821x_neighbour_find(&nb, &ext)->has_short);
+	check_result("neighbour needs an address... ",
+		!ca821x_neighbour_learn(&nb, NULL, shrt.PANId, (uint8_t *)"\xFF\xFF") &&
+		!ca821x_neighbour_learn(&nb, NULL, shrt.PANId, NULL) && nb.count == 2);
+
+	ca821x_neighbour_init(&nb);
+	for (i = 0; i < CA821X_NEIGHBOUR_MAX; i++) {
+		neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, i);
+		neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, i);
+		ca821x_neighbour_learn(&nb, ext.Address, shrt.PANId, shrt.Address);
+	}
+	check_result("neighbour table full... ", nb.count == CA821X_NEIGHBOUR_MAX &&
+		!ca821x_neighbour_learn(&nb, NULL, shrt.PANId, (uint8_t *)"\x00\x20"));
+	for (i = 0; i < CA821X_NEIGHBOUR_MAX; i += 2) {
+		neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, i);
+		ca821x_neighbour_forget(&nb, ca821x_neighbour_find(&nb, &ext));
+	}
+	ok = nb.count == CA821X_NEIGHBOUR_MAX / 2;
+	for (i = 0; i < CA821X_NEIGHBOUR_MAX; i++) {
+		neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, i);
+		neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, i);
+		n = ca821x_neighbour_find(&nb, &ext);
+		ok &= (i & 1) ? n && ca821x_neighbour_find(&nb, &shrt) == n :
+		                !n && !ca821x_neighbour_find(&nb, &shrt);
+	}
+	check_result("neighbour forget... ", ok);
+
+	/* Attached to a device, through the security table mirror */
+	ca821x_api_init(&test_dev);
+	ca821x_sim_engine_init(&engine);
+	ca821x_sim_init(&sim, &engine, 1, &test_dev);
+	ca821x_neighbour_init(&nb);
+	test_dev.neighbours = &nb;
+	MLME_RESET_request_sync(1, &test_dev);
+	ca821x_sec_mirror_init(&mirror);
+	sec_mirror_test_tables(&tables, 4);
+	ca821x_sec_mirror_sync(&mirror, &tables, &test_dev);
+	ok = nb.count == 4;
+	for (i = 0; i < 4; i++) {
+		neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, i);
+		n = ca821x_neighbour_find(&nb, &shrt);
+		ok &= n && n->device_index == i && n->ext_addr[0] == i;
+	}
+	check_result("neighbour device table... ", ok);
+	sec_mirror_test_tables(&tables, 3);
+	ca821x_sec_mirror_sync(&mirror, &tables, &test_dev);
+	neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, 3);
+	check_result("neighbour device removed... ", nb.count == 3 &&
+		!ca821x_neighbour_find(&nb, &shrt));
+
+	neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, 9);
+	neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, 9);
+	MLME_SET_request_sync(macShortAddress, 0, 2, "\x00\x00", &test_dev);
+	MLME_START_request_sync(0xCA5C, 18, 15, 15, 1, 0, 0, NULL, NULL, &test_dev);
+	MLME_ASSOCIATE_response(ext.Address, 0x1009, MAC_SUCCESS, NULL, &test_dev);
+	n = ca821x_neighbour_find(&nb, &shrt);
+	check_result("neighbour associate learned... ", n &&
+		ca821x_neighbour_find(&nb, &ext) == n);
+	MLME_RESET_request_sync(1, &test_dev);
+	check_result("neighbour reset... ", n && nb.count == 1 &&
+		ca821x_neighbour_find(&nb, &shrt) == n);
+
+	ca821x_sim_engine_deinit(&engine);
+	printf("Neighbour table test complete\n\n");
+	return 0;
+}
+
+static uint64_t link_test_ns;
+
+static uint64_t link_test_clock(struct ca821x_dev *pDeviceRef)
+{
+	return link_test_ns;
+}
+
+/** Dispatch an MCPS-DATA.indication from addr with an LQI */
+static void link_test_rx(const struct FullAddr *addr, uint8_t lqi, struct ca821x_dev *dev)
+{
+	struct MAC_Message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	msg.Length = sizeof(struct MCPS_DATA_indication_pset) - MAX_DATA_SIZE;
+	msg.PData.DataInd.Src = *addr;
+	msg.PData.DataInd.MpduLinkQuality = lqi;
+	ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, dev);
+}
+
+/** Dispatch an MCPS-DATA.confirm */
+static void link_test_confirm(uint8_t handle, uint8_t status, struct ca821x_dev *dev)
+{
+	struct MAC_Message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_CONFIRM;
+	msg.Length = sizeof(struct MCPS_DATA_confirm_pset);
+	msg.PData.DataCnf.MsduHandle = handle;
+	msg.PData.DataCnf.Status = status;
+	ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, dev);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Link statistics test
+ *******************************************************************************
+ * Dispatches indications and confirms for a neighbour and checks the averaged
+ * LQI, the transmission ratios and the last seen time, and that a new
+ * neighbour in the same position starts afresh.
+ *******************************************************************************
+ ******************************************************************************/
+int link_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_neighbours nb;
+	struct ca821x_links links;
+	struct ca821x_link_snapshot snap;
+	struct ca821x_neighbour *n;
+	struct FullAddr ext, shrt, other;
+	uint8_t i;
+	printf(ANSI_COLOR_CYAN "Testing link statistics...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_neighbour_init(&nb);
+	ca821x_link_init(&links);
+	test_dev.neighbours = &nb;
+	test_dev.links = &links;
+	test_dev.clock = link_test_clock;
+	link_test_ns = 1000;
+
+	neighbour_test_addr(&ext, MAC_MODE_LONG_ADDR, 1);
+	neighbour_test_addr(&shrt, MAC_MODE_SHORT_ADDR, 1);
+	neighbour_test_addr(&other, MAC_MODE_SHORT_ADDR, 2);
+	n = ca821x_neighbour_learn(&nb, ext.Address, shrt.PANId, shrt.Address);
+	check_result("link nothing recorded... ", n &&
+		!ca821x_link_snapshot(&links, &nb, n, &snap) && !snap.rx && !snap.lqi);
+	if (!n)
+		return 0;
+
+	/* 200, then 100 weighted 1/8: 187.5 */
+	link_test_rx(&shrt, 200, &test_dev);
+	link_test_ns = 2000;
+	link_test_rx(&ext, 100, &test_dev);
+	link_test_rx(&other, 10, &test_dev);
+	ca821x_link_snapshot(&links, &nb, n, &snap);
+	check_result("link lqi average... ", snap.rx == 2 && snap.lqi == 188 &&
+		snap.last_seen_ns == 2000);
+
+	for (i = 5; i < 9; i++)
+		ca821x_link_tx(&links, &nb, &ext, i);
+	link_test_ns = 3000;
+	link_test_confirm(5, MAC_SUCCESS, &test_dev);
+	link_test_confirm(6, MAC_NO_ACK, &test_dev);
+	link_test_confirm(7, MAC_CHANNEL_ACCESS_FAILURE, &test_dev);
+	link_test_ns = 4000;
+	link_test_confirm(8, MAC_NO_ACK, &test_dev);
+	link_test_confirm(9, MAC_SUCCESS, &test_dev);
+	link_test_confirm(5, MAC_SUCCESS, &test_dev);
+	ca821x_link_snapshot(&links, &nb, n, &snap);
+	check_result("link confirms... ", snap.tx == 4 && snap.tx_acked == 1 &&
+		snap.tx_cca == 1 && snap.ack_permille == 333 && snap.cca_permille == 250 &&
+		snap.last_seen_ns == 3000);
+
+	/* An MSDU that never reached the device has no confirm to count */
+	test_dev.ca821x_api_downstream = failing_command;
+	check_result("link request not exchanged... ",
+		MCPS_DATA_request(MAC_MODE_SHORT_ADDR, shrt, 0, &i, 11, 0, NULL,
+		                  &test_dev) == MAC_SYSTEM_ERROR);
+	link_test_confirm(11, MAC_SUCCESS, &test_dev);
+	ca821x_link_snapshot(&links, &nb, n, &snap);
+	check_result("link unsent request not counted... ", snap.tx == 4);
+
+	/* A confirm for a neighbour forgotten while its MSDU was in flight, even
+	 * once its position has been reused 256 times */
+	ca821x_link_tx(&links, &nb, &shrt, 10);
+	for (i = 0; i < 255; i++) {
+		ca821x_neighbour_forget(&nb, n);
+		n = ca821x_neighbour_learn(&nb, ext.Address, shrt.PANId, shrt.Address);
+	}
+	ca821x_neighbour_forget(&nb, n);
+	n = ca821x_neighbour_learn(&nb, NULL, other.PANId, other.Address);
+	link_test_confirm(10, MAC_SUCCESS, &test_dev);
+	check_result("link new neighbour afresh... ", n == &nb.entries[0] &&
+		!ca821x_link_snapshot(&links, &nb, n, &snap) && !snap.tx && !snap.rx);
+	ca821x_neighbour_forget(&nb, n);
+	check_result("link unknown neighbour... ",
+		ca821x_link_snapshot(&links, &nb, n, &snap) == -1);
+	printf("Link statistics test complete\n\n");
+	return 0;
+}
+
+static int dedup_test_delivered;
+
+static int dedup_test_indication(struct MCPS_DATA_indication_pset *params,
+                                 struct ca821x_dev *pDeviceRef)
+{
+	dedup_test_delivered++;
+	return 0;
+}
+
+/** Dispatch an MCPS-DATA.indication, returning 1 if it reached the callback */
+static int dedup_test_rx(const struct FullAddr *src, uint8_t dsn, struct ca821x_dev *dev)
+{
+	struct MAC_Message msg;
+	int before = dedup_test_delivered;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	msg.Length = sizeof(struct MCPS_DATA_indication_pset) - MAX_DATA_SIZE;
+	msg.PData.DataInd.Src = *src;
+	msg.PData.DataInd.DSN = dsn;
+	ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, dev);
+	return dedup_test_delivered - before;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Duplicate filter test
+ *******************************************************************************
+ * Dispatches data indications from several sources, repeating, reordering
+ * and wrapping DSNs, and checks only first receptions reach the callback,
+ * that sources expire, and that the least recently heard is evicted.
+ *******************************************************************************
+ ******************************************************************************/
+int dedup_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_dedup dedup;
+	struct FullAddr a, b, none;
+	unsigned i;
+	int ok;
+	printf(ANSI_COLOR_CYAN "Testing duplicate filter...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_dedup_init(&dedup, 1000);
+	test_dev.dedup = &dedup;
+	test_dev.callbacks.MCPS_DATA_indication = dedup_test_indication;
+	test_dev.clock = link_test_clock;
+	link_test_ns = 1;
+
+	neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, 1);
+	neighbour_test_addr(&b, MAC_MODE_LONG_ADDR, 1);
+	memset(&none, 0, sizeof(none));
+	ok = dedup_test_rx(&a, 10, &test_dev) && !dedup_test_rx(&a, 10, &test_dev) &&
+	     dedup_test_rx(&a, 11, &test_dev) && !dedup_test_rx(&a, 11, &test_dev);
+	check_result("dedup repeats dropped... ", ok && dedup.duplicates == 2);
+	check_result("dedup per source... ", dedup_test_rx(&b, 10, &test_dev) &&
+		!dedup_test_rx(&b, 10, &test_dev) && dedup_test_rx(&none, 10, &test_dev) &&
+		dedup_test_rx(&none, 10, &test_dev));
+	check_result("dedup out of order... ", dedup_test_rx(&a, 14, &test_dev) &&
+		dedup_test_rx(&a, 13, &test_dev) && dedup_test_rx(&a, 12, &test_dev) &&
+		!dedup_test_rx(&a, 13, &test_dev) && !dedup_test_rx(&a, 11, &test_dev));
+	check_result("dedup wraps... ", dedup_test_rx(&a, 255, &test_dev) &&
+		dedup_test_rx(&a, 0, &test_dev) && !dedup_test_rx(&a, 255, &test_dev) &&
+		!dedup_test_rx(&a, 0, &test_dev));
+	link_test_ns = 2000;
+	check_result("dedup source expires... ", dedup_test_rx(&a, 0, &test_dev));
+
+	/* Fill the filter, then hear from the first source again */
+	ca821x_dedup_init(&dedup, 0);
+	ok = 1;
+	for (i = 0; i < CA821X_DEDUP_SOURCES; i++) {
+		neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, i);
+		ok &= dedup_test_rx(&a, 1, &test_dev);
+	}
+	neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, 0);
+	ok &= dedup_test_rx(&a, 2, &test_dev);
+	neighbour_test_addr(&b, MAC_MODE_SHORT_ADDR, CA821X_DEDUP_SOURCES);
+	ok &= dedup_test_rx(&b, 1, &test_dev) && dedup.evictions == 1;
+	ok &= !dedup_test_rx(&a, 2, &test_dev) && !dedup_test_rx(&b, 1, &test_dev);
+	neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, 1);
+	ok &= dedup_test_rx(&a, 1, &test_dev);
+	neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, 3);
+	ok &= !dedup_test_rx(&a, 1, &test_dev);
+	check_result("dedup evicts least recent... ", ok && dedup.evictions == 2);
+	printf("Duplicate filter test complete\n\n");
+	return 0;
+}
+
+static void subs_test_handler(const uint8_t *buf, size_t len, void *context,
+                              struct ca821x_dev *pDeviceRef)
+{
+	(*(int *)context)++;
+}
+
+/** Dispatch an MCPS-DATA.indication from src to dst */
+static void subs_test_rx(const struct FullAddr *src, const struct FullAddr *dst,
+                         uint8_t dsn, struct ca821x_dev *dev)
+{
+	struct MAC_Message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	msg.Length = sizeof(struct MCPS_DATA_indication_pset) - MAX_DATA_SIZE;
+	msg.PData.DataInd.Src = *src;
+	msg.PData.DataInd.Dst = *dst;
+	msg.PData.DataInd.DSN = dsn;
+	ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, dev);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * rief Subscription registry test
+ *******************************************************************************
+ * Subscribes several handlers with address, PAN id and handle filters to
+ * data indications, confirms and comm status indications, and checks each
+ * dispatched frame reaches exactly the handlers whose filters match it.
+ *******************************************************************************
+ ******************************************************************************/
+int subs_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_subs subs;
+	struct ca821x_dedup dedup;
+	struct ca821x_sub_filter filter;
+	struct FullAddr a, b, c;
+	struct MAC_Message msg;
+	int all = 0, from_a = 0, to_c = 0, on_pan = 0, handles = 0, status = 0;
+	int id, ok;
+	unsigned i;
+	printf(ANSI_COLOR_CYAN "Testing subscription registry...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_subs_init(&subs);
+	test_dev.subs = &subs;
+	neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, 1);
+	neighbour_test_addr(&b, MAC_MODE_SHORT_ADDR, 2);
+	neighbour_test_addr(&c, MAC_MODE_LONG_ADDR, 3);
+
+	memset(&filter, 0, sizeof(filter));
+	ok = ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, NULL,
+	                      subs_test_handler, &all) >= 0;
+	filter.match = CA821X_SUB_SRC;
+	filter.src = a;
+	ok &= ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, &filter,
+	                       subs_test_handler, &from_a) >= 0;
+	filter.match = CA821X_SUB_DST;
+	filter.dst = c;
+	ok &= ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, &filter,
+	                       subs_test_handler, &to_c) >= 0;
+	filter.match = CA821X_SUB_PAN;
+	PUTLE16(0x1234, filter.pan_id);
+	id = ca821x_subscribe(&subs, SPI_MCPS_DATA_INDICATION, &filter,
+	                      subs_test_handler, &on_pan);
+	check_result("subs subscribe... ", ok && id >= 0);
+	check_result("subs row full... ", ca821x_subscribe(&subs,
+		SPI_MCPS_DATA_INDICATION, NULL, subs_test_handler, &all) == -1);
+	filter.match = CA821X_SUB_HANDLE;
+	filter.handle_min = 10;
+	filter.handle_max = 19;
+	check_result("subs missing field rejected... ", ca821x_subscribe(&subs,
+		SPI_MLME_SCAN_CONFIRM, &filter, subs_test_handler, &handles) == -1);
+
+	subs_test_rx(&a, &c, 1, &test_dev);
+	subs_test_rx(&b, &c, 2, &test_dev);
+	subs_test_rx(&a, &b, 3, &test_dev);
+	/* Same short address on another PAN, and a long address on any PAN */
+	PUTLE16(0x1234, b.PANId);
+	PUTLE16(0x1234, c.PANId);
+	b.Address[0] = a.Address[0];
+	subs_test_rx(&b, &c, 4, &test_dev);
+	check_result("subs address filters... ", all == 4 && from_a == 2 && to_c == 3);
+	check_result("subs pan filter... ", on_pan == 1);
+
+	/* Duplicates dropped by the device are not seen */
+	ca821x_dedup_init(&dedup, 0);
+	test_dev.dedup = &dedup;
+	subs_test_rx(&a, &c, 5, &test_dev);
+	subs_test_rx(&a, &c, 5, &test_dev);
+	ca821x_unsubscribe(&subs, id);
+	subs_test_rx(&a, &c, 6, &test_dev);
+	check_result("subs dedup and unsubscribe... ",
+		all == 6 && from_a == 4 && on_pan == 2);
+
+	filter.match = CA821X_SUB_HANDLE;
+	ok = ca821x_subscribe(&subs, SPI_MCPS_DATA_CONFIRM, &filter,
+	                      subs_test_handler, &handles) >= 0;
+	for (i = 0; i < 32; i++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.CommandId = SPI_MCPS_DATA_CONFIRM;
+		msg.Length = sizeof(struct MCPS_DATA_confirm_pset);
+		msg.PData.DataCnf.MsduHandle = (uint8_t)i;
+		ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, &test_dev);
+	}
+	check_result("subs handle range... ", ok && handles == 10);
+
+	/* Long source address of a comm status, compared in two parts */
+	filter.match = CA821X_SUB_SRC;
+	filter.src = c;
+	ok = ca821x_subscribe(&subs, SPI_MLME_COMM_STATUS_INDICATION, &filter,
+	                      subs_test_handler, &status) >= 0;
+	for (i = 0; i < 2; i++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.CommandId = SPI_MLME_COMM_STATUS_INDICATION;
+		msg.Length = sizeof(struct MLME_COMM_STATUS_indication_pset);
+		msg.PData.CommStatusInd.SrcAddrMode = MAC_MODE_LONG_ADDR;
+		memcpy(msg.PData.CommStatusInd.SrcAddr, c.Address, 8);
+		msg.PData.CommStatusInd.SrcAddr[7] += i;
+		ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, &test_dev);
+	}
+	/* Truncated frames do not match */
+	ca821x_downstream_dispatch((uint8_t *)&msg, 2 + 8, &test_dev);
+	check_result("subs comm status... ", ok && status == 1);
+	printf("Subscription registry test complete\n\n");
+	return 0;
+}
+
+/** Dispatch an MCPS-DATA.indication, returning 1 if it reached the callback */
+static int rxfilter_test_rx(const struct FullAddr *src, const struct FullAddr *dst,
+                            uint8_t lqi, uint8_t msdu_len, struct ca821x_dev *dev)
+{
+	struct MAC_Message msg;
+	int before = dedup_test_delivered;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_MCPS_DATA_INDICATION;
+	msg.Length = sizeof(struct MCPS_DATA_indication_pset) - MAX_DATA_SIZE + msdu_len;
+	msg.PData.DataInd.Src = *src;
+	msg.PData.DataInd.Dst = *dst;
+	msg.PData.DataInd.MsduLength = msdu_len;
+	msg.PData.DataInd.MpduLinkQuality = lqi;
+	ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, dev);
+	return dedup_test_delivered - before;
+}
+
+#if CASCODA_CA_VER >= 8211
+static int rxfilter_test_psdus;
+
+static int rxfilter_test_psdu_indication(struct PCPS_DATA_indication_pset *params,
+                                         struct ca821x_dev *pDeviceRef)
+{
+	rxfilter_test_psdus++;
+	return 0;
+}
+
+/** Dispatch a PCPS-DATA.indication of a frame, returning 1 if it reached the
+ *  callback */
+static int rxfilter_test_psdu(uint16_t fc, const struct FullAddr *src,
+                              const struct FullAddr *dst, struct ca821x_dev *dev)
+{
+	struct ca821x_frame_hdr hdr;
+	struct MAC_Message msg;
+	int before = rxfilter_test_psdus, len;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.fc = fc;
+	hdr.src = *src;
+	hdr.dst = *dst;
+	memset(&msg, 0, sizeof(msg));
+	msg.CommandId = SPI_PCPS_DATA_INDICATION;
+	len = ca821x_frame_build(msg.PData.PhyDataInd.Psdu, aMaxPHYPacketSize, &hdr,
+	                         (const uint8_t *)"payload", 7);
+	ca821x_fcs_append(msg.PData.PhyDataInd.Psdu, len + MAC_FCS_LEN);
+	msg.PData.PhyDataInd.PsduLength = len + MAC_FCS_LEN;
+	msg.Length = 3 + len + MAC_FCS_LEN;
+	ca821x_downstream_dispatch((uint8_t *)&msg, msg.Length + 2, dev);
+	return rxfilter_test_psdus - before;
+}
+#endif
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Receive filter test
+ *******************************************************************************
+ * Compiles rules on address sets, PAN id, length, link quality and frame
+ * type, and checks the data indications dispatched reach the callback only
+ * when the first matching rule, or the default, accepts them.
+ *******************************************************************************
+ ******************************************************************************/
+int rxfilter_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_rxfilter filter;
+	struct ca821x_rxfilter_rule rule;
+	struct FullAddr a, b, c, d;
+	unsigned i;
+	int ok;
+	printf(ANSI_COLOR_CYAN "Testing receive filter...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_rxfilter_init(&filter, CA821X_RXF_DROP);
+	test_dev.rxfilter = &filter;
+	test_dev.callbacks.MCPS_DATA_indication = dedup_test_indication;
+	neighbour_test_addr(&a, MAC_MODE_SHORT_ADDR, 1);
+	neighbour_test_addr(&b, MAC_MODE_SHORT_ADDR, 2);
+	neighbour_test_addr(&c, MAC_MODE_LONG_ADDR, 3);
+	neighbour_test_addr(&d, MAC_MODE_LONG_ADDR, 4);
+
+	check_result("rxfilter default action... ", !rxfilter_test_rx(&a, &b, 255, 10, &test_dev) &&
+		filter.dropped == 1);
+
+	/* Known sources with a good link, or short frames to PAN 0x1234 */
+	ok = !ca821x_rxfilter_add_addr(&filter, 0, &a) &&
+	     !ca821x_rxfilter_add_addr(&filter, 0, &c) &&
+	     !ca821x_rxfilter_add_addr(&filter, 0, &a);
+	memset(&rule, 0, sizeof(rule));
+	rule.match = CA821X_RXF_SRC_IN | CA821X_RXF_LQI;
+	rule.action = CA821X_RXF_ACCEPT;
+	rule.lqi_min = 100;
+	ok &= !ca821x_rxfilter_add_rule(&filter, &rule);
+	rule.match = CA821X_RXF_PAN | CA821X_RXF_LEN;
+	PUTLE16(0x1234, rule.pan_id);
+	rule.len_min = 0;
+	rule.len_max = 10;
+	ok &= !ca821x_rxfilter_add_rule(&filter, &rule);
+	check_result("rxfilter rules added... ", ok && filter.sets[0].num_short == 1 &&
+		filter.sets[0].num_ext == 1);
+	check_result("rxfilter source set... ", rxfilter_test_rx(&a, &b, 100, 50, &test_dev) &&
+		rxfilter_test_rx(&c, &b, 200, 50, &test_dev) &&
+		!rxfilter_test_rx(&b, &a, 200, 50, &test_dev) &&
+		!rxfilter_test_rx(&d, &a, 200, 50, &test_dev));
+	/* Same short address on another PAN */
+	b = a;
+	PUTLE16(0x1234, b.PANId);
+	check_result("rxfilter short address pan... ", !rxfilter_test_rx(&b, &c, 200, 50, &test_dev));
+	check_result("rxfilter lqi floor... ", !rxfilter_test_rx(&a, &c, 99, 50, &test_dev));
+	check_result("rxfilter pan and length... ", rxfilter_test_rx(&d, &b, 0, 10, &test_dev) &&
+		!rxfilter_test_rx(&d, &b, 0, 11, &test_dev) &&
+		!rxfilter_test_rx(&d, &c, 0, 10, &test_dev));
+
+	/* Dropping takes precedence when its rule comes first */
+	ca821x_rxfilter_init(&filter, CA821X_RXF_ACCEPT);
+	rule.match = CA821X_RXF_DST_IN;
+	rule.action = CA821X_RXF_DROP;
+	rule.dst_set = 1;
+	ok = 1;
+	for (i = 0; i < CA821X_RXF_SET_MAX; i++) {
+		neighbour_test_addr(&b, MAC_MODE_SHORT_ADDR, i * 7);
+		ok &= !ca821x_rxfilter_add_addr(&filter, 1, &b);
+	}
+	ok &= ca821x_rxfilter_add_addr(&filter, 1, &a) == -1 &&
+	      ca821x_rxfilter_add_addr(&filter, CA821X_RXF_SETS, &c) == -1;
+	ok &= !ca821x_rxfilter_add_rule(&filter, &rule);
+	rule.match = 0;
+	rule.action = CA821X_RXF_ACCEPT;
+	ok &= !ca821x_rxfilter_add_rule(&filter, &rule);
+	for (i = 0; i < CA821X_RXF_SET_MAX * 7; i++) {
+		neighbour_test_addr(&b, MAC_MODE_SHORT_ADDR, i);
+		ok &= rxfilter_test_rx(&c, &b, 0, 10, &test_dev) == !!(i % 7);
+	}
+	check_result("rxfilter full set... ", ok);
+	while (!ca821x_rxfilter_add_rule(&filter, &rule))
+		;
+	check_result("rxfilter program full... ",
+		filter.num_insns == CA821X_RXF_MAX_INSNS && rxfilter_test_rx(&c, &c, 0, 10, &test_dev));
+
+#if CASCODA_CA_VER >= 8211
+	/* Only data frames from known sources reach the raw PHY callback */
+	test_dev.callbacks.PCPS_DATA_indication = rxfilter_test_psdu_indication;
+	ca821x_rxfilter_init(&filter, CA821X_RXF_DROP);
+	ca821x_rxfilter_add_addr(&filter, 0, &c);
+	rule.match = CA821X_RXF_TYPE | CA821X_RXF_SRC_IN;
+	rule.action = CA821X_RXF_ACCEPT;
+	rule.types = 1 << MAC_FC_FT_DATA;
+	ca821x_rxfilter_add_rule(&filter, &rule);
+	check_result("rxfilter psdu... ", rxfilter_test_psdu(MAC_FC_FT_DATA, &c, &a, &test_dev) &&
+		!rxfilter_test_psdu(MAC_FC_FT_COMMAND, &c, &a, &test_dev) &&
+		!rxfilter_test_psdu(MAC_FC_FT_DATA, &d, &a, &test_dev));
+#endif
+	printf("Receive filter test complete\n\n");
+	return 0;
+}
+
+/** Per-device counters for the medium test, referenced by dev->context */
+#if CASCODA_CA_VER >= 8211
+#define PCPS_TEST_PSDUS     (300)
+
+static int pcps_test_confirms, pcps_test_callbacks, pcps_test_in_order;
+static uintptr_t pcps_test_next;
+
+/** Checks each PSDU is confirmed in submission order */
+static void pcps_test_confirm(
+	struct ca821x_pcps_tx               *tx,
+	const struct PCPS_DATA_confirm_pset *params,
+	void                                *context,
+	struct ca821x_dev                   *pDeviceRef
+)
+{
+	if ((uintptr_t)context != pcps_test_next++)
+		pcps_test_in_order = 0;
+	pcps_test_confirms++;
+}
+
+static int pcps_test_callback(
+	struct PCPS_DATA_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	pcps_test_callbacks++;
+	return 0;
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Raw PSDU transmitter test
+ *******************************************************************************
+ * Checks the window and handle allocation of a PCPS transmitter against a
+ * simulated device, that confirms are matched to their PSDUs, and that a full
+ * window keeps the simulated radio busy.
+ *******************************************************************************
+ ******************************************************************************/
+int pcps_test(void)
+{
+	struct ca821x_dev test_dev;
+	struct ca821x_sim_engine engine;
+	struct ca821x_sim sim;
+	struct ca821x_pcps_tx tx;
+	struct ca821x_sync_stats latency;
+	struct ca821x_sync_snapshot snapshot;
+	struct ca821x_pcps_psdu batch[6];
+	struct MAC_Message cnf;
+	uint8_t psdu[aMaxPHYPacketSize];
+	uint64_t start_ns, per_psdu_ns;
+	int i, handles[SIM_DIRECT_QUEUE_SIZE], ok;
+	uintptr_t submitted;
+	printf(ANSI_COLOR_CYAN "Testing PCPS transmitter...\n" ANSI_COLOR_RESET);
+	ca821x_api_init(&test_dev);
+	ca821x_sim_engine_init(&engine);
+	ca821x_sim_init(&sim, &engine, 1, &test_dev);
+	MLME_RESET_request_sync(1, &test_dev);
+	test_dev.callbacks.PCPS_DATA_confirm = pcps_test_callback;
+
+	check_result("pcps window limit... ",
+		ca821x_pcps_tx_init(&tx, 0, NULL) == -1 &&
+		ca821x_pcps_tx_init(&tx, CA821X_PCPS_MAX_WINDOW + 1, NULL) == -1);
+	ca821x_pcps_tx_init(&tx, SIM_DIRECT_QUEUE_SIZE, pcps_test_confirm);
+	test_dev.pcps_tx = &tx;
+	/* Latencies shared with the device's synchronous commands */
+	ca821x_sync_stats_init(&latency);
+	test_dev.sync_stats = &latency;
+	tx.latency = &latency;
+	MLME_RESET_request_sync(1, &test_dev);
+	memset(psdu, 0, sizeof(psdu));
+	psdu[0] = MAC_FC_FT_DATA;
+	pcps_test_in_order = 1;
+
+	/* The batch stops where the window is full */
+	for (i = 0; i < 6; i++) {
+		batch[i].psdu = psdu;
+		batch[i].len = 20;
+		batch[i].txopts = 0;
+		batch[i].context = (void *)(uintptr_t)i;
+	}
+	check_result("pcps batch fills window... ",
+		ca821x_pcps_tx_submit_batch(batch, 6, &test_dev) == SIM_DIRECT_QUEUE_SIZE &&
+		ca821x_pcps_tx_in_flight(&tx) == SIM_DIRECT_QUEUE_SIZE &&
+		ca821x_pcps_tx_submit(psdu, 20, 0, NULL, &test_dev) == -1);
+	ca821x_sim_run_for(&engine, 100000000);
+	check_result("pcps confirms matched... ",
+		pcps_test_confirms == SIM_DIRECT_QUEUE_SIZE && pcps_test_in_order &&
+		pcps_test_callbacks == SIM_DIRECT_QUEUE_SIZE &&
+		tx.confirmed == SIM_DIRECT_QUEUE_SIZE && !ca821x_pcps_tx_in_flight(&tx));
+	check_result("pcps latency kept apart... ",
+		ca821x_sync_stats_snapshot(&latency, SPI_PCPS_DATA_REQUEST, 0, &snapshot) ==
+		SIM_DIRECT_QUEUE_SIZE &&
+		ca821x_sync_stats_snapshot(&latency, SPI_MLME_RESET_REQUEST, 0, &snapshot) == 1);
+	test_dev.sync_stats = NULL;
+	tx.latency = NULL;
+	check_result("pcps rejects long PSDU... ",
+		ca821x_pcps_tx_submit(psdu, aMaxPHYPacketSize + 1, 0, NULL, &test_dev) == -1);
+	test_dev.pcps_tx = NULL;
+	check_result("pcps needs transmitter... ",
+		ca821x_pcps_tx_submit(psdu, 20, 0, NULL, &test_dev) == -1 &&
+		ca821x_pcps_tx_submit_batch(batch, 6, &test_dev) == 0);
+	test_dev.pcps_tx = &tx;
+
+	/* Handles in flight are distinct, across the wrap of the handle space */
+	ok = 1;
+	submitted = pcps_test_next;
+	for (i = 0; i < PCPS_TEST_PSDUS; i++) {
+		int slot = i % SIM_DIRECT_QUEUE_SIZE, j;
+		if (i >= SIM_DIRECT_QUEUE_SIZE && !slot)
+			ca821x_sim_run_for(&engine, 100000000);
+		handles[slot] = ca821x_pcps_tx_submit(psdu, 20, 0, (void *)submitted++, &test_dev);
+		for (j = 0; j < slot; j++)
+			ok &= handles[j] != handles[slot];
+		ok &= handles[slot] >= 0;
+	}
+	ca821x_sim_run_for(&engine, 100000000);
+	check_result("pcps handles unique... ", ok && pcps_test_in_order &&
+		tx.confirmed == SIM_DIRECT_QUEUE_SIZE + PCPS_TEST_PSDUS && tx.unmatched == 0);
+
+	/* A confirm for no PSDU in flight still reaches the callback */
+	memset(&cnf, 0, sizeof(cnf));
+	cnf.CommandId = SPI_PCPS_DATA_CONFIRM;
+	cnf.Length = sizeof(struct PCPS_DATA_confirm_pset);
+	cnf.PData.PhyDataCnf.PsduHandle = 0x99;
+	i = pcps_test_callbacks;
+	ca821x_downstream_dispatch(&cnf.CommandId, cnf.Length + 2, &test_dev);
+	check_result("pcps unmatched confirm... ",
+		tx.unmatched == 1 && pcps_test_callbacks == i + 1);
+
+	/* A window larger than the device queue overflows it */
+	ca821x_pcps_tx_init(&tx, SIM_DIRECT_QUEUE_SIZE + 2, NULL);
+	for (i = 0; i < SIM_DIRECT_QUEUE_SIZE + 2; i++)
+		ca821x_pcps_tx_submit(psdu, 20, 0, NULL, &test_dev);
+	ca821x_sim_run_for(&engine, 100000000);
+	check_result("pcps device overflow... ",
+		tx.confirmed == SIM_DIRECT_QUEUE_SIZE && tx.failed == 2);
+
+	/* Keeping the window full keeps the radio busy: each PSDU takes its air
+	 * time and at most the longest first CSMA-CA backoff and CCA (8 symbols) */
+	ca821x_pcps_tx_init(&tx, SIM_DIRECT_QUEUE_SIZE, NULL);
+	start_ns = engine.now_ns;
+	for (i = 0; i < PCPS_TEST_PSDUS; i++) {
+		while (ca821x_pcps_tx_submit(psdu, aMaxPHYPacketSize, 0, NULL, &test_dev) < 0)
+			ca821x_sim_run_for(&engine, SIM_SYMBOL_NS);
+	}
+	while (ca821x_pcps_tx_in_flight(&tx))
+		ca821x_sim_run_for(&engine, SIM_SYMBOL_NS);
+	per_psdu_ns = (engine.now_ns - start_ns) / PCPS_TEST_PSDUS;
+	check_result("pcps sustains air rate... ",
+		tx.confirmed == PCPS_TEST_PSDUS &&
+		per_psdu_ns <= (SIM_PHY_OVERHEAD + aMaxPHYPacketSize) * SIM_OCTET_NS +
+		               (7 * aUnitBackoffPeriod + 8 + aTurnaroundTime) * SIM_SYMBOL_NS +
+		               SIM_SYMBOL_NS);
+
+	ca821x_sim_engine_deinit(&engine);
+	printf("PCPS transmitter test complete\n\n");
+	return 0;
+}
+#endif
+
+struct medium_test_counts {
+	int     data_confirms;
+	uint8_t data_status;
+	int     data_indications;
+	uint8_t last_lqi;
+	int     assoc_confirms;
+	uint8_t assoc_status;
+	uint8_t assoc_short[2];
+	int     scan_confirms;
+	uint8_t scan_results;
+	int     beacons;
+	int     beacons_pending;
+	int     psdu_confirms;
+	uint8_t psdu_status;
+	int     psdu_indications;
+};
+
+static int medium_data_confirm(
+	struct MCPS_DATA_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	counts->data_confirms++;
+	counts->data_status = params->Status;
+	return 0;
+}
+
+static int medium_data_indication(
+	struct MCPS_DATA_indication_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	counts->data_indications++;
+	counts->last_lqi = params->MpduLinkQuality;
+	return 0;
+}
+
+static int medium_assoc_indication(
+	struct MLME_ASSOCIATE_indication_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	MLME_ASSOCIATE_response(params->DeviceAddress, 0x0010, MAC_SUCCESS, NULL,
+	                        pDeviceRef);
+	return 0;
+}
+
+static int medium_assoc_confirm(
+	struct MLME_ASSOCIATE_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	counts->assoc_confirms++;
+	counts->assoc_status = params->Status;
+	memcpy(counts->assoc_short, params->AssocShortAddress, 2);
+	return 0;
+}
+
+static int medium_scan_confirm(
+	struct MLME_SCAN_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	counts->scan_confirms++;
+	counts->scan_results = params->ResultListSize;
+	return 0;
+}
+
+static int medium_beacon_notify(
+	struct MLME_BEACON_NOTIFY_indication_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	struct ca821x_beacon_view view;
+
+	if (ca821x_beacon_parse(&view, params, CA821X_BEACON_IND_LEN(params)))
+		return 0;
+	counts->beacons++;
+	counts->beacons_pending += ca821x_beacon_dev_pending(&view, pDeviceRef);
+	return 0;
+}
+
+#if CASCODA_CA_VER >= 8211
+static int medium_psdu_confirm(
+	struct PCPS_DATA_confirm_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	counts->psdu_confirms++;
+	counts->psdu_status = params->Status;
+	return 0;
+}
+
+static int medium_psdu_indication(
+	struct PCPS_DATA_indication_pset *params,
+	struct ca821x_dev *pDeviceRef
+)
+{
+	struct medium_test_counts *counts = pDeviceRef->context;
+	struct ca821x_frame frame;
+
+	if (ca821x_fcs_check(params->Psdu, params->PsduLength) &&
+	    !ca821x_frame_decode(&frame, params->Psdu, params->PsduLength, 1))
+		counts->psdu_indications++;
+	return 0;
+}
+#endif
+
+static void medium_test_setup(struct ca821x_dev *dev, struct medium_test_counts *counts)
+{
+	memset(counts, 0, sizeof(*counts));
+	dev->context = counts;
+	dev->callbacks.MCPS_DATA_confirm = medium_data_confirm;
+	dev->callbacks.MCPS_DATA_indication = medium_data_indication;
+	dev->callbacks.MLME_ASSOCIATE_indication = medium_assoc_indication;
+	dev->callbacks.MLME_ASSOCIATE_confirm = medium_assoc_confirm;
+	dev->callbacks.MLME_SCAN_confirm = medium_scan_confirm;
+	dev->callbacks.MLME_BEACON_NOTIFY_indication = medium_beacon_notify;
+#if CASCODA_CA_VER >= 8211
+	dev->callbacks.PCPS_DATA_confirm = medium_psdu_confirm;
+	dev->callbacks.PCPS_DATA_indication = medium_psdu_indication;
+#endif
+	MLME_RESET_request_sync(1, dev);
+}
+
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Simulated medium test
+ *******************************************************************************
+ * Runs a coordinator and a device through scanning, association, direct and
+ * indirect data on a shared medium, then checks a larger multi-threaded
+ * network makes progress.
+ *******************************************************************************
+ ******************************************************************************/
+int sim_medium_test(void)
+{
+	struct ca821x_sim_medium *medium;
+	struct ca821x_sim_medium_stats stats;
+	struct medium_test_counts coord_counts, dev_counts, *counts;
+	struct ca821x_dev *coord, *dev;
+	struct FullAddr addr;
+	uint8_t msdu[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	uint8_t len, coord_ext[8], one = 1, zero = 0;
+	uint16_t panid = 0xCA5C, shortaddr = 0x0000;
+#if CASCODA_CA_VER == 8210
+	uint8_t interval[2] = {0, 0};
+#else
+	struct ca821x_frame_hdr hdr;
+	uint8_t psdu[aMaxPHYPacketSize];
+	int psdu_len;
+#endif
+	uint32_t i, n;
+	int ok;
+	printf(ANSI_COLOR_CYAN "Testing simulated medium...\n" ANSI_COLOR_RESET);
+
+	medium = ca821x_sim_medium_create(NULL, 1, 0);
+	coord = ca821x_sim_medium_add_node(medium, 0, 0);
+	dev = ca821x_sim_medium_add_node(medium, 10, 0);
+	medium_test_setup(coord, &coord_counts);
+	medium_test_setup(dev, &dev_counts);
+
+	MLME_SET_request_sync(macShortAddress, 0, 2, &shortaddr, coord);
+	MLME_SET_request_sync(macAssociationPermit, 0, 1, &one, coord);
+	MLME_GET_request_sync(nsIEEEAddress, 0, &len, coord_ext, coord);
+	check_result("medium start... ",
+		MLME_START_request_sync(panid, TEST_CHANNEL, 15, 15, 1, 0, 0, NULL,
+		                        NULL, coord) == MAC_SUCCESS);
+
+	MLME_SCAN_request(ACTIVE_SCAN, 1UL << TEST_CHANNEL, 2, NULL, dev);
+	ca821x_sim_medium_run_for(medium, 1000000000);
+	check_result("medium active scan... ",
+		dev_counts.scan_confirms == 1 && dev_counts.scan_results == 1);
+
+	addr.AddressMode = MAC_MODE_LONG_ADDR;
+	PUTLE16(panid, addr.PANId);
+	memcpy(addr.Address, coord_ext, 8);
+	MLME_ASSOCIATE_request(TEST_CHANNEL, addr, 0x80, NULL, dev);
+	ca821x_sim_medium_run_for(medium, 1000000000);
+	check_result("medium association... ",
+		dev_counts.assoc_confirms == 1 && dev_counts.assoc_status == MAC_SUCCESS &&
+		GETLE16(dev_counts.assoc_short) == 0x0010);
+
+	addr.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(0x0000, addr.Address);
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, addr, sizeof(msdu), msdu, 1,
+	                  TXOPT_ACKREQ, NULL, dev);
+	ca821x_sim_medium_run_for(medium, 100000000);
+	check_result("medium direct data... ",
+		dev_counts.data_confirms == 1 && dev_counts.data_status == MAC_SUCCESS &&
+		coord_counts.data_indications == 1 && coord_counts.last_lqi > 0);
+
+	PUTLE16(0x0010, addr.Address);
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, addr, sizeof(msdu), msdu, 2,
+	                  TXOPT_ACKREQ | TXOPT_INDIRECT, NULL, coord);
+	/* The beacon lists the device as having data pending */
+	MLME_SET_request_sync(macAutoRequest, 0, 1, &zero, dev);
+	MLME_SCAN_request(ACTIVE_SCAN, 1UL << TEST_CHANNEL, 2, NULL, dev);
+	ca821x_sim_medium_run_for(medium, 1000000000);
+	MLME_SET_request_sync(macAutoRequest, 0, 1, &one, dev);
+	check_result("medium beacon pending address... ",
+		dev_counts.beacons == 1 && dev_counts.beacons_pending == 1);
+	PUTLE16(0x0000, addr.Address);
+	ok = MLME_POLL_request_sync(addr,
+#if CASCODA_CA_VER == 8210
+	                            interval,
+#endif
+	                            NULL, dev) == MAC_SUCCESS;
+	ca821x_sim_medium_run_for(medium, 100000000);
+	check_result("medium indirect data... ", ok &&
+		dev_counts.data_indications == 1 && coord_counts.data_confirms == 1 &&
+		coord_counts.data_status == MAC_SUCCESS);
+
+	/* Unacknowledged frame to a device that is not there */
+	PUTLE16(0x0BAD, addr.Address);
+	MCPS_DATA_request(MAC_MODE_SHORT_ADDR, addr, sizeof(msdu), msdu, 3,
+	                  TXOPT_ACKREQ, NULL, dev);
+	ca821x_sim_medium_run_for(medium, 1000000000);
+	check_result("medium no ack... ",
+		dev_counts.data_confirms == 2 && dev_counts.data_status == MAC_NO_ACK);
+
+#if CASCODA_CA_VER >= 8211
+	/* A raw PSDU is addressed, and acknowledged, by its own header */
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.fc = MAC_FC_FT_DATA | MAC_FC_ACK_REQ;
+	hdr.dsn = 0x77;
+	hdr.dst.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(panid, hdr.dst.PANId);
+	PUTLE16(0x0000, hdr.dst.Address);
+	hdr.src.AddressMode = MAC_MODE_SHORT_ADDR;
+	PUTLE16(panid, hdr.src.PANId);
+	PUTLE16(0x0010, hdr.src.Address);
+	psdu_len = ca821x_frame_build(psdu, sizeof(psdu), &hdr, msdu, sizeof(msdu));
+	PCPS_DATA_request(0x21, TXOPT_ACKREQ, psdu_len + MAC_FCS_LEN, psdu, dev);
+	ca821x_sim_medium_run_for(medium, 100000000);
+	check_result("medium raw PSDU... ",
+		dev_counts.psdu_confirms == 1 && dev_counts.psdu_status == MAC_SUCCESS &&
+		coord_counts.psdu_indications == 1);
+#endif
+	ca821x_sim_medium_destroy(medium);
+
+	/* A grid of devices broadcasting at once, on several threads */
+	n = 400;
+	medium = ca821x_sim_medium_create(NULL, 7, 3);
+	counts = calloc(n, sizeof(*counts));
+	for (i = 0; i < n; i++) {
+		/* Clusters 1km apart form separate partitions */
+		double x = (i % 20) * 15.0 + (i / 100) * 1000.0, y = ((i / 20) % 5) * 15.0;
+		struct ca821x_dev *d = ca821x_sim_medium_add_node(medium, x, y);
+		medium_test_setup(d, &counts[i]);
+		MLME_SET_request_sync(macPANId, 0, 2, &panid, d);
+		shortaddr = (uint16_t)i;
+		MLME_SET_request_sync(macShortAddress, 0, 2, &shortaddr, d);
+		MLME_SET_request_sync(macRxOnWhenIdle, 0, 1, &one, d);
+	}
+	addr.AddressMode = MAC_MODE_SHORT_ADDR;
+	for (i = 0; i < n; i++) {
+		PUTLE16((uint16_t)((i + 1) % n), addr.Address);
+		MCPS_DATA_request(MAC_MODE_SHORT_ADDR, addr, sizeof(msdu), msdu, 1,
+		                  TXOPT_ACKREQ, NULL, ca821x_sim_medium_get_dev(medium, i));
+	}
+	ca821x_sim_medium_run_for(medium, 2000000000);
+	ca821x_sim_medium_get_stats(medium, &stats);
+	ok = 1;
+	for (i = 0; i < n; i++)
+		ok &= counts[i].data_confirms == 1;
+	check_result("medium scale confirms... ", ok);
+	check_result("medium scale traffic... ",
+		stats.frames >= n && stats.receptions > 0 && stats.acks > 0);
+	ca821x_sim_medium_destroy(medium);
+	free(counts);
+
+	printf("Simulated medium test complete\n\n");
+	return 0;
+}
+
 int main(void)
 {
 	sReturnValue = 0;
 	api_functions_test();
 	api_callbacks_test();
+	chansel_test();
+	scan_test();
+	beacon_test();
+	frame_test();
+	fcs_test();
+	haes_test();
+	sec_test();
+	sync_stats_test();
+	trace_test();
+	capture_test();
+	store_test();
+	replay_test();
+	sim_test();
+	sec_mirror_test();
+	fc_journal_test();
+	neighbour_test();
+	link_test();
+	dedup_test();
+	subs_test();
+	rxfilter_test();
+#if CASCODA_CA_VER >= 8211
+	pcps_test();
+#endif
+	sim_medium_test();
 	return sReturnValue;
 }
@@ -160,6 +160,7 @@ extern struct PHYTestRes       PHY_TESTRES;
 /******************************************************************************/
 /****** Function Declarations for Externally Defined Functions           ******/
 /******************************************************************************/
+/* Wall-clock milliseconds, used when the device has no clock (see ca821x_clock_t) */
 unsigned long test15_4_getms(void);
 
 
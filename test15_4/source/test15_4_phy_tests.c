@@ -45,18 +45,41 @@ uint8_t					PHY_TEST_INITIALISED; /* for tests that require initialisation */
 static unsigned long    start_ms; 			  /* Used for scheduling packet tx/rx */
 
 
+/******************************************************************************/
+/***************************************************************************//**
+ * \brief Returns the current time in milliseconds
+ *******************************************************************************
+ * Uses the device clock if one is provided (for example virtual time from a
+ * simulator), otherwise the externally defined test15_4_getms().
+ *******************************************************************************
+ * \param pDeviceRef - Device reference
+ *******************************************************************************
+ * \return current time in milliseconds
+ *******************************************************************************
+ ******************************************************************************/
+static unsigned long get_ms(struct ca821x_dev *pDeviceRef)
+{
+	if (pDeviceRef->clock)
+		return (unsigned long)(ca821x_get_time_ns(pDeviceRef) / 1000000);
+
+	return test15_4_getms();
+}
+
+
 /******************************************************************************/
 /***************************************************************************//**
  * \brief Returns how many milliseconds have elapsed since start_ms
  *******************************************************************************
+ * \param pDeviceRef - Device reference
+ *******************************************************************************
  * \return milliseconds since start_ms
  *******************************************************************************
  ******************************************************************************/
-static unsigned long calculate_elapsed_ms(void)
+static unsigned long calculate_elapsed_ms(struct ca821x_dev *pDeviceRef)
 {
 	unsigned long current_ms;
 
-	current_ms = test15_4_getms();
+	current_ms = get_ms(pDeviceRef);
 	return current_ms - start_ms;
 }
 
@@ -178,7 +201,7 @@ uint8_t PHYTestInitialise(struct ca821x_dev *pDeviceRef)
 			return(status);
 	}
 
-	start_ms = test15_4_getms();
+	start_ms = get_ms(pDeviceRef);
 
 	PHY_TESTRES.TEST_RUNNING = 1;
 
@@ -245,11 +268,11 @@ uint8_t PHYTestTransmitPacket(struct ca821x_dev *pDeviceRef)
  		PHY_TEST_INITIALISED = 1;
 	}
 
-	msElapsed = calculate_elapsed_ms();
+	msElapsed = calculate_elapsed_ms(pDeviceRef);
 	if (msElapsed <= PHY_TESTPAR.PACKETPERIOD)
 		return status;
 
-	start_ms = test15_4_getms();
+	start_ms = get_ms(pDeviceRef);
 	if (PHY_TESTPAR.MACENABLED)
 	{
 		status = PHY_TXPKT_MAC_request(&tx_msg, pDeviceRef);
@@ -311,7 +334,7 @@ void PHYTestReceivePacketPER(struct ca821x_dev *pDeviceRef)
 		missed_last = 0;
 		if(PHY_TESTRES.PACKET_RECEIVED)
 		{
-			start_ms = test15_4_getms();
+			start_ms = get_ms(pDeviceRef);
 			PHY_TEST_INITIALISED = 1;
 		}
 		else
@@ -320,7 +343,7 @@ void PHYTestReceivePacketPER(struct ca821x_dev *pDeviceRef)
 		}
 	}
 
-	msElapsed = calculate_elapsed_ms();
+	msElapsed = calculate_elapsed_ms(pDeviceRef);
 
 	/* 1.0 * PACKETPERIOD when previous packet was missed */
 	/* 1.5 * PACKETPERIOD when previous packet was received */
@@ -333,7 +356,7 @@ void PHYTestReceivePacketPER(struct ca821x_dev *pDeviceRef)
 	if((!missed_packet && !PHY_TESTRES.PACKET_RECEIVED))
 	 return;
 
-	start_ms = test15_4_getms();
+	start_ms = get_ms(pDeviceRef);
 
 	if (missed_packet)
 	{
@@ -396,10 +419,10 @@ void PHYTestReceivePacketPSN(struct ca821x_dev *pDeviceRef)
 	}
 	else
 	{
-		msElapsed = calculate_elapsed_ms();
+		msElapsed = calculate_elapsed_ms(pDeviceRef);
 		if (msElapsed > PHY_TEST_REPORT_PERIOD)
 		{
-			start_ms = test15_4_getms();
+			start_ms = get_ms(pDeviceRef);
 			// PHYTestStatistics(TEST_STAT_REPORT, 0, 0, 0);
 			// PHYTestReportReceivedPacketAnalysis();
 		}
@@ -451,11 +474,11 @@ uint8_t PHYTestLOLocking(struct ca821x_dev *pDeviceRef)
 
 	}
 
-	msElapsed = calculate_elapsed_ms();
+	msElapsed = calculate_elapsed_ms(pDeviceRef);
 
 	if (msElapsed > PHY_TESTPAR.LO_3_PERIOD)
 	{
-		start_ms = test15_4_getms();
+		start_ms = get_ms(pDeviceRef);
 		status = PHY_LOTLK_request(channel, rx_txb, ntest, pDeviceRef);
 
 		if (ntest < PHY_TESTPAR.LO_3_LOCKS-1)